@@ -1,6 +1,9 @@
 #include "app_service.h"
 
+#include "file_index.h"
+#include "fs_watch.h"
 #include "message_store.h"
+#include "text_scan.h"
 #include "transfer_io.h"
 
 #include <fcntl.h>
@@ -8,16 +11,90 @@
 #include <string.h>
 #include <sys/stat.h>
 
-protocol_result_t app_submit_message(const char *message) {
-  if (message == NULL) {
+static int g_app_watching = 0;
+
+static void app_handle_fs_event(const char *relative_path,
+                                fs_watch_event_t event,
+                                int is_dir,
+                                void *ctx) {
+  (void)is_dir;
+  (void)ctx;
+
+  if (event == FS_WATCH_EVENT_RESCAN) {
+    download_cache_invalidate("");
+    file_index_request_rescan();
+    return;
+  }
+  download_cache_invalidate(relative_path);
+  file_index_note_path(relative_path);
+}
+
+int app_services_start(const server_opt_t *ser_opt) {
+  const char *base_dir = ser_opt != NULL ? ser_opt->path : NULL;
+
+  if (base_dir == NULL) {
+    return 1;
+  }
+
+  transfer_set_durable(ser_opt->durable);
+  if (transfer_set_rate_limits(ser_opt->rate_limit, ser_opt->global_rate_limit) != 0) {
+    fprintf(stderr, "failed to initialize rate limit\n");
+    return 1;
+  }
+
+  g_app_watching = 0;
+  if (fs_watch_supported()) {
+    if (fs_watch_start(base_dir, app_handle_fs_event, NULL) == 0) {
+      g_app_watching = 1;
+    } else {
+      fprintf(stderr, "filesystem watcher unavailable; file index will rescan periodically\n");
+    }
+  }
+
+  if (download_cache_init(!g_app_watching) != 0) {
+    if (g_app_watching) {
+      fs_watch_stop();
+      g_app_watching = 0;
+    }
+    return 1;
+  }
+  if (file_index_start(base_dir, g_app_watching) != 0) {
+    if (g_app_watching) {
+      fs_watch_stop();
+      g_app_watching = 0;
+    }
+    download_cache_cleanup();
+    return 1;
+  }
+  return 0;
+}
+
+void app_services_stop(void) {
+  file_index_shutdown();
+  if (g_app_watching) {
+    fs_watch_stop();
+    g_app_watching = 0;
+  }
+  file_index_cleanup();
+  download_cache_cleanup();
+}
+
+protocol_result_t app_submit_message(message_store_channel_t *channel, const char *message) {
+  if (channel == NULL || message == NULL) {
     return PROTOCOL_ERR_INVALID_ARGUMENT;
   }
 
-  if (strlen(message) > HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE) {
+  size_t len = strlen(message);
+  if (len > HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE) {
     return PROTOCOL_ERR_MSG_TOO_LARGE;
   }
+  // Every ingress path lands here, and stored text is re-emitted as JSON.
+  if (!text_scan_utf8_valid(message, len)) {
+    fprintf(stderr, "rejected message: invalid UTF-8\n");
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
 
-  if (message_store_set(message) != 0) {
+  if (message_store_set(channel, message) != 0) {
     fprintf(stderr, "failed to store latest message\n");
     return PROTOCOL_ERR_IO;
   }
@@ -25,10 +102,58 @@ protocol_result_t app_submit_message(const char *message) {
   return PROTOCOL_OK;
 }
 
+// The body goes straight from the socket into a spill file; the store then
+// holds the file descriptor, not the bytes.
+protocol_result_t app_receive_binary_message(socket_t conn,
+                                             const char *base_dir,
+                                             message_store_channel_t *channel,
+                                             const char *mime,
+                                             uint64_t content_size,
+                                             app_upload_kind_t upload_kind) {
+  message_store_spill_t spill;
+  net_recv_file_result_t recv_res = NET_RECV_FILE_IO;
+
+  if (base_dir == NULL || channel == NULL || !message_store_mime_valid(mime)) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  if (content_size > HF_PROTOCOL_MAX_BINARY_MESSAGE_SIZE) {
+    return PROTOCOL_ERR_MSG_TOO_LARGE;
+  }
+  if (message_store_spill_open(&spill, base_dir) != 0) {
+    perror("open(message_spill)");
+    return PROTOCOL_ERR_IO;
+  }
+
+  recv_res = upload_kind == APP_UPLOAD_HTTP
+               ? net_recv_file_buffered(conn, spill.fd, content_size, 0, NULL)
+               : net_recv_file_best_effort(conn, spill.fd, content_size);
+  if (recv_res != NET_RECV_FILE_OK) {
+    message_store_spill_abort(&spill);
+    if (recv_res == NET_RECV_FILE_EOF) {
+      fprintf(stderr, "binary message ended early\n");
+      return PROTOCOL_ERR_EOF;
+    }
+    if (recv_res == NET_RECV_FILE_DISK_IO) {
+      perror("write(message_spill)");
+    } else {
+      sock_perror("recv(binary_message)");
+    }
+    return PROTOCOL_ERR_IO;
+  }
+
+  spill.size = content_size;
+  if (message_store_set_binary(channel, mime, &spill) != 0) {
+    fprintf(stderr, "failed to store binary message\n");
+    return PROTOCOL_ERR_IO;
+  }
+  return PROTOCOL_OK;
+}
+
 protocol_result_t app_receive_file(socket_t conn,
                                    const char *base_dir,
                                    const char *target_path,
                                    uint64_t content_size,
+                                   const uint64_t *mtime,
                                    app_upload_kind_t upload_kind,
                                    char *saved_path_out,
                                    size_t saved_path_cap) {
@@ -37,26 +162,103 @@ protocol_result_t app_receive_file(socket_t conn,
     return PROTOCOL_ERR_INVALID_ARGUMENT;
   }
 
+  protocol_result_t res = PROTOCOL_ERR_INVALID_ARGUMENT;
   switch (upload_kind) {
     case APP_UPLOAD_PROTOCOL:
-      return transfer_recv_socket_file(conn, base_dir, target_path, content_size,
-                                       "recv(file_body)",
-                                       "protocol error: unexpected EOF while receiving file",
-                                       saved_path_out, saved_path_cap);
+      res = transfer_recv_socket_file(conn, base_dir, target_path, content_size, mtime,
+                                      "recv(file_body)",
+                                      "protocol error: unexpected EOF while receiving file",
+                                      saved_path_out, saved_path_cap);
+      break;
+
+    case APP_UPLOAD_PROTOCOL_STREAM:
+      res = transfer_recv_socket_stream(conn, base_dir, target_path, "recv(file_stream)",
+                                        "protocol error: unexpected EOF while receiving stream",
+                                        saved_path_out, saved_path_cap);
+      break;
 
     case APP_UPLOAD_HTTP:
-      return transfer_recv_socket_http_file(conn, base_dir, target_path,
-                                            content_size, "recv(http_body)",
-                                            "http upload ended early",
-                                            saved_path_out, saved_path_cap);
+      res = transfer_recv_socket_http_file(conn, base_dir, target_path,
+                                           content_size, mtime, "recv(http_body)",
+                                           "http upload ended early",
+                                           saved_path_out, saved_path_cap);
+      break;
   }
 
-  return PROTOCOL_ERR_INVALID_ARGUMENT;
+  if (res == PROTOCOL_OK) {
+    download_cache_invalidate(target_path);
+    file_index_note_path(target_path);
+  }
+  return res;
 }
 
-protocol_result_t app_prepare_download(const char *base_dir,
-                                       const char *target_path,
-                                       app_download_t *download_out) {
+protocol_result_t app_begin_upload(app_upload_t *upload,
+                                   const char *base_dir,
+                                   const char *target_path) {
+  size_t len = 0;
+
+  if (upload == NULL || base_dir == NULL || target_path == NULL) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+
+  len = strlen(target_path);
+  if (len >= sizeof(upload->relative_path)) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  memcpy(upload->relative_path, target_path, len + 1u);
+  return transfer_output_open(&upload->output, base_dir, target_path);
+}
+
+protocol_result_t app_write_upload(app_upload_t *upload, const void *data, size_t len) {
+  if (upload == NULL) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  return transfer_output_write(&upload->output, data, len);
+}
+
+protocol_result_t app_reserve_upload(app_upload_t *upload, uint64_t offset, uint64_t len) {
+  if (upload == NULL) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  return transfer_output_reserve(&upload->output, offset, len);
+}
+
+protocol_result_t app_write_upload_at(app_upload_t *upload,
+                                      uint64_t offset,
+                                      const void *data,
+                                      size_t len) {
+  if (upload == NULL) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  return transfer_output_write_at(&upload->output, offset, data, len);
+}
+
+protocol_result_t app_commit_upload(app_upload_t *upload,
+                                    char *saved_path_out,
+                                    size_t saved_path_cap) {
+  protocol_result_t res = PROTOCOL_ERR_INVALID_ARGUMENT;
+
+  if (upload == NULL) {
+    return res;
+  }
+
+  res = transfer_output_commit(&upload->output, saved_path_out, saved_path_cap);
+  if (res == PROTOCOL_OK) {
+    download_cache_invalidate(upload->relative_path);
+    file_index_note_path(upload->relative_path);
+  }
+  return res;
+}
+
+void app_abort_upload(app_upload_t *upload) {
+  if (upload != NULL) {
+    transfer_output_abort(&upload->output);
+  }
+}
+
+protocol_result_t app_open_download(const char *base_dir,
+                                    const char *target_path,
+                                    app_download_t *download_out) {
   char full_path[4096];
   int fd = -1;
   int open_flags = O_RDONLY;
@@ -75,6 +277,8 @@ protocol_result_t app_prepare_download(const char *base_dir,
     return PROTOCOL_ERR_INVALID_ARGUMENT;
   }
 
+  download_out->data = NULL;
+  download_out->cache_entry = NULL;
 #ifdef _WIN32
   open_flags |= O_BINARY;
 #else
@@ -109,14 +313,77 @@ protocol_result_t app_prepare_download(const char *base_dir,
   download_out->info.kind = FS_PATH_KIND_FILE;
   download_out->info.size = (uint64_t)st.st_size;
   download_out->info.mtime = (uint64_t)st.st_mtime;
+#ifndef _WIN32
+  download_out->info.file_id = (uint64_t)st.st_ino;
+  #ifdef __APPLE__
+  download_out->info.mtime_nsec = (uint32_t)st.st_mtimespec.tv_nsec;
+  #else
+  download_out->info.mtime_nsec = (uint32_t)st.st_mtim.tv_nsec;
+  #endif
+#endif
   return PROTOCOL_OK;
 }
 
+protocol_result_t app_prepare_download(const char *base_dir,
+                                       const char *target_path,
+                                       app_download_t *download_out) {
+  download_cache_view_t view = {0};
+  download_cache_entry_t *entry = NULL;
+  uint64_t generation = 0;
+  protocol_result_t result = PROTOCOL_ERR_IO;
+
+  if (base_dir == NULL || target_path == NULL || download_out == NULL) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+
+  entry = download_cache_lookup(base_dir, target_path, &view, &generation);
+  if (entry != NULL) {
+    download_out->fd = view.fd;
+    download_out->info = view.info;
+    download_out->data = view.data;
+    download_out->cache_entry = entry;
+    return PROTOCOL_OK;
+  }
+
+  result = app_open_download(base_dir, target_path, download_out);
+  if (result != PROTOCOL_OK) {
+    return result;
+  }
+  entry = download_cache_insert(target_path, download_out->fd, &download_out->info,
+                                generation, &view);
+  if (entry != NULL) {
+    download_out->data = view.data;
+    download_out->cache_entry = entry;
+  }
+  return PROTOCOL_OK;
+}
+
+net_send_file_result_t app_send_download(socket_t conn,
+                                         const app_download_t *download) {
+  if (download == NULL) {
+    return NET_SEND_FILE_INVALID_ARGUMENT;
+  }
+
+  if (download->data != NULL) {
+    size_t len = (size_t)download->info.size;
+    return send_all(conn, download->data, len) == (ssize_t)len ? NET_SEND_FILE_OK
+                                                                : NET_SEND_FILE_IO;
+  }
+  return net_send_file_best_effort(conn, download->fd, download->info.size);
+}
+
 void app_download_cleanup(app_download_t *download) {
   if (download == NULL) {
     return;
   }
 
+  if (download->cache_entry != NULL) {
+    download_cache_release(download->cache_entry);
+    download->cache_entry = NULL;
+    download->data = NULL;
+    download->fd = -1;
+    return;
+  }
   if (download->fd != -1) {
     fs_close(download->fd);
     download->fd = -1;
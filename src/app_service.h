@@ -1,34 +1,74 @@
 #ifndef HF_APP_SERVICE_H
 #define HF_APP_SERVICE_H
 
+#include "cli.h"
+#include "download_cache.h"
 #include "fs.h"
+#include "message_store.h"
 #include "net.h"
 #include "protocol.h"
+#include "transfer_io.h"
 
 #include <stddef.h>
 #include <stdint.h>
 
 typedef enum {
   APP_UPLOAD_PROTOCOL = 0,
+  APP_UPLOAD_PROTOCOL_STREAM,  // content_size is unknown and ignored
   APP_UPLOAD_HTTP,
 } app_upload_kind_t;
 
 typedef struct {
   int fd;
   fs_path_info_t info;
+  const char *data;
+  download_cache_entry_t *cache_entry;
 } app_download_t;
 
-protocol_result_t app_submit_message(const char *message);
+typedef struct {
+  transfer_output_t output;
+  char relative_path[4096];
+} app_upload_t;
+
+int app_services_start(const server_opt_t *ser_opt);
+void app_services_stop(void);
+protocol_result_t app_submit_message(message_store_channel_t *channel, const char *message);
+protocol_result_t app_receive_binary_message(socket_t conn,
+                                             const char *base_dir,
+                                             message_store_channel_t *channel,
+                                             const char *mime,
+                                             uint64_t content_size,
+                                             app_upload_kind_t upload_kind);
 protocol_result_t app_receive_file(socket_t conn,
                                    const char *base_dir,
                                    const char *target_path,
                                    uint64_t content_size,
+                                   const uint64_t *mtime,
                                    app_upload_kind_t upload_kind,
                                    char *saved_path_out,
                                    size_t saved_path_cap);
+protocol_result_t app_begin_upload(app_upload_t *upload,
+                                   const char *base_dir,
+                                   const char *target_path);
+protocol_result_t app_write_upload(app_upload_t *upload, const void *data, size_t len);
+protocol_result_t app_reserve_upload(app_upload_t *upload, uint64_t offset, uint64_t len);
+protocol_result_t app_write_upload_at(app_upload_t *upload,
+                                      uint64_t offset,
+                                      const void *data,
+                                      size_t len);
+protocol_result_t app_commit_upload(app_upload_t *upload,
+                                    char *saved_path_out,
+                                    size_t saved_path_cap);
+void app_abort_upload(app_upload_t *upload);
 protocol_result_t app_prepare_download(const char *base_dir,
                                        const char *target_path,
                                        app_download_t *download_out);
+// As above but bypassing the download cache, for files read once in bulk.
+protocol_result_t app_open_download(const char *base_dir,
+                                    const char *target_path,
+                                    app_download_t *download_out);
+net_send_file_result_t app_send_download(socket_t conn,
+                                         const app_download_t *download);
 void app_download_cleanup(app_download_t *download);
 
 #endif  // HF_APP_SERVICE_H
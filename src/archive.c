@@ -0,0 +1,430 @@
+#include "archive.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define ARCHIVE_TAR_BLOCK 512u
+#define ARCHIVE_TAR_OCTAL11_MAX 077777777777ULL
+#define ARCHIVE_ZIP_U16_MAX 0xFFFFu
+#define ARCHIVE_ZIP_U32_MAX 0xFFFFFFFFu
+#define ARCHIVE_ZIP_LOCAL_LEN 30u
+#define ARCHIVE_ZIP_CENTRAL_LEN 46u
+#define ARCHIVE_ZIP_END_LEN 22u
+#define ARCHIVE_ZIP64_END_LEN 56u
+#define ARCHIVE_ZIP64_LOCATOR_LEN 20u
+#define ARCHIVE_ZIP_TIME_EXTRA_LEN 9u
+#define ARCHIVE_ZIP_VERSION 20u
+#define ARCHIVE_ZIP64_VERSION 45u
+#define ARCHIVE_ZIP_FLAG_UTF8 0x0800u
+
+static void archive_put16(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)(v & 0xFFu);
+  p[1] = (unsigned char)((v >> 8) & 0xFFu);
+}
+
+static void archive_put32(unsigned char *p, uint32_t v) {
+  archive_put16(p, v & 0xFFFFu);
+  archive_put16(p + 2, v >> 16);
+}
+
+static void archive_put64(unsigned char *p, uint64_t v) {
+  archive_put32(p, (uint32_t)(v & 0xFFFFFFFFu));
+  archive_put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static size_t archive_name_len(const archive_entry_t *entry) {
+  return strlen(entry->name) + (entry->is_dir ? 1u : 0u);
+}
+
+static uint64_t archive_round_block(uint64_t len) {
+  return (len + ARCHIVE_TAR_BLOCK - 1u) / ARCHIVE_TAR_BLOCK * ARCHIVE_TAR_BLOCK;
+}
+
+static size_t archive_write_name(const archive_entry_t *entry, char *out) {
+  size_t len = strlen(entry->name);
+
+  memcpy(out, entry->name, len);
+  if (entry->is_dir) {
+    out[len++] = '/';
+  }
+  return len;
+}
+
+// ---- zip ----
+
+static int archive_zip_size64(const archive_entry_t *entry) {
+  return entry->size >= ARCHIVE_ZIP_U32_MAX;
+}
+
+static size_t archive_zip_local_len(const archive_entry_t *entry) {
+  return ARCHIVE_ZIP_LOCAL_LEN + archive_name_len(entry) +
+         (archive_zip_size64(entry) ? 20u : 0u) + ARCHIVE_ZIP_TIME_EXTRA_LEN;
+}
+
+static size_t archive_zip64_central_extra_len(const archive_entry_t *entry) {
+  size_t fields = (archive_zip_size64(entry) ? 2u : 0u) +
+                  (entry->offset >= ARCHIVE_ZIP_U32_MAX ? 1u : 0u);
+  return fields > 0 ? 4u + fields * 8u : 0u;
+}
+
+static size_t archive_zip_central_len(const archive_entry_t *entry) {
+  return ARCHIVE_ZIP_CENTRAL_LEN + archive_name_len(entry) +
+         archive_zip64_central_extra_len(entry) + ARCHIVE_ZIP_TIME_EXTRA_LEN;
+}
+
+// Inverse of days_from_civil (Howard Hinnant's algorithm), UTC.
+static void archive_civil_from_days(int64_t z, int *y, unsigned *m, unsigned *d) {
+  z += 719468;
+  int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  unsigned doe = (unsigned)(z - era * 146097);
+  unsigned yoe = (doe - doe / 1460u + doe / 36524u - doe / 146096u) / 365u;
+  unsigned doy = doe - (365u * yoe + yoe / 4u - yoe / 100u);
+  unsigned mp = (5u * doy + 2u) / 153u;
+
+  *d = doy - (153u * mp + 2u) / 5u + 1u;
+  *m = mp < 10u ? mp + 3u : mp - 9u;
+  *y = (int)(yoe + era * 400) + (*m <= 2u ? 1 : 0);
+}
+
+static void archive_zip_dos_time(uint64_t mtime, uint32_t *time_out, uint32_t *date_out) {
+  int year = 0;
+  unsigned month = 0;
+  unsigned day = 0;
+  uint64_t secs = mtime % 86400u;
+
+  archive_civil_from_days((int64_t)(mtime / 86400u), &year, &month, &day);
+  if (year < 1980) {
+    *time_out = 0;
+    *date_out = (1u << 5) | 1u;
+    return;
+  }
+  if (year > 2107) {
+    year = 2107;
+  }
+  *time_out = (uint32_t)(((secs / 3600u) << 11) | (((secs / 60u) % 60u) << 5) |
+                         ((secs % 60u) / 2u));
+  *date_out = ((uint32_t)(year - 1980) << 9) | (month << 5) | day;
+}
+
+// Extended timestamp (0x5455) so unzip restores the exact UTC mtime.
+static size_t archive_zip_time_extra(const archive_entry_t *entry, unsigned char *p) {
+  archive_put16(p, 0x5455u);
+  archive_put16(p + 2, 5u);
+  p[4] = 1u;
+  archive_put32(p + 5, entry->mtime > ARCHIVE_ZIP_U32_MAX ? ARCHIVE_ZIP_U32_MAX
+                                                          : (uint32_t)entry->mtime);
+  return ARCHIVE_ZIP_TIME_EXTRA_LEN;
+}
+
+static size_t archive_zip_local_header(const archive_entry_t *entry, unsigned char *out) {
+  int size64 = archive_zip_size64(entry);
+  uint32_t size32 = size64 ? ARCHIVE_ZIP_U32_MAX : (uint32_t)entry->size;
+  uint32_t dos_time = 0;
+  uint32_t dos_date = 0;
+  size_t name_len = 0;
+  size_t extra_len = (size64 ? 20u : 0u) + ARCHIVE_ZIP_TIME_EXTRA_LEN;
+  unsigned char *p = out + ARCHIVE_ZIP_LOCAL_LEN;
+
+  archive_zip_dos_time(entry->mtime, &dos_time, &dos_date);
+  name_len = archive_write_name(entry, (char *)p);
+  p += name_len;
+
+  archive_put32(out, 0x04034b50u);
+  archive_put16(out + 4, size64 ? ARCHIVE_ZIP64_VERSION : ARCHIVE_ZIP_VERSION);
+  archive_put16(out + 6, ARCHIVE_ZIP_FLAG_UTF8);
+  archive_put16(out + 8, 0);
+  archive_put16(out + 10, dos_time);
+  archive_put16(out + 12, dos_date);
+  archive_put32(out + 14, entry->crc32);
+  archive_put32(out + 18, size32);
+  archive_put32(out + 22, size32);
+  archive_put16(out + 26, (uint32_t)name_len);
+  archive_put16(out + 28, (uint32_t)extra_len);
+
+  if (size64) {
+    archive_put16(p, 0x0001u);
+    archive_put16(p + 2, 16u);
+    archive_put64(p + 4, entry->size);
+    archive_put64(p + 12, entry->size);
+    p += 20;
+  }
+  p += archive_zip_time_extra(entry, p);
+  return (size_t)(p - out);
+}
+
+static size_t archive_zip_central_header(const archive_entry_t *entry,
+                                         unsigned char *out) {
+  int size64 = archive_zip_size64(entry);
+  int offset64 = entry->offset >= ARCHIVE_ZIP_U32_MAX;
+  size_t zip64_len = archive_zip64_central_extra_len(entry);
+  uint32_t size32 = size64 ? ARCHIVE_ZIP_U32_MAX : (uint32_t)entry->size;
+  uint32_t mode = entry->is_dir ? 040755u : 0100644u;
+  uint32_t dos_time = 0;
+  uint32_t dos_date = 0;
+  size_t name_len = 0;
+  unsigned char *p = out + ARCHIVE_ZIP_CENTRAL_LEN;
+
+  archive_zip_dos_time(entry->mtime, &dos_time, &dos_date);
+  name_len = archive_write_name(entry, (char *)p);
+  p += name_len;
+
+  archive_put32(out, 0x02014b50u);
+  archive_put16(out + 4, (3u << 8) | ARCHIVE_ZIP64_VERSION);
+  archive_put16(out + 6, zip64_len > 0 ? ARCHIVE_ZIP64_VERSION : ARCHIVE_ZIP_VERSION);
+  archive_put16(out + 8, ARCHIVE_ZIP_FLAG_UTF8);
+  archive_put16(out + 10, 0);
+  archive_put16(out + 12, dos_time);
+  archive_put16(out + 14, dos_date);
+  archive_put32(out + 16, entry->crc32);
+  archive_put32(out + 20, size32);
+  archive_put32(out + 24, size32);
+  archive_put16(out + 28, (uint32_t)name_len);
+  archive_put16(out + 30, (uint32_t)(zip64_len + ARCHIVE_ZIP_TIME_EXTRA_LEN));
+  archive_put16(out + 32, 0);
+  archive_put16(out + 34, 0);
+  archive_put16(out + 36, 0);
+  archive_put32(out + 38, (mode << 16) | (entry->is_dir ? 0x10u : 0u));
+  archive_put32(out + 42, offset64 ? ARCHIVE_ZIP_U32_MAX : (uint32_t)entry->offset);
+
+  if (zip64_len > 0) {
+    archive_put16(p, 0x0001u);
+    archive_put16(p + 2, (uint32_t)(zip64_len - 4u));
+    p += 4;
+    if (size64) {
+      archive_put64(p, entry->size);
+      archive_put64(p + 8, entry->size);
+      p += 16;
+    }
+    if (offset64) {
+      archive_put64(p, entry->offset);
+      p += 8;
+    }
+  }
+  p += archive_zip_time_extra(entry, p);
+  return (size_t)(p - out);
+}
+
+static int archive_zip_needs64_end(size_t count, uint64_t cd_offset, uint64_t cd_size) {
+  return count >= ARCHIVE_ZIP_U16_MAX || cd_offset >= ARCHIVE_ZIP_U32_MAX ||
+         cd_size >= ARCHIVE_ZIP_U32_MAX;
+}
+
+static int archive_zip_trailer(const archive_entry_t *entries, size_t count,
+                               archive_emit_fn emit, void *ctx) {
+  unsigned char buf[ARCHIVE_HEADER_MAX];
+  uint64_t cd_offset = 0;
+  uint64_t cd_size = 0;
+  unsigned char *p = buf;
+
+  if (count > 0) {
+    const archive_entry_t *last = &entries[count - 1u];
+    cd_offset = last->offset + archive_zip_local_len(last) + last->size;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    size_t n = archive_zip_central_header(&entries[i], buf);
+    if (emit(ctx, buf, n) != 0) {
+      return 1;
+    }
+    cd_size += n;
+  }
+
+  if (archive_zip_needs64_end(count, cd_offset, cd_size)) {
+    archive_put32(p, 0x06064b50u);
+    archive_put64(p + 4, ARCHIVE_ZIP64_END_LEN - 12u);
+    archive_put16(p + 12, (3u << 8) | ARCHIVE_ZIP64_VERSION);
+    archive_put16(p + 14, ARCHIVE_ZIP64_VERSION);
+    archive_put32(p + 16, 0);
+    archive_put32(p + 20, 0);
+    archive_put64(p + 24, count);
+    archive_put64(p + 32, count);
+    archive_put64(p + 40, cd_size);
+    archive_put64(p + 48, cd_offset);
+    p += ARCHIVE_ZIP64_END_LEN;
+
+    archive_put32(p, 0x07064b50u);
+    archive_put32(p + 4, 0);
+    archive_put64(p + 8, cd_offset + cd_size);
+    archive_put32(p + 16, 1u);
+    p += ARCHIVE_ZIP64_LOCATOR_LEN;
+  }
+
+  archive_put32(p, 0x06054b50u);
+  archive_put16(p + 4, 0);
+  archive_put16(p + 6, 0);
+  archive_put16(p + 8, count >= ARCHIVE_ZIP_U16_MAX ? ARCHIVE_ZIP_U16_MAX : (uint32_t)count);
+  archive_put16(p + 10, count >= ARCHIVE_ZIP_U16_MAX ? ARCHIVE_ZIP_U16_MAX : (uint32_t)count);
+  archive_put32(p + 12, cd_size >= ARCHIVE_ZIP_U32_MAX ? ARCHIVE_ZIP_U32_MAX
+                                                       : (uint32_t)cd_size);
+  archive_put32(p + 16, cd_offset >= ARCHIVE_ZIP_U32_MAX ? ARCHIVE_ZIP_U32_MAX
+                                                         : (uint32_t)cd_offset);
+  archive_put16(p + 20, 0);
+  p += ARCHIVE_ZIP_END_LEN;
+
+  return emit(ctx, buf, (size_t)(p - buf));
+}
+
+// ---- tar (POSIX ustar with pax records for long names and huge sizes) ----
+
+static size_t archive_pax_record_len(const char *key, size_t value_len) {
+  size_t body = 1u + strlen(key) + 1u + value_len + 1u;
+  size_t len = body + 1u;
+
+  while (len != body + (size_t)snprintf(NULL, 0, "%zu", len)) {
+    len = body + (size_t)snprintf(NULL, 0, "%zu", len);
+  }
+  return len;
+}
+
+static size_t archive_tar_pax_len(const archive_entry_t *entry) {
+  size_t len = 0;
+
+  if (archive_name_len(entry) > 100u) {
+    len += archive_pax_record_len("path", archive_name_len(entry));
+  }
+  if (entry->size > ARCHIVE_TAR_OCTAL11_MAX) {
+    len += archive_pax_record_len("size", (size_t)snprintf(NULL, 0, "%llu",
+                                                          (unsigned long long)entry->size));
+  }
+  return len;
+}
+
+static size_t archive_tar_header_len(const archive_entry_t *entry) {
+  size_t pax_len = archive_tar_pax_len(entry);
+  return ARCHIVE_TAR_BLOCK +
+         (pax_len > 0 ? ARCHIVE_TAR_BLOCK + (size_t)archive_round_block(pax_len) : 0u);
+}
+
+static void archive_tar_octal(char *field, size_t width, uint64_t value) {
+  if (value > ARCHIVE_TAR_OCTAL11_MAX && width == 12u) {
+    // GNU base-256 form; pax readers take the size record instead.
+    field[0] = (char)0x80;
+    for (size_t i = width - 1u; i > 0; i--) {
+      field[i] = (char)(value & 0xFFu);
+      value >>= 8;
+    }
+    return;
+  }
+  field[width - 1u] = '\0';
+  for (size_t i = width - 1u; i > 0; i--) {
+    field[i - 1u] = (char)('0' + (value & 7u));
+    value >>= 3;
+  }
+}
+
+static void archive_tar_block(char *block, const char *name, size_t name_len,
+                              char type, uint32_t mode, uint64_t size, uint64_t mtime) {
+  unsigned sum = 0;
+
+  memset(block, 0, ARCHIVE_TAR_BLOCK);
+  memcpy(block, name, name_len > 100u ? 100u : name_len);
+  archive_tar_octal(block + 100, 8u, mode);
+  archive_tar_octal(block + 108, 8u, 0);
+  archive_tar_octal(block + 116, 8u, 0);
+  archive_tar_octal(block + 124, 12u, size);
+  archive_tar_octal(block + 136, 12u,
+                    mtime > ARCHIVE_TAR_OCTAL11_MAX ? ARCHIVE_TAR_OCTAL11_MAX : mtime);
+  block[156] = type;
+  memcpy(block + 257, "ustar", 6u);
+  memcpy(block + 263, "00", 2u);
+
+  memset(block + 148, ' ', 8u);
+  for (size_t i = 0; i < ARCHIVE_TAR_BLOCK; i++) {
+    sum += (unsigned char)block[i];
+  }
+  archive_tar_octal(block + 148, 7u, sum);
+  block[155] = ' ';
+}
+
+static size_t archive_tar_header(const archive_entry_t *entry, char *out) {
+  char name[ARCHIVE_NAME_MAX + 1u];
+  size_t name_len = archive_write_name(entry, name);
+  size_t pax_len = archive_tar_pax_len(entry);
+  char *p = out;
+
+  if (pax_len > 0) {
+    char *records = p + ARCHIVE_TAR_BLOCK;
+    size_t used = 0;
+
+    archive_tar_block(p, "././@PaxHeader", 14u, 'x', 0644u, pax_len, entry->mtime);
+    if (name_len > 100u) {
+      size_t rec = archive_pax_record_len("path", name_len);
+      used += (size_t)snprintf(records + used, rec + 1u, "%zu path=", rec);
+      memcpy(records + used, name, name_len);
+      used += name_len;
+      records[used++] = '\n';
+    }
+    if (entry->size > ARCHIVE_TAR_OCTAL11_MAX) {
+      char value[32];
+      int n = snprintf(value, sizeof(value), "%llu", (unsigned long long)entry->size);
+      size_t rec = archive_pax_record_len("size", (size_t)n);
+      used += (size_t)snprintf(records + used, rec + 1u, "%zu size=%s\n", rec, value);
+    }
+    memset(records + used, 0, (size_t)archive_round_block(used) - used);
+    p = records + archive_round_block(used);
+  }
+
+  archive_tar_block(p, name, name_len, entry->is_dir ? '5' : '0',
+                    entry->is_dir ? 0755u : 0644u, entry->is_dir ? 0 : entry->size,
+                    entry->mtime);
+  return (size_t)(p + ARCHIVE_TAR_BLOCK - out);
+}
+
+int archive_plan(archive_format_t format, archive_entry_t *entries, size_t count,
+                 uint64_t *total_out) {
+  uint64_t offset = 0;
+  uint64_t cd_size = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    archive_entry_t *entry = &entries[i];
+
+    if (archive_name_len(entry) > ARCHIVE_NAME_MAX) {
+      return 1;
+    }
+    if (entry->is_dir) {
+      entry->size = 0;
+    }
+    entry->offset = offset;
+    if (format == ARCHIVE_FORMAT_ZIP) {
+      offset += archive_zip_local_len(entry) + entry->size;
+      cd_size += archive_zip_central_len(entry);
+    } else {
+      offset += archive_tar_header_len(entry) + archive_round_block(entry->size);
+    }
+  }
+
+  if (format == ARCHIVE_FORMAT_ZIP) {
+    *total_out = offset + cd_size + ARCHIVE_ZIP_END_LEN +
+                 (archive_zip_needs64_end(count, offset, cd_size)
+                    ? ARCHIVE_ZIP64_END_LEN + ARCHIVE_ZIP64_LOCATOR_LEN
+                    : 0u);
+  } else {
+    *total_out = offset + 2u * ARCHIVE_TAR_BLOCK;
+  }
+  return 0;
+}
+
+size_t archive_entry_header(archive_format_t format, const archive_entry_t *entry,
+                            char *out) {
+  if (format == ARCHIVE_FORMAT_ZIP) {
+    return archive_zip_local_header(entry, (unsigned char *)out);
+  }
+  return archive_tar_header(entry, out);
+}
+
+size_t archive_entry_padding(archive_format_t format, const archive_entry_t *entry) {
+  if (format == ARCHIVE_FORMAT_ZIP) {
+    return 0;
+  }
+  return (size_t)(archive_round_block(entry->size) - entry->size);
+}
+
+int archive_write_trailer(archive_format_t format, const archive_entry_t *entries,
+                          size_t count, archive_emit_fn emit, void *ctx) {
+  static const char zeros[2u * ARCHIVE_TAR_BLOCK] = {0};
+
+  if (format == ARCHIVE_FORMAT_ZIP) {
+    return archive_zip_trailer(entries, count, emit, ctx);
+  }
+  return emit(ctx, zeros, sizeof(zeros));
+}
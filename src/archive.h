@@ -0,0 +1,41 @@
+#ifndef HF_ARCHIVE_H
+#define HF_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARCHIVE_NAME_MAX 2048u
+#define ARCHIVE_HEADER_MAX 4096u
+
+typedef enum {
+  ARCHIVE_FORMAT_ZIP = 0,
+  ARCHIVE_FORMAT_TAR,
+} archive_format_t;
+
+typedef struct {
+  const char *name;    // path inside the archive, '/'-separated, no trailing '/'
+  const char *source;  // caller data, never encoded
+  int is_dir;
+  uint64_t size;
+  uint64_t mtime;
+  uint32_t crc32;      // zip only; must be set before the entry header is built
+  uint64_t offset;     // assigned by archive_plan
+} archive_entry_t;
+
+typedef int (*archive_emit_fn)(void *ctx, const void *data, size_t len);
+
+// Lays out a stored (uncompressed) archive and returns its exact length, so
+// the response can carry Content-Length. Returns 1 if a name is too long.
+int archive_plan(archive_format_t format, archive_entry_t *entries, size_t count,
+                 uint64_t *total_out);
+
+// Bytes preceding the entry body; out must hold ARCHIVE_HEADER_MAX bytes.
+size_t archive_entry_header(archive_format_t format, const archive_entry_t *entry,
+                            char *out);
+// Zero bytes that must follow the entry body.
+size_t archive_entry_padding(archive_format_t format, const archive_entry_t *entry);
+// Everything after the last entry: the zip central directory or tar end blocks.
+int archive_write_trailer(archive_format_t format, const archive_entry_t *entries,
+                          size_t count, archive_emit_fn emit, void *ctx);
+
+#endif  // HF_ARCHIVE_H
@@ -0,0 +1,161 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16u
+#define ARENA_MIN_BLOCK (64u * 1024u)
+
+struct arena_block {
+  arena_block_t *next;
+  size_t cap;
+  size_t used;
+  int owned;
+};
+
+#define ARENA_HEADER_SIZE \
+  ((sizeof(arena_block_t) + ARENA_ALIGN - 1u) & ~(size_t)(ARENA_ALIGN - 1u))
+
+static char *arena_block_data(arena_block_t *block) {
+  return (char *)block + ARENA_HEADER_SIZE;
+}
+
+static size_t arena_align_up(size_t n) {
+  return (n + ARENA_ALIGN - 1u) & ~(size_t)(ARENA_ALIGN - 1u);
+}
+
+void arena_init(arena_t *arena, void *initial, size_t initial_cap) {
+  uintptr_t start = 0;
+  size_t skew = 0;
+
+  memset(arena, 0, sizeof(*arena));
+  if (initial == NULL) {
+    return;
+  }
+
+  start = ((uintptr_t)initial + ARENA_ALIGN - 1u) & ~(uintptr_t)(ARENA_ALIGN - 1u);
+  skew = (size_t)(start - (uintptr_t)initial);
+  if (initial_cap < skew + ARENA_HEADER_SIZE + ARENA_ALIGN) {
+    return;
+  }
+
+  arena->head = (arena_block_t *)start;
+  arena->head->next = NULL;
+  arena->head->cap = initial_cap - skew - ARENA_HEADER_SIZE;
+  arena->head->used = 0;
+  arena->head->owned = 0;
+}
+
+static arena_block_t *arena_add_block(arena_t *arena, size_t need) {
+  size_t cap = need > ARENA_MIN_BLOCK ? need : ARENA_MIN_BLOCK;
+  arena_block_t *block = NULL;
+
+  // Grow geometrically with the amount already spilled to the heap so
+  // large responses settle into a handful of blocks.
+  if (arena->heap_bytes > cap) {
+    cap = arena->heap_bytes;
+  }
+  if (cap > SIZE_MAX - ARENA_HEADER_SIZE) {
+    return NULL;
+  }
+
+  block = (arena_block_t *)malloc(ARENA_HEADER_SIZE + cap);
+  if (block == NULL) {
+    return NULL;
+  }
+  block->next = arena->head;
+  block->cap = cap;
+  block->used = 0;
+  block->owned = 1;
+  arena->head = block;
+  arena->heap_bytes += cap;
+  return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t len) {
+  arena_block_t *block = arena->head;
+  size_t need = arena_align_up(len > 0 ? len : 1u);
+  void *ptr = NULL;
+
+  if (need < len) {
+    return NULL;
+  }
+  if (block == NULL || block->cap - block->used < need) {
+    block = arena_add_block(arena, need);
+    if (block == NULL) {
+      return NULL;
+    }
+  }
+
+  ptr = arena_block_data(block) + block->used;
+  block->used += need;
+  arena->last = ptr;
+  return ptr;
+}
+
+void *arena_grow(arena_t *arena, void *ptr, size_t old_len, size_t new_len) {
+  arena_block_t *block = arena->head;
+  void *next = NULL;
+
+  if (ptr == NULL) {
+    return arena_alloc(arena, new_len);
+  }
+  if (new_len <= old_len) {
+    return ptr;
+  }
+
+  if (ptr == arena->last && block != NULL) {
+    size_t offset = (size_t)((char *)ptr - arena_block_data(block));
+    size_t need = arena_align_up(new_len);
+    if (need >= new_len && need <= block->cap - offset) {
+      block->used = offset + need;
+      return ptr;
+    }
+  }
+
+  next = arena_alloc(arena, new_len);
+  if (next == NULL) {
+    return NULL;
+  }
+  memcpy(next, ptr, old_len);
+  return next;
+}
+
+char *arena_strndup(arena_t *arena, const char *s, size_t len) {
+  char *copy = (char *)arena_alloc(arena, len + 1u);
+  if (copy == NULL) {
+    return NULL;
+  }
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+char *arena_strdup(arena_t *arena, const char *s) {
+  return arena_strndup(arena, s, strlen(s));
+}
+
+void arena_release(arena_t *arena) {
+  arena_block_t *block = arena->head;
+
+  while (block != NULL) {
+    arena_block_t *next = block->next;
+    if (block->owned) {
+      free(block);
+    } else {
+      // Caller-provided storage is always the oldest block.
+      block->used = 0;
+      block->next = NULL;
+      arena->head = block;
+      arena->last = NULL;
+      arena->heap_bytes = 0;
+      return;
+    }
+    block = next;
+  }
+
+  arena->head = NULL;
+  arena->last = NULL;
+  arena->heap_bytes = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef HF_ARENA_H
+#define HF_ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena_block arena_block_t;
+
+// Bump allocator released in one step. The first block may live in
+// caller-provided storage (typically the stack) so short-lived work that
+// fits in it never touches the heap.
+typedef struct {
+  arena_block_t *head;
+  void *last;
+  size_t heap_bytes;
+} arena_t;
+
+void arena_init(arena_t *arena, void *initial, size_t initial_cap);
+void *arena_alloc(arena_t *arena, size_t len);
+// Extends ptr in place when it is the most recent allocation, otherwise
+// copies into a new allocation. The old region stays valid until release.
+void *arena_grow(arena_t *arena, void *ptr, size_t old_len, size_t new_len);
+char *arena_strndup(arena_t *arena, const char *s, size_t len);
+char *arena_strdup(arena_t *arena, const char *s);
+void arena_release(arena_t *arena);
+
+#endif  // HF_ARENA_H
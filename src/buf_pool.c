@@ -0,0 +1,404 @@
+#ifdef __linux__
+  #ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+  #endif
+#endif
+
+#include "buf_pool.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <malloc.h>
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <sys/mman.h>
+#endif
+
+#define BUF_POOL_SLAB_SIZE (2u * 1024u * 1024u)
+#define BUF_POOL_CAPACITY (32u * 1024u * 1024u)
+// Buffers past the pool come from the heap, but only up to this much; beyond
+// it acquire fails, so total buffer memory stays bounded under any load.
+#define BUF_POOL_HEAP_CAP (32u * 1024u * 1024u)
+#define BUF_POOL_THREAD_CACHE 2u
+#define BUF_POOL_FALLBACK_ALIGN 64u
+
+typedef struct {
+  char *bufs[BUF_POOL_THREAD_CACHE];
+  unsigned count;
+} buf_pool_thread_cache_t;
+
+typedef struct {
+  char *base;
+  size_t reserved;
+  char *free_list;
+  buf_pool_backing_t backing;
+  volatile uint64_t in_use;
+  volatile uint64_t acquired;
+  volatile uint64_t thread_cache_hits;
+  volatile uint64_t misses;
+  volatile uint64_t heap_bytes;
+  volatile uint64_t refused;
+#ifdef _WIN32
+  CRITICAL_SECTION mutex;
+  DWORD cache_slot;
+#else
+  pthread_mutex_t mutex;
+  pthread_key_t cache_key;
+#endif
+  int cache_ready;
+} buf_pool_state_t;
+
+static buf_pool_state_t g_buf_pool = {0};
+
+#ifdef _WIN32
+static INIT_ONCE g_buf_pool_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t g_buf_pool_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void buf_pool_counter_add(volatile uint64_t *counter, int64_t delta) {
+#ifdef _WIN32
+  (void)InterlockedExchangeAdd64((volatile LONG64 *)counter, (LONG64)delta);
+#else
+  (void)__atomic_fetch_add(counter, (uint64_t)delta, __ATOMIC_RELAXED);
+#endif
+}
+
+static uint64_t buf_pool_counter_load(volatile uint64_t *counter) {
+#ifdef _WIN32
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)counter, 0, 0);
+#else
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+#endif
+}
+
+static void buf_pool_lock(void) {
+#ifdef _WIN32
+  EnterCriticalSection(&g_buf_pool.mutex);
+#else
+  (void)pthread_mutex_lock(&g_buf_pool.mutex);
+#endif
+}
+
+static void buf_pool_unlock(void) {
+#ifdef _WIN32
+  LeaveCriticalSection(&g_buf_pool.mutex);
+#else
+  (void)pthread_mutex_unlock(&g_buf_pool.mutex);
+#endif
+}
+
+// Caller holds the lock.
+static void buf_pool_push_free(char *buf) {
+  char *next = g_buf_pool.free_list;
+  memcpy(buf, &next, sizeof(next));
+  g_buf_pool.free_list = buf;
+}
+
+// Caller holds the lock.
+static char *buf_pool_pop_free(void) {
+  char *buf = g_buf_pool.free_list;
+  if (buf != NULL) {
+    memcpy(&g_buf_pool.free_list, buf, sizeof(g_buf_pool.free_list));
+  }
+  return buf;
+}
+
+// The whole capacity is reserved as address space once so ownership is a
+// range check; pages only become resident as slabs are handed out.
+static char *buf_pool_reserve_region(buf_pool_backing_t *backing_out) {
+#ifdef _WIN32
+  char *base = (char *)VirtualAlloc(NULL, BUF_POOL_CAPACITY, MEM_RESERVE, PAGE_READWRITE);
+  *backing_out = BUF_POOL_BACKING_DEFAULT;
+  return base;
+#else
+  char *raw = NULL;
+  uintptr_t aligned = 0;
+  size_t raw_len = (size_t)BUF_POOL_CAPACITY + BUF_POOL_SLAB_SIZE;
+
+  #ifdef MAP_HUGETLB
+  // Explicit huge pages are reserved up front, so a short pool just fails here.
+  raw = (char *)mmap(NULL, BUF_POOL_CAPACITY, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (raw != MAP_FAILED) {
+    *backing_out = BUF_POOL_BACKING_HUGE;
+    return raw;
+  }
+  #endif
+
+  raw = (char *)mmap(NULL, raw_len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (raw == MAP_FAILED) {
+    return NULL;
+  }
+
+  aligned = ((uintptr_t)raw + BUF_POOL_SLAB_SIZE - 1u) &
+            ~(uintptr_t)(BUF_POOL_SLAB_SIZE - 1u);
+  if (aligned > (uintptr_t)raw) {
+    (void)munmap(raw, aligned - (uintptr_t)raw);
+  }
+  if ((uintptr_t)raw + raw_len > aligned + BUF_POOL_CAPACITY) {
+    (void)munmap((char *)(aligned + BUF_POOL_CAPACITY),
+                 (uintptr_t)raw + raw_len - (aligned + BUF_POOL_CAPACITY));
+  }
+
+  *backing_out = BUF_POOL_BACKING_DEFAULT;
+  #ifdef MADV_HUGEPAGE
+  if (madvise((char *)aligned, BUF_POOL_CAPACITY, MADV_HUGEPAGE) == 0) {
+    *backing_out = BUF_POOL_BACKING_TRANSPARENT_HUGE;
+  }
+  #endif
+  return (char *)aligned;
+#endif
+}
+
+// Caller holds the lock.
+static char *buf_pool_carve_slab(void) {
+  char *slab = NULL;
+
+  if (g_buf_pool.base == NULL ||
+      g_buf_pool.reserved + BUF_POOL_SLAB_SIZE > BUF_POOL_CAPACITY) {
+    return NULL;
+  }
+
+  slab = g_buf_pool.base + g_buf_pool.reserved;
+#ifdef _WIN32
+  if (VirtualAlloc(slab, BUF_POOL_SLAB_SIZE, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+    return NULL;
+  }
+#endif
+  g_buf_pool.reserved += BUF_POOL_SLAB_SIZE;
+
+  for (size_t off = BUF_POOL_BUF_SIZE; off < BUF_POOL_SLAB_SIZE; off += BUF_POOL_BUF_SIZE) {
+    buf_pool_push_free(slab + off);
+  }
+  return slab;
+}
+
+static int buf_pool_owns(const char *buf) {
+  return g_buf_pool.base != NULL && buf >= g_buf_pool.base &&
+         buf < g_buf_pool.base + BUF_POOL_CAPACITY;
+}
+
+static void buf_pool_free_thread_cache(void *arg) {
+  buf_pool_thread_cache_t *cache = (buf_pool_thread_cache_t *)arg;
+
+  if (cache == NULL) {
+    return;
+  }
+
+  buf_pool_lock();
+  for (unsigned i = 0; i < cache->count; i++) {
+    buf_pool_push_free(cache->bufs[i]);
+  }
+  buf_pool_unlock();
+  free(cache);
+}
+
+#ifdef _WIN32
+static VOID WINAPI buf_pool_thread_exit(PVOID arg) {
+  buf_pool_free_thread_cache(arg);
+}
+
+static BOOL CALLBACK buf_pool_init(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+  (void)once;
+  (void)param;
+  (void)ctx;
+
+  InitializeCriticalSection(&g_buf_pool.mutex);
+  g_buf_pool.cache_slot = FlsAlloc(buf_pool_thread_exit);
+  g_buf_pool.cache_ready = g_buf_pool.cache_slot != FLS_OUT_OF_INDEXES;
+  g_buf_pool.base = buf_pool_reserve_region(&g_buf_pool.backing);
+  return TRUE;
+}
+#else
+static void buf_pool_init(void) {
+  if (pthread_mutex_init(&g_buf_pool.mutex, NULL) != 0) {
+    return;
+  }
+  g_buf_pool.cache_ready =
+    pthread_key_create(&g_buf_pool.cache_key, buf_pool_free_thread_cache) == 0;
+  g_buf_pool.base = buf_pool_reserve_region(&g_buf_pool.backing);
+}
+#endif
+
+static void buf_pool_ensure_init(void) {
+#ifdef _WIN32
+  (void)InitOnceExecuteOnce(&g_buf_pool_once, buf_pool_init, NULL, NULL);
+#else
+  (void)pthread_once(&g_buf_pool_once, buf_pool_init);
+#endif
+}
+
+static buf_pool_thread_cache_t *buf_pool_thread_cache(int create) {
+  buf_pool_thread_cache_t *cache = NULL;
+
+  if (!g_buf_pool.cache_ready) {
+    return NULL;
+  }
+
+#ifdef _WIN32
+  cache = (buf_pool_thread_cache_t *)FlsGetValue(g_buf_pool.cache_slot);
+#else
+  cache = (buf_pool_thread_cache_t *)pthread_getspecific(g_buf_pool.cache_key);
+#endif
+  if (cache != NULL || !create) {
+    return cache;
+  }
+
+  cache = (buf_pool_thread_cache_t *)calloc(1, sizeof(*cache));
+  if (cache == NULL) {
+    return NULL;
+  }
+#ifdef _WIN32
+  if (!FlsSetValue(g_buf_pool.cache_slot, cache)) {
+#else
+  if (pthread_setspecific(g_buf_pool.cache_key, cache) != 0) {
+#endif
+    free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+static uint64_t buf_pool_counter_add_fetch(volatile uint64_t *counter, int64_t delta) {
+#ifdef _WIN32
+  return (uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)counter, (LONG64)delta) +
+         (uint64_t)delta;
+#else
+  return __atomic_add_fetch(counter, (uint64_t)delta, __ATOMIC_RELAXED);
+#endif
+}
+
+static char *buf_pool_heap_alloc(void) {
+  char *buf = NULL;
+
+  if (buf_pool_counter_add_fetch(&g_buf_pool.heap_bytes, BUF_POOL_BUF_SIZE) >
+      BUF_POOL_HEAP_CAP) {
+    buf_pool_counter_add(&g_buf_pool.heap_bytes, -(int64_t)BUF_POOL_BUF_SIZE);
+    buf_pool_counter_add(&g_buf_pool.refused, 1);
+    return NULL;
+  }
+#ifdef _WIN32
+  buf = (char *)_aligned_malloc(BUF_POOL_BUF_SIZE, BUF_POOL_FALLBACK_ALIGN);
+#else
+  void *mem = NULL;
+  if (posix_memalign(&mem, BUF_POOL_FALLBACK_ALIGN, BUF_POOL_BUF_SIZE) == 0) {
+    buf = (char *)mem;
+  }
+#endif
+  if (buf == NULL) {
+    buf_pool_counter_add(&g_buf_pool.heap_bytes, -(int64_t)BUF_POOL_BUF_SIZE);
+  }
+  return buf;
+}
+
+static void buf_pool_heap_free(char *buf) {
+#ifdef _WIN32
+  _aligned_free(buf);
+#else
+  free(buf);
+#endif
+  buf_pool_counter_add(&g_buf_pool.heap_bytes, -(int64_t)BUF_POOL_BUF_SIZE);
+}
+
+char *buf_pool_acquire(void) {
+  buf_pool_thread_cache_t *cache = NULL;
+  char *buf = NULL;
+
+  buf_pool_ensure_init();
+  buf_pool_counter_add(&g_buf_pool.acquired, 1);
+
+  cache = buf_pool_thread_cache(0);
+  if (cache != NULL && cache->count > 0) {
+    buf_pool_counter_add(&g_buf_pool.thread_cache_hits, 1);
+    buf_pool_counter_add(&g_buf_pool.in_use, 1);
+    return cache->bufs[--cache->count];
+  }
+
+  if (g_buf_pool.base != NULL) {
+    buf_pool_lock();
+    buf = buf_pool_pop_free();
+    if (buf == NULL) {
+      buf = buf_pool_carve_slab();
+    }
+    buf_pool_unlock();
+  }
+
+  if (buf == NULL) {
+    buf_pool_counter_add(&g_buf_pool.misses, 1);
+    buf = buf_pool_heap_alloc();
+  }
+  if (buf != NULL) {
+    buf_pool_counter_add(&g_buf_pool.in_use, 1);
+  }
+  return buf;
+}
+
+void buf_pool_release(char *buf) {
+  buf_pool_thread_cache_t *cache = NULL;
+
+  if (buf == NULL) {
+    return;
+  }
+
+  buf_pool_counter_add(&g_buf_pool.in_use, -1);
+  if (!buf_pool_owns(buf)) {
+    buf_pool_heap_free(buf);
+    return;
+  }
+
+  cache = buf_pool_thread_cache(1);
+  if (cache != NULL && cache->count < BUF_POOL_THREAD_CACHE) {
+    cache->bufs[cache->count++] = buf;
+    return;
+  }
+
+  buf_pool_lock();
+  buf_pool_push_free(buf);
+  buf_pool_unlock();
+}
+
+void buf_pool_get_stats(buf_pool_stats_t *out) {
+  if (out == NULL) {
+    return;
+  }
+
+  buf_pool_ensure_init();
+  memset(out, 0, sizeof(*out));
+  out->backing = g_buf_pool.base != NULL ? g_buf_pool.backing : BUF_POOL_BACKING_NONE;
+  out->buffer_size = BUF_POOL_BUF_SIZE;
+  out->capacity_bytes = g_buf_pool.base != NULL ? BUF_POOL_CAPACITY : 0;
+
+  if (g_buf_pool.base != NULL) {
+    buf_pool_lock();
+    out->reserved_bytes = (uint64_t)g_buf_pool.reserved;
+    buf_pool_unlock();
+  }
+
+  out->in_use = buf_pool_counter_load(&g_buf_pool.in_use);
+  out->acquired = buf_pool_counter_load(&g_buf_pool.acquired);
+  out->thread_cache_hits = buf_pool_counter_load(&g_buf_pool.thread_cache_hits);
+  out->misses = buf_pool_counter_load(&g_buf_pool.misses);
+  out->heap_bytes = buf_pool_counter_load(&g_buf_pool.heap_bytes);
+  out->heap_cap_bytes = BUF_POOL_HEAP_CAP;
+  out->refused = buf_pool_counter_load(&g_buf_pool.refused);
+}
+
+const char *buf_pool_backing_name(buf_pool_backing_t backing) {
+  switch (backing) {
+    case BUF_POOL_BACKING_HUGE:
+      return "hugetlb";
+    case BUF_POOL_BACKING_TRANSPARENT_HUGE:
+      return "thp";
+    case BUF_POOL_BACKING_DEFAULT:
+      return "default";
+    case BUF_POOL_BACKING_NONE:
+    default:
+      return "none";
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef HF_BUF_POOL_H
+#define HF_BUF_POOL_H
+
+#include <stdint.h>
+
+#define BUF_POOL_BUF_SIZE (1024u * 1024u)
+
+typedef enum {
+  BUF_POOL_BACKING_NONE = 0,
+  BUF_POOL_BACKING_DEFAULT,
+  BUF_POOL_BACKING_TRANSPARENT_HUGE,
+  BUF_POOL_BACKING_HUGE,
+} buf_pool_backing_t;
+
+typedef struct {
+  buf_pool_backing_t backing;
+  uint64_t buffer_size;
+  uint64_t capacity_bytes;
+  uint64_t reserved_bytes;
+  uint64_t in_use;
+  uint64_t acquired;
+  uint64_t thread_cache_hits;
+  uint64_t misses;
+  uint64_t heap_bytes;
+  uint64_t heap_cap_bytes;
+  uint64_t refused;
+} buf_pool_stats_t;
+
+// Returns a BUF_POOL_BUF_SIZE buffer aligned to at least a cache line, or
+// NULL once the pool is empty and the heap fallback has reached its cap.
+// Safe to call from any thread.
+char *buf_pool_acquire(void);
+void buf_pool_release(char *buf);
+void buf_pool_get_stats(buf_pool_stats_t *out);
+const char *buf_pool_backing_name(buf_pool_backing_t backing);
+
+#endif  // HF_BUF_POOL_H
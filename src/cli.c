@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "protocol.h"
+#include "rate_limit.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -65,13 +66,18 @@ int load_windows_utf8_argv(int *argc_out, char ***argv_out) {
 void usage(const char *argv0) {
   fprintf(stderr,
           "usage:\n"
-          "  %s -d <server_path> [-p <port>]\n"
-          "  %s -c <file_path> [-i <ip>] [-p <port>]\n"
-          "  %s -g <remote_file> [-o <local_path>] [-i <ip>] [-p <port>]\n"
-          "  %s -m <message> [-i <ip>] [-p <port>]\n"
+          "  %s -d <server_path> [-p <port>] [-s] [-l <log_path>] [-r <rate>] [-R <rate>]\n"
+          "  %s -c <file_path|glob|->... [-j <jobs>] [-J] [-r <rate>] [-R <rate>] [-i <ip>] [-p <port>]\n"
+          "  %s -c - -N <name> [-J] [-r <rate>] [-R <rate>] [-i <ip>] [-p <port>]\n"
+          "  %s -g <remote_file> [-o <local_path>] [-J] [-r <rate>] [-R <rate>] [-i <ip>] [-p <port>]\n"
+          "  %s -m <message> [-n <channel>] [-i <ip>] [-p <port>]\n"
+          "  %s -b <file_path> [-t <mime_type>] [-n <channel>] [-i <ip>] [-p <port>]\n"
+          "  %s sync <dir> [-j <jobs>] [-k] [-J] [-r <rate>] [-R <rate>] [-i <ip>] [-p <port>]\n"
           "  %s status\n"
-          "  %s stop\n",
-          argv0, argv0, argv0, argv0, argv0, argv0);
+          "  %s stop\n"
+          "rates are bytes per second with an optional K, M or G suffix; -r limits\n"
+          "each transfer and -R all of them together\n",
+          argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
 }
 
 static int parse_port(const char *s, uint16_t *out) {
@@ -85,6 +91,40 @@ static int parse_port(const char *s, uint16_t *out) {
   return 0;
 }
 
+static int parse_jobs(const char *s, unsigned *out) {
+  if (s == NULL || *s == '\0') return 1;
+  errno = 0;
+  char *end = NULL;
+  unsigned long v = strtoul(s, &end, 10);
+  if (errno != 0 || end == s || *end != '\0') return 1;
+  if (v == 0 || v > HF_CLIENT_MAX_JOBS) return 1;
+  *out = (unsigned)v;
+  return 0;
+}
+
+// Bytes per second, with an optional binary K, M or G suffix.
+static int parse_rate(const char *s, uint64_t *out) {
+  if (s == NULL || *s < '0' || *s > '9') return 1;
+  errno = 0;
+  char *end = NULL;
+  unsigned long long v = strtoull(s, &end, 10);
+  unsigned shift = 0;
+  if (errno != 0 || end == s) return 1;
+  if (*end == 'K' || *end == 'k') {
+    shift = 10;
+  } else if (*end == 'M' || *end == 'm') {
+    shift = 20;
+  } else if (*end == 'G' || *end == 'g') {
+    shift = 30;
+  }
+  if (shift != 0) end++;
+  if (*end != '\0' || v > (UINT64_MAX >> shift)) return 1;
+  v <<= shift;
+  if (v < RATE_LIMIT_MIN_RATE) return 1;
+  *out = (uint64_t)v;
+  return 0;
+}
+
 static int need_value(int argc, char **argv, int *i, const char **out) {
   if (*i + 1 >= argc) return 1;
   *i = *i + 1;
@@ -105,18 +145,41 @@ parse_result_t parse_args(int argc, char **argv, Opt *opt) {
   if (opt == NULL) return PARSE_ERR;
 
   opt->path = NULL;
+  opt->paths = NULL;
+  opt->path_count = 0;
+  opt->stream_name = NULL;
+  opt->jobs = 0;
+  opt->checksum = 0;
+  opt->json = 0;
+  opt->rate_limit = 0;
+  opt->global_rate_limit = 0;
   opt->remote_path = NULL;
   opt->output_path = NULL;
   opt->message = NULL;
+  opt->channel = NULL;
+  opt->mime = NULL;
   opt->ip = "127.0.0.1";
   opt->port = 8888;
   opt->msg_type = 0;
+  opt->durable = 0;
+  opt->message_log_path = NULL;
 
   int server_selected = 0;
   int client_actions = 0;
   char client_action = '\0';
   int output_seen = 0;
+  int channel_seen = 0;
+  int mime_seen = 0;
+  int jobs_seen = 0;
+  int checksum_seen = 0;
+  int json_seen = 0;
+  int stream_name_seen = 0;
+  int rate_seen = 0;
+  int global_rate_seen = 0;
+  int sync_selected = 0;
   int ip_seen = 0;
+  int durable_seen = 0;
+  int message_log_seen = 0;
   int control_mode_selected = 0;
   int arg_start = 1;
 
@@ -129,6 +192,15 @@ parse_result_t parse_args(int argc, char **argv, Opt *opt) {
       opt->mode = stop_mode;
       control_mode_selected = 1;
       arg_start = 2;
+    } else if (strcmp(argv[1], "sync") == 0) {
+      if (argc < 3 || argv[2][0] == '-' || argv[2][0] == '\0') {
+        fprintf(stderr, "sync requires a directory\n");
+        return PARSE_ERR;
+      }
+      opt->path = argv[2];
+      sync_selected = 1;
+      client_actions++;
+      arg_start = 3;
     }
   }
 
@@ -187,6 +259,15 @@ parse_result_t parse_args(int argc, char **argv, Opt *opt) {
           return PARSE_ERR;
         }
 
+        // Every following argument up to the next option is another path.
+        opt->paths = (const char *const *)&argv[i];
+        opt->path_count = 1;
+        while (i + 1 < argc && argv[i + 1] != NULL &&
+               (argv[i + 1][0] != '-' || argv[i + 1][1] == '\0')) {
+          opt->path_count++;
+          i++;
+        }
+
         opt->mode = client_mode;
         opt->path = v;
         opt->message = NULL;
@@ -241,6 +322,141 @@ parse_result_t parse_args(int argc, char **argv, Opt *opt) {
         break;
       }
 
+      case 'b': {
+        const char *v = NULL;
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -b\n");
+          return PARSE_ERR;
+        }
+        if (client_action == 'b') {
+          fprintf(stderr, "duplicate -b\n");
+          return PARSE_ERR;
+        }
+        if (take_value(argc, argv, &i, "invalid client path", &v) != 0) {
+          return PARSE_ERR;
+        }
+
+        opt->mode = client_mode;
+        opt->path = v;
+        opt->message = NULL;
+        opt->msg_type = HF_MSG_TYPE_BINARY_MESSAGE;
+        client_action = 'b';
+        client_actions++;
+        break;
+      }
+
+      case 't': {
+        const char *v = NULL;
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -t\n");
+          return PARSE_ERR;
+        }
+        if (mime_seen) {
+          fprintf(stderr, "duplicate -t\n");
+          return PARSE_ERR;
+        }
+        if (take_value(argc, argv, &i, "invalid mime type", &v) != 0) {
+          return PARSE_ERR;
+        }
+
+        opt->mime = v;
+        mime_seen = 1;
+        break;
+      }
+
+      case 'j': {
+        const char *v = NULL;
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -j\n");
+          return PARSE_ERR;
+        }
+        if (jobs_seen) {
+          fprintf(stderr, "duplicate -j\n");
+          return PARSE_ERR;
+        }
+        if (take_value(argc, argv, &i, "invalid jobs", &v) != 0) {
+          return PARSE_ERR;
+        }
+        if (parse_jobs(v, &opt->jobs) != 0) {
+          fprintf(stderr, "invalid jobs\n");
+          return PARSE_ERR;
+        }
+        jobs_seen = 1;
+        break;
+      }
+
+      case 'k': {
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -k\n");
+          return PARSE_ERR;
+        }
+        if (checksum_seen) {
+          fprintf(stderr, "duplicate -k\n");
+          return PARSE_ERR;
+        }
+
+        opt->checksum = 1;
+        checksum_seen = 1;
+        break;
+      }
+
+      case 'J': {
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -J\n");
+          return PARSE_ERR;
+        }
+        if (json_seen) {
+          fprintf(stderr, "duplicate -J\n");
+          return PARSE_ERR;
+        }
+
+        opt->json = 1;
+        json_seen = 1;
+        break;
+      }
+
+      case 'r':
+      case 'R': {
+        const char *v = NULL;
+        int *seen = a[1] == 'r' ? &rate_seen : &global_rate_seen;
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -%c\n", a[1]);
+          return PARSE_ERR;
+        }
+        if (*seen) {
+          fprintf(stderr, "duplicate -%c\n", a[1]);
+          return PARSE_ERR;
+        }
+        if (take_value(argc, argv, &i, "invalid rate", &v) != 0) {
+          return PARSE_ERR;
+        }
+        if (parse_rate(v, a[1] == 'r' ? &opt->rate_limit : &opt->global_rate_limit) != 0) {
+          fprintf(stderr, "invalid rate (minimum %uK)\n", RATE_LIMIT_MIN_RATE / 1024u);
+          return PARSE_ERR;
+        }
+        *seen = 1;
+        break;
+      }
+
+      case 'N': {
+        const char *v = NULL;
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -N\n");
+          return PARSE_ERR;
+        }
+        if (stream_name_seen) {
+          fprintf(stderr, "duplicate -N\n");
+          return PARSE_ERR;
+        }
+        if (take_value(argc, argv, &i, "invalid stream name", &v) != 0) {
+          return PARSE_ERR;
+        }
+
+        opt->stream_name = v;
+        stream_name_seen = 1;
+        break;
+      }
+
       case 'o': {
         const char *v = NULL;
         if (control_mode_selected) {
@@ -260,6 +476,25 @@ parse_result_t parse_args(int argc, char **argv, Opt *opt) {
         break;
       }
 
+      case 'n': {
+        const char *v = NULL;
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -n\n");
+          return PARSE_ERR;
+        }
+        if (channel_seen) {
+          fprintf(stderr, "duplicate -n\n");
+          return PARSE_ERR;
+        }
+        if (take_value(argc, argv, &i, "invalid channel", &v) != 0) {
+          return PARSE_ERR;
+        }
+
+        opt->channel = v;
+        channel_seen = 1;
+        break;
+      }
+
       case 'i': {
         const char *v = NULL;
         if (take_value(argc, argv, &i, "invalid argument", &v) != 0) {
@@ -271,6 +506,41 @@ parse_result_t parse_args(int argc, char **argv, Opt *opt) {
         break;
       }
 
+      case 's': {
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -s\n");
+          return PARSE_ERR;
+        }
+        if (durable_seen) {
+          fprintf(stderr, "duplicate -s\n");
+          return PARSE_ERR;
+        }
+
+        opt->durable = 1;
+        durable_seen = 1;
+        break;
+      }
+
+      case 'l': {
+        const char *v = NULL;
+
+        if (control_mode_selected) {
+          fprintf(stderr, "control mode does not accept -l\n");
+          return PARSE_ERR;
+        }
+        if (message_log_seen) {
+          fprintf(stderr, "duplicate -l\n");
+          return PARSE_ERR;
+        }
+        if (take_value(argc, argv, &i, "invalid message log path", &v) != 0) {
+          return PARSE_ERR;
+        }
+
+        opt->message_log_path = v;
+        message_log_seen = 1;
+        break;
+      }
+
       case 'p': {
         const char *v = NULL;
         if (control_mode_selected) {
@@ -298,6 +568,58 @@ parse_result_t parse_args(int argc, char **argv, Opt *opt) {
     return PARSE_ERR;
   }
 
+  if (channel_seen && client_action != 'm' && client_action != 'b') {
+    fprintf(stderr, "-n requires -m or -b\n");
+    return PARSE_ERR;
+  }
+
+  if (stream_name_seen &&
+      (client_action != 'c' || opt->path_count != 1 || strcmp(opt->path, "-") != 0)) {
+    fprintf(stderr, "-N requires -c -\n");
+    return PARSE_ERR;
+  }
+
+  if (stream_name_seen && jobs_seen) {
+    fprintf(stderr, "-N does not accept -j\n");
+    return PARSE_ERR;
+  }
+
+  if (jobs_seen && client_action != 'c' && !sync_selected) {
+    fprintf(stderr, "-j requires -c or sync\n");
+    return PARSE_ERR;
+  }
+
+  if (checksum_seen && !sync_selected) {
+    fprintf(stderr, "-k requires sync\n");
+    return PARSE_ERR;
+  }
+
+  if (json_seen && client_action != 'c' && client_action != 'g' && !sync_selected) {
+    fprintf(stderr, "-J requires -c, -g or sync\n");
+    return PARSE_ERR;
+  }
+
+  if ((rate_seen || global_rate_seen) && !server_selected && client_action != 'c' &&
+      client_action != 'g' && !sync_selected) {
+    fprintf(stderr, "-%c requires -d, -c, -g or sync\n", rate_seen ? 'r' : 'R');
+    return PARSE_ERR;
+  }
+
+  if (mime_seen && client_action != 'b') {
+    fprintf(stderr, "-t requires -b\n");
+    return PARSE_ERR;
+  }
+
+  if (durable_seen && !server_selected) {
+    fprintf(stderr, "-s requires -d\n");
+    return PARSE_ERR;
+  }
+
+  if (message_log_seen && !server_selected) {
+    fprintf(stderr, "-l requires -d\n");
+    return PARSE_ERR;
+  }
+
   if (!server_selected && client_actions == 0 && !control_mode_selected) {
     return PARSE_ERR;
   }
@@ -307,21 +629,31 @@ parse_result_t parse_args(int argc, char **argv, Opt *opt) {
     return PARSE_ERR;
   }
 
+  if (sync_selected && client_actions > 1) {
+    fprintf(stderr, "sync does not accept -%c\n", client_action);
+    return PARSE_ERR;
+  }
+
   if (client_actions > 1) {
-    fprintf(stderr, "must choose exactly one client action: -c, -g, or -m\n");
+    fprintf(stderr, "must choose exactly one client action: -c, -g, -m, or -b\n");
     return PARSE_ERR;
   }
 
-  if (!control_mode_selected) {
+  if (sync_selected) {
+    opt->mode = sync_mode;
+  } else if (!control_mode_selected) {
     opt->mode = server_selected ? server_mode : client_mode;
   }
   if (opt->mode == server_mode && opt->path == NULL) return PARSE_ERR;
-  if (opt->mode == client_mode && client_action == 'c' && opt->path == NULL) return PARSE_ERR;
+  if (opt->mode == client_mode && (client_action == 'c' || client_action == 'b') &&
+      opt->path == NULL) {
+    return PARSE_ERR;
+  }
   if (opt->mode == client_mode && client_action == 'g' && opt->remote_path == NULL) return PARSE_ERR;
   if (opt->mode == client_mode && client_action == 'm' && opt->message == NULL) {
     return PARSE_ERR;
   }
-  if (ip_seen && opt->mode != client_mode) {
+  if (ip_seen && opt->mode != client_mode && opt->mode != sync_mode) {
     fprintf(stderr, "%s mode does not accept -i\n",
             opt->mode == server_mode ? "server" : "control");
     return PARSE_ERR;
@@ -1,8 +1,11 @@
 #ifndef HF_CLI_H
 #define HF_CLI_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#define HF_CLIENT_MAX_JOBS 64u
+
 typedef enum {
   PARSE_OK,
   PARSE_HELP,
@@ -14,24 +17,49 @@ typedef enum {
   client_mode,
   status_mode,
   stop_mode,
+  sync_mode,
 } Mode;
 
 typedef struct {
   Mode mode;
   const char *path;
+  // -c: path is paths[0]; each one may be a glob, or "-" for a list on stdin.
+  const char *const *paths;
+  size_t path_count;
+  const char *stream_name;  // -c - -N: stdin is the file's content, not a list
+  unsigned jobs;
+  int checksum;  // sync: compare content hashes instead of mtimes
+  int json;      // print a JSON transfer summary on stdout
+  // Bytes per second for each transfer and across all of them; 0 is unlimited.
+  uint64_t rate_limit;
+  uint64_t global_rate_limit;
   const char *remote_path;
   const char *output_path;
   const char *message;
+  const char *channel;
+  const char *mime;
   const char *ip;
   uint16_t port;
   uint8_t msg_type;
+  int durable;
+  const char *message_log_path;
 } Opt;
 
 typedef struct {
   const char *path;
+  const char *const *paths;
+  size_t path_count;
+  const char *stream_name;
+  unsigned jobs;
+  int checksum;
+  int json;
+  uint64_t rate_limit;
+  uint64_t global_rate_limit;
   const char *remote_path;
   const char *output_path;
   const char *message;
+  const char *channel;
+  const char *mime;
   const char *ip;
   uint16_t port;
   uint8_t msg_type;
@@ -42,6 +70,10 @@ typedef struct {
   const char *path;
   uint16_t port;
   long pid;
+  uint64_t rate_limit;
+  uint64_t global_rate_limit;
+  int durable;
+  const char *message_log_path;
 } server_opt_t;
 
 
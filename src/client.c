@@ -3,9 +3,12 @@
 #include "fs.h"
 #include "net.h"
 #include "protocol.h"
+#include "rate_limit.h"
+#include "sha1.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,13 +17,28 @@
 #include <sys/stat.h>
 
 #ifdef _WIN32
+  #include <io.h>
   #include <process.h>
+  #include <windows.h>
 #else
+  #include <glob.h>
+  #include <pthread.h>
   #include <sys/time.h>
+  #include <time.h>
   #include <unistd.h>
 #endif
 
 #define CLIENT_SOCKET_TIMEOUT_MS 30000u
+#define CLIENT_DEFAULT_JOBS 4u
+#define CLIENT_PROGRESS_INTERVAL_MS 200u
+#define CLIENT_PROGRESS_POLL_MS 20u
+#define CLIENT_STREAM_PIPE_SIZE (1024u * 1024u)
+#define CLIENT_STREAM_READ_SIZE (1024u * 1024u)
+#ifdef _WIN32
+  #define CLIENT_STDIN_FD 0
+#else
+  #define CLIENT_STDIN_FD STDIN_FILENO
+#endif
 
 static const char *client_protocol_result_name(protocol_result_t res) {
   switch (res) {
@@ -204,6 +222,7 @@ static int client_set_socket_timeouts(socket_t sock, uint32_t timeout_ms) {
 
 static int client_send_header_payload(socket_t sock,
                                       uint8_t msg_type,
+                                      uint8_t flags,
                                       uint64_t payload_size,
                                       const uint8_t *payload,
                                       size_t payload_len,
@@ -216,7 +235,7 @@ static int client_send_header_payload(socket_t sock,
 
   init_header(&header);
   header.msg_type = msg_type;
-  header.flags = HF_MSG_FLAG_NONE;
+  header.flags = flags;
   header.payload_size = payload_size;
 
   proto_res = encode_header(&header, header_buf);
@@ -296,7 +315,8 @@ static int client_connect(const char *ip, uint16_t port, socket_t *sock_out) {
   return 0;
 }
 
-static int client_get_file_size(int in, uint64_t *content_size_out) {
+// mtime_out may be NULL.
+static int client_get_file_size(int in, uint64_t *content_size_out, uint64_t *mtime_out) {
 #ifdef _WIN32
   struct _stat64 st;
 #else
@@ -328,12 +348,252 @@ static int client_get_file_size(int in, uint64_t *content_size_out) {
   }
 
   *content_size_out = (uint64_t)st.st_size;
+  if (mtime_out != NULL) {
+    *mtime_out = (uint64_t)st.st_mtime;
+  }
   return 0;
 }
 
-static int client_send_file_body(int in, socket_t sock, uint64_t content_size) {
+#ifdef _WIN32
+typedef HANDLE client_thread_t;
+typedef unsigned(__stdcall *client_thread_fn)(void *);
+#else
+typedef pthread_t client_thread_t;
+typedef void *(*client_thread_fn)(void *);
+#endif
+
+static int client_start_thread(client_thread_fn fn, void *arg, client_thread_t *thread) {
+#ifdef _WIN32
+  uintptr_t handle = _beginthreadex(NULL, 0, fn, arg, 0, NULL);
+  if (handle == 0) {
+    return 1;
+  }
+  *thread = (HANDLE)handle;
+  return 0;
+#else
+  return pthread_create(thread, NULL, fn, arg) == 0 ? 0 : 1;
+#endif
+}
+
+static void client_join_thread(client_thread_t thread) {
+#ifdef _WIN32
+  (void)WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  (void)pthread_join(thread, NULL);
+#endif
+}
+
+static uint64_t client_now_us(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  (void)QueryPerformanceFrequency(&freq);
+  (void)QueryPerformanceCounter(&now);
+  return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000u +
+         (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000u / (uint64_t)freq.QuadPart;
+#else
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+#endif
+}
+
+static uint64_t client_load_u64(volatile uint64_t *value) {
+#ifdef _WIN32
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)value, 0, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+static void client_add_u64(volatile uint64_t *value, uint64_t delta) {
+#ifdef _WIN32
+  (void)InterlockedExchangeAdd64((volatile LONG64 *)value, (LONG64)delta);
+#else
+  (void)__atomic_fetch_add(value, delta, __ATOMIC_RELAXED);
+#endif
+}
+
+static double client_mib_per_s(uint64_t bytes, uint64_t elapsed_us) {
+  if (elapsed_us == 0) {
+    return 0.0;
+  }
+  return (double)bytes / (1024.0 * 1024.0) / ((double)elapsed_us / 1000000.0);
+}
+
+// Where one transfer spent its time, in microseconds. ready covers sending
+// the request until READY (and, for a get, the file prefix) arrives.
+typedef struct {
+  uint64_t connect_us;
+  uint64_t ready_us;
+  uint64_t body_us;
+  uint64_t final_us;
+  uint64_t bytes;
+  net_transfer_t io;
+} client_timing_t;
+
+// Redraws one status line on stderr while transfers run, from the counter
+// the net layer bumps. Only started when stderr is a terminal.
+typedef struct {
+  volatile uint64_t bytes;
+  volatile uint64_t done;
+  uint64_t total;
+  uint64_t start_us;
+  uint64_t end_us;
+  int running;
+  client_thread_t thread;
+} client_progress_t;
+
+static int client_stderr_is_tty(void) {
+#ifdef _WIN32
+  return _isatty(_fileno(stderr));
+#else
+  return isatty(STDERR_FILENO);
+#endif
+}
+
+static void client_sleep_ms(uint32_t ms) {
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  struct timespec ts = {(time_t)(ms / 1000u), (long)(ms % 1000u) * 1000000L};
+  (void)nanosleep(&ts, NULL);
+#endif
+}
+
+static void client_progress_draw(client_progress_t *progress) {
+  uint64_t bytes = client_load_u64(&progress->bytes);
+  uint64_t elapsed_us =
+    (progress->end_us != 0 ? progress->end_us : client_now_us()) - progress->start_us;
+
+  // Streams have no total to measure against.
+  if (progress->total == 0) {
+    fprintf(stderr, "\r%.1f MiB %.2f MiB/s ", (double)bytes / (1024.0 * 1024.0),
+            client_mib_per_s(bytes, elapsed_us));
+  } else {
+    fprintf(stderr, "\r%.1f of %.1f MiB (%3.0f%%) %.2f MiB/s ",
+            (double)bytes / (1024.0 * 1024.0), (double)progress->total / (1024.0 * 1024.0),
+            100.0 * (double)bytes / (double)progress->total,
+            client_mib_per_s(bytes, elapsed_us));
+  }
+  fflush(stderr);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall client_progress_main(void *arg) {
+#else
+static void *client_progress_main(void *arg) {
+#endif
+  client_progress_t *progress = (client_progress_t *)arg;
+  uint32_t waited_ms = CLIENT_PROGRESS_INTERVAL_MS;
+
+  while (client_load_u64(&progress->done) == 0) {
+    if (waited_ms >= CLIENT_PROGRESS_INTERVAL_MS) {
+      client_progress_draw(progress);
+      waited_ms = 0;
+    }
+    client_sleep_ms(CLIENT_PROGRESS_POLL_MS);
+    waited_ms += CLIENT_PROGRESS_POLL_MS;
+  }
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static void client_progress_start(client_progress_t *progress, uint64_t total) {
+  progress->bytes = 0;
+  progress->done = 0;
+  progress->total = total;
+  progress->start_us = client_now_us();
+  progress->end_us = 0;
+  progress->running = client_stderr_is_tty() &&
+                      client_start_thread(client_progress_main, progress,
+                                          &progress->thread) == 0;
+}
+
+static void client_progress_stop(client_progress_t *progress) {
+  if (!progress->running) {
+    return;
+  }
+  progress->end_us = client_now_us();
+#ifdef _WIN32
+  (void)InterlockedExchange64((volatile LONG64 *)&progress->done, 1);
+#else
+  __atomic_store_n(&progress->done, 1u, __ATOMIC_RELAXED);
+#endif
+  client_join_thread(progress->thread);
+  progress->running = 0;
+  client_progress_draw(progress);
+  fputc('\n', stderr);
+}
+
+static void client_json_string(const char *s) {
+  putchar('"');
+  for (const unsigned char *p = (const unsigned char *)s; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\') {
+      printf("\\%c", *p);
+    } else if (*p < 0x20u) {
+      printf("\\u%04x", (unsigned)*p);
+    } else {
+      putchar(*p);
+    }
+  }
+  putchar('"');
+}
+
+// The fields shared by every transfer summary, without the braces.
+static void client_json_timing(const char *path, int ok, const client_timing_t *timing) {
+  uint64_t total_us = timing->connect_us + timing->ready_us + timing->body_us +
+                      timing->final_us;
+
+  printf("\"path\":");
+  client_json_string(path);
+  printf(",\"ok\":%s,\"bytes\":%" PRIu64 ",\"io_path\":\"%s\","
+         "\"connect_ms\":%.3f,\"ready_ms\":%.3f,\"body_ms\":%.3f,\"final_ms\":%.3f,"
+         "\"total_ms\":%.3f,\"mib_per_s\":%.2f,\"body_mib_per_s\":%.2f",
+         ok ? "true" : "false", timing->bytes, net_io_path_name(timing->io.path),
+         (double)timing->connect_us / 1000.0, (double)timing->ready_us / 1000.0,
+         (double)timing->body_us / 1000.0, (double)timing->final_us / 1000.0,
+         (double)total_us / 1000.0, client_mib_per_s(timing->bytes, total_us),
+         client_mib_per_s(timing->bytes, timing->body_us));
+}
+
+static void client_json_transfer(const char *op, const char *path, int ok,
+                                 const client_timing_t *timing) {
+  printf("{\"op\":\"%s\",", op);
+  client_json_timing(path, ok, timing);
+  printf("}\n");
+}
+
+// Paces one body under -r, drawing from global (-R) as well when it is set.
+static int client_pace_open(const client_opt_t *opt, rate_limit_t *global,
+                            rate_limit_t *limit, net_transfer_t *io) {
+  io->limit = NULL;
+  if (opt->rate_limit == 0 && !rate_limit_active(global)) {
+    return 0;
+  }
+  if (rate_limit_init(limit, opt->rate_limit, global) != 0) {
+    fprintf(stderr, "failed to initialize rate limit\n");
+    return 1;
+  }
+  io->limit = limit;
+  return 0;
+}
+
+static void client_pace_close(rate_limit_t *limit, net_transfer_t *io) {
+  if (io->limit != NULL) {
+    rate_limit_destroy(limit);
+    io->limit = NULL;
+  }
+}
+
+static int client_send_file_body(int in, socket_t sock, uint64_t content_size,
+                                 net_transfer_t *io) {
   net_send_file_result_t send_file_res =
-    net_send_file_best_effort(sock, in, content_size);
+    net_send_file_tracked(sock, in, content_size, io);
   if (send_file_res == NET_SEND_FILE_OK) {
     return 0;
   }
@@ -382,9 +642,10 @@ static int client_open_temp_download(const char *final_path,
   return 1;
 }
 
-static int client_recv_file_body(socket_t sock, int out_fd, uint64_t content_size) {
+static int client_recv_file_body(socket_t sock, int out_fd, uint64_t content_size,
+                                 net_transfer_t *io) {
   net_recv_file_result_t recv_res =
-    net_recv_file_best_effort(sock, out_fd, content_size);
+    net_recv_file_tracked(sock, out_fd, content_size, 0, io);
   if (recv_res == NET_RECV_FILE_OK) {
     return 0;
   }
@@ -393,6 +654,8 @@ static int client_recv_file_body(socket_t sock, int out_fd, uint64_t content_siz
     fprintf(stderr, "server closed connection while sending file body\n");
   } else if (recv_res == NET_RECV_FILE_INVALID_ARGUMENT) {
     fprintf(stderr, "invalid download arguments\n");
+  } else if (recv_res == NET_RECV_FILE_DISK_IO) {
+    perror("write(file_body)");
   } else {
     sock_perror("recv(file_body)");
   }
@@ -400,17 +663,25 @@ static int client_recv_file_body(socket_t sock, int out_fd, uint64_t content_siz
   return 1;
 }
 
-static int client_send_file_raw(const client_opt_t *opt) {
+// With remote_path the file lands at that path below the receive dir and keeps
+// its mtime; otherwise it is named after its basename. progress, when set,
+// is run over the body, and global_rate is the bucket shared under -R.
+static int client_send_file_raw(const client_opt_t *opt, const char *source_path,
+                                const char *remote_path, client_timing_t *timing,
+                                client_progress_t *progress, rate_limit_t *global_rate) {
   int exit_code = 0;
   int in = -1;
   socket_t sock;
   socket_init(&sock);
-  const char *path = opt->path;
-  const char *file_name = NULL;
+  const char *path = source_path;
+  const char *file_name = remote_path;
   uint16_t file_name_len = 0;
   uint64_t content_size = 0;
+  uint64_t mtime = 0;
+  uint64_t phase_start = 0;
+  rate_limit_t limit;
 
-  if (fs_basename_from_path(&path, &file_name) != 0) {
+  if (file_name == NULL && fs_basename_from_path(&path, &file_name) != 0) {
     fprintf(stderr, "invalid client path\n");
     exit_code = 1;
     goto CLEAN_UP;
@@ -439,7 +710,7 @@ static int client_send_file_raw(const client_opt_t *opt) {
     goto CLEAN_UP;
   }
 
-  if (client_get_file_size(in, &content_size) != 0) {
+  if (client_get_file_size(in, &content_size, &mtime) != 0) {
     exit_code = 1;
     goto CLEAN_UP;
   }
@@ -449,16 +720,24 @@ static int client_send_file_raw(const client_opt_t *opt) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  timing->bytes = content_size;
 
+  phase_start = client_now_us();
   if (client_connect(opt->ip, opt->port, &sock) != 0) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  timing->connect_us = client_now_us() - phase_start;
+  phase_start += timing->connect_us;
 
-  uint64_t payload_size =
-    (uint64_t)proto_file_transfer_prefix_size(file_name_len) + content_size;
+  size_t file_prefix_size = proto_file_transfer_prefix_size(file_name_len);
+  if (remote_path != NULL) {
+    file_prefix_size += sizeof(uint64_t);
+  }
+  uint64_t payload_size = (uint64_t)file_prefix_size + content_size;
 
-  uint8_t file_prefix_buf[sizeof(uint16_t) + HF_PROTOCOL_MAX_FILE_NAME_LEN + sizeof(uint64_t)];
+  uint8_t file_prefix_buf[sizeof(uint16_t) + HF_PROTOCOL_MAX_FILE_NAME_LEN +
+                          2u * sizeof(uint64_t)];
   protocol_result_t proto_res = encode_file_prefix(file_name, content_size,
                                                    file_prefix_buf);
   if (proto_res != PROTOCOL_OK) {
@@ -466,11 +745,13 @@ static int client_send_file_raw(const client_opt_t *opt) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  if (remote_path != NULL) {
+    encode_u64_be(mtime, file_prefix_buf + file_prefix_size - sizeof(uint64_t));
+  }
 
-
-  size_t file_prefix_size = proto_file_transfer_prefix_size(file_name_len);
-  if (client_send_header_payload(sock, opt->msg_type, payload_size,
-                                 file_prefix_buf, file_prefix_size,
+  if (client_send_header_payload(sock, HF_MSG_TYPE_SEND_FILE,
+                                 remote_path != NULL ? HF_MSG_FLAG_SYNC : HF_MSG_FLAG_NONE,
+                                 payload_size, file_prefix_buf, file_prefix_size,
                                  "send(file_preamble)") != 0) {
     exit_code = 1;
     goto CLEAN_UP;
@@ -481,19 +762,38 @@ static int client_send_file_raw(const client_opt_t *opt) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  timing->ready_us = client_now_us() - phase_start;
+  phase_start += timing->ready_us;
 
-  if (client_send_file_body(in, sock, content_size) != 0) {
+  if (client_pace_open(opt, global_rate, &limit, &timing->io) != 0) {
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  if (progress != NULL) {
+    client_progress_start(progress, content_size);
+  }
+  if (client_send_file_body(in, sock, content_size, &timing->io) != 0) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  if (progress != NULL) {
+    client_progress_stop(progress);
+  }
+  timing->body_us = client_now_us() - phase_start;
+  phase_start += timing->body_us;
 
   client_shutdown_write(sock);
   if (client_recv_checked_response(sock, PROTO_PHASE_FINAL, "transfer", &r_f) != 0) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  timing->final_us = client_now_us() - phase_start;
 
 CLEAN_UP:
+  if (progress != NULL) {
+    client_progress_stop(progress);
+  }
+  client_pace_close(&limit, &timing->io);
   socket_close(sock);
   if (in != -1) {
     fs_close(in);
@@ -502,12 +802,551 @@ CLEAN_UP:
   return exit_code;
 }
 
+static int client_send_file(const client_opt_t *opt) {
+  client_progress_t progress = {0};
+  client_timing_t timing = {0};
+  rate_limit_t global_rate;
+  int exit_code = 0;
+
+  if (rate_limit_init(&global_rate, opt->global_rate_limit, NULL) != 0) {
+    fprintf(stderr, "failed to initialize rate limit\n");
+    return 1;
+  }
+  timing.io.progress = &progress.bytes;
+  exit_code = client_send_file_raw(opt, opt->path, NULL, &timing, &progress, &global_rate);
+  if (opt->json) {
+    client_json_transfer("send", opt->path, exit_code == 0, &timing);
+  }
+  rate_limit_destroy(&global_rate);
+  return exit_code;
+}
+
+typedef struct {
+  char *path;
+  char *remote_path;  // sync only
+  uint64_t size;
+  int failed;
+  client_timing_t timing;
+} client_batch_file_t;
+
+// Workers claim files by bumping next; each entry is only written by the
+// worker that claimed it, and read once they have all been joined.
+typedef struct {
+  const client_opt_t *opt;
+  client_batch_file_t *files;
+  size_t count;
+  size_t cap;
+  int sync;
+  size_t scanned;  // sync: local files compared against the server
+  volatile uint64_t next;
+  client_progress_t progress;
+  rate_limit_t global_rate;
+} client_batch_t;
+
+static int client_batch_add(client_batch_t *batch, const char *path,
+                            const char *remote_path) {
+  client_batch_file_t *file = NULL;
+  size_t len = strlen(path);
+
+  if (batch->count == batch->cap) {
+    size_t cap = batch->cap == 0 ? 64u : batch->cap * 2u;
+    client_batch_file_t *files =
+      (client_batch_file_t *)realloc(batch->files, cap * sizeof(*files));
+    if (files == NULL) {
+      perror("realloc(batch)");
+      return 1;
+    }
+    batch->files = files;
+    batch->cap = cap;
+  }
+  file = &batch->files[batch->count];
+  memset(file, 0, sizeof(*file));
+  file->path = (char *)malloc(len + 1u);
+  if (file->path == NULL) {
+    perror("malloc(batch_path)");
+    return 1;
+  }
+  memcpy(file->path, path, len + 1u);
+  batch->count++;
+  if (remote_path != NULL) {
+    len = strlen(remote_path);
+    file->remote_path = (char *)malloc(len + 1u);
+    if (file->remote_path == NULL) {
+      perror("malloc(batch_path)");
+      return 1;
+    }
+    memcpy(file->remote_path, remote_path, len + 1u);
+  }
+  return 0;
+}
+
+static int client_has_glob_chars(const char *s) {
+  return strpbrk(s, "*?[") != NULL;
+}
+
+// A pattern that matches nothing is kept as is and fails like a missing file.
+static int client_batch_add_pattern(client_batch_t *batch, const char *pattern) {
+  if (!client_has_glob_chars(pattern)) {
+    return client_batch_add(batch, pattern, NULL);
+  }
+#ifdef _WIN32
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA(pattern, &data);
+  const char *base = pattern;
+  char path[4096];
+
+  for (const char *p = pattern; *p != '\0'; p++) {
+    if (*p == '/' || *p == '\\') {
+      base = p + 1;
+    }
+  }
+  if (find == INVALID_HANDLE_VALUE) {
+    return client_batch_add(batch, pattern, NULL);
+  }
+  do {
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+      continue;
+    }
+    int n = snprintf(path, sizeof(path), "%.*s%s", (int)(base - pattern), pattern,
+                     data.cFileName);
+    if (n < 0 || (size_t)n >= sizeof(path) || client_batch_add(batch, path, NULL) != 0) {
+      FindClose(find);
+      return 1;
+    }
+  } while (FindNextFileA(find, &data));
+  FindClose(find);
+  return 0;
+#else
+  glob_t matches;
+  int rc = glob(pattern, 0, NULL, &matches);
+  int exit_code = 0;
+
+  if (rc == GLOB_NOMATCH) {
+    return client_batch_add(batch, pattern, NULL);
+  }
+  if (rc != 0) {
+    fprintf(stderr, "glob failed: %s\n", pattern);
+    return 1;
+  }
+  for (size_t i = 0; i < matches.gl_pathc && exit_code == 0; i++) {
+    exit_code = client_batch_add(batch, matches.gl_pathv[i], NULL);
+  }
+  globfree(&matches);
+  return exit_code;
+#endif
+}
+
+static int client_batch_add_stdin(client_batch_t *batch) {
+  char line[4096];
+
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1u] == '\n' || line[len - 1u] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len > 0 && client_batch_add_pattern(batch, line) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int client_batch_file_cmp(const void *lhs, const void *rhs) {
+  const client_batch_file_t *a = (const client_batch_file_t *)lhs;
+  const client_batch_file_t *b = (const client_batch_file_t *)rhs;
+
+  if (a->size != b->size) {
+    return a->size > b->size ? -1 : 1;
+  }
+  return strcmp(a->path, b->path);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall client_batch_worker(void *arg) {
+#else
+static void *client_batch_worker(void *arg) {
+#endif
+  client_batch_t *batch = (client_batch_t *)arg;
+
+  for (;;) {
+#ifdef _WIN32
+    uint64_t index =
+      (uint64_t)InterlockedIncrement64((volatile LONG64 *)&batch->next) - 1u;
+#else
+    uint64_t index = __atomic_fetch_add(&batch->next, 1u, __ATOMIC_RELAXED);
+#endif
+    if (index >= batch->count) {
+      break;
+    }
+    batch->files[index].timing.io.progress = &batch->progress.bytes;
+    batch->files[index].failed =
+      client_send_file_raw(batch->opt, batch->files[index].path,
+                           batch->files[index].remote_path,
+                           &batch->files[index].timing, NULL,
+                           &batch->global_rate) != 0;
+  }
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static void client_batch_free(client_batch_t *batch) {
+  for (size_t i = 0; i < batch->count; i++) {
+    free(batch->files[i].path);
+    free(batch->files[i].remote_path);
+  }
+  free(batch->files);
+}
+
+static void client_batch_json(const client_batch_t *batch, size_t sent, uint64_t sent_bytes,
+                              uint64_t elapsed_us, size_t connections) {
+  client_timing_t sum = {0};
+
+  for (size_t i = 0; i < batch->count; i++) {
+    sum.connect_us += batch->files[i].timing.connect_us;
+    sum.ready_us += batch->files[i].timing.ready_us;
+    sum.body_us += batch->files[i].timing.body_us;
+    sum.final_us += batch->files[i].timing.final_us;
+  }
+  printf("{\"op\":\"%s\",\"ok\":%s,", batch->sync ? "sync" : "send",
+         sent == batch->count ? "true" : "false");
+  if (batch->sync) {
+    printf("\"scanned\":%zu,", batch->scanned);
+  }
+  printf("\"files\":%zu,\"sent\":%zu,\"bytes\":%" PRIu64 ",\"elapsed_ms\":%.3f,"
+         "\"mib_per_s\":%.2f,\"connections\":%zu,\"phase_ms\":{\"connect\":%.3f,"
+         "\"ready\":%.3f,\"body\":%.3f,\"final\":%.3f},\"transfers\":[",
+         batch->count, sent, sent_bytes, (double)elapsed_us / 1000.0,
+         client_mib_per_s(sent_bytes, elapsed_us), connections,
+         (double)sum.connect_us / 1000.0, (double)sum.ready_us / 1000.0,
+         (double)sum.body_us / 1000.0, (double)sum.final_us / 1000.0);
+  for (size_t i = 0; i < batch->count; i++) {
+    printf("%s{", i > 0 ? "," : "");
+    client_json_timing(batch->files[i].path, !batch->files[i].failed,
+                       &batch->files[i].timing);
+    putchar('}');
+  }
+  printf("]}\n");
+}
+
+// The largest files go first, so the pool does not end waiting on one big
+// straggler. phase_ms in the JSON summary adds up every connection, so it
+// shows where the time goes rather than the wall clock.
+static int client_run_batch(client_batch_t *batch) {
+  client_thread_t threads[HF_CLIENT_MAX_JOBS];
+  size_t started = 0;
+  size_t jobs = batch->opt->jobs != 0 ? batch->opt->jobs : CLIENT_DEFAULT_JOBS;
+  uint64_t total_bytes = 0;
+  uint64_t sent_bytes = 0;
+  size_t sent = 0;
+  size_t failed = 0;
+  uint64_t start_us = 0;
+  uint64_t elapsed_us = 0;
+
+  for (size_t i = 0; i < batch->count; i++) {
+    fs_path_info_t info = {0};
+    if (fs_stat_path(batch->files[i].path, &info) == 0 && info.kind == FS_PATH_KIND_FILE) {
+      batch->files[i].size = info.size;
+      total_bytes += info.size;
+    }
+  }
+  qsort(batch->files, batch->count, sizeof(*batch->files), client_batch_file_cmp);
+
+  if (jobs > batch->count) {
+    jobs = batch->count;
+  }
+  if (rate_limit_init(&batch->global_rate, batch->opt->global_rate_limit, NULL) != 0) {
+    fprintf(stderr, "failed to initialize rate limit\n");
+    return 1;
+  }
+  client_progress_start(&batch->progress, total_bytes);
+  start_us = client_now_us();
+  while (started < jobs &&
+         client_start_thread(client_batch_worker, batch, &threads[started]) == 0) {
+    started++;
+  }
+  if (started == 0) {
+    (void)client_batch_worker(batch);
+  }
+  for (size_t i = 0; i < started; i++) {
+    client_join_thread(threads[i]);
+  }
+  elapsed_us = client_now_us() - start_us;
+  client_progress_stop(&batch->progress);
+  rate_limit_destroy(&batch->global_rate);
+
+  for (size_t i = 0; i < batch->count; i++) {
+    if (batch->files[i].failed) {
+      fprintf(stderr, "failed: %s\n", batch->files[i].path);
+      failed++;
+    } else {
+      sent_bytes += batch->files[i].size;
+      sent++;
+    }
+  }
+  if (batch->opt->json) {
+    client_batch_json(batch, sent, sent_bytes, elapsed_us, started > 0 ? started : 1u);
+  } else {
+    printf("sent %zu of %zu files, %" PRIu64 " bytes in %.3fs (%.2f MiB/s, %zu connection%s)\n",
+           sent, batch->count, sent_bytes, (double)elapsed_us / 1000000.0,
+           client_mib_per_s(sent_bytes, elapsed_us), started > 0 ? started : 1u,
+           started > 1 ? "s" : "");
+  }
+  return failed == 0 ? 0 : 1;
+}
+
+static int client_send_stream_chunk_len(socket_t sock, uint64_t len) {
+  uint8_t buf[4];
+
+  buf[0] = (uint8_t)(len >> 24);
+  buf[1] = (uint8_t)(len >> 16);
+  buf[2] = (uint8_t)(len >> 8);
+  buf[3] = (uint8_t)len;
+  if (send_all(sock, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+    sock_perror("send(stream_chunk)");
+    return 1;
+  }
+  return 0;
+}
+
+// HF_STREAM_KEEPALIVE_MS lets tests pause a producer for less than a full
+// interval.
+static uint32_t client_stream_keepalive_ms(void) {
+  const char *value = getenv("HF_STREAM_KEEPALIVE_MS");
+  char *end = NULL;
+  unsigned long parsed = 0;
+
+  if (value == NULL || value[0] == '\0') {
+    return HF_PROTOCOL_STREAM_KEEPALIVE_MS;
+  }
+  parsed = strtoul(value, &end, 10);
+  if (*end != '\0' || parsed == 0 || parsed > HF_PROTOCOL_STREAM_KEEPALIVE_MS) {
+    return HF_PROTOCOL_STREAM_KEEPALIVE_MS;
+  }
+  return (uint32_t)parsed;
+}
+
+// Sends stdin under opt->stream_name without knowing its length. A pipe is
+// spliced to the socket one chunk per batch of queued bytes; anything else
+// is read and copied.
+static int client_send_stream(const client_opt_t *opt) {
+  int exit_code = 1;
+  socket_t sock;
+  uint16_t name_len = 0;
+  uint8_t prefix[sizeof(uint16_t) + HF_PROTOCOL_MAX_FILE_NAME_LEN + sizeof(uint64_t)];
+  size_t prefix_size = 0;
+  client_progress_t progress = {0};
+  client_timing_t timing = {0};
+  rate_limit_t global_rate;
+  rate_limit_t limit;
+  int global_rate_ready = 0;
+  char *buf = NULL;
+  int use_pipe = 0;
+  uint32_t keepalive_ms = client_stream_keepalive_ms();
+  uint64_t phase_start = 0;
+  res_frame_t r_f = {0};
+
+  socket_init(&sock);
+  if (fs_validate_file_name(opt->stream_name) != 0 ||
+      proto_get_file_name_len(opt->stream_name, &name_len) != 0) {
+    fprintf(stderr, "invalid stream name\n");
+    return 1;
+  }
+  prefix_size = proto_file_transfer_prefix_size(name_len);
+  if (encode_file_prefix(opt->stream_name, 0, prefix) != PROTOCOL_OK) {
+    fprintf(stderr, "failed to encode file_prefix\n");
+    return 1;
+  }
+#ifdef _WIN32
+  (void)_setmode(_fileno(stdin), _O_BINARY);
+#else
+  {
+    struct stat st;
+    use_pipe = fstat(CLIENT_STDIN_FD, &st) == 0 && S_ISFIFO(st.st_mode);
+  }
+  if (use_pipe) {
+    (void)net_pipe_grow(CLIENT_STDIN_FD, CLIENT_STREAM_PIPE_SIZE);
+  }
+#endif
+
+  if (rate_limit_init(&global_rate, opt->global_rate_limit, NULL) != 0) {
+    fprintf(stderr, "failed to initialize rate limit\n");
+    goto CLEAN_UP;
+  }
+  global_rate_ready = 1;
+
+  timing.io.progress = &progress.bytes;
+  phase_start = client_now_us();
+  if (client_connect(opt->ip, opt->port, &sock) != 0) {
+    goto CLEAN_UP;
+  }
+  timing.connect_us = client_now_us() - phase_start;
+  phase_start += timing.connect_us;
+
+  if (client_send_header_payload(sock, HF_MSG_TYPE_SEND_FILE, HF_MSG_FLAG_STREAM,
+                                 (uint64_t)prefix_size, prefix, prefix_size,
+                                 "send(stream_preamble)") != 0) {
+    goto CLEAN_UP;
+  }
+  if (client_recv_checked_response(sock, PROTO_PHASE_READY, "transfer", &r_f) != 0) {
+    goto CLEAN_UP;
+  }
+  timing.ready_us = client_now_us() - phase_start;
+  phase_start += timing.ready_us;
+
+  if (client_pace_open(opt, &global_rate, &limit, &timing.io) != 0) {
+    goto CLEAN_UP;
+  }
+  client_progress_start(&progress, 0);
+  for (;;) {
+    uint64_t len = 0;
+
+    if (use_pipe) {
+      net_send_file_result_t res =
+        net_pipe_wait(CLIENT_STDIN_FD, keepalive_ms, &len);
+      if (res == NET_SEND_FILE_TIMEOUT) {
+        if (client_send_stream_chunk_len(sock, HF_PROTOCOL_STREAM_KEEPALIVE) != 0) {
+          goto CLEAN_UP;
+        }
+        continue;
+      }
+      if (res == NET_SEND_FILE_UNSUPPORTED) {
+        use_pipe = 0;
+        continue;
+      }
+      if (res != NET_SEND_FILE_OK) {
+        perror("poll(stdin)");
+        goto CLEAN_UP;
+      }
+      if (len > HF_PROTOCOL_MAX_STREAM_CHUNK) {
+        len = HF_PROTOCOL_MAX_STREAM_CHUNK;
+      }
+    } else {
+      size_t want = CLIENT_STREAM_READ_SIZE;
+      ssize_t n = 0;
+      int ready = 0;
+
+      if (net_fd_wait_readable(CLIENT_STDIN_FD, keepalive_ms, &ready) != 0) {
+        perror("poll(stdin)");
+        goto CLEAN_UP;
+      }
+      if (!ready) {
+        if (client_send_stream_chunk_len(sock, HF_PROTOCOL_STREAM_KEEPALIVE) != 0) {
+          goto CLEAN_UP;
+        }
+        continue;
+      }
+      if (buf == NULL && (buf = (char *)malloc(CLIENT_STREAM_READ_SIZE)) == NULL) {
+        perror("malloc(stream_buffer)");
+        goto CLEAN_UP;
+      }
+      if (timing.io.limit != NULL) {
+        want = (size_t)rate_limit_acquire(timing.io.limit, want);
+      }
+      n = fs_read(CLIENT_STDIN_FD, buf, want);
+      if (timing.io.limit != NULL && (n < 0 || (size_t)n < want)) {
+        rate_limit_release(timing.io.limit, want - (n > 0 ? (size_t)n : 0u));
+      }
+      if (n < 0) {
+        perror("read(stdin)");
+        goto CLEAN_UP;
+      }
+      len = (uint64_t)n;
+    }
+    if (len == 0) {
+      break;
+    }
+    if (timing.bytes + len > HF_MAX_FILE_SIZE) {
+      fprintf(stderr, "MAX_FILE_SIZE is 100GB\n");
+      goto CLEAN_UP;
+    }
+    if (client_send_stream_chunk_len(sock, len) != 0) {
+      goto CLEAN_UP;
+    }
+    if (use_pipe) {
+      net_send_file_result_t res = net_send_pipe(sock, CLIENT_STDIN_FD, len, &timing.io);
+      if (res != NET_SEND_FILE_OK) {
+        if (res == NET_SEND_FILE_SOURCE_CHANGED) {
+          fprintf(stderr, "stdin ended early\n");
+        } else {
+          sock_perror("splice(stdin)");
+        }
+        goto CLEAN_UP;
+      }
+    } else {
+      if (send_all(sock, buf, (size_t)len) != (ssize_t)len) {
+        sock_perror("send(stream_chunk)");
+        goto CLEAN_UP;
+      }
+      timing.io.path = NET_IO_PATH_BUFFERED;
+      client_add_u64(&progress.bytes, len);
+    }
+    timing.bytes += len;
+  }
+  if (client_send_stream_chunk_len(sock, 0) != 0) {
+    goto CLEAN_UP;
+  }
+  client_progress_stop(&progress);
+  timing.body_us = client_now_us() - phase_start;
+  phase_start += timing.body_us;
+
+  client_shutdown_write(sock);
+  if (client_recv_checked_response(sock, PROTO_PHASE_FINAL, "transfer", &r_f) != 0) {
+    goto CLEAN_UP;
+  }
+  timing.final_us = client_now_us() - phase_start;
+  exit_code = 0;
+
+CLEAN_UP:
+  client_progress_stop(&progress);
+  client_pace_close(&limit, &timing.io);
+  if (global_rate_ready) {
+    rate_limit_destroy(&global_rate);
+  }
+  free(buf);
+  socket_close(sock);
+  if (opt->json) {
+    client_json_transfer("send", opt->stream_name, exit_code == 0, &timing);
+  }
+  return exit_code;
+}
+
+// Uploads every path, glob match and stdin line over a pool of connections.
+static int client_send_files(const client_opt_t *opt) {
+  client_batch_t batch = {.opt = opt};
+  int exit_code = 1;
+
+  for (size_t i = 0; i < opt->path_count; i++) {
+    int rc = strcmp(opt->paths[i], "-") == 0 ? client_batch_add_stdin(&batch)
+                                             : client_batch_add_pattern(&batch, opt->paths[i]);
+    if (rc != 0) {
+      goto CLEANUP;
+    }
+  }
+  if (batch.count == 0) {
+    fprintf(stderr, "no files to send\n");
+    goto CLEANUP;
+  }
+  exit_code = client_run_batch(&batch);
+
+CLEANUP:
+  client_batch_free(&batch);
+  return exit_code;
+}
+
 static int client_send_message(const client_opt_t *opt) {
   int exit_code = 0;
   socket_t sock;
   socket_init(&sock);
   const char *message = opt->message;
   size_t message_len = 0;
+  size_t channel_len = 0;
+  uint8_t *framed = NULL;
+  const uint8_t *payload = NULL;
+  size_t payload_len = 0;
+  uint8_t flags = HF_MSG_FLAG_NONE;
 
   message_len = strlen(message);
   if (message_len > HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE) {
@@ -515,15 +1354,37 @@ static int client_send_message(const client_opt_t *opt) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  if (opt->channel != NULL) {
+    channel_len = strlen(opt->channel);
+    if (channel_len == 0 || channel_len > HF_PROTOCOL_MAX_CHANNEL_NAME_LEN) {
+      fprintf(stderr, "invalid channel\n");
+      exit_code = 1;
+      goto CLEAN_UP;
+    }
+    payload_len = 1u + channel_len + message_len;
+    framed = (uint8_t *)malloc(payload_len);
+    if (framed == NULL) {
+      perror("malloc(message)");
+      exit_code = 1;
+      goto CLEAN_UP;
+    }
+    framed[0] = (uint8_t)channel_len;
+    memcpy(framed + 1, opt->channel, channel_len);
+    memcpy(framed + 1 + channel_len, message, message_len);
+    payload = framed;
+    flags = HF_MSG_FLAG_CHANNEL;
+  } else {
+    payload = (const uint8_t *)message;
+    payload_len = message_len;
+  }
 
   if (client_connect(opt->ip, opt->port, &sock) != 0) {
     exit_code = 1;
     goto CLEAN_UP;
   }
 
-  if (client_send_header_payload(sock, HF_MSG_TYPE_TEXT_MESSAGE,
-                                 (uint64_t)message_len,
-                                 (const uint8_t *)message, message_len,
+  if (client_send_header_payload(sock, HF_MSG_TYPE_TEXT_MESSAGE, flags,
+                                 (uint64_t)payload_len, payload, payload_len,
                                  "send(message)") != 0) {
     exit_code = 1;
     goto CLEAN_UP;
@@ -535,8 +1396,100 @@ static int client_send_message(const client_opt_t *opt) {
     goto CLEAN_UP;
   }
 
+CLEAN_UP:
+  free(framed);
+  socket_close(sock);
+  return exit_code;
+}
+
+static int client_send_binary_message(const client_opt_t *opt) {
+  int exit_code = 0;
+  int in = -1;
+  socket_t sock;
+  socket_init(&sock);
+  const char *mime = opt->mime != NULL ? opt->mime : "application/octet-stream";
+  size_t mime_len = strlen(mime);
+  size_t channel_len = 0;
+  uint8_t prefix[2u + HF_PROTOCOL_MAX_MIME_LEN + HF_PROTOCOL_MAX_CHANNEL_NAME_LEN];
+  size_t prefix_len = 0;
+  uint8_t flags = HF_MSG_FLAG_NONE;
+  uint64_t content_size = 0;
+
+  if (mime_len == 0 || mime_len > HF_PROTOCOL_MAX_MIME_LEN) {
+    fprintf(stderr, "invalid mime type\n");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  prefix[prefix_len++] = (uint8_t)mime_len;
+  memcpy(prefix + prefix_len, mime, mime_len);
+  prefix_len += mime_len;
+  if (opt->channel != NULL) {
+    channel_len = strlen(opt->channel);
+    if (channel_len == 0 || channel_len > HF_PROTOCOL_MAX_CHANNEL_NAME_LEN) {
+      fprintf(stderr, "invalid channel\n");
+      exit_code = 1;
+      goto CLEAN_UP;
+    }
+    prefix[prefix_len++] = (uint8_t)channel_len;
+    memcpy(prefix + prefix_len, opt->channel, channel_len);
+    prefix_len += channel_len;
+    flags = HF_MSG_FLAG_CHANNEL;
+  }
+
+#ifdef _WIN32
+  in = fs_open(opt->path, O_RDONLY | O_BINARY, 0);
+#else
+  in = fs_open(opt->path, O_RDONLY, 0);
+#endif
+  if (in == -1) {
+    perror("open");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  if (client_get_file_size(in, &content_size, NULL) != 0) {
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  if (content_size > HF_PROTOCOL_MAX_BINARY_MESSAGE_SIZE) {
+    fprintf(stderr, "binary message too large\n");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+
+  if (client_connect(opt->ip, opt->port, &sock) != 0) {
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+
+  if (client_send_header_payload(sock, HF_MSG_TYPE_BINARY_MESSAGE, flags,
+                                 (uint64_t)prefix_len + content_size, prefix, prefix_len,
+                                 "send(binary_message_preamble)") != 0) {
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+
+  res_frame_t r_f = {0};
+  if (client_recv_checked_response(sock, PROTO_PHASE_READY, "message", &r_f) != 0) {
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+
+  if (client_send_file_body(in, sock, content_size, NULL) != 0) {
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+
+  client_shutdown_write(sock);
+  if (client_recv_checked_response(sock, PROTO_PHASE_FINAL, "message", &r_f) != 0) {
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+
 CLEAN_UP:
   socket_close(sock);
+  if (in != -1) {
+    fs_close(in);
+  }
   return exit_code;
 }
 
@@ -552,6 +1505,12 @@ static int client_get_file(const client_opt_t *opt) {
   uint16_t remote_name_len = 0;
   char tmp_path[4096];
   protocol_result_t proto_res = PROTOCOL_OK;
+  client_progress_t progress = {0};
+  client_timing_t timing = {0};
+  uint64_t phase_start = 0;
+  rate_limit_t global_rate;
+  rate_limit_t limit;
+  int global_rate_ready = 0;
 
   tmp_path[0] = '\0';
 
@@ -564,9 +1523,21 @@ static int client_get_file(const client_opt_t *opt) {
     return 1;
   }
 
+  if (rate_limit_init(&global_rate, opt->global_rate_limit, NULL) != 0) {
+    fprintf(stderr, "failed to initialize rate limit\n");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  global_rate_ready = 1;
+
+  timing.io.progress = &progress.bytes;
+  phase_start = client_now_us();
   if (client_connect(opt->ip, opt->port, &sock) != 0) {
-    return 1;
+    exit_code = 1;
+    goto CLEAN_UP;
   }
+  timing.connect_us = client_now_us() - phase_start;
+  phase_start += timing.connect_us;
 
   {
     uint8_t request_buf[sizeof(uint16_t) + HF_PROTOCOL_MAX_FILE_NAME_LEN];
@@ -579,7 +1550,7 @@ static int client_get_file(const client_opt_t *opt) {
       goto CLEAN_UP;
     }
 
-    if (client_send_header_payload(sock, HF_MSG_TYPE_GET_FILE,
+    if (client_send_header_payload(sock, HF_MSG_TYPE_GET_FILE, HF_MSG_FLAG_NONE,
                                    (uint64_t)request_size,
                                    request_buf, request_size,
                                    "send(get_preamble)") != 0) {
@@ -606,6 +1577,9 @@ static int client_get_file(const client_opt_t *opt) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  timing.bytes = content_size;
+  timing.ready_us = client_now_us() - phase_start;
+  phase_start += timing.ready_us;
 
   if (output_path == NULL) {
     if (fs_validate_file_name(offered_name) != 0) {
@@ -622,10 +1596,16 @@ static int client_get_file(const client_opt_t *opt) {
     goto CLEAN_UP;
   }
 
-  if (client_recv_file_body(sock, out, content_size) != 0) {
+  if (client_pace_open(opt, &global_rate, &limit, &timing.io) != 0) {
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  client_progress_start(&progress, content_size);
+  if (client_recv_file_body(sock, out, content_size, &timing.io) != 0) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  client_progress_stop(&progress);
 
   if (fs_close(out) != 0) {
     perror("close(temp_download)");
@@ -634,11 +1614,14 @@ static int client_get_file(const client_opt_t *opt) {
     goto CLEAN_UP;
   }
   out = -1;
+  timing.body_us = client_now_us() - phase_start;
+  phase_start += timing.body_us;
 
   if (client_recv_checked_response(sock, PROTO_PHASE_FINAL, "get", NULL) != 0) {
     exit_code = 1;
     goto CLEAN_UP;
   }
+  timing.final_us = client_now_us() - phase_start;
 
   if (fs_commit_temp_file(tmp_path, output_path, NULL) != 0) {
     perror("rename(download)");
@@ -648,16 +1631,340 @@ static int client_get_file(const client_opt_t *opt) {
   tmp_path[0] = '\0';
 
 CLEAN_UP:
+  client_progress_stop(&progress);
+  client_pace_close(&limit, &timing.io);
+  if (global_rate_ready) {
+    rate_limit_destroy(&global_rate);
+  }
   if (out != -1) {
     fs_close(out);
   }
   if (tmp_path[0] != '\0') {
     fs_remove_ignore_error(tmp_path);
   }
+  socket_close(sock);
+  if (opt->json) {
+    client_json_transfer("get", output_path != NULL ? output_path : remote_path,
+                         exit_code == 0, &timing);
+  }
   if (offered_name != NULL) {
     free(offered_name);
   }
+  return exit_code;
+}
+
+typedef struct {
+  char *path;  // relative to the synced directory
+  uint64_t size;
+  uint64_t mtime;
+} client_sync_file_t;
+
+typedef struct {
+  client_sync_file_t *files;
+  size_t count;
+  size_t cap;
+} client_sync_list_t;
+
+typedef struct {
+  socket_t sock;
+  size_t pos;
+  size_t len;
+  uint8_t buf[64u * 1024u];
+} client_reader_t;
+
+static int client_sync_collect(const char *relative_path, const fs_path_info_t *info,
+                               void *ctx) {
+  client_sync_list_t *list = (client_sync_list_t *)ctx;
+  size_t len = strlen(relative_path);
+
+  if (list->count == list->cap) {
+    size_t cap = list->cap == 0 ? 256u : list->cap * 2u;
+    client_sync_file_t *files =
+      (client_sync_file_t *)realloc(list->files, cap * sizeof(*files));
+    if (files == NULL) {
+      errno = ENOMEM;
+      return 1;
+    }
+    list->files = files;
+    list->cap = cap;
+  }
+  list->files[list->count].path = (char *)malloc(len + 1u);
+  if (list->files[list->count].path == NULL) {
+    errno = ENOMEM;
+    return 1;
+  }
+  memcpy(list->files[list->count].path, relative_path, len + 1u);
+  list->files[list->count].size = info->size;
+  list->files[list->count].mtime = info->mtime;
+  list->count++;
+  return 0;
+}
+
+static int client_reader_read(client_reader_t *reader, void *out, size_t len) {
+  uint8_t *p = (uint8_t *)out;
+
+  while (len > 0) {
+    size_t take = 0;
+
+    if (reader->pos == reader->len) {
+#ifdef _WIN32
+      int n = recv(reader->sock, (char *)reader->buf, (int)sizeof(reader->buf), 0);
+      if (n == SOCKET_ERROR && WSAGetLastError() == WSAEINTR) {
+        continue;
+      }
+#else
+      ssize_t n = recv(reader->sock, reader->buf, sizeof(reader->buf), 0);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+#endif
+      if (n < 0) {
+        sock_perror("recv(list_files)");
+        return 1;
+      }
+      if (n == 0) {
+        fprintf(stderr, "server closed connection while listing files\n");
+        return 1;
+      }
+      reader->pos = 0;
+      reader->len = (size_t)n;
+    }
+    take = reader->len - reader->pos < len ? reader->len - reader->pos : len;
+    memcpy(p, reader->buf + reader->pos, take);
+    reader->pos += take;
+    p += take;
+    len -= take;
+  }
+  return 0;
+}
+
+// Resolves dir and names the server directory after its last component.
+static int client_sync_resolve(const char *dir, char **resolved_out, char *root,
+                               size_t root_cap) {
+  const char *path = NULL;
+  const char *name = NULL;
+  char *resolved = NULL;
+  uint16_t name_len = 0;
+#ifdef _WIN32
+  size_t len = 0;
+#endif
+
+#ifdef _WIN32
+  resolved = _fullpath(NULL, dir, 0);
+#else
+  resolved = realpath(dir, NULL);
+#endif
+  if (resolved == NULL) {
+    perror(dir);
+    return 1;
+  }
+#ifdef _WIN32
+  len = strlen(resolved);
+  while (len > 1u && (resolved[len - 1u] == '/' || resolved[len - 1u] == '\\')) {
+    resolved[--len] = '\0';
+  }
+#endif
+  path = resolved;
+  if (fs_basename_from_path(&path, &name) != 0 || fs_validate_file_name(name) != 0 ||
+      proto_get_file_name_len(name, &name_len) != 0 || (size_t)name_len >= root_cap) {
+    fprintf(stderr, "invalid sync directory\n");
+    free(resolved);
+    return 1;
+  }
+  memcpy(root, name, (size_t)name_len + 1u);
+  *resolved_out = resolved;
+  return 0;
+}
+
+static int client_sync_queue(client_batch_t *batch, const char *dir, const char *root,
+                             const client_sync_file_t *file) {
+  char local_path[4096];
+  char remote_path[4096];
+  int n = snprintf(remote_path, sizeof(remote_path), "%s/%s", root, file->path);
+
+  if (n < 0 || (size_t)n >= sizeof(remote_path) ||
+      fs_join_relative_path(local_path, sizeof(local_path), dir, file->path) != 0) {
+    fprintf(stderr, "path too long: %s\n", file->path);
+    return 1;
+  }
+  if (client_batch_add(batch, local_path, remote_path) != 0) {
+    return 1;
+  }
+  batch->files[batch->count - 1u].size = file->size;
+  return 0;
+}
+
+// Sizes decide first, then content hashes with -k and mtimes without.
+static int client_sync_changed(const client_opt_t *opt, const char *dir,
+                               const client_sync_file_t *file, uint64_t size,
+                               uint64_t mtime, const uint8_t *hash) {
+  char path[4096];
+  uint8_t local_hash[SHA1_DIGEST_SIZE];
+  int fd = -1;
+  int rc = 0;
+
+  if (file->size != size) {
+    return 1;
+  }
+  if (!opt->checksum) {
+    return file->mtime != mtime;
+  }
+  if (fs_join_relative_path(path, sizeof(path), dir, file->path) != 0) {
+    return 1;
+  }
+#ifdef _WIN32
+  fd = fs_open(path, O_RDONLY | O_BINARY, 0);
+#else
+  fd = fs_open(path, O_RDONLY, 0);
+#endif
+  if (fd == -1) {
+    return 1;
+  }
+  rc = sha1_fd(fd, local_hash);
+  fs_close(fd);
+  return rc != 0 || memcmp(local_hash, hash, SHA1_DIGEST_SIZE) != 0;
+}
+
+// Both listings come sorted by fs_path_cmp, so one merge pass over the local
+// list and the streamed remote one finds every new or changed file without
+// holding the remote listing in memory. Files only on the server are kept.
+int client_sync(const client_opt_t *opt) {
+  client_sync_list_t local = {0};
+  client_batch_t batch = {.opt = opt};
+  client_reader_t *reader = NULL;
+  socket_t sock;
+  char *dir = NULL;
+  char root[HF_PROTOCOL_MAX_FILE_NAME_LEN + 1u];
+  char remote[HF_PROTOCOL_MAX_PATH_LEN + 1u];
+  char prev[HF_PROTOCOL_MAX_PATH_LEN + 1u];
+  uint8_t request[sizeof(uint16_t) + HF_PROTOCOL_MAX_FILE_NAME_LEN];
+  uint8_t tail[2u * sizeof(uint64_t) + SHA1_DIGEST_SIZE];
+  size_t tail_len = 2u * sizeof(uint64_t) + (opt->checksum ? SHA1_DIGEST_SIZE : 0u);
+  size_t remote_count = 0;
+  size_t next = 0;
+  res_frame_t frame = {0};
+  int exit_code = 1;
+
+  socket_init(&sock);
+  if (client_sync_resolve(opt->path, &dir, root, sizeof(root)) != 0) {
+    goto CLEANUP;
+  }
+  if (fs_walk_files(dir, client_sync_collect, &local) != 0) {
+    perror(opt->path);
+    goto CLEANUP;
+  }
+  if (encode_file_name_only(root, request) != PROTOCOL_OK) {
+    fprintf(stderr, "invalid sync directory\n");
+    goto CLEANUP;
+  }
+
+  if (client_connect(opt->ip, opt->port, &sock) != 0) {
+    goto CLEANUP;
+  }
+  // Hashing one large file can keep the server quiet past the usual timeout.
+  if (opt->checksum && client_set_socket_timeouts(sock, 0) != 0) {
+    sock_perror("setsockopt(client_timeout)");
+    goto CLEANUP;
+  }
+  if (client_send_header_payload(sock, HF_MSG_TYPE_LIST_FILES,
+                                 opt->checksum ? HF_MSG_FLAG_HASH : HF_MSG_FLAG_NONE,
+                                 proto_file_name_only_size((uint16_t)strlen(root)), request,
+                                 proto_file_name_only_size((uint16_t)strlen(root)),
+                                 "send(list_request)") != 0) {
+    goto CLEANUP;
+  }
+  if (client_recv_checked_response(sock, PROTO_PHASE_READY, "list", NULL) != 0) {
+    goto CLEANUP;
+  }
+
+  reader = (client_reader_t *)malloc(sizeof(*reader));
+  if (reader == NULL) {
+    perror("malloc(reader)");
+    goto CLEANUP;
+  }
+  reader->sock = sock;
+  reader->pos = 0;
+  reader->len = 0;
+
+  for (;;) {
+    uint8_t len_buf[2];
+    size_t len = 0;
+
+    if (client_reader_read(reader, len_buf, sizeof(len_buf)) != 0) {
+      goto CLEANUP;
+    }
+    len = ((size_t)len_buf[0] << 8) | len_buf[1];
+    if (len == 0) {
+      break;
+    }
+    if (len > HF_PROTOCOL_MAX_PATH_LEN || client_reader_read(reader, remote, len) != 0 ||
+        client_reader_read(reader, tail, tail_len) != 0) {
+      fprintf(stderr, "invalid list entry\n");
+      goto CLEANUP;
+    }
+    remote[len] = '\0';
+    if (remote_count > 0 && fs_path_cmp(prev, remote) >= 0) {
+      fprintf(stderr, "server listing is out of order\n");
+      goto CLEANUP;
+    }
+    memcpy(prev, remote, len + 1u);
+    remote_count++;
+
+    while (next < local.count && fs_path_cmp(local.files[next].path, remote) < 0) {
+      if (client_sync_queue(&batch, dir, root, &local.files[next]) != 0) {
+        goto CLEANUP;
+      }
+      next++;
+    }
+    if (next < local.count && strcmp(local.files[next].path, remote) == 0) {
+      if (client_sync_changed(opt, dir, &local.files[next], decode_u64_be(tail),
+                              decode_u64_be(tail + sizeof(uint64_t)),
+                              tail + 2u * sizeof(uint64_t)) &&
+          client_sync_queue(&batch, dir, root, &local.files[next]) != 0) {
+        goto CLEANUP;
+      }
+      next++;
+    }
+  }
+
+  {
+    uint8_t frame_buf[HF_PROTOCOL_RES_FRAME_SIZE];
+    if (client_reader_read(reader, frame_buf, sizeof(frame_buf)) != 0 ||
+        decode_res_frame(&frame, frame_buf) != PROTOCOL_OK ||
+        frame.phase != PROTO_PHASE_FINAL) {
+      fprintf(stderr, "invalid list final response\n");
+      goto CLEANUP;
+    }
+    if (client_check_response(&frame, PROTO_PHASE_FINAL, "list") != 0) {
+      goto CLEANUP;
+    }
+  }
+  for (; next < local.count; next++) {
+    if (client_sync_queue(&batch, dir, root, &local.files[next]) != 0) {
+      goto CLEANUP;
+    }
+  }
   socket_close(sock);
+  socket_init(&sock);
+
+  batch.sync = 1;
+  batch.scanned = local.count;
+  if (opt->json) {
+    exit_code = client_run_batch(&batch);
+  } else {
+    printf("%zu of %zu files new or changed\n", batch.count, local.count);
+    exit_code = batch.count > 0 ? client_run_batch(&batch) : 0;
+  }
+
+CLEANUP:
+  socket_close(sock);
+  free(reader);
+  client_batch_free(&batch);
+  for (size_t i = 0; i < local.count; i++) {
+    free(local.files[i].path);
+  }
+  free(local.files);
+  free(dir);
   return exit_code;
 }
 
@@ -669,11 +1976,21 @@ int client(const client_opt_t *cli_opt) {
 
   switch (cli_opt->msg_type) {
     case HF_MSG_TYPE_SEND_FILE:
-      return client_send_file_raw(cli_opt);
+      if (cli_opt->stream_name != NULL) {
+        return client_send_stream(cli_opt);
+      }
+      // One plain path keeps the single-connection upload.
+      if (cli_opt->path_count <= 1 && cli_opt->jobs == 0 &&
+          strcmp(cli_opt->path, "-") != 0 && !client_has_glob_chars(cli_opt->path)) {
+        return client_send_file(cli_opt);
+      }
+      return client_send_files(cli_opt);
     case HF_MSG_TYPE_TEXT_MESSAGE:
       return client_send_message(cli_opt);
     case HF_MSG_TYPE_GET_FILE:
       return client_get_file(cli_opt);
+    case HF_MSG_TYPE_BINARY_MESSAGE:
+      return client_send_binary_message(cli_opt);
     default:
       fprintf(stderr, "unsupported client message type: %u\n",
               (unsigned)cli_opt->msg_type);
@@ -4,5 +4,8 @@
 #include "cli.h"
 
 int client(const client_opt_t *cli_opt);
+// Uploads the files under cli_opt->path that are new or changed compared to
+// the directory of the same name on the server.
+int client_sync(const client_opt_t *cli_opt);
 
 #endif  // HF_CLIENT_H
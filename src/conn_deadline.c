@@ -0,0 +1,504 @@
+#include "conn_deadline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <process.h>
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <sys/socket.h>
+  #include <time.h>
+#endif
+
+// A hashed wheel: a deadline lives in slot (tick % SLOTS) and fires when the
+// wheel reaches that tick; anything further out than one turn just stays put
+// until its own tick comes round.
+#define CONN_DEADLINE_TICK_MS 250u
+#define CONN_DEADLINE_SLOTS 512u
+
+struct conn_deadline {
+  socket_t conn;
+  conn_deadline_phase_t phase;
+  uint64_t expires_tick;
+  volatile uint64_t progress;  // body bytes since the last rate check
+  uint32_t paused_left_ms;     // rest of the body window while paused
+  uint64_t stream_idle_ms;     // body time re-armed by keepalives, not data
+  int paused;
+  int scheduled;
+  conn_deadline_t *prev;
+  conn_deadline_t *next;
+};
+
+typedef struct {
+  int initialized;
+  int stopping;
+  uint64_t start_ms;
+  uint64_t tick;  // last tick the wheel has processed
+  uint32_t body_window_ms;
+  uint64_t stream_idle_max_ms;
+  conn_deadline_t *slots[CONN_DEADLINE_SLOTS];
+  conn_deadline_stats_t stats;
+#ifdef _WIN32
+  CRITICAL_SECTION mutex;
+  CONDITION_VARIABLE cond;
+  HANDLE thread;
+  DWORD current_slot;
+#else
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  pthread_key_t current_key;
+#endif
+} conn_deadline_state_t;
+
+static conn_deadline_state_t g_conn_deadline = {0};
+
+static void conn_deadline_lock(void) {
+#ifdef _WIN32
+  EnterCriticalSection(&g_conn_deadline.mutex);
+#else
+  (void)pthread_mutex_lock(&g_conn_deadline.mutex);
+#endif
+}
+
+static void conn_deadline_unlock(void) {
+#ifdef _WIN32
+  LeaveCriticalSection(&g_conn_deadline.mutex);
+#else
+  (void)pthread_mutex_unlock(&g_conn_deadline.mutex);
+#endif
+}
+
+static void conn_deadline_wait(uint32_t timeout_ms) {
+#ifdef _WIN32
+  (void)SleepConditionVariableCS(&g_conn_deadline.cond, &g_conn_deadline.mutex,
+                                 timeout_ms);
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+    return;
+  }
+  ts.tv_sec += (time_t)(timeout_ms / 1000u);
+  ts.tv_nsec += (long)(timeout_ms % 1000u) * 1000000L;
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec += 1;
+    ts.tv_nsec -= 1000000000L;
+  }
+  (void)pthread_cond_timedwait(&g_conn_deadline.cond, &g_conn_deadline.mutex, &ts);
+#endif
+}
+
+static uint64_t conn_deadline_now_ms(void) {
+#ifdef _WIN32
+  return (uint64_t)GetTickCount64();
+#else
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+#endif
+}
+
+static uint64_t conn_deadline_now_tick(void) {
+  return (conn_deadline_now_ms() - g_conn_deadline.start_ms) / CONN_DEADLINE_TICK_MS;
+}
+
+static conn_deadline_t *conn_deadline_current(void) {
+  if (!g_conn_deadline.initialized) {
+    return NULL;
+  }
+#ifdef _WIN32
+  return (conn_deadline_t *)TlsGetValue(g_conn_deadline.current_slot);
+#else
+  return (conn_deadline_t *)pthread_getspecific(g_conn_deadline.current_key);
+#endif
+}
+
+static void conn_deadline_set_current(conn_deadline_t *deadline) {
+#ifdef _WIN32
+  (void)TlsSetValue(g_conn_deadline.current_slot, deadline);
+#else
+  (void)pthread_setspecific(g_conn_deadline.current_key, deadline);
+#endif
+}
+
+// Tests shorten the body clock through the environment rather than waiting
+// out full windows.
+static uint64_t conn_deadline_env_ms(const char *name, uint64_t fallback) {
+  const char *value = getenv(name);
+  char *end = NULL;
+  unsigned long long parsed = 0;
+
+  if (value == NULL || value[0] == '\0') {
+    return fallback;
+  }
+  parsed = strtoull(value, &end, 10);
+  if (*end != '\0' || parsed < CONN_DEADLINE_TICK_MS || parsed > UINT32_MAX) {
+    return fallback;
+  }
+  return (uint64_t)parsed;
+}
+
+static uint64_t conn_deadline_body_min_bytes(void) {
+  return (uint64_t)CONN_DEADLINE_BODY_MIN_RATE * g_conn_deadline.body_window_ms / 1000u;
+}
+
+static uint64_t conn_deadline_take_progress(conn_deadline_t *deadline) {
+#ifdef _WIN32
+  return (uint64_t)InterlockedExchange64((volatile LONG64 *)&deadline->progress, 0);
+#else
+  return __atomic_exchange_n(&deadline->progress, 0, __ATOMIC_RELAXED);
+#endif
+}
+
+static void conn_deadline_unlink(conn_deadline_t *deadline) {
+  if (!deadline->scheduled) {
+    return;
+  }
+  if (deadline->prev != NULL) {
+    deadline->prev->next = deadline->next;
+  } else {
+    g_conn_deadline.slots[deadline->expires_tick % CONN_DEADLINE_SLOTS] = deadline->next;
+  }
+  if (deadline->next != NULL) {
+    deadline->next->prev = deadline->prev;
+  }
+  deadline->prev = NULL;
+  deadline->next = NULL;
+  deadline->scheduled = 0;
+}
+
+// Called with the lock held.
+static void conn_deadline_schedule(conn_deadline_t *deadline, uint32_t delay_ms) {
+  conn_deadline_t **slot = NULL;
+  uint64_t expires = conn_deadline_now_tick() +
+                     (delay_ms + CONN_DEADLINE_TICK_MS - 1u) / CONN_DEADLINE_TICK_MS;
+
+  conn_deadline_unlink(deadline);
+  if (expires <= g_conn_deadline.tick) {
+    expires = g_conn_deadline.tick + 1u;
+  }
+  deadline->expires_tick = expires;
+  slot = &g_conn_deadline.slots[expires % CONN_DEADLINE_SLOTS];
+  deadline->next = *slot;
+  if (*slot != NULL) {
+    (*slot)->prev = deadline;
+  }
+  *slot = deadline;
+  deadline->scheduled = 1;
+}
+
+static void conn_deadline_evict(conn_deadline_t *deadline) {
+  const char *what = "idle";
+
+  if (deadline->phase == CONN_DEADLINE_HEADER) {
+    what = "header";
+    g_conn_deadline.stats.evicted_header++;
+  } else if (deadline->phase == CONN_DEADLINE_BODY) {
+    what = "body rate";
+    g_conn_deadline.stats.evicted_body++;
+  } else {
+    g_conn_deadline.stats.evicted_idle++;
+  }
+  fprintf(stderr, "evicting slow connection: %s deadline missed\n", what);
+
+  conn_deadline_unlink(deadline);
+  deadline->phase = CONN_DEADLINE_NONE;
+#ifdef _WIN32
+  (void)shutdown(deadline->conn, SD_BOTH);
+#else
+  (void)shutdown(deadline->conn, SHUT_RDWR);
+#endif
+}
+
+static void conn_deadline_fire_slot(uint64_t tick) {
+  conn_deadline_t *deadline = g_conn_deadline.slots[tick % CONN_DEADLINE_SLOTS];
+
+  while (deadline != NULL) {
+    conn_deadline_t *next = deadline->next;
+    if (deadline->expires_tick <= tick) {
+      if (deadline->phase == CONN_DEADLINE_BODY &&
+          conn_deadline_take_progress(deadline) >= conn_deadline_body_min_bytes()) {
+        deadline->stream_idle_ms = 0;
+        conn_deadline_schedule(deadline, g_conn_deadline.body_window_ms);
+      } else {
+        conn_deadline_evict(deadline);
+      }
+    }
+    deadline = next;
+  }
+}
+
+#ifdef _WIN32
+static unsigned __stdcall conn_deadline_thread_main(void *arg) {
+#else
+static void *conn_deadline_thread_main(void *arg) {
+#endif
+  (void)arg;
+
+  conn_deadline_lock();
+  while (!g_conn_deadline.stopping) {
+    uint64_t now_tick = conn_deadline_now_tick();
+    while (g_conn_deadline.tick < now_tick) {
+      g_conn_deadline.tick++;
+      conn_deadline_fire_slot(g_conn_deadline.tick);
+    }
+    conn_deadline_wait(CONN_DEADLINE_TICK_MS);
+  }
+  conn_deadline_unlock();
+
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+int conn_deadline_start(void) {
+  if (g_conn_deadline.initialized) {
+    return 1;
+  }
+
+  memset(&g_conn_deadline, 0, sizeof(g_conn_deadline));
+  g_conn_deadline.start_ms = conn_deadline_now_ms();
+  g_conn_deadline.body_window_ms = (uint32_t)conn_deadline_env_ms(
+      "HF_CONN_DEADLINE_BODY_WINDOW_MS", CONN_DEADLINE_BODY_WINDOW_MS);
+  g_conn_deadline.stream_idle_max_ms = conn_deadline_env_ms(
+      "HF_CONN_DEADLINE_STREAM_IDLE_MS", CONN_DEADLINE_STREAM_IDLE_MS);
+
+#ifdef _WIN32
+  g_conn_deadline.current_slot = TlsAlloc();
+  if (g_conn_deadline.current_slot == TLS_OUT_OF_INDEXES) {
+    return 1;
+  }
+  InitializeCriticalSection(&g_conn_deadline.mutex);
+  InitializeConditionVariable(&g_conn_deadline.cond);
+  {
+    uintptr_t handle = _beginthreadex(NULL, 0, conn_deadline_thread_main, NULL, 0, NULL);
+    if (handle == 0) {
+      fprintf(stderr, "_beginthreadex(conn_deadline) failed\n");
+      DeleteCriticalSection(&g_conn_deadline.mutex);
+      (void)TlsFree(g_conn_deadline.current_slot);
+      return 1;
+    }
+    g_conn_deadline.thread = (HANDLE)handle;
+  }
+#else
+  if (pthread_key_create(&g_conn_deadline.current_key, NULL) != 0) {
+    return 1;
+  }
+  if (pthread_mutex_init(&g_conn_deadline.mutex, NULL) != 0) {
+    (void)pthread_key_delete(g_conn_deadline.current_key);
+    return 1;
+  }
+  if (pthread_cond_init(&g_conn_deadline.cond, NULL) != 0) {
+    (void)pthread_mutex_destroy(&g_conn_deadline.mutex);
+    (void)pthread_key_delete(g_conn_deadline.current_key);
+    return 1;
+  }
+  {
+    int err = pthread_create(&g_conn_deadline.thread, NULL, conn_deadline_thread_main, NULL);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create(conn_deadline): %s\n", strerror(err));
+      (void)pthread_cond_destroy(&g_conn_deadline.cond);
+      (void)pthread_mutex_destroy(&g_conn_deadline.mutex);
+      (void)pthread_key_delete(g_conn_deadline.current_key);
+      return 1;
+    }
+  }
+#endif
+
+  g_conn_deadline.initialized = 1;
+  return 0;
+}
+
+// Every connection must be detached first.
+void conn_deadline_stop(void) {
+  if (!g_conn_deadline.initialized) {
+    return;
+  }
+
+  conn_deadline_lock();
+  g_conn_deadline.stopping = 1;
+#ifdef _WIN32
+  WakeAllConditionVariable(&g_conn_deadline.cond);
+#else
+  (void)pthread_cond_broadcast(&g_conn_deadline.cond);
+#endif
+  conn_deadline_unlock();
+
+#ifdef _WIN32
+  (void)WaitForSingleObject(g_conn_deadline.thread, INFINITE);
+  CloseHandle(g_conn_deadline.thread);
+  DeleteCriticalSection(&g_conn_deadline.mutex);
+  (void)TlsFree(g_conn_deadline.current_slot);
+#else
+  (void)pthread_join(g_conn_deadline.thread, NULL);
+  (void)pthread_cond_destroy(&g_conn_deadline.cond);
+  (void)pthread_mutex_destroy(&g_conn_deadline.mutex);
+  (void)pthread_key_delete(g_conn_deadline.current_key);
+#endif
+  g_conn_deadline.initialized = 0;
+}
+
+conn_deadline_t *conn_deadline_attach(socket_t conn) {
+  conn_deadline_t *deadline = NULL;
+
+  if (!g_conn_deadline.initialized) {
+    return NULL;
+  }
+  deadline = (conn_deadline_t *)calloc(1, sizeof(*deadline));
+  if (deadline == NULL) {
+    return NULL;
+  }
+
+  deadline->conn = conn;
+  deadline->phase = CONN_DEADLINE_IDLE;
+  conn_deadline_lock();
+  conn_deadline_schedule(deadline, CONN_DEADLINE_IDLE_MS);
+  g_conn_deadline.stats.active++;
+  conn_deadline_unlock();
+  conn_deadline_set_current(deadline);
+  return deadline;
+}
+
+void conn_deadline_detach(conn_deadline_t *deadline) {
+  if (deadline == NULL) {
+    return;
+  }
+
+  conn_deadline_lock();
+  conn_deadline_unlink(deadline);
+  g_conn_deadline.stats.active--;
+  conn_deadline_unlock();
+  if (conn_deadline_current() == deadline) {
+    conn_deadline_set_current(NULL);
+  }
+  free(deadline);
+}
+
+void conn_deadline_enter(conn_deadline_phase_t phase) {
+  conn_deadline_t *deadline = conn_deadline_current();
+
+  if (deadline == NULL) {
+    return;
+  }
+
+  conn_deadline_lock();
+  deadline->phase = phase;
+  deadline->paused = 0;
+  switch (phase) {
+    case CONN_DEADLINE_IDLE:
+      conn_deadline_schedule(deadline, CONN_DEADLINE_IDLE_MS);
+      break;
+    case CONN_DEADLINE_HEADER:
+      conn_deadline_schedule(deadline, CONN_DEADLINE_HEADER_MS);
+      break;
+    case CONN_DEADLINE_BODY:
+      (void)conn_deadline_take_progress(deadline);
+      deadline->stream_idle_ms = 0;
+      conn_deadline_schedule(deadline, g_conn_deadline.body_window_ms);
+      break;
+    default:
+      conn_deadline_unlink(deadline);
+      break;
+  }
+  conn_deadline_unlock();
+}
+
+void conn_deadline_progress(uint64_t bytes) {
+  conn_deadline_t *deadline = conn_deadline_current();
+
+  if (deadline == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  (void)InterlockedExchangeAdd64((volatile LONG64 *)&deadline->progress, (LONG64)bytes);
+#else
+  (void)__atomic_fetch_add(&deadline->progress, bytes, __ATOMIC_RELAXED);
+#endif
+}
+
+void conn_deadline_pause(void) {
+  conn_deadline_t *deadline = conn_deadline_current();
+
+  if (deadline == NULL) {
+    return;
+  }
+
+  conn_deadline_lock();
+  if (deadline->phase == CONN_DEADLINE_BODY && deadline->scheduled && !deadline->paused) {
+    uint64_t now_tick = conn_deadline_now_tick();
+    uint64_t left = deadline->expires_tick > now_tick ? deadline->expires_tick - now_tick : 0;
+
+    deadline->paused_left_ms = (uint32_t)(left * CONN_DEADLINE_TICK_MS);
+    deadline->paused = 1;
+    conn_deadline_unlink(deadline);
+  }
+  conn_deadline_unlock();
+}
+
+void conn_deadline_resume(void) {
+  conn_deadline_t *deadline = conn_deadline_current();
+
+  if (deadline == NULL) {
+    return;
+  }
+
+  conn_deadline_lock();
+  if (deadline->paused) {
+    deadline->paused = 0;
+    conn_deadline_schedule(deadline, deadline->paused_left_ms);
+  }
+  conn_deadline_unlock();
+}
+
+int conn_deadline_keepalive(void) {
+  conn_deadline_t *deadline = conn_deadline_current();
+  int evicted = 0;
+
+  if (deadline == NULL) {
+    return 0;
+  }
+
+  conn_deadline_lock();
+  if (deadline->phase == CONN_DEADLINE_BODY && deadline->scheduled) {
+    uint64_t now_tick = conn_deadline_now_tick();
+    uint64_t left_ms = deadline->expires_tick > now_tick
+                           ? (deadline->expires_tick - now_tick) * CONN_DEADLINE_TICK_MS
+                           : 0;
+    uint64_t elapsed_ms =
+        left_ms < g_conn_deadline.body_window_ms ? g_conn_deadline.body_window_ms - left_ms : 0;
+
+    // Only a window's worth of data clears the idle total, so interleaving
+    // tiny chunks with keepalives cannot hold the connection forever.
+    if (conn_deadline_take_progress(deadline) >= conn_deadline_body_min_bytes()) {
+      deadline->stream_idle_ms = 0;
+    } else {
+      deadline->stream_idle_ms += elapsed_ms;
+    }
+    if (deadline->stream_idle_ms >= g_conn_deadline.stream_idle_max_ms) {
+      conn_deadline_evict(deadline);
+      evicted = 1;
+    } else {
+      conn_deadline_schedule(deadline, g_conn_deadline.body_window_ms);
+    }
+  }
+  conn_deadline_unlock();
+  return evicted;
+}
+
+void conn_deadline_get_stats(conn_deadline_stats_t *out) {
+  if (out == NULL) {
+    return;
+  }
+  memset(out, 0, sizeof(*out));
+  if (!g_conn_deadline.initialized) {
+    return;
+  }
+  conn_deadline_lock();
+  *out = g_conn_deadline.stats;
+  conn_deadline_unlock();
+}
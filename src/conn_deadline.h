@@ -0,0 +1,58 @@
+#ifndef HF_CONN_DEADLINE_H
+#define HF_CONN_DEADLINE_H
+
+#include "net.h"
+
+#include <stdint.h>
+
+// Limits enforced by one timer-wheel thread for every server connection.
+// A connection that misses its deadline is shut down, which fails the
+// blocked recv in its thread.
+#define CONN_DEADLINE_IDLE_MS 15000u         // accept to first request byte
+#define CONN_DEADLINE_HEADER_MS 10000u       // first byte to end of headers
+#define CONN_DEADLINE_BODY_WINDOW_MS 30000u  // body rate is checked per window
+#define CONN_DEADLINE_BODY_MIN_RATE 1024u    // bytes per second
+#define CONN_DEADLINE_STREAM_IDLE_MS 300000u // keepalive-only time per stream
+
+typedef enum {
+  CONN_DEADLINE_NONE = 0,  // responding or long-lived; not timed
+  CONN_DEADLINE_IDLE,
+  CONN_DEADLINE_HEADER,
+  CONN_DEADLINE_BODY,
+} conn_deadline_phase_t;
+
+typedef struct {
+  uint64_t active;
+  uint64_t evicted_idle;
+  uint64_t evicted_header;
+  uint64_t evicted_body;
+} conn_deadline_stats_t;
+
+typedef struct conn_deadline conn_deadline_t;
+
+int conn_deadline_start(void);
+void conn_deadline_stop(void);
+
+// Starts timing conn in the idle phase and binds it to the calling thread;
+// detach before closing conn. Returns NULL when the wheel is not running.
+conn_deadline_t *conn_deadline_attach(socket_t conn);
+void conn_deadline_detach(conn_deadline_t *deadline);
+
+// Both act on the calling thread's connection and do nothing without one,
+// so shared receive paths can report progress unconditionally.
+void conn_deadline_enter(conn_deadline_phase_t phase);
+void conn_deadline_progress(uint64_t bytes);
+// Stops the body clock while the server itself holds the connection back,
+// as when it waits out a rate limit; resuming picks the window up where it
+// stopped rather than starting a new one.
+void conn_deadline_pause(void);
+void conn_deadline_resume(void);
+// A stream keepalive restarts the body window, but the time it covers adds
+// up until a window's worth of data arrives; past
+// CONN_DEADLINE_STREAM_IDLE_MS the connection is evicted as a body miss.
+// Returns nonzero when it was.
+int conn_deadline_keepalive(void);
+
+void conn_deadline_get_stats(conn_deadline_stats_t *out);
+
+#endif  // HF_CONN_DEADLINE_H
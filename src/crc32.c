@@ -0,0 +1,71 @@
+#include "crc32.h"
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+// Slicing-by-8: eight tables let the main loop fold 8 input bytes per step.
+static uint32_t g_crc32_table[8][256];
+
+#ifdef _WIN32
+static INIT_ONCE g_crc32_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t g_crc32_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void crc32_build_tables(void) {
+  for (uint32_t i = 0; i < 256u; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1u) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    g_crc32_table[0][i] = c;
+  }
+  for (uint32_t i = 0; i < 256u; i++) {
+    for (int t = 1; t < 8; t++) {
+      uint32_t prev = g_crc32_table[t - 1][i];
+      g_crc32_table[t][i] = g_crc32_table[0][prev & 0xFFu] ^ (prev >> 8);
+    }
+  }
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK crc32_init(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+  (void)once;
+  (void)param;
+  (void)ctx;
+  crc32_build_tables();
+  return TRUE;
+}
+#endif
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char *)data;
+
+#ifdef _WIN32
+  (void)InitOnceExecuteOnce(&g_crc32_once, crc32_init, NULL, NULL);
+#else
+  (void)pthread_once(&g_crc32_once, crc32_build_tables);
+#endif
+
+  crc = ~crc;
+  while (len >= 8u) {
+    uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+    uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) |
+                  ((uint32_t)p[7] << 24);
+    crc = g_crc32_table[7][lo & 0xFFu] ^ g_crc32_table[6][(lo >> 8) & 0xFFu] ^
+          g_crc32_table[5][(lo >> 16) & 0xFFu] ^ g_crc32_table[4][lo >> 24] ^
+          g_crc32_table[3][hi & 0xFFu] ^ g_crc32_table[2][(hi >> 8) & 0xFFu] ^
+          g_crc32_table[1][(hi >> 16) & 0xFFu] ^ g_crc32_table[0][hi >> 24];
+    p += 8;
+    len -= 8u;
+  }
+  while (len > 0) {
+    crc = g_crc32_table[0][(crc ^ *p++) & 0xFFu] ^ (crc >> 8);
+    len--;
+  }
+  return ~crc;
+}
@@ -0,0 +1,11 @@
+#ifndef HF_CRC32_H
+#define HF_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, as used by gzip and zip). Start from 0 and feed the
+// previous result back in to checksum data in pieces.
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+#endif  // HF_CRC32_H
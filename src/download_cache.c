@@ -0,0 +1,351 @@
+#include "download_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+#define DOWNLOAD_CACHE_BUCKETS 256u
+#define DOWNLOAD_CACHE_INLINE_MAX (64u * 1024u)
+
+// Windows keeps cached files locked against rename, which would make upload
+// commits over a hot file fail, so the cache only holds descriptors on POSIX.
+#ifdef _WIN32
+  #define DOWNLOAD_CACHE_MAX_ENTRIES 0u
+#else
+  #define DOWNLOAD_CACHE_MAX_ENTRIES 64u
+#endif
+
+struct download_cache_entry {
+  char *path;
+  uint32_t hash;
+  int fd;
+  fs_path_info_t info;
+  char *data;
+  uint32_t refs;
+  int linked;
+  download_cache_entry_t *hash_next;
+  download_cache_entry_t *lru_prev;
+  download_cache_entry_t *lru_next;
+};
+
+typedef struct {
+  int initialized;
+  int validate_on_hit;
+  uint64_t generation;
+  size_t count;
+  download_cache_entry_t *buckets[DOWNLOAD_CACHE_BUCKETS];
+  download_cache_entry_t *lru_head;
+  download_cache_entry_t *lru_tail;
+#ifdef _WIN32
+  CRITICAL_SECTION mutex;
+#else
+  pthread_mutex_t mutex;
+#endif
+} download_cache_state_t;
+
+static download_cache_state_t g_download_cache = {0};
+
+static void download_cache_lock(void) {
+#ifdef _WIN32
+  EnterCriticalSection(&g_download_cache.mutex);
+#else
+  (void)pthread_mutex_lock(&g_download_cache.mutex);
+#endif
+}
+
+static void download_cache_unlock(void) {
+#ifdef _WIN32
+  LeaveCriticalSection(&g_download_cache.mutex);
+#else
+  (void)pthread_mutex_unlock(&g_download_cache.mutex);
+#endif
+}
+
+static uint32_t download_cache_hash(const char *path) {
+  uint32_t h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)path; *p != '\0'; p++) {
+    h ^= *p;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void download_cache_free_entry(download_cache_entry_t *entry) {
+  if (entry->fd != -1) {
+    fs_close(entry->fd);
+  }
+  free(entry->data);
+  free(entry->path);
+  free(entry);
+}
+
+static void download_cache_lru_unlink(download_cache_entry_t *entry) {
+  if (entry->lru_prev != NULL) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    g_download_cache.lru_head = entry->lru_next;
+  }
+  if (entry->lru_next != NULL) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    g_download_cache.lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void download_cache_lru_push_front(download_cache_entry_t *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = g_download_cache.lru_head;
+  if (g_download_cache.lru_head != NULL) {
+    g_download_cache.lru_head->lru_prev = entry;
+  }
+  g_download_cache.lru_head = entry;
+  if (g_download_cache.lru_tail == NULL) {
+    g_download_cache.lru_tail = entry;
+  }
+}
+
+// Caller holds the lock. The entry stays alive until its last reader lets go.
+static void download_cache_unlink(download_cache_entry_t *entry) {
+  download_cache_entry_t **slot =
+    &g_download_cache.buckets[entry->hash % DOWNLOAD_CACHE_BUCKETS];
+
+  while (*slot != NULL && *slot != entry) {
+    slot = &(*slot)->hash_next;
+  }
+  if (*slot == entry) {
+    *slot = entry->hash_next;
+  }
+  entry->hash_next = NULL;
+  download_cache_lru_unlink(entry);
+  entry->linked = 0;
+  g_download_cache.count--;
+
+  if (entry->refs == 0) {
+    download_cache_free_entry(entry);
+  }
+}
+
+static download_cache_entry_t *download_cache_find(const char *path, uint32_t hash) {
+  download_cache_entry_t *entry = g_download_cache.buckets[hash % DOWNLOAD_CACHE_BUCKETS];
+
+  while (entry != NULL) {
+    if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+      return entry;
+    }
+    entry = entry->hash_next;
+  }
+  return NULL;
+}
+
+static void download_cache_fill_view(const download_cache_entry_t *entry,
+                                     download_cache_view_t *view_out) {
+  view_out->fd = entry->fd;
+  view_out->info = entry->info;
+  view_out->data = entry->data;
+}
+
+int download_cache_init(int validate_on_hit) {
+  if (g_download_cache.initialized) {
+    return 0;
+  }
+
+  memset(&g_download_cache, 0, sizeof(g_download_cache));
+#ifdef _WIN32
+  InitializeCriticalSection(&g_download_cache.mutex);
+#else
+  if (pthread_mutex_init(&g_download_cache.mutex, NULL) != 0) {
+    return 1;
+  }
+#endif
+  g_download_cache.validate_on_hit = validate_on_hit ? 1 : 0;
+  g_download_cache.initialized = 1;
+  return 0;
+}
+
+void download_cache_cleanup(void) {
+  if (!g_download_cache.initialized) {
+    return;
+  }
+
+  download_cache_lock();
+  while (g_download_cache.lru_head != NULL) {
+    download_cache_unlink(g_download_cache.lru_head);
+  }
+  download_cache_unlock();
+
+#ifdef _WIN32
+  DeleteCriticalSection(&g_download_cache.mutex);
+#else
+  (void)pthread_mutex_destroy(&g_download_cache.mutex);
+#endif
+  g_download_cache.initialized = 0;
+}
+
+download_cache_entry_t *download_cache_lookup(const char *base_dir,
+                                              const char *relative_path,
+                                              download_cache_view_t *view_out,
+                                              uint64_t *generation_out) {
+  download_cache_entry_t *entry = NULL;
+  uint32_t hash = 0;
+
+  if (generation_out != NULL) {
+    *generation_out = 0;
+  }
+  if (!g_download_cache.initialized || relative_path == NULL || view_out == NULL) {
+    return NULL;
+  }
+
+  hash = download_cache_hash(relative_path);
+  download_cache_lock();
+  if (generation_out != NULL) {
+    *generation_out = g_download_cache.generation;
+  }
+  entry = download_cache_find(relative_path, hash);
+  if (entry != NULL) {
+    entry->refs++;
+    download_cache_lru_unlink(entry);
+    download_cache_lru_push_front(entry);
+    download_cache_fill_view(entry, view_out);
+  }
+  download_cache_unlock();
+
+  if (entry == NULL || !g_download_cache.validate_on_hit) {
+    return entry;
+  }
+
+  // Without a filesystem watcher, out-of-band edits are only visible to stat.
+  char full_path[4096];
+  fs_path_info_t info = {0};
+  if (base_dir != NULL &&
+      fs_join_relative_path(full_path, sizeof(full_path), base_dir, relative_path) == 0 &&
+      fs_stat_path(full_path, &info) == 0 && info.kind == FS_PATH_KIND_FILE &&
+      info.size == entry->info.size && info.mtime == entry->info.mtime) {
+    return entry;
+  }
+
+  download_cache_lock();
+  if (entry->linked) {
+    download_cache_unlink(entry);
+    g_download_cache.generation++;
+  }
+  if (generation_out != NULL) {
+    *generation_out = g_download_cache.generation;
+  }
+  download_cache_unlock();
+  download_cache_release(entry);
+  return NULL;
+}
+
+download_cache_entry_t *download_cache_insert(const char *relative_path,
+                                              int fd,
+                                              const fs_path_info_t *info,
+                                              uint64_t generation,
+                                              download_cache_view_t *view_out) {
+  download_cache_entry_t *entry = NULL;
+  download_cache_entry_t *existing = NULL;
+
+  if (!g_download_cache.initialized || DOWNLOAD_CACHE_MAX_ENTRIES == 0u ||
+      relative_path == NULL || fd < 0 || info == NULL || view_out == NULL) {
+    return NULL;
+  }
+
+  entry = (download_cache_entry_t *)calloc(1, sizeof(*entry));
+  if (entry == NULL) {
+    return NULL;
+  }
+  entry->path = strdup(relative_path);
+  if (entry->path == NULL) {
+    free(entry);
+    return NULL;
+  }
+  entry->hash = download_cache_hash(relative_path);
+  entry->fd = fd;
+  entry->info = *info;
+
+  if (info->size > 0 && info->size <= DOWNLOAD_CACHE_INLINE_MAX) {
+    size_t len = (size_t)info->size;
+    size_t got = 0;
+
+    entry->data = (char *)malloc(len);
+    while (entry->data != NULL && got < len) {
+      ssize_t n = fs_pread(fd, entry->data + got, len - got, (uint64_t)got);
+      if (n <= 0) {
+        free(entry->data);
+        entry->data = NULL;
+        break;
+      }
+      got += (size_t)n;
+    }
+  }
+
+  download_cache_lock();
+  existing = download_cache_find(relative_path, entry->hash);
+  if (generation != g_download_cache.generation || existing != NULL) {
+    download_cache_unlock();
+    entry->fd = -1;
+    download_cache_free_entry(entry);
+    return NULL;
+  }
+
+  while (g_download_cache.count >= DOWNLOAD_CACHE_MAX_ENTRIES &&
+         g_download_cache.lru_tail != NULL) {
+    download_cache_unlink(g_download_cache.lru_tail);
+  }
+
+  download_cache_entry_t **bucket =
+    &g_download_cache.buckets[entry->hash % DOWNLOAD_CACHE_BUCKETS];
+  entry->hash_next = *bucket;
+  *bucket = entry;
+  download_cache_lru_push_front(entry);
+  entry->linked = 1;
+  entry->refs = 1;
+  g_download_cache.count++;
+  download_cache_fill_view(entry, view_out);
+  download_cache_unlock();
+  return entry;
+}
+
+void download_cache_release(download_cache_entry_t *entry) {
+  if (entry == NULL) {
+    return;
+  }
+
+  download_cache_lock();
+  if (entry->refs > 0) {
+    entry->refs--;
+  }
+  if (entry->refs == 0 && !entry->linked) {
+    download_cache_free_entry(entry);
+  }
+  download_cache_unlock();
+}
+
+void download_cache_invalidate(const char *relative_path) {
+  size_t len = 0;
+
+  if (!g_download_cache.initialized || relative_path == NULL) {
+    return;
+  }
+
+  len = strlen(relative_path);
+  download_cache_lock();
+  g_download_cache.generation++;
+  for (download_cache_entry_t *entry = g_download_cache.lru_head; entry != NULL;) {
+    download_cache_entry_t *next = entry->lru_next;
+    if (len == 0 ||
+        (strncmp(entry->path, relative_path, len) == 0 &&
+         (entry->path[len] == '\0' || entry->path[len] == '/'))) {
+      download_cache_unlink(entry);
+    }
+    entry = next;
+  }
+  download_cache_unlock();
+}
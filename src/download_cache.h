@@ -0,0 +1,30 @@
+#ifndef HF_DOWNLOAD_CACHE_H
+#define HF_DOWNLOAD_CACHE_H
+
+#include "fs.h"
+
+#include <stdint.h>
+
+typedef struct download_cache_entry download_cache_entry_t;
+
+typedef struct {
+  int fd;
+  fs_path_info_t info;
+  const char *data;
+} download_cache_view_t;
+
+int download_cache_init(int validate_on_hit);
+void download_cache_cleanup(void);
+download_cache_entry_t *download_cache_lookup(const char *base_dir,
+                                              const char *relative_path,
+                                              download_cache_view_t *view_out,
+                                              uint64_t *generation_out);
+download_cache_entry_t *download_cache_insert(const char *relative_path,
+                                              int fd,
+                                              const fs_path_info_t *info,
+                                              uint64_t generation,
+                                              download_cache_view_t *view_out);
+void download_cache_release(download_cache_entry_t *entry);
+void download_cache_invalidate(const char *relative_path);
+
+#endif  // HF_DOWNLOAD_CACHE_H
@@ -0,0 +1,922 @@
+#ifdef __linux__
+  #ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+  #endif
+#endif
+
+#include "file_index.h"
+
+#include "fs_watch.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <process.h>
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <time.h>
+#endif
+
+#define FILE_INDEX_RESCAN_INTERVAL_MS 60000u
+#define FILE_INDEX_WAIT_SLICE_MS 1000u
+#define FILE_INDEX_COMPACT_MIN_BYTES (1024u * 1024u)
+#define FILE_INDEX_POOL_MAX ((size_t)UINT32_MAX)
+
+typedef struct {
+  uint32_t off;
+  uint32_t len;
+  uint64_t size;
+  uint64_t mtime;
+  uint8_t kind;
+  uint8_t dead;
+} file_index_record_t;
+
+// Paths are stored back to back, NUL separated, in two parallel pools: the
+// original bytes and an ASCII case-folded copy that matching scans directly.
+typedef struct {
+  char *paths;
+  char *folded;
+  size_t pool_len;
+  size_t pool_cap;
+  file_index_record_t *records;
+  size_t record_count;
+  size_t record_cap;
+  uint32_t *order;
+  size_t order_count;
+  size_t order_cap;
+  size_t dead_bytes;
+} file_index_table_t;
+
+typedef struct {
+  const char *folded;
+  const char *path;
+  uint32_t id;
+} file_index_sort_key_t;
+
+typedef struct {
+  int initialized;
+  int ready;
+  int building;
+  int watching;
+  int rescan_requested;
+  volatile int stopping;
+  char root_dir[4096];
+  file_index_table_t table;
+  char **pending;
+  size_t pending_count;
+  size_t pending_cap;
+#ifdef _WIN32
+  CRITICAL_SECTION mutex;
+  CONDITION_VARIABLE cond;
+  HANDLE thread;
+#else
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+#endif
+} file_index_state_t;
+
+static file_index_state_t g_file_index = {0};
+
+static fs_path_info_t file_index_record_info(const file_index_record_t *rec) {
+  fs_path_info_t info = {0};
+  info.kind = (fs_path_kind_t)rec->kind;
+  info.size = rec->size;
+  info.mtime = rec->mtime;
+  return info;
+}
+
+static void file_index_lock(void) {
+#ifdef _WIN32
+  EnterCriticalSection(&g_file_index.mutex);
+#else
+  (void)pthread_mutex_lock(&g_file_index.mutex);
+#endif
+}
+
+static void file_index_unlock(void) {
+#ifdef _WIN32
+  LeaveCriticalSection(&g_file_index.mutex);
+#else
+  (void)pthread_mutex_unlock(&g_file_index.mutex);
+#endif
+}
+
+static void file_index_signal(void) {
+#ifdef _WIN32
+  WakeAllConditionVariable(&g_file_index.cond);
+#else
+  (void)pthread_cond_broadcast(&g_file_index.cond);
+#endif
+}
+
+static void file_index_wait(uint32_t timeout_ms) {
+#ifdef _WIN32
+  (void)SleepConditionVariableCS(&g_file_index.cond, &g_file_index.mutex,
+                                 timeout_ms);
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+    return;
+  }
+  ts.tv_sec += (time_t)(timeout_ms / 1000u);
+  ts.tv_nsec += (long)(timeout_ms % 1000u) * 1000000L;
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec += 1;
+    ts.tv_nsec -= 1000000000L;
+  }
+  (void)pthread_cond_timedwait(&g_file_index.cond, &g_file_index.mutex, &ts);
+#endif
+}
+
+static void file_index_fold(char *dst, const char *src, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    dst[i] = (char)tolower((unsigned char)src[i]);
+  }
+  dst[len] = '\0';
+}
+
+static const char *file_index_find_bytes(const char *haystack, size_t haystack_len,
+                                         const char *needle, size_t needle_len) {
+#ifdef _WIN32
+  const char *end = haystack + haystack_len;
+
+  if (needle_len == 0 || needle_len > haystack_len) {
+    return NULL;
+  }
+  for (const char *p = haystack; (size_t)(end - p) >= needle_len; p++) {
+    p = (const char *)memchr(p, needle[0], (size_t)(end - p) - needle_len + 1u);
+    if (p == NULL) {
+      return NULL;
+    }
+    if (memcmp(p, needle, needle_len) == 0) {
+      return p;
+    }
+  }
+  return NULL;
+#else
+  return (const char *)memmem(haystack, haystack_len, needle, needle_len);
+#endif
+}
+
+static void file_index_table_free(file_index_table_t *t) {
+  free(t->paths);
+  free(t->folded);
+  free(t->records);
+  free(t->order);
+  memset(t, 0, sizeof(*t));
+}
+
+static int file_index_table_reserve_pool(file_index_table_t *t, size_t need) {
+  size_t next_cap = t->pool_cap == 0 ? 64u * 1024u : t->pool_cap;
+  char *paths = NULL;
+  char *folded = NULL;
+
+  if (need > FILE_INDEX_POOL_MAX - t->pool_len) {
+    return 1;
+  }
+  if (t->pool_len + need <= t->pool_cap) {
+    return 0;
+  }
+  while (next_cap < t->pool_len + need) {
+    next_cap *= 2u;
+  }
+
+  paths = (char *)realloc(t->paths, next_cap);
+  if (paths == NULL) {
+    return 1;
+  }
+  t->paths = paths;
+  folded = (char *)realloc(t->folded, next_cap);
+  if (folded == NULL) {
+    return 1;
+  }
+  t->folded = folded;
+  t->pool_cap = next_cap;
+  return 0;
+}
+
+static int file_index_table_reserve_order(file_index_table_t *t, size_t need) {
+  size_t next_cap = t->order_cap == 0 ? 1024u : t->order_cap;
+  uint32_t *order = NULL;
+
+  if (t->order_count + need <= t->order_cap) {
+    return 0;
+  }
+  while (next_cap < t->order_count + need) {
+    next_cap *= 2u;
+  }
+  order = (uint32_t *)realloc(t->order, next_cap * sizeof(*order));
+  if (order == NULL) {
+    return 1;
+  }
+  t->order = order;
+  t->order_cap = next_cap;
+  return 0;
+}
+
+static int file_index_table_append(file_index_table_t *t, const char *path,
+                                   const fs_path_info_t *info, uint32_t *id_out) {
+  size_t len = strlen(path);
+  file_index_record_t *rec = NULL;
+
+  if (t->record_count >= UINT32_MAX || file_index_table_reserve_pool(t, len + 1u) != 0) {
+    return 1;
+  }
+  if (t->record_count == t->record_cap) {
+    size_t next_cap = t->record_cap == 0 ? 1024u : t->record_cap * 2u;
+    file_index_record_t *records =
+      (file_index_record_t *)realloc(t->records, next_cap * sizeof(*records));
+    if (records == NULL) {
+      return 1;
+    }
+    t->records = records;
+    t->record_cap = next_cap;
+  }
+
+  rec = &t->records[t->record_count];
+  rec->off = (uint32_t)t->pool_len;
+  rec->len = (uint32_t)len;
+  rec->size = info->size;
+  rec->mtime = info->mtime;
+  rec->kind = (uint8_t)info->kind;
+  rec->dead = 0;
+
+  memcpy(t->paths + t->pool_len, path, len + 1u);
+  file_index_fold(t->folded + t->pool_len, path, len);
+  t->pool_len += len + 1u;
+  *id_out = (uint32_t)t->record_count++;
+  return 0;
+}
+
+static int file_index_sort_key_cmp(const void *lhs, const void *rhs) {
+  const file_index_sort_key_t *a = (const file_index_sort_key_t *)lhs;
+  const file_index_sort_key_t *b = (const file_index_sort_key_t *)rhs;
+  int cmp = strcmp(a->folded, b->folded);
+  return cmp != 0 ? cmp : strcmp(a->path, b->path);
+}
+
+static int file_index_table_sort(file_index_table_t *t) {
+  file_index_sort_key_t *keys = NULL;
+
+  if (file_index_table_reserve_order(t, t->record_count) != 0) {
+    return 1;
+  }
+  if (t->record_count == 0) {
+    t->order_count = 0;
+    return 0;
+  }
+
+  keys = (file_index_sort_key_t *)malloc(t->record_count * sizeof(*keys));
+  if (keys == NULL) {
+    return 1;
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < t->record_count; i++) {
+    if (t->records[i].dead) {
+      continue;
+    }
+    keys[count].folded = t->folded + t->records[i].off;
+    keys[count].path = t->paths + t->records[i].off;
+    keys[count].id = (uint32_t)i;
+    count++;
+  }
+  qsort(keys, count, sizeof(*keys), file_index_sort_key_cmp);
+  for (size_t i = 0; i < count; i++) {
+    t->order[i] = keys[i].id;
+  }
+  t->order_count = count;
+  free(keys);
+  return 0;
+}
+
+static int file_index_table_cmp_at(const file_index_table_t *t, size_t pos,
+                                   const char *folded_key, const char *path_key) {
+  const file_index_record_t *rec = &t->records[t->order[pos]];
+  int cmp = strcmp(t->folded + rec->off, folded_key);
+  if (cmp != 0 || path_key == NULL) {
+    return cmp;
+  }
+  return strcmp(t->paths + rec->off, path_key);
+}
+
+static size_t file_index_table_lower_bound(const file_index_table_t *t,
+                                           const char *folded_key,
+                                           const char *path_key) {
+  size_t lo = 0;
+  size_t hi = t->order_count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2u;
+    if (file_index_table_cmp_at(t, mid, folded_key, path_key) < 0) {
+      lo = mid + 1u;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static int file_index_table_upsert(file_index_table_t *t, const char *path,
+                                   const char *folded_path,
+                                   const fs_path_info_t *info) {
+  size_t pos = file_index_table_lower_bound(t, folded_path, path);
+  uint32_t id = 0;
+
+  if (pos < t->order_count && file_index_table_cmp_at(t, pos, folded_path, path) == 0) {
+    file_index_record_t *rec = &t->records[t->order[pos]];
+    rec->size = info->size;
+    rec->mtime = info->mtime;
+    rec->kind = (uint8_t)info->kind;
+    return 0;
+  }
+
+  if (file_index_table_reserve_order(t, 1u) != 0 ||
+      file_index_table_append(t, path, info, &id) != 0) {
+    return 1;
+  }
+  memmove(&t->order[pos + 1u], &t->order[pos],
+          (t->order_count - pos) * sizeof(*t->order));
+  t->order[pos] = id;
+  t->order_count++;
+  return 0;
+}
+
+static void file_index_table_remove_tree(file_index_table_t *t, const char *path,
+                                         const char *folded_path) {
+  size_t path_len = strlen(path);
+  size_t start = file_index_table_lower_bound(t, folded_path, NULL);
+  size_t end = start;
+  size_t kept = start;
+
+  while (end < t->order_count) {
+    file_index_record_t *rec = &t->records[t->order[end]];
+    const char *rec_path = t->paths + rec->off;
+
+    if (strncmp(t->folded + rec->off, folded_path, path_len) != 0) {
+      break;
+    }
+    if (strncmp(rec_path, path, path_len) == 0 &&
+        (rec_path[path_len] == '\0' || rec_path[path_len] == '/')) {
+      rec->dead = 1;
+      t->dead_bytes += (size_t)rec->len + 1u;
+    } else {
+      t->order[kept++] = t->order[end];
+    }
+    end++;
+  }
+
+  memmove(&t->order[kept], &t->order[end],
+          (t->order_count - end) * sizeof(*t->order));
+  t->order_count -= end - kept;
+}
+
+static int file_index_table_compact(file_index_table_t *t) {
+  file_index_table_t next = {0};
+
+  if (t->dead_bytes < FILE_INDEX_COMPACT_MIN_BYTES ||
+      t->dead_bytes < t->pool_len / 2u) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < t->order_count; i++) {
+    const file_index_record_t *rec = &t->records[t->order[i]];
+    fs_path_info_t info = file_index_record_info(rec);
+    uint32_t id = 0;
+
+    if (file_index_table_append(&next, t->paths + rec->off, &info, &id) != 0) {
+      file_index_table_free(&next);
+      return 1;
+    }
+  }
+  if (file_index_table_reserve_order(&next, next.record_count) != 0) {
+    file_index_table_free(&next);
+    return 1;
+  }
+  for (size_t i = 0; i < next.record_count; i++) {
+    next.order[i] = (uint32_t)i;
+  }
+  next.order_count = next.record_count;
+
+  file_index_table_free(t);
+  *t = next;
+  return 0;
+}
+
+// Folds a sorted batch into the live table with one linear merge instead of
+// shifting the order array once per inserted path.
+static int file_index_table_merge(file_index_table_t *dst, const file_index_table_t *src) {
+  uint32_t *added = NULL;
+  uint32_t *merged = NULL;
+  size_t added_count = 0;
+  size_t i = 0;
+  size_t j = 0;
+  size_t k = 0;
+
+  if (src->order_count == 0) {
+    return 0;
+  }
+  added = (uint32_t *)malloc(src->order_count * sizeof(*added));
+  if (added == NULL) {
+    return 1;
+  }
+
+  for (size_t s = 0; s < src->order_count; s++) {
+    const file_index_record_t *rec = &src->records[src->order[s]];
+    const char *path = src->paths + rec->off;
+    const char *folded = src->folded + rec->off;
+    fs_path_info_t info = file_index_record_info(rec);
+    size_t pos = file_index_table_lower_bound(dst, folded, path);
+
+    if (pos < dst->order_count && file_index_table_cmp_at(dst, pos, folded, path) == 0) {
+      file_index_record_t *existing = &dst->records[dst->order[pos]];
+      existing->size = rec->size;
+      existing->mtime = rec->mtime;
+      existing->kind = rec->kind;
+      continue;
+    }
+    if (file_index_table_append(dst, path, &info, &added[added_count]) != 0) {
+      free(added);
+      return 1;
+    }
+    added_count++;
+  }
+
+  if (added_count == 0) {
+    free(added);
+    return 0;
+  }
+
+  merged = (uint32_t *)malloc((dst->order_count + added_count) * sizeof(*merged));
+  if (merged == NULL) {
+    free(added);
+    return 1;
+  }
+  while (i < dst->order_count || j < added_count) {
+    if (j == added_count) {
+      merged[k++] = dst->order[i++];
+    } else if (i == dst->order_count) {
+      merged[k++] = added[j++];
+    } else {
+      const file_index_record_t *a = &dst->records[dst->order[i]];
+      const file_index_record_t *b = &dst->records[added[j]];
+      int cmp = strcmp(dst->folded + a->off, dst->folded + b->off);
+      if (cmp == 0) {
+        cmp = strcmp(dst->paths + a->off, dst->paths + b->off);
+      }
+      merged[k++] = cmp <= 0 ? dst->order[i++] : added[j++];
+    }
+  }
+
+  free(dst->order);
+  free(added);
+  dst->order = merged;
+  dst->order_count = k;
+  dst->order_cap = k;
+  return 0;
+}
+
+static const file_index_record_t *file_index_table_record_at(const file_index_table_t *t,
+                                                             size_t off) {
+  size_t lo = 0;
+  size_t hi = t->record_count;
+
+  while (hi - lo > 1u) {
+    size_t mid = lo + (hi - lo) / 2u;
+    if (t->records[mid].off <= off) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return &t->records[lo];
+}
+
+typedef struct {
+  file_index_table_t *table;
+  const char *relative_dir;
+  char **stack;
+  size_t stack_count;
+  size_t stack_cap;
+  int failed;
+} file_index_scan_ctx_t;
+
+static int file_index_scan_visit(const char *name, const fs_path_info_t *info,
+                                 void *arg) {
+  file_index_scan_ctx_t *ctx = (file_index_scan_ctx_t *)arg;
+  char relative_path[4096];
+  uint32_t id = 0;
+  int n = 0;
+
+  if (fs_is_temp_name(name)) {
+    return 0;
+  }
+  n = ctx->relative_dir[0] != '\0'
+        ? snprintf(relative_path, sizeof(relative_path), "%s/%s", ctx->relative_dir, name)
+        : snprintf(relative_path, sizeof(relative_path), "%s", name);
+  if (n < 0 || (size_t)n >= sizeof(relative_path)) {
+    return 0;
+  }
+
+  if (file_index_table_append(ctx->table, relative_path, info, &id) != 0) {
+    ctx->failed = 1;
+    return 1;
+  }
+  if (info->kind != FS_PATH_KIND_DIR) {
+    return 0;
+  }
+
+  if (ctx->stack_count == ctx->stack_cap) {
+    size_t next_cap = ctx->stack_cap == 0 ? 64u : ctx->stack_cap * 2u;
+    char **next = (char **)realloc(ctx->stack, next_cap * sizeof(*next));
+    if (next == NULL) {
+      ctx->failed = 1;
+      return 1;
+    }
+    ctx->stack = next;
+    ctx->stack_cap = next_cap;
+  }
+  ctx->stack[ctx->stack_count] = strdup(relative_path);
+  if (ctx->stack[ctx->stack_count] == NULL) {
+    ctx->failed = 1;
+    return 1;
+  }
+  ctx->stack_count++;
+  return 0;
+}
+
+static int file_index_scan_tree(file_index_table_t *t, const char *relative_root) {
+  file_index_scan_ctx_t ctx = {0};
+  int exit_code = 0;
+
+  ctx.table = t;
+  ctx.stack = (char **)malloc(sizeof(*ctx.stack));
+  if (ctx.stack == NULL) {
+    return 1;
+  }
+  ctx.stack_cap = 1;
+  ctx.stack[0] = strdup(relative_root);
+  if (ctx.stack[0] == NULL) {
+    free(ctx.stack);
+    return 1;
+  }
+  ctx.stack_count = 1;
+
+  while (ctx.stack_count > 0) {
+    char full_path[4096];
+    char *relative_dir = ctx.stack[--ctx.stack_count];
+
+    if (g_file_index.stopping) {
+      free(relative_dir);
+      exit_code = 1;
+      break;
+    }
+    if (g_file_index.watching) {
+      (void)fs_watch_add_dir(relative_dir);
+    }
+
+    ctx.relative_dir = relative_dir;
+    if (fs_join_relative_path(full_path, sizeof(full_path), g_file_index.root_dir,
+                              relative_dir) == 0) {
+      (void)fs_list_dir(full_path, file_index_scan_visit, &ctx);
+    }
+    free(relative_dir);
+    if (ctx.failed) {
+      exit_code = 1;
+      break;
+    }
+  }
+
+  while (ctx.stack_count > 0) {
+    free(ctx.stack[--ctx.stack_count]);
+  }
+  free(ctx.stack);
+
+  if (exit_code == 0 && file_index_table_sort(t) != 0) {
+    exit_code = 1;
+  }
+  return exit_code;
+}
+
+static void file_index_revalidate(const char *relative_path) {
+  char full_path[4096];
+  char folded_path[4096];
+  size_t len = strlen(relative_path);
+  fs_path_info_t info = {0};
+
+  if (len >= sizeof(folded_path) ||
+      fs_join_relative_path(full_path, sizeof(full_path), g_file_index.root_dir,
+                            relative_path) != 0) {
+    return;
+  }
+  file_index_fold(folded_path, relative_path, len);
+
+  if (fs_stat_path(full_path, &info) != 0) {
+    file_index_lock();
+    file_index_table_remove_tree(&g_file_index.table, relative_path, folded_path);
+    (void)file_index_table_compact(&g_file_index.table);
+    file_index_unlock();
+    return;
+  }
+
+  file_index_lock();
+  if (file_index_table_upsert(&g_file_index.table, relative_path, folded_path,
+                              &info) != 0) {
+    fprintf(stderr, "file index: failed to record %s\n", relative_path);
+  }
+  file_index_unlock();
+
+  if (info.kind == FS_PATH_KIND_DIR) {
+    file_index_table_t subtree = {0};
+    if (file_index_scan_tree(&subtree, relative_path) == 0) {
+      file_index_lock();
+      if (file_index_table_merge(&g_file_index.table, &subtree) != 0) {
+        fprintf(stderr, "file index: failed to merge %s\n", relative_path);
+      }
+      file_index_unlock();
+    }
+    file_index_table_free(&subtree);
+  }
+}
+
+#ifdef _WIN32
+static unsigned __stdcall file_index_thread_main(void *arg) {
+#else
+static void *file_index_thread_main(void *arg) {
+#endif
+  (void)arg;
+
+  while (!g_file_index.stopping) {
+    file_index_table_t built = {0};
+    char **pending = NULL;
+    size_t pending_count = 0;
+    uint32_t waited_ms = 0;
+
+    file_index_lock();
+    g_file_index.building = 1;
+    g_file_index.rescan_requested = 0;
+    file_index_unlock();
+
+    int rc = file_index_scan_tree(&built, "");
+
+    file_index_lock();
+    g_file_index.building = 0;
+    if (rc == 0 && !g_file_index.stopping) {
+      file_index_table_free(&g_file_index.table);
+      g_file_index.table = built;
+      g_file_index.ready = 1;
+    } else {
+      file_index_table_free(&built);
+      if (!g_file_index.stopping) {
+        fprintf(stderr, "file index: failed to scan %s\n", g_file_index.root_dir);
+      }
+    }
+    pending = g_file_index.pending;
+    pending_count = g_file_index.pending_count;
+    g_file_index.pending = NULL;
+    g_file_index.pending_count = 0;
+    g_file_index.pending_cap = 0;
+    file_index_unlock();
+
+    for (size_t i = 0; i < pending_count; i++) {
+      if (!g_file_index.stopping) {
+        file_index_revalidate(pending[i]);
+      }
+      free(pending[i]);
+    }
+    free(pending);
+
+    file_index_lock();
+    while (!g_file_index.stopping && !g_file_index.rescan_requested) {
+      if (!g_file_index.watching && waited_ms >= FILE_INDEX_RESCAN_INTERVAL_MS) {
+        break;
+      }
+      file_index_wait(FILE_INDEX_WAIT_SLICE_MS);
+      waited_ms += FILE_INDEX_WAIT_SLICE_MS;
+    }
+    file_index_unlock();
+  }
+
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+int file_index_start(const char *root_dir, int watching) {
+  int n = 0;
+
+  if (root_dir == NULL || g_file_index.initialized) {
+    return 1;
+  }
+
+  memset(&g_file_index, 0, sizeof(g_file_index));
+  n = snprintf(g_file_index.root_dir, sizeof(g_file_index.root_dir), "%s", root_dir);
+  if (n < 0 || (size_t)n >= sizeof(g_file_index.root_dir)) {
+    return 1;
+  }
+  g_file_index.watching = watching ? 1 : 0;
+
+#ifdef _WIN32
+  InitializeCriticalSection(&g_file_index.mutex);
+  InitializeConditionVariable(&g_file_index.cond);
+  {
+    uintptr_t handle = _beginthreadex(NULL, 0, file_index_thread_main, NULL, 0, NULL);
+    if (handle == 0) {
+      fprintf(stderr, "_beginthreadex(file_index) failed\n");
+      DeleteCriticalSection(&g_file_index.mutex);
+      return 1;
+    }
+    g_file_index.thread = (HANDLE)handle;
+  }
+#else
+  if (pthread_mutex_init(&g_file_index.mutex, NULL) != 0) {
+    return 1;
+  }
+  if (pthread_cond_init(&g_file_index.cond, NULL) != 0) {
+    (void)pthread_mutex_destroy(&g_file_index.mutex);
+    return 1;
+  }
+  {
+    int err = pthread_create(&g_file_index.thread, NULL, file_index_thread_main, NULL);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create(file_index): %s\n", strerror(err));
+      (void)pthread_cond_destroy(&g_file_index.cond);
+      (void)pthread_mutex_destroy(&g_file_index.mutex);
+      return 1;
+    }
+  }
+#endif
+
+  g_file_index.initialized = 1;
+  return 0;
+}
+
+void file_index_shutdown(void) {
+  if (!g_file_index.initialized) {
+    return;
+  }
+
+  file_index_lock();
+  g_file_index.stopping = 1;
+  file_index_signal();
+  file_index_unlock();
+
+#ifdef _WIN32
+  if (g_file_index.thread != NULL) {
+    (void)WaitForSingleObject(g_file_index.thread, INFINITE);
+    CloseHandle(g_file_index.thread);
+    g_file_index.thread = NULL;
+  }
+#else
+  (void)pthread_join(g_file_index.thread, NULL);
+#endif
+}
+
+void file_index_cleanup(void) {
+  if (!g_file_index.initialized) {
+    return;
+  }
+
+  file_index_shutdown();
+  file_index_table_free(&g_file_index.table);
+  for (size_t i = 0; i < g_file_index.pending_count; i++) {
+    free(g_file_index.pending[i]);
+  }
+  free(g_file_index.pending);
+  g_file_index.pending = NULL;
+  g_file_index.pending_count = 0;
+
+#ifdef _WIN32
+  DeleteCriticalSection(&g_file_index.mutex);
+#else
+  (void)pthread_cond_destroy(&g_file_index.cond);
+  (void)pthread_mutex_destroy(&g_file_index.mutex);
+#endif
+
+  g_file_index.initialized = 0;
+}
+
+void file_index_note_path(const char *relative_path) {
+  const char *name = NULL;
+
+  if (!g_file_index.initialized || g_file_index.stopping ||
+      fs_validate_relative_path(relative_path) != 0) {
+    return;
+  }
+  name = strrchr(relative_path, '/');
+  if (fs_is_temp_name(name != NULL ? name + 1 : relative_path)) {
+    return;
+  }
+
+  file_index_lock();
+  if (g_file_index.building) {
+    if (g_file_index.pending_count == g_file_index.pending_cap) {
+      size_t next_cap = g_file_index.pending_cap == 0 ? 64u : g_file_index.pending_cap * 2u;
+      char **next = (char **)realloc(g_file_index.pending, next_cap * sizeof(*next));
+      if (next == NULL) {
+        g_file_index.rescan_requested = 1;
+        file_index_unlock();
+        return;
+      }
+      g_file_index.pending = next;
+      g_file_index.pending_cap = next_cap;
+    }
+    g_file_index.pending[g_file_index.pending_count] = strdup(relative_path);
+    if (g_file_index.pending[g_file_index.pending_count] != NULL) {
+      g_file_index.pending_count++;
+    } else {
+      g_file_index.rescan_requested = 1;
+    }
+    file_index_unlock();
+    return;
+  }
+  file_index_unlock();
+
+  file_index_revalidate(relative_path);
+}
+
+void file_index_request_rescan(void) {
+  if (!g_file_index.initialized) {
+    return;
+  }
+
+  file_index_lock();
+  g_file_index.rescan_requested = 1;
+  file_index_signal();
+  file_index_unlock();
+}
+
+int file_index_search(const char *query,
+                      file_index_match_t match,
+                      size_t limit,
+                      file_index_visit_fn visit,
+                      void *ctx,
+                      file_index_status_t *status_out) {
+  char folded_query[4096];
+  size_t query_len = 0;
+  size_t hits = 0;
+  const file_index_table_t *t = &g_file_index.table;
+
+  if (!g_file_index.initialized || query == NULL || visit == NULL) {
+    return 1;
+  }
+  query_len = strlen(query);
+  if (query_len == 0 || query_len >= sizeof(folded_query)) {
+    return 1;
+  }
+  file_index_fold(folded_query, query, query_len);
+
+  file_index_lock();
+  if (status_out != NULL) {
+    status_out->ready = g_file_index.ready;
+    status_out->entry_count = t->order_count;
+  }
+
+  if (match == FILE_INDEX_MATCH_PREFIX) {
+    for (size_t pos = file_index_table_lower_bound(t, folded_query, NULL);
+         pos < t->order_count && hits < limit; pos++) {
+      const file_index_record_t *rec = &t->records[t->order[pos]];
+      fs_path_info_t info = file_index_record_info(rec);
+
+      if (strncmp(t->folded + rec->off, folded_query, query_len) != 0) {
+        break;
+      }
+      hits++;
+      if (visit(t->paths + rec->off, &info, ctx) != 0) {
+        break;
+      }
+    }
+  } else {
+    size_t off = 0;
+    while (off < t->pool_len && hits < limit) {
+      const char *hit = file_index_find_bytes(t->folded + off, t->pool_len - off,
+                                              folded_query, query_len);
+      if (hit == NULL) {
+        break;
+      }
+
+      const file_index_record_t *rec =
+        file_index_table_record_at(t, (size_t)(hit - t->folded));
+      off = (size_t)rec->off + rec->len + 1u;
+      if (rec->dead) {
+        continue;
+      }
+
+      fs_path_info_t info = file_index_record_info(rec);
+      hits++;
+      if (visit(t->paths + rec->off, &info, ctx) != 0) {
+        break;
+      }
+    }
+  }
+  file_index_unlock();
+  return 0;
+}
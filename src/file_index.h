@@ -0,0 +1,35 @@
+#ifndef HF_FILE_INDEX_H
+#define HF_FILE_INDEX_H
+
+#include "fs.h"
+
+#include <stddef.h>
+
+typedef enum {
+  FILE_INDEX_MATCH_SUBSTRING = 0,
+  FILE_INDEX_MATCH_PREFIX,
+} file_index_match_t;
+
+typedef struct {
+  int ready;
+  size_t entry_count;
+} file_index_status_t;
+
+// Called with the index lock held; return nonzero to stop the search.
+typedef int (*file_index_visit_fn)(const char *relative_path,
+                                   const fs_path_info_t *info,
+                                   void *ctx);
+
+int file_index_start(const char *root_dir, int watching);
+void file_index_shutdown(void);
+void file_index_cleanup(void);
+void file_index_note_path(const char *relative_path);
+void file_index_request_rescan(void);
+int file_index_search(const char *query,
+                      file_index_match_t match,
+                      size_t limit,
+                      file_index_visit_fn visit,
+                      void *ctx,
+                      file_index_status_t *status_out);
+
+#endif  // HF_FILE_INDEX_H
@@ -1,7 +1,14 @@
+#ifdef __linux__
+  #ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+  #endif
+#endif
+
 #include "fs.h"
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef _WIN32
@@ -11,6 +18,7 @@
 #else
   #include <dirent.h>
   #include <fcntl.h>
+  #include <sys/mman.h>
   #include <sys/stat.h>
   #include <unistd.h>
 #endif
@@ -28,6 +36,8 @@ static uint64_t fs_filetime_to_unix_seconds(FILETIME filetime) {
 }
 #endif
 
+#define FS_WALK_PATH_MAX 4096u
+
 static int fs_remove_tree_validate(const char *path);
 static int fs_remove_tree_impl(const char *path);
 
@@ -49,6 +59,35 @@ ssize_t fs_read(int fd, void *buf, size_t len) {
 #endif
 }
 
+ssize_t fs_pread(int fd, void *buf, size_t len, uint64_t offset) {
+#ifdef _WIN32
+  HANDLE handle = (HANDLE)_get_osfhandle(fd);
+  OVERLAPPED ov;
+  DWORD got = 0;
+
+  if (handle == INVALID_HANDLE_VALUE) {
+    errno = EBADF;
+    return -1;
+  }
+  memset(&ov, 0, sizeof(ov));
+  ov.Offset = (DWORD)(offset & 0xFFFFFFFFu);
+  ov.OffsetHigh = (DWORD)(offset >> 32);
+  if (len > 0x7FFFFFFFu) {
+    len = 0x7FFFFFFFu;
+  }
+  if (!ReadFile(handle, buf, (DWORD)len, &got, &ov)) {
+    if (GetLastError() == ERROR_HANDLE_EOF) {
+      return 0;
+    }
+    errno = EIO;
+    return -1;
+  }
+  return (ssize_t)got;
+#else
+  return pread(fd, buf, len, (off_t)offset);
+#endif
+}
+
 ssize_t fs_write(int fd, const void *buf, size_t len) {
 #ifdef _WIN32
   int n = _write(fd, buf, (unsigned)len);
@@ -58,6 +97,109 @@ ssize_t fs_write(int fd, const void *buf, size_t len) {
 #endif
 }
 
+ssize_t fs_pwrite(int fd, const void *buf, size_t len, uint64_t offset) {
+#ifdef _WIN32
+  HANDLE handle = (HANDLE)_get_osfhandle(fd);
+  OVERLAPPED ov;
+  DWORD put = 0;
+
+  if (handle == INVALID_HANDLE_VALUE) {
+    errno = EBADF;
+    return -1;
+  }
+  memset(&ov, 0, sizeof(ov));
+  ov.Offset = (DWORD)(offset & 0xFFFFFFFFu);
+  ov.OffsetHigh = (DWORD)(offset >> 32);
+  if (len > 0x7FFFFFFFu) {
+    len = 0x7FFFFFFFu;
+  }
+  if (!WriteFile(handle, buf, (DWORD)len, &put, &ov)) {
+    errno = EIO;
+    return -1;
+  }
+  return (ssize_t)put;
+#else
+  return pwrite(fd, buf, len, (off_t)offset);
+#endif
+}
+
+// Reserves blocks for a range about to be written where the filesystem
+// allows it, so the range cannot run out of space half way. Elsewhere it is a
+// no-op; the writes themselves allocate.
+int fs_preallocate(int fd, uint64_t offset, uint64_t len) {
+#if defined(__linux__)
+  if (len == 0) {
+    return 0;
+  }
+  int rc = posix_fallocate(fd, (off_t)offset, (off_t)len);
+  if (rc == 0 || rc == EOPNOTSUPP || rc == EINVAL) {
+    return 0;
+  }
+  errno = rc;
+  return 1;
+#else
+  (void)fd;
+  (void)offset;
+  (void)len;
+  return 0;
+#endif
+}
+
+int fs_truncate(int fd, uint64_t size) {
+#ifdef _WIN32
+  return _chsize_s(fd, (__int64)size) == 0 ? 0 : 1;
+#else
+  return ftruncate(fd, (off_t)size) == 0 ? 0 : 1;
+#endif
+}
+
+int fs_map_readonly(int fd, uint64_t size, const void **data_out) {
+  if (data_out == NULL || size == 0 || size > (uint64_t)SIZE_MAX) {
+    return 1;
+  }
+#ifdef _WIN32
+  HANDLE handle = (HANDLE)_get_osfhandle(fd);
+  HANDLE mapping = NULL;
+  void *data = NULL;
+
+  if (handle == INVALID_HANDLE_VALUE) {
+    return 1;
+  }
+  mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, (DWORD)(size >> 32),
+                               (DWORD)(size & 0xFFFFFFFFu), NULL);
+  if (mapping == NULL) {
+    return 1;
+  }
+  // The view keeps the mapping object alive on its own.
+  data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)size);
+  (void)CloseHandle(mapping);
+  if (data == NULL) {
+    return 1;
+  }
+  *data_out = data;
+  return 0;
+#else
+  void *data = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    return 1;
+  }
+  *data_out = data;
+  return 0;
+#endif
+}
+
+void fs_unmap(const void *data, uint64_t size) {
+  if (data == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  (void)size;
+  (void)UnmapViewOfFile(data);
+#else
+  (void)munmap((void *)data, (size_t)size);
+#endif
+}
+
 int fs_close(int fd) {
 #ifdef _WIN32
   return _close(fd);
@@ -74,6 +216,78 @@ int fs_seek_start(int fd) {
 #endif
 }
 
+int fs_sync_file(int fd) {
+#ifdef _WIN32
+  return _commit(fd) == 0 ? 0 : 1;
+#elif defined(__APPLE__)
+  if (fcntl(fd, F_FULLFSYNC) == 0) {
+    return 0;
+  }
+  return fsync(fd) == 0 ? 0 : 1;
+#elif defined(__linux__)
+  return fdatasync(fd) == 0 ? 0 : 1;
+#else
+  return fsync(fd) == 0 ? 0 : 1;
+#endif
+}
+
+int fs_sync_dir(const char *dir_path) {
+#ifdef _WIN32
+  (void)dir_path;
+  return 0;
+#else
+  int flags = O_RDONLY;
+  #ifdef O_DIRECTORY
+  flags |= O_DIRECTORY;
+  #endif
+  int fd = open(dir_path, flags);
+  int rc = 0;
+
+  if (fd < 0) {
+    return 1;
+  }
+  if (fsync(fd) != 0 && errno != EINVAL) {
+    rc = 1;
+  }
+  (void)close(fd);
+  return rc;
+#endif
+}
+
+int fs_set_mtime(int fd, uint64_t mtime) {
+#ifdef _WIN32
+  HANDLE handle = (HANDLE)_get_osfhandle(fd);
+  ULARGE_INTEGER value;
+  FILETIME filetime;
+
+  if (handle == INVALID_HANDLE_VALUE) {
+    return 1;
+  }
+  value.QuadPart = mtime * 10000000ULL + 116444736000000000ULL;
+  filetime.dwLowDateTime = value.LowPart;
+  filetime.dwHighDateTime = value.HighPart;
+  return SetFileTime(handle, NULL, NULL, &filetime) ? 0 : 1;
+#else
+  struct timespec times[2];
+
+  times[0].tv_sec = 0;
+  times[0].tv_nsec = UTIME_OMIT;
+  times[1].tv_sec = (time_t)mtime;
+  times[1].tv_nsec = 0;
+  return futimens(fd, times) == 0 ? 0 : 1;
+#endif
+}
+
+// Starts asynchronous writeback so a later fs_sync_file has little left to do.
+void fs_writeback_range(int fd, uint64_t offset, uint64_t len) {
+#if defined(__linux__)
+  (void)sync_file_range(fd, (off64_t)offset, (off64_t)len, SYNC_FILE_RANGE_WRITE);
+#else
+  (void)fd;
+  (void)offset;
+  (void)len;
+#endif
+}
 
 ssize_t fs_write_all(int fd, const void *buf, size_t len) {
   const char *p = buf;
@@ -91,6 +305,24 @@ ssize_t fs_write_all(int fd, const void *buf, size_t len) {
   return (ssize_t)total;
 }
 
+ssize_t fs_pwrite_all(int fd, const void *buf, size_t len, uint64_t offset) {
+  const char *p = (const char *)buf;
+  size_t total = 0;
+
+  while (total < len) {
+    ssize_t n = fs_pwrite(fd, p + total, len - total, offset + total);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += (size_t)n;
+  }
+  return (ssize_t)total;
+}
+
 int fs_validate_file_name(const char *file_name) {
   if (file_name == NULL || file_name[0] == '\0') return 1;
   if (strchr(file_name, '/') != NULL) return 1;
@@ -163,6 +395,39 @@ int fs_join_relative_path(char *out, size_t out_cap, const char *base_dir,
   return 0;
 }
 
+int fs_make_parent_dirs(const char *base_dir, const char *relative_path) {
+  char prefix[4096];
+  char full_path[4096];
+
+  if (base_dir == NULL || fs_validate_relative_path(relative_path) != 0) {
+    errno = EINVAL;
+    return 1;
+  }
+
+  for (const char *slash = strchr(relative_path, '/'); slash != NULL;
+       slash = strchr(slash + 1, '/')) {
+    size_t len = (size_t)(slash - relative_path);
+    if (len >= sizeof(prefix)) {
+      errno = ENAMETOOLONG;
+      return 1;
+    }
+    memcpy(prefix, relative_path, len);
+    prefix[len] = '\0';
+    if (fs_join_relative_path(full_path, sizeof(full_path), base_dir, prefix) != 0) {
+      errno = ENAMETOOLONG;
+      return 1;
+    }
+#ifdef _WIN32
+    if (_mkdir(full_path) != 0 && errno != EEXIST) {
+#else
+    if (mkdir(full_path, 0755) != 0 && errno != EEXIST) {
+#endif
+      return 1;
+    }
+  }
+  return 0;
+}
+
 int fs_stat_path(const char *path, fs_path_info_t *out) {
   if (path == NULL || out == NULL) {
     return 1;
@@ -238,6 +503,29 @@ int fs_build_temp_path(
   return 0;
 }
 
+int fs_is_temp_name(const char *name) {
+  const char *marker = NULL;
+  const char *p = NULL;
+  int dots = 0;
+
+  if (name == NULL) return 0;
+  for (p = strstr(name, ".tmp."); p != NULL; p = strstr(p + 1, ".tmp.")) {
+    marker = p;
+  }
+  if (marker == NULL || marker == name) return 0;
+
+  p = marker + 5;
+  if (*p < '0' || *p > '9') return 0;
+  for (; *p != '\0'; p++) {
+    if (*p == '.') {
+      if (dots++ != 0 || p[1] < '0' || p[1] > '9') return 0;
+      continue;
+    }
+    if (*p < '0' || *p > '9') return 0;
+  }
+  return dots == 1;
+}
+
 int fs_open_temp_file(const char *tmp_path) {
   if (tmp_path == NULL) {
     errno = EINVAL;
@@ -273,6 +561,246 @@ int fs_commit_temp_file(
 #endif
 }
 
+int fs_list_dir(const char *dir_path, fs_dir_visit_fn visit, void *ctx) {
+  if (dir_path == NULL || visit == NULL) {
+    errno = EINVAL;
+    return 1;
+  }
+
+#ifdef _WIN32
+  char pattern[4096];
+  WIN32_FIND_DATAA find_data;
+  HANDLE handle = INVALID_HANDLE_VALUE;
+
+  if (fs_join_path(pattern, sizeof(pattern), dir_path, "*") != 0) {
+    errno = ENAMETOOLONG;
+    return 1;
+  }
+
+  handle = FindFirstFileA(pattern, &find_data);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return GetLastError() == ERROR_FILE_NOT_FOUND ? 0 : 1;
+  }
+
+  do {
+    const char *name = find_data.cFileName;
+    fs_path_info_t info = {0};
+
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+    info.mtime = fs_filetime_to_unix_seconds(find_data.ftLastWriteTime);
+    if (find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+      info.kind = FS_PATH_KIND_SYMLINK;
+    } else if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      info.kind = FS_PATH_KIND_DIR;
+    } else {
+      info.kind = FS_PATH_KIND_FILE;
+      info.size = ((uint64_t)find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow;
+    }
+    if (visit(name, &info, ctx) != 0) {
+      FindClose(handle);
+      return 1;
+    }
+  } while (FindNextFileA(handle, &find_data) != 0);
+
+  if (GetLastError() != ERROR_NO_MORE_FILES) {
+    FindClose(handle);
+    errno = EIO;
+    return 1;
+  }
+
+  FindClose(handle);
+  return 0;
+#else
+  DIR *dp = opendir(dir_path);
+  struct dirent *de = NULL;
+
+  if (dp == NULL) {
+    return 1;
+  }
+
+  while ((errno = 0, de = readdir(dp)) != NULL) {
+    fs_path_info_t info = {0};
+    struct stat st;
+
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+      continue;
+    }
+    if (fstatat(dirfd(dp), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      continue;
+    }
+
+    info.mtime = (uint64_t)st.st_mtime;
+    if (S_ISLNK(st.st_mode)) {
+      info.kind = FS_PATH_KIND_SYMLINK;
+    } else if (S_ISDIR(st.st_mode)) {
+      info.kind = FS_PATH_KIND_DIR;
+    } else if (S_ISREG(st.st_mode) && st.st_size >= 0) {
+      info.kind = FS_PATH_KIND_FILE;
+      info.size = (uint64_t)st.st_size;
+    } else {
+      info.kind = FS_PATH_KIND_OTHER;
+    }
+    if (visit(de->d_name, &info, ctx) != 0) {
+      closedir(dp);
+      return 1;
+    }
+  }
+
+  if (errno != 0) {
+    closedir(dp);
+    return 1;
+  }
+
+  return closedir(dp) == 0 ? 0 : 1;
+#endif
+}
+
+int fs_path_cmp(const char *a, const char *b) {
+  const unsigned char *p = (const unsigned char *)a;
+  const unsigned char *q = (const unsigned char *)b;
+
+  while (*p != '\0' && *p == *q) {
+    p++;
+    q++;
+  }
+  if (*p == *q) return 0;
+  if (*p == '\0') return -1;
+  if (*q == '\0') return 1;
+  if (*p == '/') return -1;
+  if (*q == '/') return 1;
+  return *p < *q ? -1 : 1;
+}
+
+typedef struct {
+  char *name;
+  fs_path_info_t info;
+} fs_walk_entry_t;
+
+typedef struct {
+  fs_walk_entry_t *entries;
+  size_t count;
+  size_t cap;
+} fs_walk_dir_t;
+
+static int fs_walk_collect(const char *name, const fs_path_info_t *info, void *ctx) {
+  fs_walk_dir_t *dir = (fs_walk_dir_t *)ctx;
+  size_t len = strlen(name);
+
+  if (info->kind != FS_PATH_KIND_DIR &&
+      (info->kind != FS_PATH_KIND_FILE || fs_is_temp_name(name))) {
+    return 0;
+  }
+  if (dir->count == dir->cap) {
+    size_t cap = dir->cap == 0 ? 64u : dir->cap * 2u;
+    fs_walk_entry_t *entries =
+      (fs_walk_entry_t *)realloc(dir->entries, cap * sizeof(*entries));
+    if (entries == NULL) {
+      errno = ENOMEM;
+      return 1;
+    }
+    dir->entries = entries;
+    dir->cap = cap;
+  }
+  dir->entries[dir->count].name = (char *)malloc(len + 1u);
+  if (dir->entries[dir->count].name == NULL) {
+    errno = ENOMEM;
+    return 1;
+  }
+  memcpy(dir->entries[dir->count].name, name, len + 1u);
+  dir->entries[dir->count].info = *info;
+  dir->count++;
+  return 0;
+}
+
+static int fs_walk_entry_cmp(const void *lhs, const void *rhs) {
+  return strcmp(((const fs_walk_entry_t *)lhs)->name,
+                ((const fs_walk_entry_t *)rhs)->name);
+}
+
+// full and relative are extended in place for each child and restored after,
+// so the whole walk shares two path buffers.
+static int fs_walk_dir(char *full, size_t full_len, char *relative, size_t relative_len,
+                       fs_dir_visit_fn visit, void *ctx) {
+  fs_walk_dir_t dir = {0};
+  int rc = 1;
+
+  if (fs_list_dir(full, fs_walk_collect, &dir) != 0) {
+    goto CLEANUP;
+  }
+  if (dir.count > 1u) {
+    qsort(dir.entries, dir.count, sizeof(*dir.entries), fs_walk_entry_cmp);
+  }
+
+  for (size_t i = 0; i < dir.count; i++) {
+    const fs_walk_entry_t *entry = &dir.entries[i];
+    size_t name_len = strlen(entry->name);
+    size_t child_full_len = full_len + 1u + name_len;
+    size_t child_relative_len = relative_len + (relative_len > 0 ? 1u : 0u) + name_len;
+
+    if (child_full_len >= FS_WALK_PATH_MAX || child_relative_len >= FS_WALK_PATH_MAX) {
+      errno = ENAMETOOLONG;
+      goto CLEANUP;
+    }
+#ifdef _WIN32
+    full[full_len] = '\\';
+#else
+    full[full_len] = '/';
+#endif
+    memcpy(full + full_len + 1u, entry->name, name_len + 1u);
+    if (relative_len > 0) {
+      relative[relative_len] = '/';
+    }
+    memcpy(relative + child_relative_len - name_len, entry->name, name_len + 1u);
+
+    if (entry->info.kind == FS_PATH_KIND_DIR) {
+      if (fs_walk_dir(full, child_full_len, relative, child_relative_len, visit, ctx) != 0) {
+        goto CLEANUP;
+      }
+    } else if (visit(relative, &entry->info, ctx) != 0) {
+      goto CLEANUP;
+    }
+  }
+  rc = 0;
+
+CLEANUP:
+  full[full_len] = '\0';
+  relative[relative_len] = '\0';
+  for (size_t i = 0; i < dir.count; i++) {
+    free(dir.entries[i].name);
+  }
+  free(dir.entries);
+  return rc;
+}
+
+int fs_walk_files(const char *root, fs_dir_visit_fn visit, void *ctx) {
+  char full[FS_WALK_PATH_MAX];
+  char relative[FS_WALK_PATH_MAX];
+  size_t len = 0;
+
+  if (root == NULL || visit == NULL) {
+    errno = EINVAL;
+    return 1;
+  }
+  len = strlen(root);
+#ifdef _WIN32
+  while (len > 1u && (root[len - 1u] == '/' || root[len - 1u] == '\\')) {
+#else
+  while (len > 1u && root[len - 1u] == '/') {
+#endif
+    len--;
+  }
+  if (len == 0 || len >= sizeof(full)) {
+    errno = ENAMETOOLONG;
+    return 1;
+  }
+  memcpy(full, root, len);
+  full[len] = '\0';
+  relative[0] = '\0';
+  return fs_walk_dir(full, len, relative, 0, visit, ctx);
+}
+
 int fs_remove_tree(const char *path) {
   if (path == NULL || path[0] == '\0') {
     errno = EINVAL;
@@ -41,15 +41,33 @@ typedef struct {
   fs_path_kind_t kind;
   uint64_t size;
   uint64_t mtime;
+  // Only filled for opened downloads; zero where the platform lacks them.
+  uint64_t file_id;
+  uint32_t mtime_nsec;
 } fs_path_info_t;
 
+typedef int (*fs_dir_visit_fn)(const char *name, const fs_path_info_t *info,
+                               void *ctx);
+
 int fs_basename_from_path(const char **file_path, const char **file_name);
 
 int fs_open(const char *path, int flags, int mode);
 ssize_t fs_read(int fd, void *buf, size_t len);
+ssize_t fs_pread(int fd, void *buf, size_t len, uint64_t offset);
 ssize_t fs_write(int fd, const void *buf, size_t len);
+ssize_t fs_pwrite(int fd, const void *buf, size_t len, uint64_t offset);
+ssize_t fs_pwrite_all(int fd, const void *buf, size_t len, uint64_t offset);
+int fs_preallocate(int fd, uint64_t offset, uint64_t len);
+int fs_truncate(int fd, uint64_t size);
+// Read-only view of the first size bytes; size must be non-zero.
+int fs_map_readonly(int fd, uint64_t size, const void **data_out);
+void fs_unmap(const void *data, uint64_t size);
 int fs_close(int fd);
 int fs_seek_start(int fd);
+int fs_sync_file(int fd);
+int fs_sync_dir(const char *dir_path);
+void fs_writeback_range(int fd, uint64_t offset, uint64_t len);
+int fs_set_mtime(int fd, uint64_t mtime);
 
 ssize_t fs_write_all(int fd, const void *buf, size_t len);
 
@@ -58,6 +76,8 @@ int fs_validate_relative_path(const char *path);
 int fs_join_path(char *out, size_t out_cap, const char *dir, const char *file);
 int fs_join_relative_path(char *out, size_t out_cap, const char *base_dir,
                           const char *relative_path);
+// Creates every missing directory above the last segment of relative_path.
+int fs_make_parent_dirs(const char *base_dir, const char *relative_path);
 int fs_stat_path(const char *path, fs_path_info_t *out);
 int fs_build_temp_path(
   char *out,
@@ -65,11 +85,20 @@ int fs_build_temp_path(
   const char *final_path,
   int pid,
   int attempt);
+int fs_is_temp_name(const char *name);
 int fs_open_temp_file(const char *tmp_path);
 int fs_commit_temp_file(
   const char *tmp_path,
   const char *final_path,
   unsigned long *win_err);
+int fs_list_dir(const char *dir_path, fs_dir_visit_fn visit, void *ctx);
+// Orders '/'-separated relative paths the way fs_walk_files visits them:
+// bytewise, except that '/' sorts before every other byte.
+int fs_path_cmp(const char *a, const char *b);
+// Visits every regular file below root, depth first with each directory's
+// entries in byte order, passing its '/'-separated path relative to root.
+// Symlinks and upload temp files are skipped.
+int fs_walk_files(const char *root, fs_dir_visit_fn visit, void *ctx);
 int fs_remove_tree(const char *path);
 void fs_remove_ignore_error(const char *path);
 
@@ -0,0 +1,346 @@
+#include "fs_watch.h"
+
+#include "fs.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+  #include <poll.h>
+  #include <pthread.h>
+  #include <sys/inotify.h>
+  #include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+#define FS_WATCH_POLL_INTERVAL_MS 250
+#define FS_WATCH_EVENT_BUF_SIZE (64u * 1024u)
+// IN_MODIFY catches writers that rewrite a file in place and keep it open;
+// the kernel coalesces repeats, so a long write does not flood the queue.
+#define FS_WATCH_MASK                                                     \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | \
+   IN_MODIFY | IN_ATTRIB | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+typedef struct {
+  int wd;
+  char *path;
+} fs_watch_dir_t;
+
+typedef struct {
+  int fd;
+  int running;
+  volatile int stopping;
+  char root_dir[4096];
+  fs_watch_callback_t callback;
+  void *ctx;
+  fs_watch_dir_t *dirs;
+  size_t dir_count;
+  size_t dir_cap;
+  int limit_reported;
+  pthread_t tid;
+  pthread_mutex_t mutex;
+} fs_watch_state_t;
+
+static fs_watch_state_t g_fs_watch = {.fd = -1};
+
+static size_t fs_watch_find_slot(int wd) {
+  size_t lo = 0;
+  size_t hi = g_fs_watch.dir_count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2u;
+    if (g_fs_watch.dirs[mid].wd < wd) {
+      lo = mid + 1u;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static int fs_watch_put_dir(int wd, const char *relative_dir) {
+  size_t slot = fs_watch_find_slot(wd);
+  char *copy = strdup(relative_dir);
+
+  if (copy == NULL) {
+    return 1;
+  }
+
+  if (slot < g_fs_watch.dir_count && g_fs_watch.dirs[slot].wd == wd) {
+    free(g_fs_watch.dirs[slot].path);
+    g_fs_watch.dirs[slot].path = copy;
+    return 0;
+  }
+
+  if (g_fs_watch.dir_count == g_fs_watch.dir_cap) {
+    size_t next_cap = g_fs_watch.dir_cap == 0 ? 64u : g_fs_watch.dir_cap * 2u;
+    fs_watch_dir_t *next =
+      (fs_watch_dir_t *)realloc(g_fs_watch.dirs, next_cap * sizeof(*next));
+    if (next == NULL) {
+      free(copy);
+      return 1;
+    }
+    g_fs_watch.dirs = next;
+    g_fs_watch.dir_cap = next_cap;
+  }
+
+  memmove(&g_fs_watch.dirs[slot + 1u], &g_fs_watch.dirs[slot],
+          (g_fs_watch.dir_count - slot) * sizeof(*g_fs_watch.dirs));
+  g_fs_watch.dirs[slot].wd = wd;
+  g_fs_watch.dirs[slot].path = copy;
+  g_fs_watch.dir_count++;
+  return 0;
+}
+
+static void fs_watch_drop_dir(int wd) {
+  size_t slot = fs_watch_find_slot(wd);
+
+  if (slot >= g_fs_watch.dir_count || g_fs_watch.dirs[slot].wd != wd) {
+    return;
+  }
+
+  free(g_fs_watch.dirs[slot].path);
+  memmove(&g_fs_watch.dirs[slot], &g_fs_watch.dirs[slot + 1u],
+          (g_fs_watch.dir_count - slot - 1u) * sizeof(*g_fs_watch.dirs));
+  g_fs_watch.dir_count--;
+}
+
+// A moved-away subtree would keep reporting under its old name; drop its
+// watches so a rescan can register them again at the new location.
+static void fs_watch_forget_subtree(const char *relative_dir) {
+  size_t len = strlen(relative_dir);
+  size_t kept = 0;
+
+  for (size_t i = 0; i < g_fs_watch.dir_count; i++) {
+    const char *path = g_fs_watch.dirs[i].path;
+    if (strncmp(path, relative_dir, len) == 0 &&
+        (path[len] == '\0' || path[len] == '/')) {
+      (void)inotify_rm_watch(g_fs_watch.fd, g_fs_watch.dirs[i].wd);
+      free(g_fs_watch.dirs[i].path);
+      continue;
+    }
+    g_fs_watch.dirs[kept++] = g_fs_watch.dirs[i];
+  }
+  g_fs_watch.dir_count = kept;
+}
+
+static int fs_watch_dispatch(const struct inotify_event *ev) {
+  char relative_path[4096];
+  int is_dir = (ev->mask & IN_ISDIR) != 0;
+  fs_watch_event_t event = 0;
+  size_t slot = 0;
+
+  if (ev->mask & IN_Q_OVERFLOW) {
+    g_fs_watch.callback("", FS_WATCH_EVENT_RESCAN, 1, g_fs_watch.ctx);
+    return 0;
+  }
+
+  (void)pthread_mutex_lock(&g_fs_watch.mutex);
+  slot = fs_watch_find_slot(ev->wd);
+  if (slot >= g_fs_watch.dir_count || g_fs_watch.dirs[slot].wd != ev->wd) {
+    (void)pthread_mutex_unlock(&g_fs_watch.mutex);
+    return 0;
+  }
+  if (ev->mask & IN_IGNORED) {
+    fs_watch_drop_dir(ev->wd);
+    (void)pthread_mutex_unlock(&g_fs_watch.mutex);
+    return 0;
+  }
+  if (ev->len == 0 || ev->name[0] == '\0') {
+    (void)pthread_mutex_unlock(&g_fs_watch.mutex);
+    return 0;
+  }
+
+  const char *dir = g_fs_watch.dirs[slot].path;
+  int n = dir[0] != '\0'
+            ? snprintf(relative_path, sizeof(relative_path), "%s/%s", dir, ev->name)
+            : snprintf(relative_path, sizeof(relative_path), "%s", ev->name);
+  if (n < 0 || (size_t)n >= sizeof(relative_path)) {
+    (void)pthread_mutex_unlock(&g_fs_watch.mutex);
+    return 0;
+  }
+  if (is_dir && (ev->mask & (IN_MOVED_FROM | IN_DELETE))) {
+    fs_watch_forget_subtree(relative_path);
+  }
+  (void)pthread_mutex_unlock(&g_fs_watch.mutex);
+
+  if (fs_is_temp_name(ev->name)) {
+    return 0;
+  }
+
+  if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+    event = FS_WATCH_EVENT_REMOVED;
+  } else if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_MODIFY |
+                          IN_ATTRIB)) {
+    event = FS_WATCH_EVENT_CHANGED;
+  } else {
+    return 0;
+  }
+
+  g_fs_watch.callback(relative_path, event, is_dir, g_fs_watch.ctx);
+  return 0;
+}
+
+static void *fs_watch_thread_main(void *arg) {
+  char buf[FS_WATCH_EVENT_BUF_SIZE]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  (void)arg;
+  while (!g_fs_watch.stopping) {
+    struct pollfd pfd;
+    pfd.fd = g_fs_watch.fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int rc = poll(&pfd, 1, FS_WATCH_POLL_INTERVAL_MS);
+    if (rc < 0) {
+      if (errno == EINTR) continue;
+      perror("poll(fs_watch)");
+      break;
+    }
+    if (rc == 0) {
+      continue;
+    }
+
+    ssize_t n = read(g_fs_watch.fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      perror("read(fs_watch)");
+      break;
+    }
+
+    for (ssize_t off = 0; off < n;) {
+      const struct inotify_event *ev = (const struct inotify_event *)(buf + off);
+      (void)fs_watch_dispatch(ev);
+      off += (ssize_t)(sizeof(*ev) + ev->len);
+    }
+  }
+
+  return NULL;
+}
+
+int fs_watch_supported(void) {
+  return 1;
+}
+
+int fs_watch_start(const char *root_dir, fs_watch_callback_t callback, void *ctx) {
+  int n = 0;
+
+  if (root_dir == NULL || callback == NULL || g_fs_watch.running) {
+    return 1;
+  }
+
+  n = snprintf(g_fs_watch.root_dir, sizeof(g_fs_watch.root_dir), "%s", root_dir);
+  if (n < 0 || (size_t)n >= sizeof(g_fs_watch.root_dir)) {
+    return 1;
+  }
+
+  g_fs_watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (g_fs_watch.fd < 0) {
+    perror("inotify_init1");
+    return 1;
+  }
+  if (pthread_mutex_init(&g_fs_watch.mutex, NULL) != 0) {
+    (void)close(g_fs_watch.fd);
+    g_fs_watch.fd = -1;
+    return 1;
+  }
+
+  g_fs_watch.callback = callback;
+  g_fs_watch.ctx = ctx;
+  g_fs_watch.stopping = 0;
+  g_fs_watch.limit_reported = 0;
+
+  int err = pthread_create(&g_fs_watch.tid, NULL, fs_watch_thread_main, NULL);
+  if (err != 0) {
+    fprintf(stderr, "pthread_create(fs_watch): %s\n", strerror(err));
+    (void)pthread_mutex_destroy(&g_fs_watch.mutex);
+    (void)close(g_fs_watch.fd);
+    g_fs_watch.fd = -1;
+    return 1;
+  }
+
+  g_fs_watch.running = 1;
+  return 0;
+}
+
+int fs_watch_add_dir(const char *relative_dir) {
+  char full_path[4096];
+  uint32_t mask = FS_WATCH_MASK;
+  int wd = -1;
+  int rc = 0;
+
+  if (!g_fs_watch.running || relative_dir == NULL) {
+    return 1;
+  }
+  if (fs_join_relative_path(full_path, sizeof(full_path), g_fs_watch.root_dir,
+                            relative_dir) != 0) {
+    return 1;
+  }
+  if (relative_dir[0] != '\0') {
+    mask |= IN_DONT_FOLLOW;
+  }
+
+  wd = inotify_add_watch(g_fs_watch.fd, full_path, mask);
+  if (wd < 0) {
+    if (errno == ENOSPC && !g_fs_watch.limit_reported) {
+      g_fs_watch.limit_reported = 1;
+      fprintf(stderr,
+              "inotify watch limit reached; index updates for new directories may lag\n");
+    }
+    return 1;
+  }
+
+  (void)pthread_mutex_lock(&g_fs_watch.mutex);
+  rc = fs_watch_put_dir(wd, relative_dir);
+  (void)pthread_mutex_unlock(&g_fs_watch.mutex);
+  return rc;
+}
+
+void fs_watch_stop(void) {
+  if (!g_fs_watch.running) {
+    return;
+  }
+
+  g_fs_watch.stopping = 1;
+  (void)pthread_join(g_fs_watch.tid, NULL);
+  (void)close(g_fs_watch.fd);
+  g_fs_watch.fd = -1;
+
+  for (size_t i = 0; i < g_fs_watch.dir_count; i++) {
+    free(g_fs_watch.dirs[i].path);
+  }
+  free(g_fs_watch.dirs);
+  g_fs_watch.dirs = NULL;
+  g_fs_watch.dir_count = 0;
+  g_fs_watch.dir_cap = 0;
+
+  (void)pthread_mutex_destroy(&g_fs_watch.mutex);
+  g_fs_watch.running = 0;
+}
+
+#else
+
+int fs_watch_supported(void) {
+  return 0;
+}
+
+int fs_watch_start(const char *root_dir, fs_watch_callback_t callback, void *ctx) {
+  (void)root_dir;
+  (void)callback;
+  (void)ctx;
+  return 1;
+}
+
+int fs_watch_add_dir(const char *relative_dir) {
+  (void)relative_dir;
+  return 1;
+}
+
+void fs_watch_stop(void) {
+}
+
+#endif
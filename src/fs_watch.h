@@ -0,0 +1,21 @@
+#ifndef HF_FS_WATCH_H
+#define HF_FS_WATCH_H
+
+typedef enum {
+  FS_WATCH_EVENT_CHANGED = 1,
+  FS_WATCH_EVENT_REMOVED,
+  FS_WATCH_EVENT_RESCAN,
+} fs_watch_event_t;
+
+// Invoked from the watcher thread with a path relative to the watched root.
+typedef void (*fs_watch_callback_t)(const char *relative_path,
+                                    fs_watch_event_t event,
+                                    int is_dir,
+                                    void *ctx);
+
+int fs_watch_supported(void);
+int fs_watch_start(const char *root_dir, fs_watch_callback_t callback, void *ctx);
+int fs_watch_add_dir(const char *relative_dir);
+void fs_watch_stop(void);
+
+#endif  // HF_FS_WATCH_H
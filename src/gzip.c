@@ -0,0 +1,202 @@
+#include "gzip.h"
+
+#include "crc32.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GZIP_WINDOW_SIZE 32768u
+#define GZIP_MIN_MATCH 3u
+#define GZIP_MAX_MATCH 258u
+#define GZIP_HASH_BITS 15u
+#define GZIP_HASH_SIZE (1u << GZIP_HASH_BITS)
+#define GZIP_MAX_CHAIN 128u
+
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+  uint32_t bit_buf;
+  unsigned bit_count;
+} gzip_writer_t;
+
+static const uint16_t gzip_length_base[29] = {
+  3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+  31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t gzip_length_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t gzip_dist_base[30] = {
+  1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+  193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t gzip_dist_extra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static void gzip_put_byte(gzip_writer_t *w, unsigned char byte) {
+  if (w->len < w->cap) {
+    w->data[w->len] = byte;
+  }
+  w->len++;
+}
+
+static void gzip_put_bits(gzip_writer_t *w, uint32_t value, unsigned count) {
+  w->bit_buf |= value << w->bit_count;
+  w->bit_count += count;
+  while (w->bit_count >= 8u) {
+    gzip_put_byte(w, (unsigned char)(w->bit_buf & 0xFFu));
+    w->bit_buf >>= 8;
+    w->bit_count -= 8u;
+  }
+}
+
+// Huffman codes are defined MSB-first but deflate packs bits LSB-first.
+static void gzip_put_code(gzip_writer_t *w, uint32_t code, unsigned count) {
+  uint32_t reversed = 0;
+  for (unsigned i = 0; i < count; i++) {
+    reversed = (reversed << 1) | ((code >> i) & 1u);
+  }
+  gzip_put_bits(w, reversed, count);
+}
+
+static void gzip_put_literal(gzip_writer_t *w, unsigned symbol) {
+  if (symbol <= 143u) {
+    gzip_put_code(w, 0x30u + symbol, 8);
+  } else if (symbol <= 255u) {
+    gzip_put_code(w, 0x190u + (symbol - 144u), 9);
+  } else if (symbol <= 279u) {
+    gzip_put_code(w, symbol - 256u, 7);
+  } else {
+    gzip_put_code(w, 0xC0u + (symbol - 280u), 8);
+  }
+}
+
+static void gzip_put_match(gzip_writer_t *w, unsigned length, unsigned distance) {
+  unsigned li = 28;
+  unsigned di = 29;
+
+  while (gzip_length_base[li] > length) {
+    li--;
+  }
+  gzip_put_literal(w, 257u + li);
+  gzip_put_bits(w, length - gzip_length_base[li], gzip_length_extra[li]);
+
+  while (gzip_dist_base[di] > distance) {
+    di--;
+  }
+  gzip_put_code(w, di, 5);
+  gzip_put_bits(w, distance - gzip_dist_base[di], gzip_dist_extra[di]);
+}
+
+static uint32_t gzip_hash3(const unsigned char *p) {
+  uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+  return (v * 2654435761u) >> (32u - GZIP_HASH_BITS);
+}
+
+static void gzip_put_u32_le(gzip_writer_t *w, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    gzip_put_byte(w, (unsigned char)((v >> (8 * i)) & 0xFFu));
+  }
+}
+
+int gzip_compress(const void *data, size_t len, char **out_data, size_t *out_len) {
+  static const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+  const unsigned char *in = (const unsigned char *)data;
+  gzip_writer_t w = {0};
+  int32_t *head = NULL;
+  int32_t *prev = NULL;
+  size_t pos = 0;
+
+  if ((data == NULL && len > 0) || out_data == NULL || out_len == NULL ||
+      len > (size_t)INT32_MAX) {
+    return 1;
+  }
+
+  // Fixed codes never exceed 9 bits per literal.
+  w.cap = sizeof(header) + len + len / 8u + 64u;
+  w.data = (unsigned char *)malloc(w.cap);
+  head = (int32_t *)malloc(GZIP_HASH_SIZE * sizeof(*head));
+  prev = (int32_t *)malloc((len > 0 ? len : 1u) * sizeof(*prev));
+  if (w.data == NULL || head == NULL || prev == NULL) {
+    free(w.data);
+    free(head);
+    free(prev);
+    return 1;
+  }
+  memset(head, 0xff, GZIP_HASH_SIZE * sizeof(*head));
+
+  for (size_t i = 0; i < sizeof(header); i++) {
+    gzip_put_byte(&w, header[i]);
+  }
+  gzip_put_bits(&w, 1u, 1);
+  gzip_put_bits(&w, 1u, 2);
+
+  while (pos < len) {
+    unsigned best_len = 0;
+    unsigned best_dist = 0;
+
+    if (len - pos >= GZIP_MIN_MATCH) {
+      uint32_t h = gzip_hash3(in + pos);
+      size_t max_len = len - pos < GZIP_MAX_MATCH ? len - pos : GZIP_MAX_MATCH;
+      int32_t cand = head[h];
+      unsigned chain = 0;
+
+      while (cand >= 0 && pos - (size_t)cand <= GZIP_WINDOW_SIZE &&
+             chain++ < GZIP_MAX_CHAIN) {
+        const unsigned char *a = in + cand;
+        const unsigned char *b = in + pos;
+        unsigned n = 0;
+        while (n < max_len && a[n] == b[n]) {
+          n++;
+        }
+        if (n > best_len) {
+          best_len = n;
+          best_dist = (unsigned)(pos - (size_t)cand);
+          if (n == max_len) {
+            break;
+          }
+        }
+        cand = prev[cand];
+      }
+      prev[pos] = head[h];
+      head[h] = (int32_t)pos;
+    }
+
+    if (best_len >= GZIP_MIN_MATCH) {
+      gzip_put_match(&w, best_len, best_dist);
+      for (size_t k = 1; k < best_len; k++) {
+        size_t p = pos + k;
+        if (len - p >= GZIP_MIN_MATCH) {
+          uint32_t h = gzip_hash3(in + p);
+          prev[p] = head[h];
+          head[h] = (int32_t)p;
+        }
+      }
+      pos += best_len;
+    } else {
+      gzip_put_literal(&w, in[pos]);
+      pos++;
+    }
+  }
+
+  gzip_put_literal(&w, 256u);
+  if (w.bit_count > 0) {
+    gzip_put_bits(&w, 0, 8u - w.bit_count);
+  }
+  gzip_put_u32_le(&w, crc32_update(0, in, len));
+  gzip_put_u32_le(&w, (uint32_t)len);
+
+  free(head);
+  free(prev);
+  if (w.len > w.cap) {
+    free(w.data);
+    return 1;
+  }
+
+  *out_data = (char *)w.data;
+  *out_len = w.len;
+  return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef HF_GZIP_H
+#define HF_GZIP_H
+
+#include <stddef.h>
+
+// Single-member gzip stream using LZ77 + fixed Huffman codes. Meant for
+// small, static payloads; the caller frees *out_data.
+int gzip_compress(const void *data, size_t len, char **out_data, size_t *out_len);
+
+#endif  // HF_GZIP_H
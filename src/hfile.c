@@ -11,13 +11,27 @@
 static inline void init_server_opt(const Opt *opt, server_opt_t *server_opt) {
   server_opt->path = opt->path;
   server_opt->port = opt->port;
+  server_opt->rate_limit = opt->rate_limit;
+  server_opt->global_rate_limit = opt->global_rate_limit;
+  server_opt->durable = opt->durable;
+  server_opt->message_log_path = opt->message_log_path;
 }
 
 static inline void init_client_opt(const Opt *opt, client_opt_t *client_opt) {
   client_opt->path = opt->path;
+  client_opt->paths = opt->paths;
+  client_opt->path_count = opt->path_count;
+  client_opt->stream_name = opt->stream_name;
+  client_opt->jobs = opt->jobs;
+  client_opt->checksum = opt->checksum;
+  client_opt->json = opt->json;
+  client_opt->rate_limit = opt->rate_limit;
+  client_opt->global_rate_limit = opt->global_rate_limit;
   client_opt->remote_path = opt->remote_path;
   client_opt->output_path = opt->output_path;
   client_opt->message = opt->message;
+  client_opt->channel = opt->channel;
+  client_opt->mime = opt->mime;
   client_opt->ip = opt->ip;
   client_opt->port = opt->port;
   client_opt->msg_type = opt->msg_type;
@@ -66,6 +80,10 @@ int main(int argc, char **argv) {
     client_opt_t client_opt = {0};
     init_client_opt(&opt, &client_opt);
     ret = client(&client_opt);
+  } else if (opt.mode == sync_mode) {
+    client_opt_t client_opt = {0};
+    init_client_opt(&opt, &client_opt);
+    ret = client_sync(&client_opt);
   } else if (opt.mode == status_mode) {
     ret = control_status();
   } else if (opt.mode == stop_mode) {
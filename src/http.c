@@ -1,12 +1,23 @@
 #include "app_service.h"
 #include "http.h"
 
+#include "archive.h"
+#include "arena.h"
+#include "buf_pool.h"
+#include "conn_deadline.h"
+#include "crc32.h"
+#include "file_index.h"
 #include "fs.h"
 #include "message_store.h"
+#include "multipart.h"
 #include "net.h"
 #include "protocol.h"
 #include "shutdown.h"
+#include "sse_hub.h"
+#include "text_scan.h"
+#include "upload_session.h"
 #include "webui.h"
+#include "websocket.h"
 #include "picohttpparser.h"
 
 #include <ctype.h>
@@ -35,15 +46,25 @@
 #define HF_HTTP_HEADER_MAX 16384u
 #define HF_HTTP_MAX_HEADERS 64u
 #define HF_HTTP_PATH_MAX 1024u
-#define HF_HTTP_CONTENT_TYPE_MAX 128u
+#define HF_HTTP_CONTENT_TYPE_MAX 256u
+#define HF_HTTP_VALIDATOR_MAX 256u
 #define HF_HTTP_UPLOAD_MAX (16ULL * 1024ULL * 1024ULL * 1024ULL)
 #define HF_HTTP_MESSAGE_BODY_TIMEOUT_MS 30000u
 #define HF_HTTP_UPLOAD_BODY_TIMEOUT_MS 120000u
-
+#define HF_HTTP_SEARCH_DEFAULT_LIMIT 100u
+#define HF_HTTP_SEARCH_MAX_LIMIT 1000u
+#define HF_HTTP_ARENA_INLINE 8192u
+#define HF_HTTP_SCRATCH_INLINE 512u
+#define HF_HTTP_ARCHIVE_MAX_ENTRIES (1024u * 1024u)
+#define HF_HTTP_WS_PING_INTERVAL_MS 15000u
+
+// Buffers with an arena grow inside it and are reclaimed with the request;
+// without one they fall back to the heap.
 typedef struct {
   char *data;
   size_t len;
   size_t cap;
+  arena_t *arena;
 } http_buf_t;
 
 typedef struct {
@@ -54,6 +75,16 @@ typedef struct {
   uint64_t content_length;
   int has_content_length;
   int has_transfer_encoding;
+  int accepts_gzip;
+  char if_none_match[HF_HTTP_VALIDATOR_MAX];
+  char if_modified_since[64];
+  char content_range[96];
+  char last_event_id[32];
+  int upgrade_websocket;
+  int connection_upgrade;
+  int websocket_version;
+  char websocket_key[32];
+  arena_t *arena;
 } http_request_t;
 
 typedef struct {
@@ -77,7 +108,9 @@ static int http_buf_reserve(http_buf_t *buf, size_t need) {
     new_cap *= 2u;
   }
 
-  char *new_data = (char *)realloc(buf->data, new_cap);
+  char *new_data = buf->arena != NULL
+                     ? (char *)arena_grow(buf->arena, buf->data, buf->cap, new_cap)
+                     : (char *)realloc(buf->data, new_cap);
   if (new_data == NULL) {
     return 1;
   }
@@ -107,7 +140,7 @@ static int http_buf_append_ch(http_buf_t *buf, char ch) {
 }
 
 static void http_buf_free(http_buf_t *buf) {
-  if (buf->data != NULL) {
+  if (buf->data != NULL && buf->arena == NULL) {
     free(buf->data);
   }
   buf->data = NULL;
@@ -162,17 +195,41 @@ static int http_set_connection_recv_timeout(socket_t conn, uint32_t timeout_ms)
 #endif
 }
 
+// One recv that retries EINTR, as recv_all does.
+static ssize_t http_recv_some(socket_t conn, void *buf, size_t len) {
+  for (;;) {
+#ifdef _WIN32
+    int n = recv(conn, (char *)buf, (int)len, 0);
+    if (n == SOCKET_ERROR) {
+      if (WSAGetLastError() == WSAEINTR) continue;
+      return -1;
+    }
+#else
+    ssize_t n = recv(conn, buf, len, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+#endif
+    if (n > 0) {
+      conn_deadline_progress((uint64_t)n);
+    }
+    return (ssize_t)n;
+  }
+}
+
 static int http_discard_body(socket_t conn, uint64_t content_length) {
   char buf[4096];
   uint64_t remaining = content_length;
 
+  conn_deadline_enter(CONN_DEADLINE_BODY);
   while (remaining > 0) {
     size_t want = sizeof(buf);
     if ((uint64_t)want > remaining) {
       want = (size_t)remaining;
     }
 
-    ssize_t n = recv(conn, buf, want, 0);
+    ssize_t n = http_recv_some(conn, buf, want);
     if (n < 0) {
       sock_perror("recv(http_discard_body)");
       return 1;
@@ -183,6 +240,7 @@ static int http_discard_body(socket_t conn, uint64_t content_length) {
     remaining -= (uint64_t)n;
   }
 
+  conn_deadline_enter(CONN_DEADLINE_NONE);
   return 0;
 }
 
@@ -234,63 +292,15 @@ static int http_send_sse_headers(socket_t conn) {
            : 1;
 }
 
-static int http_send_sse_message_event(socket_t conn, const char *message) {
-  http_buf_t event = {0};
-  int exit_code = 1;
-
-  if (http_buf_append_str(&event, "event: message\n") != 0 ||
-      http_buf_append_str(&event, "data: ") != 0) {
-    goto CLEANUP;
-  }
-
-  if (message != NULL) {
-    const char *line = message;
-    const char *next = NULL;
-
-    for (;;) {
-      next = strchr(line, '\n');
-      if (next == NULL) {
-        if (http_buf_append(&event, line, strlen(line)) != 0) {
-          goto CLEANUP;
-        }
-        break;
-      }
-      if (http_buf_append(&event, line, (size_t)(next - line)) != 0 ||
-          http_buf_append_str(&event, "\ndata: ") != 0) {
-        goto CLEANUP;
-      }
-      line = next + 1;
-    }
-  }
-
-  if (http_buf_append_str(&event, "\n\n") != 0) {
-    goto CLEANUP;
-  }
-
-  if (send_all(conn, event.data, event.len) != (ssize_t)event.len) {
-    goto CLEANUP;
-  }
-
-  exit_code = 0;
-
-CLEANUP:
-  http_buf_free(&event);
-  return exit_code;
-}
-
-static int http_send_sse_keepalive(socket_t conn) {
-  static const char keepalive[] = ": keep-alive\n\n";
-  return send_all(conn, keepalive, sizeof(keepalive) - 1u) ==
-         (ssize_t)(sizeof(keepalive) - 1u)
-           ? 0
-           : 1;
-}
-
 static int http_send_json_error(socket_t conn, int status, const char *reason,
                                 const char *message) {
-  http_buf_t body = {0};
+  char scratch[HF_HTTP_SCRATCH_INLINE];
+  arena_t arena;
+  http_buf_t body = {.arena = &arena};
   int exit_code = 1;
 
+  arena_init(&arena, scratch, sizeof(scratch));
+
   if (http_buf_append_str(&body, "{\"error\":\"") != 0) {
     goto CLEANUP;
   }
@@ -338,7 +348,7 @@ static int http_send_json_error(socket_t conn, int status, const char *reason,
   exit_code = 0;
 
 CLEANUP:
-  http_buf_free(&body);
+  arena_release(&arena);
   return exit_code;
 }
 
@@ -405,6 +415,218 @@ static int http_copy_header_value(char *dst, size_t dst_cap,
   return 0;
 }
 
+static const char *const http_weekday_names[7] = {
+  "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat",
+};
+static const char *const http_month_names[12] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+};
+
+static int64_t http_days_from_civil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2u;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = (unsigned)(y - era * 400);
+  unsigned doy = (153u * (m > 2u ? m - 3u : m + 9u) + 2u) / 5u + d - 1u;
+  unsigned doe = yoe * 365u + yoe / 4u - yoe / 100u + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+// IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+static int http_format_date(uint64_t unix_seconds, char *out, size_t out_cap) {
+  int64_t days = (int64_t)(unix_seconds / 86400u);
+  unsigned secs = (unsigned)(unix_seconds % 86400u);
+  int64_t z = days + 719468;
+  int64_t era = z / 146097;
+  unsigned doe = (unsigned)(z - era * 146097);
+  unsigned yoe = (doe - doe / 1460u + doe / 36524u - doe / 146096u) / 365u;
+  unsigned doy = doe - (365u * yoe + yoe / 4u - yoe / 100u);
+  unsigned mp = (5u * doy + 2u) / 153u;
+  unsigned day = doy - (153u * mp + 2u) / 5u + 1u;
+  unsigned month = mp < 10u ? mp + 3u : mp - 9u;
+  int64_t year = (int64_t)yoe + era * 400 + (month <= 2u);
+
+  int n = snprintf(out, out_cap, "%s, %02u %s %04" PRId64 " %02u:%02u:%02u GMT",
+                   http_weekday_names[(days + 4) % 7], day, http_month_names[month - 1u],
+                   year, secs / 3600u, (secs / 60u) % 60u, secs % 60u);
+  return n < 0 || (size_t)n >= out_cap;
+}
+
+static int http_parse_digits(const char *s, size_t count, unsigned *out) {
+  unsigned v = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (s[i] < '0' || s[i] > '9') {
+      return 1;
+    }
+    v = v * 10u + (unsigned)(s[i] - '0');
+  }
+  *out = v;
+  return 0;
+}
+
+static int http_parse_date(const char *s, uint64_t *out) {
+  unsigned day = 0;
+  unsigned month = 0;
+  unsigned year = 0;
+  unsigned hh = 0;
+  unsigned mm = 0;
+  unsigned ss = 0;
+
+  if (s == NULL || strlen(s) != 29u || s[3] != ',' || s[4] != ' ' || s[7] != ' ' ||
+      s[11] != ' ' || s[16] != ' ' || s[19] != ':' || s[22] != ':' ||
+      strcmp(s + 25, " GMT") != 0) {
+    return 1;
+  }
+  if (http_parse_digits(s + 5, 2, &day) != 0 || http_parse_digits(s + 12, 4, &year) != 0 ||
+      http_parse_digits(s + 17, 2, &hh) != 0 || http_parse_digits(s + 20, 2, &mm) != 0 ||
+      http_parse_digits(s + 23, 2, &ss) != 0) {
+    return 1;
+  }
+  for (unsigned i = 0; i < 12u; i++) {
+    if (strncmp(s + 8, http_month_names[i], 3) == 0) {
+      month = i + 1u;
+      break;
+    }
+  }
+  if (month == 0 || day == 0 || day > 31u || year < 1970u || hh > 23u || mm > 59u ||
+      ss > 60u) {
+    return 1;
+  }
+
+  *out = (uint64_t)http_days_from_civil(year, month, day) * 86400u + hh * 3600u +
+         mm * 60u + ss;
+  return 0;
+}
+
+static int http_is_token_space(char ch) {
+  return ch == ' ' || ch == '\t';
+}
+
+// Matches one element of a comma-separated header list, case-insensitively.
+static int http_header_has_token(const char *value, size_t len, const char *token) {
+  size_t token_len = strlen(token);
+  size_t i = 0;
+
+  while (i < len) {
+    size_t start = 0;
+    size_t end = 0;
+
+    while (i < len && (http_is_token_space(value[i]) || value[i] == ',')) {
+      i++;
+    }
+    start = i;
+    while (i < len && value[i] != ',') {
+      i++;
+    }
+    end = i;
+    while (end > start && http_is_token_space(value[end - 1u])) {
+      end--;
+    }
+    if (end - start == token_len && http_ascii_starts_with(value + start, token)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Returns nonzero when the coding (or "*") is listed without q=0.
+static int http_accepts_coding(const char *value, size_t len, const char *coding) {
+  size_t coding_len = strlen(coding);
+  int coding_q = -1;
+  int star_q = -1;
+  size_t i = 0;
+
+  while (i < len) {
+    size_t start = 0;
+    size_t end = 0;
+    int q = 1;
+
+    while (i < len && (http_is_token_space(value[i]) || value[i] == ',')) {
+      i++;
+    }
+    start = i;
+    while (i < len && value[i] != ',' && value[i] != ';' && !http_is_token_space(value[i])) {
+      i++;
+    }
+    end = i;
+
+    while (i < len && value[i] != ',') {
+      if (value[i] == ';') {
+        i++;
+        while (i < len && http_is_token_space(value[i])) {
+          i++;
+        }
+        if (i + 1u < len && (value[i] == 'q' || value[i] == 'Q') && value[i + 1u] == '=') {
+          i += 2u;
+          q = 0;
+          for (; i < len && value[i] != ',' && value[i] != ';'; i++) {
+            if (value[i] >= '1' && value[i] <= '9') {
+              q = 1;
+            }
+          }
+          continue;
+        }
+      }
+      i++;
+    }
+
+    if (end - start == coding_len && http_ascii_starts_with(value + start, coding)) {
+      coding_q = q;
+    } else if (end - start == 1u && value[start] == '*') {
+      star_q = q;
+    }
+  }
+
+  return coding_q >= 0 ? coding_q : star_q > 0;
+}
+
+// Weak comparison as required for If-None-Match.
+static int http_etag_list_matches(const char *list, const char *etag) {
+  const char *p = list;
+  size_t etag_len = strlen(etag);
+
+  if (list == NULL || list[0] == '\0' || etag == NULL) {
+    return 0;
+  }
+
+  while (*p != '\0') {
+    const char *start = NULL;
+    size_t len = 0;
+
+    while (http_is_token_space(*p) || *p == ',') {
+      p++;
+    }
+    if (*p == '*') {
+      return 1;
+    }
+    if (strncmp(p, "W/", 2) == 0) {
+      p += 2;
+    }
+    start = p;
+    if (*p == '"') {
+      p++;
+      while (*p != '\0' && *p != '"') {
+        p++;
+      }
+      if (*p == '"') {
+        p++;
+      }
+    } else {
+      while (*p != '\0' && *p != ',') {
+        p++;
+      }
+    }
+    len = (size_t)(p - start);
+    if (len == etag_len && strncmp(start, etag, len) == 0) {
+      return 1;
+    }
+    while (*p != '\0' && *p != ',') {
+      p++;
+    }
+  }
+
+  return 0;
+}
+
 static int http_parse_request(char *header_block, http_request_t *req) {
   const char *method = NULL;
   const char *path = NULL;
@@ -466,6 +688,47 @@ static int http_parse_request(char *header_block, http_request_t *req) {
       }
     } else if (http_header_name_equals(header, "Transfer-Encoding")) {
       req->has_transfer_encoding = 1;
+    } else if (http_header_name_equals(header, "Accept-Encoding")) {
+      req->accepts_gzip = http_accepts_coding(header->value, header->value_len, "gzip");
+    } else if (http_header_name_equals(header, "If-None-Match")) {
+      // Oversized validators are ignored rather than rejected.
+      if (http_copy_header_value(req->if_none_match, sizeof(req->if_none_match),
+                                 header->value, header->value_len) != 0) {
+        req->if_none_match[0] = '\0';
+      }
+    } else if (http_header_name_equals(header, "If-Modified-Since")) {
+      if (http_copy_header_value(req->if_modified_since, sizeof(req->if_modified_since),
+                                 header->value, header->value_len) != 0) {
+        req->if_modified_since[0] = '\0';
+      }
+    } else if (http_header_name_equals(header, "Content-Range")) {
+      if (http_copy_header_value(req->content_range, sizeof(req->content_range),
+                                 header->value, header->value_len) != 0) {
+        req->content_range[0] = '\0';
+      }
+    } else if (http_header_name_equals(header, "Last-Event-ID")) {
+      if (http_copy_header_value(req->last_event_id, sizeof(req->last_event_id),
+                                 header->value, header->value_len) != 0) {
+        req->last_event_id[0] = '\0';
+      }
+    } else if (http_header_name_equals(header, "Upgrade")) {
+      req->upgrade_websocket =
+        http_header_has_token(header->value, header->value_len, "websocket");
+    } else if (http_header_name_equals(header, "Connection")) {
+      req->connection_upgrade =
+        http_header_has_token(header->value, header->value_len, "upgrade");
+    } else if (http_header_name_equals(header, "Sec-WebSocket-Key")) {
+      if (http_copy_header_value(req->websocket_key, sizeof(req->websocket_key),
+                                 header->value, header->value_len) != 0) {
+        req->websocket_key[0] = '\0';
+      }
+    } else if (http_header_name_equals(header, "Sec-WebSocket-Version")) {
+      uint64_t version = 0;
+      if (http_copy_header_value(header_value, sizeof(header_value), header->value,
+                                 header->value_len) == 0 &&
+          http_parse_u64(header_value, &version) == 0 && version <= 255u) {
+        req->websocket_version = (int)version;
+      }
     }
   }
 
@@ -594,41 +857,50 @@ static const char *http_relative_basename(const char *path) {
   return base != NULL ? base + 1 : path;
 }
 
+static int http_json_escape_byte(http_buf_t *buf, unsigned char ch) {
+  char escaped[7];
+
+  switch (ch) {
+    case '\\':
+      return http_buf_append_str(buf, "\\\\");
+    case '"':
+      return http_buf_append_str(buf, "\\\"");
+    case '\b':
+      return http_buf_append_str(buf, "\\b");
+    case '\f':
+      return http_buf_append_str(buf, "\\f");
+    case '\n':
+      return http_buf_append_str(buf, "\\n");
+    case '\r':
+      return http_buf_append_str(buf, "\\r");
+    case '\t':
+      return http_buf_append_str(buf, "\\t");
+    default: {
+      int n = snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+      return n < 0 ? 1 : http_buf_append(buf, escaped, (size_t)n);
+    }
+  }
+}
+
+// Copies runs that need no escaping in bulk; the scan is vectorized.
 static int http_json_escape(http_buf_t *buf, const char *text) {
-  for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++) {
-    char escaped[7];
-    switch (*p) {
-      case '\\':
-        if (http_buf_append_str(buf, "\\\\") != 0) return 1;
-        break;
-      case '"':
-        if (http_buf_append_str(buf, "\\\"") != 0) return 1;
-        break;
-      case '\b':
-        if (http_buf_append_str(buf, "\\b") != 0) return 1;
-        break;
-      case '\f':
-        if (http_buf_append_str(buf, "\\f") != 0) return 1;
-        break;
-      case '\n':
-        if (http_buf_append_str(buf, "\\n") != 0) return 1;
-        break;
-      case '\r':
-        if (http_buf_append_str(buf, "\\r") != 0) return 1;
-        break;
-      case '\t':
-        if (http_buf_append_str(buf, "\\t") != 0) return 1;
-        break;
-      default:
-        if (*p < 0x20u) {
-          int n = snprintf(escaped, sizeof(escaped), "\\u%04x", *p);
-          if (n < 0 || http_buf_append(buf, escaped, (size_t)n) != 0) {
-            return 1;
-          }
-        } else if (http_buf_append_ch(buf, (char)*p) != 0) {
-          return 1;
-        }
-        break;
+  size_t len = strlen(text);
+  size_t i = 0;
+
+  if (http_buf_reserve(buf, buf->len + len + 1u) != 0) {
+    return 1;
+  }
+  while (i < len) {
+    size_t run = text_scan_json_plain(text + i, len - i);
+    if (run > 0 && http_buf_append(buf, text + i, run) != 0) {
+      return 1;
+    }
+    i += run;
+    if (i < len) {
+      if (http_json_escape_byte(buf, (unsigned char)text[i]) != 0) {
+        return 1;
+      }
+      i++;
     }
   }
   return 0;
@@ -695,18 +967,31 @@ static int http_buf_append_utf8(http_buf_t *buf, uint32_t cp) {
   return http_buf_append(buf, encoded, len);
 }
 
-static int http_json_parse_string(const char **p_in, char **out) {
-  http_buf_t buf = {0};
+// Rejects raw text that is not well-formed UTF-8.
+static int http_json_parse_string(arena_t *arena, const char **p_in, char **out) {
+  http_buf_t buf = {.arena = arena};
   const char *p = *p_in;
+  const char *end = NULL;
   int exit_code = 1;
 
   if (*p != '"') {
     return 1;
   }
   p++;
+  end = p + strlen(p);
 
   while (*p != '\0' && *p != '"') {
-    unsigned char ch = (unsigned char)*p++;
+    size_t run = text_scan_json_plain(p, (size_t)(end - p));
+    unsigned char ch = 0;
+    if (run > 0) {
+      // Runs end on ASCII bytes, so a sequence split across runs is invalid.
+      if (!text_scan_utf8_valid(p, run) || http_buf_append(&buf, p, run) != 0) {
+        goto CLEANUP;
+      }
+      p += run;
+      continue;
+    }
+    ch = (unsigned char)*p++;
     if (ch == '\\') {
       ch = (unsigned char)*p++;
       switch (ch) {
@@ -781,43 +1066,29 @@ CLEANUP:
   return exit_code;
 }
 
-static int http_parse_message_json(const char *body, size_t len, char **message_out) {
-  char *copy = NULL;
+// The body must be NUL-terminated; the message is allocated from the arena.
+static int http_parse_message_json(arena_t *arena, const char *body,
+                                   char **message_out) {
   const char *p = NULL;
   char *key = NULL;
   char *value = NULL;
-  int exit_code = 1;
-
-  copy = (char *)malloc(len + 1u);
-  if (copy == NULL) {
-    return 1;
-  }
-  memcpy(copy, body, len);
-  copy[len] = '\0';
 
-  p = http_json_skip_ws(copy);
-  if (*p != '{') goto CLEANUP;
+  p = http_json_skip_ws(body);
+  if (*p != '{') return 1;
   p = http_json_skip_ws(p + 1);
-  if (http_json_parse_string(&p, &key) != 0) goto CLEANUP;
+  if (http_json_parse_string(arena, &p, &key) != 0) return 1;
   p = http_json_skip_ws(p);
-  if (*p != ':') goto CLEANUP;
+  if (*p != ':') return 1;
   p = http_json_skip_ws(p + 1);
-  if (http_json_parse_string(&p, &value) != 0) goto CLEANUP;
+  if (http_json_parse_string(arena, &p, &value) != 0) return 1;
   p = http_json_skip_ws(p);
-  if (*p != '}') goto CLEANUP;
+  if (*p != '}') return 1;
   p = http_json_skip_ws(p + 1);
-  if (*p != '\0') goto CLEANUP;
-  if (strcmp(key, "message") != 0) goto CLEANUP;
+  if (*p != '\0') return 1;
+  if (strcmp(key, "message") != 0) return 1;
 
   *message_out = value;
-  value = NULL;
-  exit_code = 0;
-
-CLEANUP:
-  if (key != NULL) free(key);
-  if (value != NULL) free(value);
-  if (copy != NULL) free(copy);
-  return exit_code;
+  return 0;
 }
 
 static int http_file_entry_cmp(const void *lhs, const void *rhs) {
@@ -828,244 +1099,207 @@ static int http_file_entry_cmp(const void *lhs, const void *rhs) {
   return strcmp(a->name, b->name);
 }
 
-static void http_free_file_entries(http_file_entry_t *entries, size_t count) {
-  if (entries == NULL) {
-    return;
-  }
-  for (size_t i = 0; i < count; i++) {
-    free(entries[i].name);
-    free(entries[i].path);
-  }
-  free(entries);
-}
-
-static int http_list_files(const char *dir, const char *relative_dir,
-                           http_file_entry_t **entries_out,
-                           size_t *count_out) {
-  http_file_entry_t *entries = NULL;
-  size_t count = 0;
-  size_t cap = 0;
-  int exit_code = 1;
+typedef struct {
+  arena_t *arena;
+  const char *relative_dir;
+  http_file_entry_t *entries;
+  size_t count;
+  size_t cap;
+  int failed;
+} http_list_ctx_t;
 
-#ifdef _WIN32
-  char pattern[4096];
-  WIN32_FIND_DATAA find_data;
-  HANDLE handle = INVALID_HANDLE_VALUE;
+static int http_list_visit(const char *name, const fs_path_info_t *info, void *opaque) {
+  http_list_ctx_t *ctx = (http_list_ctx_t *)opaque;
+  char relative_path[HF_HTTP_PATH_MAX];
+  http_file_entry_t *entry = NULL;
 
-  if (fs_join_path(pattern, sizeof(pattern), dir, "*") != 0) {
+  if (http_build_relative_child_path(relative_path, sizeof(relative_path),
+                                     ctx->relative_dir, name) != 0) {
+    ctx->failed = 1;
     return 1;
   }
 
-  handle = FindFirstFileA(pattern, &find_data);
-  if (handle == INVALID_HANDLE_VALUE) {
-    DWORD err = GetLastError();
-    if (err == ERROR_FILE_NOT_FOUND) {
-      *entries_out = NULL;
-      *count_out = 0;
-      return 0;
+  if (ctx->count == ctx->cap) {
+    size_t new_cap = ctx->cap == 0 ? 64u : ctx->cap * 2u;
+    http_file_entry_t *new_entries = (http_file_entry_t *)arena_grow(
+      ctx->arena, ctx->entries, ctx->cap * sizeof(*ctx->entries),
+      new_cap * sizeof(*ctx->entries));
+    if (new_entries == NULL) {
+      ctx->failed = 1;
+      return 1;
     }
+    ctx->entries = new_entries;
+    ctx->cap = new_cap;
+  }
+
+  entry = &ctx->entries[ctx->count];
+  entry->name = arena_strdup(ctx->arena, name);
+  entry->path = arena_strdup(ctx->arena, relative_path);
+  if (entry->name == NULL || entry->path == NULL) {
+    ctx->failed = 1;
     return 1;
   }
+  entry->kind = info->kind;
+  entry->size = info->kind == FS_PATH_KIND_FILE ? info->size : 0;
+  entry->mtime = info->mtime;
+  ctx->count++;
+  return 0;
+}
 
-  do {
-    const char *name = find_data.cFileName;
-    char full_path[4096];
-    char relative_path[HF_HTTP_PATH_MAX];
-    fs_path_info_t info = {0};
+// Entries and their strings live in the arena and go away with the request.
+static int http_list_files(arena_t *arena, const char *dir, const char *relative_dir,
+                           http_file_entry_t **entries_out, size_t *count_out) {
+  http_list_ctx_t ctx = {0};
 
-    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
-      continue;
-    }
-    if (fs_join_path(full_path, sizeof(full_path), dir, name) != 0) {
-      goto CLEANUP;
-    }
-    if (http_build_relative_child_path(relative_path, sizeof(relative_path),
-                                       relative_dir, name) != 0) {
-      goto CLEANUP;
-    }
-    if (fs_stat_path(full_path, &info) != 0) {
-      continue;
+  ctx.arena = arena;
+  ctx.relative_dir = relative_dir;
+  if (fs_list_dir(dir, http_list_visit, &ctx) != 0 || ctx.failed) {
+    if (!ctx.failed) {
+      perror("opendir");
     }
+    return 1;
+  }
 
-    if (count == cap) {
-      size_t new_cap = cap == 0 ? 8u : cap * 2u;
-      http_file_entry_t *new_entries =
-        (http_file_entry_t *)realloc(entries, new_cap * sizeof(*entries));
-      if (new_entries == NULL) {
-        goto CLEANUP;
-      }
-      entries = new_entries;
-      cap = new_cap;
-    }
+  if (ctx.count > 1u) {
+    qsort(ctx.entries, ctx.count, sizeof(*ctx.entries), http_file_entry_cmp);
+  }
 
-    entries[count].name = _strdup(name);
-    if (entries[count].name == NULL) {
-      goto CLEANUP;
-    }
-    entries[count].path = _strdup(relative_path);
-    if (entries[count].path == NULL) {
-      free(entries[count].name);
-      entries[count].name = NULL;
-      goto CLEANUP;
-    }
-    entries[count].kind = info.kind;
-    entries[count].size = info.kind == FS_PATH_KIND_FILE ? info.size : 0;
-    entries[count].mtime = info.mtime;
-    count++;
-  } while (FindNextFileA(handle, &find_data) != 0);
+  *entries_out = ctx.entries;
+  *count_out = ctx.count;
+  return 0;
+}
 
-  if (GetLastError() != ERROR_NO_MORE_FILES) {
-    goto CLEANUP;
+static int http_append_file_entry_json(http_buf_t *out, const char *name,
+                                       const char *path,
+                                       const fs_path_info_t *info) {
+  char numbuf[64];
+
+  if (http_buf_append_str(out, "{\"name\":\"") != 0 ||
+      http_json_escape(out, name) != 0 ||
+      http_buf_append_str(out, "\",\"path\":\"") != 0 ||
+      http_json_escape(out, path) != 0 ||
+      http_buf_append_str(out, "\",\"kind\":\"") != 0 ||
+      http_json_escape(out, http_path_kind_name(info->kind)) != 0 ||
+      http_buf_append_str(out, "\",\"size\":") != 0) {
+    return 1;
   }
 
-#else
-  DIR *dp = opendir(dir);
-  struct dirent *de = NULL;
+  int n = snprintf(numbuf, sizeof(numbuf), "%" PRIu64, info->size);
+  if (n < 0 || http_buf_append(out, numbuf, (size_t)n) != 0 ||
+      http_buf_append_str(out, ",\"mtime\":") != 0) {
+    return 1;
+  }
 
-  if (dp == NULL) {
-    perror("opendir");
+  n = snprintf(numbuf, sizeof(numbuf), "%" PRIu64, info->mtime);
+  if (n < 0 || http_buf_append(out, numbuf, (size_t)n) != 0 ||
+      http_buf_append_ch(out, '}') != 0) {
     return 1;
   }
+  return 0;
+}
 
-  while ((de = readdir(dp)) != NULL) {
-    const char *name = de->d_name;
-    char full_path[4096];
-    char relative_path[HF_HTTP_PATH_MAX];
-    fs_path_info_t info = {0};
+static int http_build_files_json(arena_t *arena, const char *dir,
+                                 const char *relative_dir, http_buf_t *out) {
+  http_file_entry_t *entries = NULL;
+  size_t count = 0;
 
-    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
-      continue;
-    }
+  if (http_list_files(arena, dir, relative_dir, &entries, &count) != 0) {
+    return 1;
+  }
 
-    if (fs_join_path(full_path, sizeof(full_path), dir, name) != 0) {
-      goto CLEANUP;
-    }
-    if (http_build_relative_child_path(relative_path, sizeof(relative_path),
-                                       relative_dir, name) != 0) {
-      goto CLEANUP;
+  if (http_buf_append_ch(out, '[') != 0) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    fs_path_info_t info = {0};
+    info.kind = entries[i].kind;
+    info.size = entries[i].size;
+    info.mtime = entries[i].mtime;
+    if (i > 0 && http_buf_append_ch(out, ',') != 0) {
+      return 1;
     }
-    if (fs_stat_path(full_path, &info) != 0) {
-      continue;
+    if (http_append_file_entry_json(out, entries[i].name, entries[i].path,
+                                    &info) != 0) {
+      return 1;
     }
+  }
 
-    if (count == cap) {
-      size_t new_cap = cap == 0 ? 8u : cap * 2u;
-      http_file_entry_t *new_entries =
-        (http_file_entry_t *)realloc(entries, new_cap * sizeof(*entries));
-      if (new_entries == NULL) {
-        goto CLEANUP;
-      }
-      entries = new_entries;
-      cap = new_cap;
-    }
+  return http_buf_append_ch(out, ']');
+}
 
-    entries[count].name = strdup(name);
-    if (entries[count].name == NULL) {
-      goto CLEANUP;
-    }
-    entries[count].path = strdup(relative_path);
-    if (entries[count].path == NULL) {
-      free(entries[count].name);
-      entries[count].name = NULL;
-      goto CLEANUP;
-    }
-    entries[count].kind = info.kind;
-    entries[count].size = info.kind == FS_PATH_KIND_FILE ? info.size : 0;
-    entries[count].mtime = info.mtime;
-    count++;
-  }
-
-#endif
-
-  if (count > 1u) {
-    qsort(entries, count, sizeof(*entries), http_file_entry_cmp);
-  }
-
-  *entries_out = entries;
-  *count_out = count;
-  exit_code = 0;
-  entries = NULL;
-
-CLEANUP:
-#ifdef _WIN32
-  if (handle != INVALID_HANDLE_VALUE) {
-    FindClose(handle);
-  }
-#else
-  if (dp != NULL) {
-    closedir(dp);
-  }
-#endif
-  http_free_file_entries(entries, count);
-  return exit_code;
-}
-
-static int http_build_files_json(const char *dir, const char *relative_dir,
-                                 http_buf_t *out) {
-  http_file_entry_t *entries = NULL;
-  size_t count = 0;
-  int exit_code = 1;
-
-  if (http_list_files(dir, relative_dir, &entries, &count) != 0) {
+static int http_send_status_only(socket_t conn, int status, const char *reason) {
+  char header[256];
+  int n = snprintf(header, sizeof(header),
+                   "HTTP/1.1 %d %s\r\n"
+                   "Content-Length: 0\r\n"
+                   "Connection: close\r\n"
+                   "\r\n",
+                   status, reason);
+  if (n < 0 || (size_t)n >= sizeof(header)) {
     return 1;
   }
+  return send_all(conn, header, (size_t)n) == (ssize_t)n ? 0 : 1;
+}
 
-  if (http_buf_append_ch(out, '[') != 0) {
-    goto CLEANUP;
-  }
-
-  for (size_t i = 0; i < count; i++) {
-    char numbuf[64];
-    if (i > 0 && http_buf_append_ch(out, ',') != 0) {
-      goto CLEANUP;
-    }
-    if (http_buf_append_str(out, "{\"name\":\"") != 0 ||
-        http_json_escape(out, entries[i].name) != 0 ||
-        http_buf_append_str(out, "\",\"path\":\"") != 0 ||
-        http_json_escape(out, entries[i].path) != 0 ||
-        http_buf_append_str(out, "\",\"kind\":\"") != 0 ||
-        http_json_escape(out, http_path_kind_name(entries[i].kind)) != 0 ||
-        http_buf_append_str(out, "\",\"size\":") != 0) {
-      goto CLEANUP;
-    }
-
-    int n = snprintf(numbuf, sizeof(numbuf), "%" PRIu64, entries[i].size);
-    if (n < 0 || http_buf_append(out, numbuf, (size_t)n) != 0 ||
-        http_buf_append_str(out, ",\"mtime\":") != 0) {
-      goto CLEANUP;
-    }
+// Conditional requests follow RFC 9110: If-None-Match wins when present.
+static int http_download_not_modified(const http_request_t *req, const char *etag,
+                                      uint64_t mtime) {
+  uint64_t since = 0;
 
-    n = snprintf(numbuf, sizeof(numbuf), "%" PRIu64, entries[i].mtime);
-    if (n < 0 || http_buf_append(out, numbuf, (size_t)n) != 0 ||
-        http_buf_append_ch(out, '}') != 0) {
-      goto CLEANUP;
-    }
+  if (req->if_none_match[0] != '\0') {
+    return http_etag_list_matches(req->if_none_match, etag);
   }
-
-  if (http_buf_append_ch(out, ']') != 0) {
-    goto CLEANUP;
+  if (req->if_modified_since[0] != '\0' &&
+      http_parse_date(req->if_modified_since, &since) == 0) {
+    return mtime <= since;
   }
-
-  exit_code = 0;
-
-CLEANUP:
-  http_free_file_entries(entries, count);
-  return exit_code;
+  return 0;
 }
 
 static int http_send_file(socket_t conn, const server_opt_t *ser_opt,
-                          const char *relative_path) {
+                          const http_request_t *req, const char *relative_path,
+                          int head_only) {
   char header[1024];
+  char etag[80];
+  char last_modified[40];
   app_download_t download = {.fd = -1};
   int exit_code = 1;
   char safe_name[512];
   size_t safe_len = 0;
+  int n = 0;
 
   if (fs_validate_relative_path(relative_path) != 0) {
-    return http_send_json_error(conn, 400, "Bad Request", "invalid file path");
+    return head_only ? http_send_status_only(conn, 400, "Bad Request")
+                     : http_send_json_error(conn, 400, "Bad Request", "invalid file path");
   }
   if (app_prepare_download(ser_opt->path, relative_path, &download) != PROTOCOL_OK) {
-    return http_send_json_error(conn, 404, "Not Found", "file not found");
+    return head_only ? http_send_status_only(conn, 404, "Not Found")
+                     : http_send_json_error(conn, 404, "Not Found", "file not found");
+  }
+
+  n = snprintf(etag, sizeof(etag), "\"%" PRIx64 "-%" PRIx64 "-%" PRIx64 ".%08" PRIx32 "\"",
+               download.info.file_id, download.info.size, download.info.mtime,
+               download.info.mtime_nsec);
+  if (n < 0 || (size_t)n >= sizeof(etag) ||
+      http_format_date(download.info.mtime, last_modified, sizeof(last_modified)) != 0) {
+    goto CLEANUP;
+  }
+
+  if (http_download_not_modified(req, etag, download.info.mtime)) {
+    n = snprintf(header, sizeof(header),
+                 "HTTP/1.1 304 Not Modified\r\n"
+                 "ETag: %s\r\n"
+                 "Last-Modified: %s\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "Connection: close\r\n"
+                 "\r\n",
+                 etag, last_modified);
+    if (n >= 0 && (size_t)n < sizeof(header) &&
+        send_all(conn, header, (size_t)n) == (ssize_t)n) {
+      exit_code = 0;
+    }
+    goto CLEANUP;
   }
 
   for (const char *p = http_relative_basename(relative_path);
@@ -1078,14 +1312,17 @@ static int http_send_file(socket_t conn, const server_opt_t *ser_opt,
   }
   safe_name[safe_len] = '\0';
 
-  int n = snprintf(header, sizeof(header),
-                   "HTTP/1.1 200 OK\r\n"
-                   "Content-Type: application/octet-stream\r\n"
-                   "Content-Length: %" PRIu64 "\r\n"
-                   "Content-Disposition: attachment; filename=\"%s\"\r\n"
-                   "Connection: close\r\n"
-                   "\r\n",
-                   download.info.size, safe_name);
+  n = snprintf(header, sizeof(header),
+               "HTTP/1.1 200 OK\r\n"
+               "Content-Type: application/octet-stream\r\n"
+               "Content-Length: %" PRIu64 "\r\n"
+               "Content-Disposition: attachment; filename=\"%s\"\r\n"
+               "ETag: %s\r\n"
+               "Last-Modified: %s\r\n"
+               "Cache-Control: no-cache\r\n"
+               "Connection: close\r\n"
+               "\r\n",
+               download.info.size, safe_name, etag, last_modified);
   if (n < 0 || (size_t)n >= sizeof(header)) {
     goto CLEANUP;
   }
@@ -1093,9 +1330,12 @@ static int http_send_file(socket_t conn, const server_opt_t *ser_opt,
   if (send_all(conn, header, (size_t)n) != (ssize_t)n) {
     goto CLEANUP;
   }
+  if (head_only) {
+    exit_code = 0;
+    goto CLEANUP;
+  }
 
-  net_send_file_result_t send_file_res =
-    net_send_file_best_effort(conn, download.fd, download.info.size);
+  net_send_file_result_t send_file_res = app_send_download(conn, &download);
   if (send_file_res != NET_SEND_FILE_OK) {
     if (send_file_res == NET_SEND_FILE_SOURCE_CHANGED) {
       fprintf(stderr, "source file changed during http download\n");
@@ -1112,18 +1352,35 @@ CLEANUP:
   return exit_code;
 }
 
-static int http_handle_webui_asset(socket_t conn, const webui_asset_t *asset) {
+static int http_handle_webui_asset(socket_t conn, const webui_asset_t *asset,
+                                   const http_request_t *req) {
+  const webui_variant_t *variant = NULL;
+
   if (asset == NULL) {
     return 1;
   }
 
-  return http_send_response(conn, 200, "OK", asset->content_type,
-                            asset->body, asset->body_len, NULL);
+  variant = webui_select_variant(asset, req->accepts_gzip);
+  if (variant == NULL) {
+    return http_send_response(conn, 200, "OK", asset->content_type,
+                              asset->body, asset->body_len, NULL);
+  }
+
+  if (http_etag_list_matches(req->if_none_match, variant->etag)) {
+    return send_all(conn, variant->not_modified, variant->not_modified_len) ==
+               (ssize_t)variant->not_modified_len
+             ? 0
+             : 1;
+  }
+  return send_all(conn, variant->response, variant->response_len) ==
+             (ssize_t)variant->response_len
+           ? 0
+           : 1;
 }
 
 static int http_handle_files_list(socket_t conn, const server_opt_t *ser_opt,
                                   const http_request_t *req) {
-  http_buf_t body = {0};
+  http_buf_t body = {.arena = req->arena};
   char encoded_path[HF_HTTP_PATH_MAX];
   char relative_dir[HF_HTTP_PATH_MAX];
   char dir_path[4096];
@@ -1164,7 +1421,7 @@ static int http_handle_files_list(socket_t conn, const server_opt_t *ser_opt,
 #endif
   }
 
-  if (http_build_files_json(dir_path, relative_dir, &body) != 0) {
+  if (http_build_files_json(req->arena, dir_path, relative_dir, &body) != 0) {
     return http_send_json_error(conn, 500, "Internal Server Error",
                                 "failed to list files");
   }
@@ -1181,13 +1438,167 @@ CLEANUP:
   return exit_code;
 }
 
+typedef struct {
+  http_buf_t *out;
+  size_t count;
+  int failed;
+} http_search_ctx_t;
+
+static int http_search_visit(const char *relative_path, const fs_path_info_t *info,
+                             void *arg) {
+  http_search_ctx_t *ctx = (http_search_ctx_t *)arg;
+
+  if ((ctx->count > 0 && http_buf_append_ch(ctx->out, ',') != 0) ||
+      http_append_file_entry_json(ctx->out, http_relative_basename(relative_path),
+                                  relative_path, info) != 0) {
+    ctx->failed = 1;
+    return 1;
+  }
+  ctx->count++;
+  return 0;
+}
+
+static int http_handle_search(socket_t conn, const http_request_t *req) {
+  http_buf_t body = {.arena = req->arena};
+  char encoded[HF_HTTP_PATH_MAX];
+  char query[HF_HTTP_PATH_MAX];
+  char value[32];
+  file_index_match_t match = FILE_INDEX_MATCH_SUBSTRING;
+  uint64_t limit = HF_HTTP_SEARCH_DEFAULT_LIMIT;
+  file_index_status_t status = {0};
+  http_search_ctx_t ctx = {0};
+  char numbuf[64];
+  int exit_code = 1;
+
+  if (http_query_get_value(req->query, "q", encoded, sizeof(encoded)) != 0 ||
+      http_decode_name(encoded, query, sizeof(query)) != 0 || query[0] == '\0') {
+    return http_send_json_error(conn, 400, "Bad Request", "missing search query");
+  }
+  if (http_query_get_value(req->query, "mode", value, sizeof(value)) == 0) {
+    if (strcmp(value, "prefix") == 0) {
+      match = FILE_INDEX_MATCH_PREFIX;
+    } else if (strcmp(value, "substring") != 0) {
+      return http_send_json_error(conn, 400, "Bad Request", "invalid search mode");
+    }
+  }
+  if (http_query_get_value(req->query, "limit", value, sizeof(value)) == 0) {
+    if (http_parse_u64(value, &limit) != 0 || limit == 0) {
+      return http_send_json_error(conn, 400, "Bad Request", "invalid limit");
+    }
+    if (limit > HF_HTTP_SEARCH_MAX_LIMIT) {
+      limit = HF_HTTP_SEARCH_MAX_LIMIT;
+    }
+  }
+
+  ctx.out = &body;
+  if (http_buf_append_str(&body, "{\"results\":[") != 0 ||
+      file_index_search(query, match, (size_t)limit, http_search_visit, &ctx,
+                        &status) != 0 ||
+      ctx.failed) {
+    http_buf_free(&body);
+    return http_send_json_error(conn, 500, "Internal Server Error", "search failed");
+  }
+
+  int n = snprintf(numbuf, sizeof(numbuf), "%zu", status.entry_count);
+  if (n < 0 || http_buf_append_str(&body, "],\"ready\":") != 0 ||
+      http_buf_append_str(&body, status.ready ? "true" : "false") != 0 ||
+      http_buf_append_str(&body, ",\"indexed\":") != 0 ||
+      http_buf_append(&body, numbuf, (size_t)n) != 0 ||
+      http_buf_append_ch(&body, '}') != 0) {
+    http_buf_free(&body);
+    return http_send_json_error(conn, 500, "Internal Server Error", "search failed");
+  }
+
+  if (http_send_response(conn, 200, "OK", "application/json; charset=utf-8",
+                         body.data, body.len, NULL) != 0) {
+    goto CLEANUP;
+  }
+
+  exit_code = 0;
+
+CLEANUP:
+  http_buf_free(&body);
+  return exit_code;
+}
+
+static int http_handle_stats(socket_t conn) {
+  buf_pool_stats_t pool = {0};
+  conn_deadline_stats_t conns = {0};
+  char body[1024];
+
+  buf_pool_get_stats(&pool);
+  conn_deadline_get_stats(&conns);
+  int n = snprintf(body, sizeof(body),
+                   "{\"buffer_pool\":{\"backing\":\"%s\",\"buffer_size\":%" PRIu64
+                   ",\"capacity_bytes\":%" PRIu64 ",\"reserved_bytes\":%" PRIu64
+                   ",\"in_use\":%" PRIu64 ",\"acquired\":%" PRIu64
+                   ",\"thread_cache_hits\":%" PRIu64 ",\"misses\":%" PRIu64
+                   ",\"heap_bytes\":%" PRIu64 ",\"heap_cap_bytes\":%" PRIu64
+                   ",\"refused\":%" PRIu64 "}"
+                   ",\"connections\":{\"active\":%" PRIu64 ",\"evicted_idle\":%" PRIu64
+                   ",\"evicted_header\":%" PRIu64 ",\"evicted_body\":%" PRIu64 "}}",
+                   buf_pool_backing_name(pool.backing), pool.buffer_size,
+                   pool.capacity_bytes, pool.reserved_bytes, pool.in_use, pool.acquired,
+                   pool.thread_cache_hits, pool.misses, pool.heap_bytes,
+                   pool.heap_cap_bytes, pool.refused, conns.active, conns.evicted_idle,
+                   conns.evicted_header, conns.evicted_body);
+  if (n < 0 || (size_t)n >= sizeof(body)) {
+    return http_send_json_error(conn, 500, "Internal Server Error", "stats unavailable");
+  }
+
+  return http_send_response(conn, 200, "OK", "application/json; charset=utf-8", body,
+                            (size_t)n, NULL);
+}
+
+static int http_send_channel_error(socket_t conn, const char *name) {
+  if (!message_store_channel_name_valid(name)) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid channel");
+  }
+  return http_send_json_error(conn, 503, "Service Unavailable", "too many channels");
+}
+
+// Any body that is not JSON is a binary message of its own content type.
+static int http_handle_binary_message_post(socket_t conn, const server_opt_t *ser_opt,
+                                           const http_request_t *req,
+                                           message_store_channel_t *channel) {
+  static const char ok_body[] = "{\"ok\":true}";
+  protocol_result_t result = PROTOCOL_ERR_IO;
+
+  if (!message_store_mime_valid(req->content_type)) {
+    (void)http_discard_body(conn, req->content_length);
+    return http_send_json_error(conn, 415, "Unsupported Media Type",
+                                "content-type must be a valid mime type");
+  }
+  if (req->content_length > HF_PROTOCOL_MAX_BINARY_MESSAGE_SIZE) {
+    return http_send_json_error(conn, 413, "Payload Too Large", "message too large");
+  }
+
+  if (http_set_connection_recv_timeout(conn, HF_HTTP_UPLOAD_BODY_TIMEOUT_MS) != 0) {
+    sock_perror("setsockopt(SO_RCVTIMEO)");
+  }
+  conn_deadline_enter(CONN_DEADLINE_BODY);
+  result = app_receive_binary_message(conn, ser_opt->path, channel, req->content_type,
+                                      req->content_length, APP_UPLOAD_HTTP);
+  conn_deadline_enter(CONN_DEADLINE_NONE);
+  if (result == PROTOCOL_ERR_EOF) {
+    return 1;
+  }
+  if (result != PROTOCOL_OK) {
+    (void)http_send_json_error(conn, 500, "Internal Server Error",
+                               "failed to store message");
+    return 1;
+  }
+
+  return http_send_response(conn, 201, "Created", "application/json; charset=utf-8",
+                            ok_body, sizeof(ok_body) - 1u, NULL);
+}
+
 static int http_handle_messages_post(socket_t conn, const server_opt_t *ser_opt,
-                                     const http_request_t *req) {
+                                     const http_request_t *req,
+                                     message_store_channel_t *channel) {
+  static const char ok_body[] = "{\"ok\":true}";
   char *body = NULL;
   char *message = NULL;
-  const char *body_data = NULL;
-  http_buf_t response = {0};
-  int exit_code = 1;
   ssize_t n = 0;
   size_t body_len = 0;
 
@@ -1199,20 +1610,25 @@ static int http_handle_messages_post(socket_t conn, const server_opt_t *ser_opt,
   if (!req->has_content_length) {
     return http_send_json_error(conn, 411, "Length Required", "content-length required");
   }
-  if (req->content_length > HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE) {
-    return http_send_json_error(conn, 413, "Payload Too Large", "message too large");
+  if (req->content_type[0] == '\0') {
+    (void)http_discard_body(conn, req->content_length);
+    return http_send_json_error(conn, 415, "Unsupported Media Type",
+                                "content-type required");
   }
   if (!http_ascii_starts_with(req->content_type, "application/json")) {
-    return http_send_json_error(conn, 415, "Unsupported Media Type",
-                                "content-type must be application/json");
+    return http_handle_binary_message_post(conn, ser_opt, req, channel);
+  }
+  if (req->content_length > HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE) {
+    return http_send_json_error(conn, 413, "Payload Too Large", "message too large");
   }
 
   if (http_set_connection_recv_timeout(conn, HF_HTTP_MESSAGE_BODY_TIMEOUT_MS) != 0) {
     sock_perror("setsockopt(SO_RCVTIMEO)");
   }
+  conn_deadline_enter(CONN_DEADLINE_BODY);
 
   body_len = (size_t)req->content_length;
-  body = (char *)malloc(body_len + 1u);
+  body = (char *)arena_alloc(req->arena, body_len + 1u);
   if (body == NULL) {
     return http_send_json_error(conn, 500, "Internal Server Error", "allocation failed");
   }
@@ -1220,51 +1636,59 @@ static int http_handle_messages_post(socket_t conn, const server_opt_t *ser_opt,
   n = recv_all(conn, body, body_len);
   if (n < 0) {
     sock_perror("recv_all(http_message)");
-    goto CLEANUP;
+    return 1;
   }
   if ((size_t)n != body_len) {
     fprintf(stderr, "http error: unexpected EOF while receiving message body\n");
-    goto CLEANUP;
+    return 1;
   }
+  conn_deadline_enter(CONN_DEADLINE_NONE);
   body[body_len] = '\0';
-  body_data = body;
 
-  if (http_parse_message_json(body_data, body_len, &message) != 0) {
+  if (http_parse_message_json(req->arena, body, &message) != 0) {
     (void)http_send_json_error(conn, 400, "Bad Request", "invalid message payload");
-    goto CLEANUP;
+    return 1;
   }
-  (void)ser_opt;
-  if (app_submit_message(message) != PROTOCOL_OK) {
+  if (app_submit_message(channel, message) != PROTOCOL_OK) {
     (void)http_send_json_error(conn, 500, "Internal Server Error",
                                "failed to store message");
-    goto CLEANUP;
-  }
-
-  if (http_buf_append_str(&response, "{\"ok\":true}") != 0) {
-    goto CLEANUP;
+    return 1;
   }
 
-  if (http_send_response(conn, 201, "Created", "application/json; charset=utf-8",
-                         response.data, response.len, NULL) != 0) {
-    goto CLEANUP;
-  }
+  return http_send_response(conn, 201, "Created", "application/json; charset=utf-8",
+                            ok_body, sizeof(ok_body) - 1u, NULL);
+}
 
-  exit_code = 0;
+// Binary messages keep an empty "message" and add their type and size; the
+// payload itself is fetched from /api/messages/<channel>/<version>. One
+// restored from the message log is marked expired, its payload gone.
+static int http_append_binary_fields(http_buf_t *buf, const message_store_blob_t *blob) {
+  char numbuf[48];
+  int n = 0;
 
-CLEANUP:
-  if (body != NULL) free(body);
-  if (message != NULL) free(message);
-  http_buf_free(&response);
-  return exit_code;
+  if (blob == NULL || blob->mime == NULL) {
+    return 0;
+  }
+  n = snprintf(numbuf, sizeof(numbuf), "\",\"size\":%" PRIu64, blob->size);
+  if (n < 0 || (size_t)n >= sizeof(numbuf) ||
+      http_buf_append_str(buf, ",\"mime\":\"") != 0 ||
+      http_json_escape(buf, blob->mime) != 0 ||
+      http_buf_append(buf, numbuf, (size_t)n) != 0 ||
+      (blob->fd < 0 && http_buf_append_str(buf, ",\"expired\":true") != 0)) {
+    return 1;
+  }
+  return 0;
 }
 
-static int http_handle_messages_latest_get(socket_t conn) {
-  http_buf_t response = {0};
-  char *message = NULL;
-  int has_message = 0;
+static int http_handle_messages_latest_get(socket_t conn, const http_request_t *req,
+                                          message_store_channel_t *channel) {
+  http_buf_t response = {.arena = req->arena};
+  message_store_blob_t *message = NULL;
+  char numbuf[48];
+  uint64_t version = 0;
   int exit_code = 1;
 
-  if (message_store_get_copy(&message, &has_message) != 0) {
+  if (message_store_get_snapshot(channel, &message, &version) != 0) {
     return http_send_json_error(conn, 500, "Internal Server Error",
                                 "failed to load message");
   }
@@ -1272,16 +1696,22 @@ static int http_handle_messages_latest_get(socket_t conn) {
   if (http_buf_append_str(&response, "{\"has_message\":") != 0) {
     goto CLEANUP;
   }
-  if (http_buf_append_str(&response, has_message ? "true" : "false") != 0) {
+  if (http_buf_append_str(&response, message != NULL ? "true" : "false") != 0) {
+    goto CLEANUP;
+  }
+  int n = snprintf(numbuf, sizeof(numbuf), ",\"version\":%" PRIu64, version);
+  if (n < 0 || http_buf_append(&response, numbuf, (size_t)n) != 0) {
     goto CLEANUP;
   }
   if (http_buf_append_str(&response, ",\"message\":\"") != 0) {
     goto CLEANUP;
   }
-  if (has_message && http_json_escape(&response, message) != 0) {
+  if (message != NULL && http_json_escape(&response, message->text) != 0) {
     goto CLEANUP;
   }
-  if (http_buf_append_str(&response, "\"}") != 0) {
+  if (http_buf_append_ch(&response, '"') != 0 ||
+      http_append_binary_fields(&response, message) != 0 ||
+      http_buf_append_ch(&response, '}') != 0) {
     goto CLEANUP;
   }
 
@@ -1293,138 +1723,981 @@ static int http_handle_messages_latest_get(socket_t conn) {
   exit_code = 0;
 
 CLEANUP:
-  if (message != NULL) free(message);
+  message_store_unref(message);
   http_buf_free(&response);
   return exit_code;
 }
 
-static int http_handle_messages_stream(socket_t conn) {
-  uint64_t version = 0;
-  char *message = NULL;
-  int has_message = 0;
+// GET /api/messages?since=<version>[&limit=<n>]: held messages newer than
+// since, oldest first. oldest_version tells a client whether it missed any.
+static int http_handle_messages_list(socket_t conn, const http_request_t *req,
+                                     message_store_channel_t *channel) {
+  http_buf_t response = {.arena = req->arena};
+  message_store_history_t history = {0};
+  char value[32];
+  char numbuf[96];
+  uint64_t since = 0;
+  uint64_t limit = MESSAGE_STORE_HISTORY;
   int exit_code = 1;
+  int n = 0;
 
-  if (http_send_sse_headers(conn) != 0) {
-    return 1;
+  if (http_query_get_value(req->query, "since", value, sizeof(value)) == 0 &&
+      http_parse_u64(value, &since) != 0) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid since");
   }
-
-  if (message_store_get_snapshot(&message, &has_message, &version) != 0) {
-    return 1;
+  if (http_query_get_value(req->query, "limit", value, sizeof(value)) == 0 &&
+      (http_parse_u64(value, &limit) != 0 || limit == 0)) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid limit");
   }
-  if (has_message && http_send_sse_message_event(conn, message) != 0) {
-    goto CLEANUP;
+  if (limit > MESSAGE_STORE_HISTORY) {
+    limit = MESSAGE_STORE_HISTORY;
+  }
+  if (message_store_get_since(channel, since, (size_t)limit, &history) != 0) {
+    return http_send_json_error(conn, 500, "Internal Server Error",
+                                "failed to load messages");
   }
-  free(message);
-  message = NULL;
-
-  for (;;) {
-    if (message_store_wait_for_update(version, 15000u, &message, &has_message,
-                                      &version) != 0) {
-      goto CLEANUP;
-    }
-
-    if (shutdown_requested()) {
-      exit_code = 0;
-      goto CLEANUP;
-    }
-
-    if (message == NULL && !has_message) {
-      if (http_send_sse_keepalive(conn) != 0) {
-        goto CLEANUP;
-      }
-      continue;
-    }
 
-    if (http_send_sse_message_event(conn, message) != 0) {
+  n = snprintf(numbuf, sizeof(numbuf),
+               "{\"latest_version\":%" PRIu64 ",\"oldest_version\":%" PRIu64
+               ",\"has_more\":%s,\"messages\":[",
+               history.latest_version, history.oldest_version,
+               history.has_more ? "true" : "false");
+  if (n < 0 || (size_t)n >= sizeof(numbuf) ||
+      http_buf_append(&response, numbuf, (size_t)n) != 0) {
+    goto CLEANUP;
+  }
+  for (size_t i = 0; i < history.count; i++) {
+    n = snprintf(numbuf, sizeof(numbuf), "%s{\"version\":%" PRIu64 ",\"message\":\"",
+                 i > 0 ? "," : "", history.messages[i]->version);
+    if (n < 0 || http_buf_append(&response, numbuf, (size_t)n) != 0 ||
+        http_json_escape(&response, history.messages[i]->text) != 0 ||
+        http_buf_append_ch(&response, '"') != 0 ||
+        http_append_binary_fields(&response, history.messages[i]) != 0 ||
+        http_buf_append_ch(&response, '}') != 0) {
       goto CLEANUP;
     }
-    free(message);
-    message = NULL;
+  }
+  if (http_buf_append_str(&response, "]}") != 0) {
+    goto CLEANUP;
   }
 
-  exit_code = 0;
+  exit_code = http_send_response(conn, 200, "OK", "application/json; charset=utf-8",
+                                 response.data, response.len, NULL);
 
 CLEANUP:
-  if (message != NULL) {
-    free(message);
-  }
+  message_store_history_release(&history);
+  http_buf_free(&response);
   return exit_code;
 }
 
-static int http_handle_file_put(socket_t conn, const server_opt_t *ser_opt,
-                                const http_request_t *req, const char *relative_path) {
-  http_buf_t response = {0};
-  fs_path_info_t info = {0};
+// GET /api/messages/<channel>/<version>: one held message as its own body.
+// Binary payloads go out with sendfile straight from the spill file. The
+// content type is whatever the sender chose, so it is sandboxed.
+static int http_handle_message_content(socket_t conn, message_store_channel_t *channel,
+                                       const char *version_text) {
+  message_store_history_t history = {0};
+  const message_store_blob_t *blob = NULL;
+  char header[512];
+  uint64_t version = 0;
+  uint64_t size = 0;
   int exit_code = 1;
-  char numbuf[64];
-  protocol_result_t recv_result = PROTOCOL_ERR_IO;
+  int n = 0;
 
-  if (req->has_transfer_encoding) {
-    return http_send_json_error(conn, 501, "Not Implemented",
-                                "transfer-encoding not supported");
+  if (http_parse_u64(version_text, &version) != 0 || version == 0) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid version");
   }
-
-  if (!req->has_content_length) {
-    return http_send_json_error(conn, 411, "Length Required", "content-length required");
+  if (message_store_get_since(channel, version - 1u, 1u, &history) != 0) {
+    return http_send_json_error(conn, 500, "Internal Server Error",
+                                "failed to load message");
   }
-  if (req->content_length > HF_HTTP_UPLOAD_MAX) {
-    return http_send_json_error(conn, 413, "Payload Too Large", "upload too large");
+  if (history.count == 0 || history.messages[0]->version != version) {
+    message_store_history_release(&history);
+    return http_send_json_error(conn, 404, "Not Found", "message not found");
+  }
+
+  blob = history.messages[0];
+  if (blob->mime != NULL && blob->fd < 0) {
+    message_store_history_release(&history);
+    return http_send_json_error(conn, 410, "Gone", "message payload expired");
+  }
+  size = blob->mime != NULL ? blob->size : (uint64_t)blob->len;
+  n = snprintf(header, sizeof(header),
+               "HTTP/1.1 200 OK\r\n"
+               "Content-Type: %s\r\n"
+               "Content-Length: %" PRIu64 "\r\n"
+               "Content-Security-Policy: sandbox\r\n"
+               "X-Content-Type-Options: nosniff\r\n"
+               "Cache-Control: no-cache\r\n"
+               "Connection: close\r\n"
+               "\r\n",
+               blob->mime != NULL ? blob->mime : "text/plain; charset=utf-8", size);
+  if (n < 0 || (size_t)n >= sizeof(header) ||
+      send_all(conn, header, (size_t)n) != (ssize_t)n) {
+    goto CLEANUP;
   }
-  if (!http_ascii_starts_with(req->content_type, "application/octet-stream")) {
-    if (req->has_content_length) {
-      (void)http_discard_body(conn, req->content_length);
-    }
-    return http_send_json_error(conn, 415, "Unsupported Media Type",
-                                "content-type must be application/octet-stream");
+  if (blob->mime == NULL) {
+    exit_code = send_all(conn, blob->text, blob->len) == (ssize_t)blob->len ? 0 : 1;
+    goto CLEANUP;
   }
-  if (fs_validate_relative_path(relative_path) != 0) {
-    if (req->has_content_length) {
-      (void)http_discard_body(conn, req->content_length);
-    }
-    return http_send_json_error(conn, 400, "Bad Request", "invalid file path");
+  if (net_send_file_best_effort(conn, blob->fd, blob->size) != NET_SEND_FILE_OK) {
+    sock_perror("sendfile(http_message)");
+    goto CLEANUP;
   }
+  exit_code = 0;
 
-  if (http_set_connection_recv_timeout(conn, HF_HTTP_UPLOAD_BODY_TIMEOUT_MS) != 0) {
-    sock_perror("setsockopt(SO_RCVTIMEO)");
-  }
+CLEANUP:
+  message_store_history_release(&history);
+  return exit_code;
+}
 
-  char saved_path[4096];
-  recv_result = app_receive_file(conn, ser_opt->path, relative_path,
-                                 req->content_length, APP_UPLOAD_HTTP,
-                                 saved_path, sizeof(saved_path));
-  if (recv_result == PROTOCOL_ERR_MSG_TOO_LARGE) {
-    return http_send_json_error(conn, 413, "Payload Too Large", "upload too large");
+// The hub owns the socket from here on; this connection thread is released.
+// A reconnecting EventSource sends Last-Event-ID; other clients can pass
+// ?since=<version> to catch up the same way.
+static int http_handle_messages_stream(socket_t conn, const http_request_t *req,
+                                       message_store_channel_t *channel) {
+  char value[32];
+  uint64_t since = 0;
+  int has_since = 0;
+
+  if (http_query_get_value(req->query, "since", value, sizeof(value)) == 0) {
+    has_since = http_parse_u64(value, &since) == 0;
+  } else if (req->last_event_id[0] != '\0') {
+    has_since = http_parse_u64(req->last_event_id, &since) == 0;
   }
-  if (recv_result == PROTOCOL_ERR_INVALID_ARGUMENT) {
-    return http_send_json_error(conn, 400, "Bad Request", "invalid file path");
+  if (http_send_sse_headers(conn) != 0) {
+    return 1;
   }
-  if (recv_result != PROTOCOL_OK) {
-    return http_send_json_error(conn, 500, "Internal Server Error", "failed to save file");
+  return sse_hub_subscribe(conn, channel, has_since ? &since : NULL) == 0
+           ? HTTP_CONN_DETACHED
+           : 1;
+}
+
+static void http_ws_notify(void *ctx) {
+  net_waker_signal((net_waker_t *)ctx);
+}
+
+static int http_ws_send_message_event(socket_t conn, const message_store_blob_t *message) {
+  char scratch[HF_HTTP_SCRATCH_INLINE * 2u];
+  char head[80];
+  arena_t arena;
+  http_buf_t event = {.arena = &arena};
+  int exit_code = 1;
+  int n = snprintf(head, sizeof(head),
+                   "{\"type\":\"message\",\"version\":%" PRIu64 ",\"message\":\"",
+                   message->version);
+
+  if (n < 0 || (size_t)n >= sizeof(head)) {
+    return 1;
+  }
+  arena_init(&arena, scratch, sizeof(scratch));
+  if (http_buf_append(&event, head, (size_t)n) == 0 &&
+      http_json_escape(&event, message->text) == 0 &&
+      http_buf_append_ch(&event, '"') == 0 &&
+      http_append_binary_fields(&event, message) == 0 &&
+      http_buf_append_ch(&event, '}') == 0) {
+    exit_code = websocket_send_frame(conn, WEBSOCKET_OP_TEXT, event.data, event.len);
+  }
+  arena_release(&arena);
+  return exit_code;
+}
+
+static int http_ws_send_static(socket_t conn, const char *json) {
+  return websocket_send_frame(conn, WEBSOCKET_OP_TEXT, json, strlen(json));
+}
+
+// Inbound text frames carry the same {"message": "..."} body as POST.
+static int http_ws_handle_text(socket_t conn, message_store_channel_t *channel,
+                               char *payload) {
+  char scratch[HF_HTTP_SCRATCH_INLINE * 2u];
+  arena_t arena;
+  char *message = NULL;
+  int exit_code = 1;
+
+  arena_init(&arena, scratch, sizeof(scratch));
+  if (http_parse_message_json(&arena, payload, &message) != 0) {
+    exit_code = http_ws_send_static(
+      conn, "{\"type\":\"error\",\"error\":\"invalid message payload\"}");
+  } else if (app_submit_message(channel, message) != PROTOCOL_OK) {
+    exit_code = http_ws_send_static(
+      conn, "{\"type\":\"error\",\"error\":\"failed to store message\"}");
+  } else {
+    exit_code = http_ws_send_static(conn, "{\"type\":\"ack\"}");
+  }
+  arena_release(&arena);
+  return exit_code;
+}
+
+// Serves one WebSocket connection on one channel (?channel=, else the
+// default): message events go out as text frames when the channel changes,
+// inbound text frames post to it, and an idle connection is probed with
+// ping instead of SSE comment keepalives.
+static int http_handle_websocket(socket_t conn, const http_request_t *req) {
+  char accept_key[WEBSOCKET_ACCEPT_LEN + 1u];
+  char header[256];
+  char channel_name[MESSAGE_STORE_CHANNEL_NAME_MAX + 1u];
+  message_store_channel_t *channel = NULL;
+  net_waker_t waker;
+  message_store_listener_t listener = {0};
+  message_store_blob_t *message = NULL;
+  char *pending = NULL;
+  size_t pending_len = 0;
+  int in_message = 0;
+  int awaiting_pong = 0;
+  uint64_t version = 0;
+  websocket_close_code_t close_code = WEBSOCKET_CLOSE_NORMAL;
+  int exit_code = 1;
+
+  if (!req->upgrade_websocket || !req->connection_upgrade) {
+    return http_send_json_error(conn, 400, "Bad Request", "websocket upgrade required");
+  }
+  if (req->websocket_version != 13) {
+    static const char body[] = "{\"error\":\"unsupported websocket version\"}";
+    return http_send_response(conn, 426, "Upgrade Required", "application/json; charset=utf-8",
+                              body, sizeof(body) - 1u, "Sec-WebSocket-Version: 13\r\n");
+  }
+  if (websocket_accept_key(req->websocket_key, accept_key) != 0) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid websocket key");
+  }
+  switch (http_query_get_value(req->query, "channel", channel_name, sizeof(channel_name))) {
+    case 0:
+      break;
+    case 1:
+      (void)snprintf(channel_name, sizeof(channel_name), "%s", MESSAGE_STORE_DEFAULT_CHANNEL);
+      break;
+    default:
+      return http_send_json_error(conn, 400, "Bad Request", "invalid channel");
+  }
+  channel = message_store_channel(channel_name);
+  if (channel == NULL) {
+    return http_send_channel_error(conn, channel_name);
+  }
+  if (net_waker_open(&waker) != 0) {
+    message_store_channel_release(channel);
+    return http_send_json_error(conn, 500, "Internal Server Error", "websocket unavailable");
+  }
+  listener.notify = http_ws_notify;
+  listener.ctx = &waker;
+  message_store_add_listener(channel, &listener);
+
+  int n = snprintf(header, sizeof(header),
+                   "HTTP/1.1 101 Switching Protocols\r\n"
+                   "Upgrade: websocket\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Sec-WebSocket-Accept: %s\r\n"
+                   "\r\n",
+                   accept_key);
+  if (n < 0 || (size_t)n >= sizeof(header) ||
+      send_all(conn, header, (size_t)n) != (ssize_t)n) {
+    goto CLEANUP;
+  }
+
+  if (message_store_get_snapshot(channel, &message, &version) != 0) {
+    goto CLEANUP;
+  }
+  if (message != NULL && http_ws_send_message_event(conn, message) != 0) {
+    goto CLEANUP;
+  }
+  message_store_unref(message);
+  message = NULL;
+
+  for (;;) {
+    websocket_frame_t frame;
+    int ready = 0;
+    int woken = 0;
+    int rc = 0;
+
+    if (shutdown_requested()) {
+      close_code = WEBSOCKET_CLOSE_GOING_AWAY;
+      break;
+    }
+    if (net_wait_readable_or_woken(conn, &waker, HF_HTTP_WS_PING_INTERVAL_MS, &ready,
+                                   &woken) != 0) {
+      goto CLEANUP;
+    }
+
+    if (woken) {
+      if (message_store_wait_for_update(channel, version, 0, &message, &version) != 0) {
+        goto CLEANUP;
+      }
+      if (message != NULL && http_ws_send_message_event(conn, message) != 0) {
+        goto CLEANUP;
+      }
+      message_store_unref(message);
+      message = NULL;
+    }
+
+    if (!ready) {
+      if (woken) {
+        continue;
+      }
+      // A full interval passed with no frames at all since the last ping.
+      if (awaiting_pong) {
+        goto CLEANUP;
+      }
+      if (websocket_send_frame(conn, WEBSOCKET_OP_PING, NULL, 0) != 0) {
+        goto CLEANUP;
+      }
+      awaiting_pong = 1;
+      continue;
+    }
+
+    rc = websocket_recv_frame_header(conn, &frame);
+    if (rc == 1) {
+      goto CLEANUP;
+    }
+    if (rc == 2 || !frame.masked) {
+      close_code = WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+      break;
+    }
+    awaiting_pong = 0;
+
+    if (frame.opcode >= WEBSOCKET_OP_CLOSE) {
+      uint8_t control[WEBSOCKET_CONTROL_MAX];
+      if (websocket_recv_payload(conn, &frame, control) != 0) {
+        goto CLEANUP;
+      }
+      if (frame.opcode == WEBSOCKET_OP_CLOSE) {
+        break;
+      }
+      if (frame.opcode == WEBSOCKET_OP_PING &&
+          websocket_send_frame(conn, WEBSOCKET_OP_PONG, control,
+                               (size_t)frame.payload_len) != 0) {
+        goto CLEANUP;
+      }
+      if (frame.opcode != WEBSOCKET_OP_PING && frame.opcode != WEBSOCKET_OP_PONG) {
+        close_code = WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+        break;
+      }
+      continue;
+    }
+
+    if (frame.opcode == WEBSOCKET_OP_BINARY) {
+      close_code = WEBSOCKET_CLOSE_UNSUPPORTED;
+      break;
+    }
+    if ((frame.opcode == WEBSOCKET_OP_CONTINUATION) != in_message ||
+        (frame.opcode != WEBSOCKET_OP_TEXT && frame.opcode != WEBSOCKET_OP_CONTINUATION)) {
+      close_code = WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+      break;
+    }
+    if (frame.payload_len > HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE - pending_len) {
+      close_code = WEBSOCKET_CLOSE_TOO_BIG;
+      break;
+    }
+
+    char *grown = (char *)realloc(pending, pending_len + (size_t)frame.payload_len + 1u);
+    if (grown == NULL) {
+      goto CLEANUP;
+    }
+    pending = grown;
+    if (websocket_recv_payload(conn, &frame, pending + pending_len) != 0) {
+      goto CLEANUP;
+    }
+    pending_len += (size_t)frame.payload_len;
+    in_message = !frame.fin;
+    if (in_message) {
+      continue;
+    }
+
+    pending[pending_len] = '\0';
+    if (!text_scan_utf8_valid(pending, pending_len)) {
+      close_code = WEBSOCKET_CLOSE_INVALID_PAYLOAD;
+      break;
+    }
+    if (http_ws_handle_text(conn, channel, pending) != 0) {
+      goto CLEANUP;
+    }
+    pending_len = 0;
+  }
+
+  (void)websocket_send_close(conn, close_code);
+  exit_code = 0;
+
+CLEANUP:
+  message_store_remove_listener(channel, &listener);
+  message_store_channel_release(channel);
+  net_waker_close(&waker);
+  message_store_unref(message);
+  free(pending);
+  return exit_code;
+}
+
+static int http_upload_range_json(void *ctx, uint64_t start, uint64_t end) {
+  http_buf_t *out = (http_buf_t *)ctx;
+  char range[64];
+  int n = snprintf(range, sizeof(range), "%s[%" PRIu64 ",%" PRIu64 "]",
+                   out->data[out->len - 1u] == '[' ? "" : ",", start, end);
+
+  return n < 0 || http_buf_append(out, range, (size_t)n) != 0 ? 1 : 0;
+}
+
+static int http_send_upload_session(socket_t conn, const http_request_t *req, int status,
+                                    const char *reason, upload_session_t *session) {
+  http_buf_t response = {.arena = req->arena};
+  char numbuf[96];
+  int exit_code = 1;
+
+  if (http_buf_append_str(&response, "{\"id\":\"") != 0 ||
+      http_buf_append_str(&response, upload_session_id(session)) != 0 ||
+      http_buf_append_str(&response, "\",\"path\":\"") != 0 ||
+      http_json_escape(&response, upload_session_path(session)) != 0) {
+    goto CLEANUP;
+  }
+  int n = snprintf(numbuf, sizeof(numbuf), "\",\"size\":%" PRIu64 ",\"chunk_size\":%" PRIu64,
+                   upload_session_size(session), upload_session_chunk_size(session));
+  if (n < 0 || http_buf_append(&response, numbuf, (size_t)n) != 0 ||
+      http_buf_append_str(&response, ",\"received\":[") != 0 ||
+      upload_session_visit_received(session, http_upload_range_json, &response) != 0 ||
+      http_buf_append_str(&response, "]}") != 0) {
+    (void)http_send_json_error(conn, 500, "Internal Server Error", "allocation failed");
+    goto CLEANUP;
+  }
+
+  exit_code = http_send_response(conn, status, reason, "application/json; charset=utf-8",
+                                 response.data, response.len, NULL);
+
+CLEANUP:
+  http_buf_free(&response);
+  return exit_code;
+}
+
+// POST /api/uploads?path=<file>&size=<bytes>[&chunk_size=<bytes>]
+static int http_handle_upload_create(socket_t conn, const server_opt_t *ser_opt,
+                                     const http_request_t *req) {
+  char encoded[HF_HTTP_PATH_MAX];
+  char relative_path[HF_HTTP_PATH_MAX];
+  uint64_t size = 0;
+  uint64_t chunk_size = UPLOAD_SESSION_DEFAULT_CHUNK;
+  upload_session_t *session = NULL;
+  upload_session_result_t res = UPLOAD_SESSION_OK;
+  int exit_code = 1;
+
+  if (req->has_content_length && req->content_length > 0 &&
+      http_discard_body(conn, req->content_length) != 0) {
+    return 1;
+  }
+  if (http_query_get_value(req->query, "path", encoded, sizeof(encoded)) != 0 ||
+      http_decode_name(encoded, relative_path, sizeof(relative_path)) != 0 ||
+      fs_validate_relative_path(relative_path) != 0) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid file path");
+  }
+  if (http_query_get_value(req->query, "size", encoded, sizeof(encoded)) != 0 ||
+      http_parse_u64(encoded, &size) != 0) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid size");
+  }
+  if (size > HF_HTTP_UPLOAD_MAX) {
+    return http_send_json_error(conn, 413, "Payload Too Large", "upload too large");
+  }
+  if (http_query_get_value(req->query, "chunk_size", encoded, sizeof(encoded)) == 0 &&
+      (http_parse_u64(encoded, &chunk_size) != 0 ||
+       chunk_size < UPLOAD_SESSION_MIN_CHUNK || chunk_size > UPLOAD_SESSION_MAX_CHUNK)) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid chunk size");
+  }
+
+  res = upload_session_create(ser_opt->path, relative_path, size, chunk_size, &session);
+  if (res == UPLOAD_SESSION_ERR_INVALID) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid file path");
+  }
+  if (res == UPLOAD_SESSION_ERR_TOO_MANY) {
+    return http_send_json_error(conn, 503, "Service Unavailable",
+                                "too many unfinished uploads");
+  }
+  if (res != UPLOAD_SESSION_OK) {
+    return http_send_json_error(conn, 507, "Insufficient Storage",
+                                "failed to reserve upload");
+  }
+
+  exit_code = http_send_upload_session(conn, req, 201, "Created", session);
+  upload_session_release(session);
+  return exit_code;
+}
+
+// Content-Range: bytes <first>-<last>/<total>
+static int http_parse_content_range(const char *value, uint64_t *first_out,
+                                    uint64_t *last_out, uint64_t *total_out) {
+  char part[32];
+  const char *dash = NULL;
+  const char *slash = NULL;
+
+  if (strncmp(value, "bytes ", 6) != 0) {
+    return 1;
+  }
+  value += 6;
+  dash = strchr(value, '-');
+  slash = dash != NULL ? strchr(dash, '/') : NULL;
+  if (slash == NULL || (size_t)(dash - value) >= sizeof(part) ||
+      (size_t)(slash - dash - 1) >= sizeof(part)) {
+    return 1;
+  }
+
+  memcpy(part, value, (size_t)(dash - value));
+  part[dash - value] = '\0';
+  if (http_parse_u64(part, first_out) != 0) {
+    return 1;
+  }
+  memcpy(part, dash + 1, (size_t)(slash - dash - 1));
+  part[slash - dash - 1] = '\0';
+  if (http_parse_u64(part, last_out) != 0 || http_parse_u64(slash + 1, total_out) != 0) {
+    return 1;
+  }
+  return *last_out < *first_out ? 1 : 0;
+}
+
+// Chunks may arrive in any order and on parallel connections; a chunk only
+// counts once every byte of it is on disk, so an interrupted PUT is simply
+// sent again.
+static int http_handle_upload_chunk(socket_t conn, const http_request_t *req,
+                                    upload_session_t *session) {
+  uint64_t first = 0;
+  uint64_t last = 0;
+  uint64_t total = 0;
+  uint64_t index = 0;
+  uint64_t done = 0;
+  char *buf = NULL;
+  int exit_code = 1;
+
+  if (req->has_transfer_encoding) {
+    return http_send_json_error(conn, 501, "Not Implemented",
+                                "transfer-encoding not supported");
+  }
+  if (!req->has_content_length) {
+    return http_send_json_error(conn, 411, "Length Required", "content-length required");
+  }
+  if (http_parse_content_range(req->content_range, &first, &last, &total) != 0 ||
+      total != upload_session_size(session) || last - first + 1u != req->content_length ||
+      upload_session_chunk_index(session, first, req->content_length, &index) != 0) {
+    if (http_discard_body(conn, req->content_length) != 0) {
+      return 1;
+    }
+    return http_send_json_error(conn, 416, "Range Not Satisfiable",
+                                "content-range must cover exactly one chunk");
+  }
+
+  if (http_set_connection_recv_timeout(conn, HF_HTTP_UPLOAD_BODY_TIMEOUT_MS) != 0) {
+    sock_perror("setsockopt(SO_RCVTIMEO)");
+  }
+  conn_deadline_enter(CONN_DEADLINE_BODY);
+  buf = buf_pool_acquire();
+  if (buf == NULL) {
+    (void)http_discard_body(conn, req->content_length);
+    return http_send_json_error(conn, 500, "Internal Server Error", "allocation failed");
+  }
+  if (upload_session_reserve_chunk(session, index) != UPLOAD_SESSION_OK) {
+    (void)http_discard_body(conn, req->content_length);
+    (void)http_send_json_error(conn, 507, "Insufficient Storage", "failed to reserve chunk");
+    goto CLEANUP;
+  }
+
+  while (done < req->content_length) {
+    uint64_t want = req->content_length - done;
+    if (want > BUF_POOL_BUF_SIZE) {
+      want = BUF_POOL_BUF_SIZE;
+    }
+    if (recv_all(conn, buf, (size_t)want) != (ssize_t)want) {
+      fprintf(stderr, "http upload chunk ended early\n");
+      goto CLEANUP;
+    }
+    if (upload_session_write(session, first + done, buf, (size_t)want) !=
+        UPLOAD_SESSION_OK) {
+      (void)http_discard_body(conn, req->content_length - done - want);
+      (void)http_send_json_error(conn, 500, "Internal Server Error", "failed to write chunk");
+      goto CLEANUP;
+    }
+    done += want;
+  }
+  conn_deadline_enter(CONN_DEADLINE_NONE);
+
+  upload_session_mark_received(session, index);
+  exit_code = http_send_response(conn, 204, "No Content", "application/json; charset=utf-8",
+                                 NULL, 0, NULL);
+
+CLEANUP:
+  buf_pool_release(buf);
+  return exit_code;
+}
+
+static int http_handle_upload_finalize(socket_t conn, const http_request_t *req,
+                                       upload_session_t *session) {
+  http_buf_t response = {.arena = req->arena};
+  char saved_path[4096];
+  fs_path_info_t info = {0};
+  upload_session_result_t res = UPLOAD_SESSION_OK;
+  int exit_code = 1;
+
+  if (req->has_content_length && req->content_length > 0 &&
+      http_discard_body(conn, req->content_length) != 0) {
+    return 1;
+  }
+
+  res = upload_session_finalize(session, saved_path, sizeof(saved_path));
+  if (res == UPLOAD_SESSION_ERR_INCOMPLETE) {
+    return http_send_json_error(conn, 409, "Conflict", "upload incomplete");
+  }
+  if (res == UPLOAD_SESSION_ERR_BUSY) {
+    return http_send_json_error(conn, 409, "Conflict", "chunks still uploading");
+  }
+  if (res == UPLOAD_SESSION_ERR_GONE) {
+    return http_send_json_error(conn, 404, "Not Found", "upload not found");
+  }
+  if (res != UPLOAD_SESSION_OK) {
+    return http_send_json_error(conn, 500, "Internal Server Error", "failed to save file");
+  }
+  if (fs_stat_path(saved_path, &info) != 0 || info.kind != FS_PATH_KIND_FILE) {
+    return http_send_json_error(conn, 500, "Internal Server Error", "saved file missing");
+  }
+
+  if (http_append_file_entry_json(&response,
+                                  http_relative_basename(upload_session_path(session)),
+                                  upload_session_path(session), &info) != 0) {
+    (void)http_send_json_error(conn, 500, "Internal Server Error", "allocation failed");
+    goto CLEANUP;
+  }
+  exit_code = http_send_response(conn, 201, "Created", "application/json; charset=utf-8",
+                                 response.data, response.len, NULL);
+
+CLEANUP:
+  http_buf_free(&response);
+  return exit_code;
+}
+
+// GET reports received ranges, PUT stores one chunk, POST finalizes and
+// DELETE abandons the session.
+static int http_dispatch_upload_route(socket_t conn, const http_request_t *req) {
+  upload_session_t *session = NULL;
+  int exit_code = 1;
+
+  if (strncmp(req->path, "/api/uploads/", 13) != 0) {
+    return -1;
+  }
+  session = upload_session_acquire(req->path + 13);
+  if (session == NULL) {
+    if (req->has_content_length && req->content_length > 0 &&
+        http_discard_body(conn, req->content_length) != 0) {
+      return 1;
+    }
+    return http_send_json_error(conn, 404, "Not Found", "upload not found");
+  }
+
+  if (strcmp(req->method, "GET") == 0) {
+    exit_code = http_send_upload_session(conn, req, 200, "OK", session);
+  } else if (strcmp(req->method, "PUT") == 0) {
+    exit_code = http_handle_upload_chunk(conn, req, session);
+  } else if (strcmp(req->method, "POST") == 0) {
+    exit_code = http_handle_upload_finalize(conn, req, session);
+  } else if (strcmp(req->method, "DELETE") == 0) {
+    upload_session_abort(session);
+    exit_code = http_send_response(conn, 204, "No Content",
+                                   "application/json; charset=utf-8", NULL, 0, NULL);
+  } else {
+    exit_code = http_send_json_error(conn, 405, "Method Not Allowed", "method not allowed");
+  }
+
+  upload_session_release(session);
+  return exit_code;
+}
+
+static int http_handle_file_put(socket_t conn, const server_opt_t *ser_opt,
+                                const http_request_t *req, const char *relative_path) {
+  http_buf_t response = {.arena = req->arena};
+  fs_path_info_t info = {0};
+  int exit_code = 1;
+  char numbuf[64];
+  protocol_result_t recv_result = PROTOCOL_ERR_IO;
+
+  if (req->has_transfer_encoding) {
+    return http_send_json_error(conn, 501, "Not Implemented",
+                                "transfer-encoding not supported");
+  }
+
+  if (!req->has_content_length) {
+    return http_send_json_error(conn, 411, "Length Required", "content-length required");
+  }
+  if (req->content_length > HF_HTTP_UPLOAD_MAX) {
+    return http_send_json_error(conn, 413, "Payload Too Large", "upload too large");
+  }
+  if (!http_ascii_starts_with(req->content_type, "application/octet-stream")) {
+    if (req->has_content_length) {
+      (void)http_discard_body(conn, req->content_length);
+    }
+    return http_send_json_error(conn, 415, "Unsupported Media Type",
+                                "content-type must be application/octet-stream");
+  }
+  if (fs_validate_relative_path(relative_path) != 0) {
+    if (req->has_content_length) {
+      (void)http_discard_body(conn, req->content_length);
+    }
+    return http_send_json_error(conn, 400, "Bad Request", "invalid file path");
+  }
+
+  if (http_set_connection_recv_timeout(conn, HF_HTTP_UPLOAD_BODY_TIMEOUT_MS) != 0) {
+    sock_perror("setsockopt(SO_RCVTIMEO)");
+  }
+  conn_deadline_enter(CONN_DEADLINE_BODY);
+
+  char saved_path[4096];
+  recv_result = app_receive_file(conn, ser_opt->path, relative_path,
+                                 req->content_length, NULL, APP_UPLOAD_HTTP,
+                                 saved_path, sizeof(saved_path));
+  conn_deadline_enter(CONN_DEADLINE_NONE);
+  if (recv_result == PROTOCOL_ERR_MSG_TOO_LARGE) {
+    return http_send_json_error(conn, 413, "Payload Too Large", "upload too large");
+  }
+  if (recv_result == PROTOCOL_ERR_INVALID_ARGUMENT) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid file path");
+  }
+  if (recv_result != PROTOCOL_OK) {
+    return http_send_json_error(conn, 500, "Internal Server Error", "failed to save file");
+  }
+
+  if (fs_stat_path(saved_path, &info) != 0 || info.kind != FS_PATH_KIND_FILE) {
+    return http_send_json_error(conn, 500, "Internal Server Error", "saved file missing");
+  }
+
+  if (http_buf_append_str(&response, "{\"name\":\"") != 0 ||
+      http_json_escape(&response, http_relative_basename(relative_path)) != 0 ||
+      http_buf_append_str(&response, "\",\"path\":\"") != 0 ||
+      http_json_escape(&response, relative_path) != 0 ||
+      http_buf_append_str(&response, "\",\"kind\":\"file\",\"size\":") != 0) {
+    goto CLEANUP;
+  }
+  int n = snprintf(numbuf, sizeof(numbuf), "%" PRIu64, info.size);
+  if (n < 0 || http_buf_append(&response, numbuf, (size_t)n) != 0 ||
+      http_buf_append_str(&response, ",\"mtime\":") != 0) {
+    goto CLEANUP;
+  }
+  n = snprintf(numbuf, sizeof(numbuf), "%" PRIu64, info.mtime);
+  if (n < 0 || http_buf_append(&response, numbuf, (size_t)n) != 0 ||
+      http_buf_append_ch(&response, '}') != 0) {
+    goto CLEANUP;
+  }
+
+  if (http_send_response(conn, 201, "Created", "application/json; charset=utf-8",
+                         response.data, response.len, NULL) != 0) {
+    goto CLEANUP;
+  }
+
+  exit_code = 0;
+
+CLEANUP:
+  http_buf_free(&response);
+  return exit_code;
+}
+
+typedef struct {
+  const server_opt_t *ser_opt;
+  const char *relative_dir;
+  http_buf_t *response;
+  app_upload_t upload;
+  int uploading;
+  size_t saved;
+  int status;
+  const char *reason;
+  const char *error;
+} http_multipart_ctx_t;
+
+static int http_multipart_fail(http_multipart_ctx_t *ctx, int status, const char *reason,
+                               const char *error) {
+  ctx->status = status;
+  ctx->reason = reason;
+  ctx->error = error;
+  return 1;
+}
+
+// Only parts with a filename are stored; plain form fields are skipped.
+static int http_multipart_part_begin(void *opaque, const char *name, const char *filename) {
+  http_multipart_ctx_t *ctx = (http_multipart_ctx_t *)opaque;
+  char relative_path[HF_HTTP_PATH_MAX];
+  const char *base = filename;
+  protocol_result_t res = PROTOCOL_ERR_IO;
+
+  (void)name;
+  ctx->uploading = 0;
+  if (filename == NULL || filename[0] == '\0') {
+    return 0;
+  }
+
+  // Older browsers send the client-side path; keep only its last component.
+  for (const char *p = filename; *p != '\0'; p++) {
+    if (*p == '/' || *p == '\\') {
+      base = p + 1;
+    }
+  }
+  if (fs_validate_file_name(base) != 0 ||
+      http_build_relative_child_path(relative_path, sizeof(relative_path),
+                                     ctx->relative_dir, base) != 0 ||
+      fs_validate_relative_path(relative_path) != 0) {
+    return http_multipart_fail(ctx, 400, "Bad Request", "invalid file name");
+  }
+
+  res = app_begin_upload(&ctx->upload, ctx->ser_opt->path, relative_path);
+  if (res == PROTOCOL_ERR_INVALID_ARGUMENT) {
+    return http_multipart_fail(ctx, 400, "Bad Request", "invalid file path");
+  }
+  if (res != PROTOCOL_OK) {
+    return http_multipart_fail(ctx, 500, "Internal Server Error", "failed to save file");
+  }
+  ctx->uploading = 1;
+  return 0;
+}
+
+static int http_multipart_part_data(void *opaque, const char *data, size_t len) {
+  http_multipart_ctx_t *ctx = (http_multipart_ctx_t *)opaque;
+
+  if (ctx->uploading && app_write_upload(&ctx->upload, data, len) != PROTOCOL_OK) {
+    return http_multipart_fail(ctx, 500, "Internal Server Error", "failed to save file");
+  }
+  return 0;
+}
+
+static int http_multipart_part_end(void *opaque) {
+  http_multipart_ctx_t *ctx = (http_multipart_ctx_t *)opaque;
+  char saved_path[4096];
+  fs_path_info_t info = {0};
+
+  if (!ctx->uploading) {
+    return 0;
+  }
+  ctx->uploading = 0;
+  if (app_commit_upload(&ctx->upload, saved_path, sizeof(saved_path)) != PROTOCOL_OK) {
+    return http_multipart_fail(ctx, 500, "Internal Server Error", "failed to save file");
+  }
+  if (fs_stat_path(saved_path, &info) != 0 || info.kind != FS_PATH_KIND_FILE) {
+    return http_multipart_fail(ctx, 500, "Internal Server Error", "saved file missing");
+  }
+
+  if ((ctx->saved > 0 && http_buf_append_ch(ctx->response, ',') != 0) ||
+      http_append_file_entry_json(ctx->response,
+                                  http_relative_basename(ctx->upload.relative_path),
+                                  ctx->upload.relative_path, &info) != 0) {
+    return http_multipart_fail(ctx, 500, "Internal Server Error", "allocation failed");
+  }
+  ctx->saved++;
+  return 0;
+}
+
+static const multipart_callbacks_t http_multipart_callbacks = {
+  .part_begin = http_multipart_part_begin,
+  .part_data = http_multipart_part_data,
+  .part_end = http_multipart_part_end,
+};
+
+// Each file part streams from the socket into its own temp file; nothing
+// larger than a delimiter tail or one part's header block stays in memory.
+static int http_handle_files_upload(socket_t conn, const server_opt_t *ser_opt,
+                                    const http_request_t *req) {
+  http_buf_t response = {.arena = req->arena};
+  http_multipart_ctx_t ctx = {0};
+  multipart_parser_t parser;
+  multipart_result_t parse_res = MULTIPART_OK;
+  char boundary[MULTIPART_BOUNDARY_MAX + 1u];
+  char encoded_path[HF_HTTP_PATH_MAX];
+  char relative_dir[HF_HTTP_PATH_MAX];
+  char dir_path[4096];
+  fs_path_info_t info = {0};
+  uint64_t remaining = 0;
+  int exit_code = 1;
+
+  if (req->has_transfer_encoding) {
+    return http_send_json_error(conn, 501, "Not Implemented",
+                                "transfer-encoding not supported");
+  }
+  if (!req->has_content_length) {
+    return http_send_json_error(conn, 411, "Length Required", "content-length required");
+  }
+  if (req->content_length > HF_HTTP_UPLOAD_MAX) {
+    return http_send_json_error(conn, 413, "Payload Too Large", "upload too large");
+  }
+  if (multipart_parse_boundary(req->content_type, boundary, sizeof(boundary)) != 0) {
+    (void)http_discard_body(conn, req->content_length);
+    return http_send_json_error(conn, 415, "Unsupported Media Type",
+                                "content-type must be multipart/form-data");
   }
 
-  if (fs_stat_path(saved_path, &info) != 0 || info.kind != FS_PATH_KIND_FILE) {
-    return http_send_json_error(conn, 500, "Internal Server Error", "saved file missing");
+  relative_dir[0] = '\0';
+  if (http_query_get_value(req->query, "path", encoded_path, sizeof(encoded_path)) == 0 &&
+      (http_decode_name(encoded_path, relative_dir, sizeof(relative_dir)) != 0 ||
+       (relative_dir[0] != '\0' && fs_validate_relative_path(relative_dir) != 0))) {
+    (void)http_discard_body(conn, req->content_length);
+    return http_send_json_error(conn, 400, "Bad Request", "invalid path");
+  }
+  if (fs_join_relative_path(dir_path, sizeof(dir_path), ser_opt->path, relative_dir) != 0 ||
+      fs_stat_path(dir_path, &info) != 0 ||
+      (info.kind != FS_PATH_KIND_DIR && relative_dir[0] != '\0')) {
+    (void)http_discard_body(conn, req->content_length);
+    return http_send_json_error(conn, 404, "Not Found", "path not found");
   }
 
-  if (http_buf_append_str(&response, "{\"name\":\"") != 0 ||
-      http_json_escape(&response, http_relative_basename(relative_path)) != 0 ||
-      http_buf_append_str(&response, "\",\"path\":\"") != 0 ||
-      http_json_escape(&response, relative_path) != 0 ||
-      http_buf_append_str(&response, "\",\"kind\":\"file\",\"size\":") != 0) {
+  if (http_set_connection_recv_timeout(conn, HF_HTTP_UPLOAD_BODY_TIMEOUT_MS) != 0) {
+    sock_perror("setsockopt(SO_RCVTIMEO)");
+  }
+  conn_deadline_enter(CONN_DEADLINE_BODY);
+
+  ctx.ser_opt = ser_opt;
+  ctx.relative_dir = relative_dir;
+  ctx.response = &response;
+  if (http_buf_append_str(&response, "{\"files\":[") != 0) {
+    (void)http_discard_body(conn, req->content_length);
+    return http_send_json_error(conn, 500, "Internal Server Error", "allocation failed");
+  }
+  if (multipart_parser_init(&parser, boundary, &http_multipart_callbacks, &ctx) !=
+      MULTIPART_OK) {
+    multipart_parser_cleanup(&parser);
+    http_buf_free(&response);
+    (void)http_discard_body(conn, req->content_length);
+    return http_send_json_error(conn, 500, "Internal Server Error", "allocation failed");
+  }
+
+  remaining = req->content_length;
+  while (remaining > 0 && !multipart_parser_done(&parser)) {
+    size_t cap = 0;
+    char *space = multipart_parser_space(&parser, &cap);
+    if ((uint64_t)cap > remaining) {
+      cap = (size_t)remaining;
+    }
+
+    ssize_t n = http_recv_some(conn, space, cap);
+    if (n < 0) {
+      sock_perror("recv(http_multipart)");
+      goto CLEANUP;
+    }
+    if (n == 0) {
+      fprintf(stderr, "http upload ended early\n");
+      goto CLEANUP;
+    }
+    remaining -= (uint64_t)n;
+
+    parse_res = multipart_parser_commit(&parser, (size_t)n);
+    if (parse_res != MULTIPART_OK) {
+      break;
+    }
+  }
+  conn_deadline_enter(CONN_DEADLINE_NONE);
+
+  // The client is still sending; drain what is left so it reads the error
+  // instead of a reset.
+  if (remaining > 0 && http_discard_body(conn, remaining) != 0) {
     goto CLEANUP;
   }
-  int n = snprintf(numbuf, sizeof(numbuf), "%" PRIu64, info.size);
-  if (n < 0 || http_buf_append(&response, numbuf, (size_t)n) != 0 ||
-      http_buf_append_str(&response, ",\"mtime\":") != 0) {
+  if (parse_res == MULTIPART_ERR_CALLBACK) {
+    (void)http_send_json_error(conn, ctx.status, ctx.reason, ctx.error);
     goto CLEANUP;
   }
-  n = snprintf(numbuf, sizeof(numbuf), "%" PRIu64, info.mtime);
-  if (n < 0 || http_buf_append(&response, numbuf, (size_t)n) != 0 ||
-      http_buf_append_ch(&response, '}') != 0) {
+  if (parse_res == MULTIPART_ERR_HEADERS_TOO_LARGE) {
+    (void)http_send_json_error(conn, 431, "Request Header Fields Too Large",
+                               "part headers too large");
+    goto CLEANUP;
+  }
+  if (parse_res != MULTIPART_OK || !multipart_parser_done(&parser)) {
+    (void)http_send_json_error(conn, 400, "Bad Request", "invalid multipart body");
+    goto CLEANUP;
+  }
+  if (ctx.saved == 0) {
+    (void)http_send_json_error(conn, 400, "Bad Request", "no files in upload");
     goto CLEANUP;
   }
 
-  if (http_send_response(conn, 201, "Created", "application/json; charset=utf-8",
+  if (http_buf_append_str(&response, "]}") != 0 ||
+      http_send_response(conn, 201, "Created", "application/json; charset=utf-8",
                          response.data, response.len, NULL) != 0) {
     goto CLEANUP;
   }
@@ -1432,10 +2705,340 @@ static int http_handle_file_put(socket_t conn, const server_opt_t *ser_opt,
   exit_code = 0;
 
 CLEANUP:
+  if (ctx.uploading) {
+    app_abort_upload(&ctx.upload);
+  }
+  multipart_parser_cleanup(&parser);
   http_buf_free(&response);
   return exit_code;
 }
 
+// Coalesces small writes (headers, inline-cached bodies) into one pooled
+// buffer so a tree of tiny files does not cost a send per header.
+typedef struct {
+  socket_t conn;
+  char *buf;
+  size_t len;
+} http_stream_t;
+
+static int http_stream_flush(http_stream_t *out) {
+  if (out->len > 0 && send_all(out->conn, out->buf, out->len) != (ssize_t)out->len) {
+    return 1;
+  }
+  out->len = 0;
+  return 0;
+}
+
+static int http_stream_write(void *opaque, const void *data, size_t len) {
+  http_stream_t *out = (http_stream_t *)opaque;
+
+  if (len > BUF_POOL_BUF_SIZE - out->len) {
+    if (http_stream_flush(out) != 0) {
+      return 1;
+    }
+    if (len > BUF_POOL_BUF_SIZE / 2u) {
+      return send_all(out->conn, data, len) == (ssize_t)len ? 0 : 1;
+    }
+  }
+  memcpy(out->buf + out->len, data, len);
+  out->len += len;
+  return 0;
+}
+
+typedef struct {
+  arena_t *arena;
+  const char *base_dir;
+  const char *source_dir;
+  const char *name_dir;
+  archive_entry_t *entries;
+  size_t count;
+  size_t cap;
+  int status;
+} http_archive_walk_t;
+
+static int http_archive_add(http_archive_walk_t *walk, const char *source,
+                            const char *name, const fs_path_info_t *info) {
+  archive_entry_t *entry = NULL;
+
+  if (walk->count == walk->cap) {
+    size_t new_cap = walk->cap == 0 ? 64u : walk->cap * 2u;
+    archive_entry_t *grown = NULL;
+
+    if (walk->count >= HF_HTTP_ARCHIVE_MAX_ENTRIES) {
+      walk->status = 413;
+      return 1;
+    }
+    grown = (archive_entry_t *)arena_grow(walk->arena, walk->entries,
+                                          walk->cap * sizeof(*walk->entries),
+                                          new_cap * sizeof(*walk->entries));
+    if (grown == NULL) {
+      walk->status = 500;
+      return 1;
+    }
+    walk->entries = grown;
+    walk->cap = new_cap;
+  }
+
+  entry = &walk->entries[walk->count];
+  memset(entry, 0, sizeof(*entry));
+  entry->name = arena_strdup(walk->arena, name);
+  entry->source = arena_strdup(walk->arena, source);
+  if (entry->name == NULL || entry->source == NULL) {
+    walk->status = 500;
+    return 1;
+  }
+  entry->is_dir = info->kind == FS_PATH_KIND_DIR;
+  entry->size = entry->is_dir ? 0 : info->size;
+  entry->mtime = info->mtime;
+  walk->count++;
+  return 0;
+}
+
+// Symlinks are skipped so an archive never reaches outside the served tree.
+static int http_archive_visit(const char *name, const fs_path_info_t *info, void *opaque) {
+  http_archive_walk_t *walk = (http_archive_walk_t *)opaque;
+  char source[HF_HTTP_PATH_MAX];
+  char entry_name[ARCHIVE_NAME_MAX + 1u];
+
+  if (fs_is_temp_name(name) ||
+      (info->kind != FS_PATH_KIND_FILE && info->kind != FS_PATH_KIND_DIR)) {
+    return 0;
+  }
+  if (http_build_relative_child_path(source, sizeof(source), walk->source_dir, name) != 0 ||
+      http_build_relative_child_path(entry_name, sizeof(entry_name), walk->name_dir,
+                                     name) != 0) {
+    walk->status = 413;
+    return 1;
+  }
+  return http_archive_add(walk, source, entry_name, info);
+}
+
+// The entry list doubles as the work queue: each directory is listed once
+// when the scan reaches it, appending its children behind it. Depth costs
+// heap, never connection-thread stack.
+static int http_archive_scan(http_archive_walk_t *walk) {
+  char full_path[4096];
+
+  for (size_t i = 0; i < walk->count; i++) {
+    if (!walk->entries[i].is_dir) {
+      continue;
+    }
+    walk->source_dir = walk->entries[i].source;
+    walk->name_dir = walk->entries[i].name;
+    if (fs_join_relative_path(full_path, sizeof(full_path), walk->base_dir,
+                              walk->source_dir) != 0) {
+      walk->status = 413;
+      return 1;
+    }
+    if (fs_list_dir(full_path, http_archive_visit, walk) != 0) {
+      if (walk->status == 0) {
+        walk->status = 500;
+      }
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int http_archive_entry_cmp(const void *lhs, const void *rhs) {
+  return strcmp(((const archive_entry_t *)lhs)->name, ((const archive_entry_t *)rhs)->name);
+}
+
+// The CRC pass reads through the (just flushed) stream buffer; the body then
+// goes out with sendfile, so zip costs one extra page-cache read per file.
+static int http_archive_crc(http_stream_t *out, const app_download_t *download,
+                            uint32_t *crc_out) {
+  uint32_t crc = 0;
+
+  if (download->data != NULL) {
+    *crc_out = crc32_update(0, download->data, (size_t)download->info.size);
+    return 0;
+  }
+  if (http_stream_flush(out) != 0) {
+    return 1;
+  }
+  for (uint64_t offset = 0; offset < download->info.size;) {
+    size_t want = BUF_POOL_BUF_SIZE;
+    if ((uint64_t)want > download->info.size - offset) {
+      want = (size_t)(download->info.size - offset);
+    }
+    ssize_t n = fs_pread(download->fd, out->buf, want, offset);
+    if (n <= 0) {
+      return 1;
+    }
+    crc = crc32_update(crc, out->buf, (size_t)n);
+    offset += (uint64_t)n;
+  }
+  *crc_out = crc;
+  return 0;
+}
+
+static int http_archive_send_entry(http_stream_t *out, const server_opt_t *ser_opt,
+                                   archive_format_t format, archive_entry_t *entry) {
+  static const char zeros[512] = {0};
+  char header[ARCHIVE_HEADER_MAX];
+  app_download_t download = {.fd = -1};
+  size_t header_len = 0;
+  size_t padding = 0;
+  int exit_code = 1;
+
+  if (entry->is_dir) {
+    header_len = archive_entry_header(format, entry, header);
+    return http_stream_write(out, header, header_len);
+  }
+
+  // Archived files are read once, so they bypass the download cache.
+  if (app_open_download(ser_opt->path, entry->source, &download) != PROTOCOL_OK) {
+    fprintf(stderr, "archive source vanished: %s\n", entry->source);
+    return 1;
+  }
+  // Content-Length is already on the wire, so a resized file cannot be fixed up.
+  if (download.info.size != entry->size) {
+    fprintf(stderr, "source file changed during archive download\n");
+    goto CLEANUP;
+  }
+  if (format == ARCHIVE_FORMAT_ZIP && http_archive_crc(out, &download, &entry->crc32) != 0) {
+    goto CLEANUP;
+  }
+
+  header_len = archive_entry_header(format, entry, header);
+  if (http_stream_write(out, header, header_len) != 0) {
+    goto CLEANUP;
+  }
+  if (download.data != NULL) {
+    if (http_stream_write(out, download.data, (size_t)download.info.size) != 0) {
+      goto CLEANUP;
+    }
+  } else if (download.info.size > 0) {
+    if (http_stream_flush(out) != 0) {
+      goto CLEANUP;
+    }
+    net_send_file_result_t send_res = app_send_download(out->conn, &download);
+    if (send_res != NET_SEND_FILE_OK) {
+      if (send_res == NET_SEND_FILE_SOURCE_CHANGED) {
+        fprintf(stderr, "source file changed during archive download\n");
+      } else {
+        sock_perror("sendfile(http_archive)");
+      }
+      goto CLEANUP;
+    }
+  }
+
+  padding = archive_entry_padding(format, entry);
+  if (padding > 0 && http_stream_write(out, zeros, padding) != 0) {
+    goto CLEANUP;
+  }
+  exit_code = 0;
+
+CLEANUP:
+  app_download_cleanup(&download);
+  return exit_code;
+}
+
+static int http_handle_archive(socket_t conn, const server_opt_t *ser_opt,
+                               const http_request_t *req) {
+  http_archive_walk_t walk = {0};
+  http_stream_t out = {.conn = conn};
+  archive_format_t format = ARCHIVE_FORMAT_ZIP;
+  char encoded_path[HF_HTTP_PATH_MAX];
+  char relative_dir[HF_HTTP_PATH_MAX];
+  char dir_path[4096];
+  char value[16];
+  char safe_name[256];
+  char header[1024];
+  const char *root_name = "files";
+  size_t safe_len = 0;
+  uint64_t total = 0;
+  fs_path_info_t info = {0};
+  int exit_code = 1;
+
+  relative_dir[0] = '\0';
+  if (http_query_get_value(req->query, "path", encoded_path, sizeof(encoded_path)) == 0 &&
+      (http_decode_name(encoded_path, relative_dir, sizeof(relative_dir)) != 0 ||
+       (relative_dir[0] != '\0' && fs_validate_relative_path(relative_dir) != 0))) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid path");
+  }
+  if (http_query_get_value(req->query, "format", value, sizeof(value)) == 0) {
+    if (strcmp(value, "tar") == 0) {
+      format = ARCHIVE_FORMAT_TAR;
+    } else if (strcmp(value, "zip") != 0) {
+      return http_send_json_error(conn, 400, "Bad Request", "invalid archive format");
+    }
+  }
+  if (fs_join_relative_path(dir_path, sizeof(dir_path), ser_opt->path, relative_dir) != 0 ||
+      fs_stat_path(dir_path, &info) != 0) {
+    return http_send_json_error(conn, 404, "Not Found", "path not found");
+  }
+  if (info.kind != FS_PATH_KIND_DIR && relative_dir[0] != '\0') {
+    return http_send_json_error(conn, 400, "Bad Request", "path is not a directory");
+  }
+
+  if (relative_dir[0] != '\0') {
+    root_name = http_relative_basename(relative_dir);
+  }
+  info.kind = FS_PATH_KIND_DIR;
+  walk.arena = req->arena;
+  walk.base_dir = ser_opt->path;
+  if (http_archive_add(&walk, relative_dir, root_name, &info) != 0 ||
+      http_archive_scan(&walk) != 0) {
+    if (walk.status == 413) {
+      return http_send_json_error(conn, 413, "Payload Too Large",
+                                  "directory too large to archive");
+    }
+    return http_send_json_error(conn, 500, "Internal Server Error",
+                                "failed to list files");
+  }
+  if (walk.count > 2u) {
+    qsort(walk.entries + 1, walk.count - 1u, sizeof(*walk.entries), http_archive_entry_cmp);
+  }
+  if (archive_plan(format, walk.entries, walk.count, &total) != 0) {
+    return http_send_json_error(conn, 413, "Payload Too Large",
+                                "archive path too long");
+  }
+
+  for (const char *p = root_name; *p != '\0' && safe_len + 1u < sizeof(safe_name); p++) {
+    safe_name[safe_len++] = (*p == '"' || *p == '\\' || *p == '\r' || *p == '\n') ? '_' : *p;
+  }
+  safe_name[safe_len] = '\0';
+
+  int n = snprintf(header, sizeof(header),
+                   "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %" PRIu64 "\r\n"
+                   "Content-Disposition: attachment; filename=\"%s.%s\"\r\n"
+                   "Cache-Control: no-store\r\n"
+                   "Connection: close\r\n"
+                   "\r\n",
+                   format == ARCHIVE_FORMAT_ZIP ? "application/zip" : "application/x-tar",
+                   total, safe_name, format == ARCHIVE_FORMAT_ZIP ? "zip" : "tar");
+  if (n < 0 || (size_t)n >= sizeof(header)) {
+    return http_send_json_error(conn, 500, "Internal Server Error", "header too large");
+  }
+
+  out.buf = buf_pool_acquire();
+  if (out.buf == NULL) {
+    return http_send_json_error(conn, 500, "Internal Server Error", "allocation failed");
+  }
+  if (http_stream_write(&out, header, (size_t)n) != 0) {
+    goto CLEANUP;
+  }
+  for (size_t i = 0; i < walk.count; i++) {
+    if (http_archive_send_entry(&out, ser_opt, format, &walk.entries[i]) != 0) {
+      goto CLEANUP;
+    }
+  }
+  if (archive_write_trailer(format, walk.entries, walk.count, http_stream_write, &out) != 0 ||
+      http_stream_flush(&out) != 0) {
+    goto CLEANUP;
+  }
+
+  exit_code = 0;
+
+CLEANUP:
+  buf_pool_release(out.buf);
+  return exit_code;
+}
+
 typedef int (*http_exact_route_handler_t)(socket_t conn,
                                           const server_opt_t *ser_opt,
                                           const http_request_t *req);
@@ -1451,38 +3054,117 @@ static int http_route_files_list(socket_t conn, const server_opt_t *ser_opt,
   return http_handle_files_list(conn, ser_opt, req);
 }
 
+static int http_route_files_upload(socket_t conn, const server_opt_t *ser_opt,
+                                   const http_request_t *req) {
+  return http_handle_files_upload(conn, ser_opt, req);
+}
+
+static int http_route_upload_create(socket_t conn, const server_opt_t *ser_opt,
+                                    const http_request_t *req) {
+  return http_handle_upload_create(conn, ser_opt, req);
+}
+
+static int http_route_archive(socket_t conn, const server_opt_t *ser_opt,
+                              const http_request_t *req) {
+  return http_handle_archive(conn, ser_opt, req);
+}
+
+static int http_route_websocket(socket_t conn, const server_opt_t *ser_opt,
+                                const http_request_t *req) {
+  (void)ser_opt;
+  return http_handle_websocket(conn, req);
+}
+
+static int http_route_search(socket_t conn, const server_opt_t *ser_opt,
+                             const http_request_t *req) {
+  (void)ser_opt;
+  return http_handle_search(conn, req);
+}
+
+static int http_route_stats(socket_t conn, const server_opt_t *ser_opt,
+                            const http_request_t *req) {
+  (void)ser_opt;
+  (void)req;
+  return http_handle_stats(conn);
+}
+
+// The unnamed /api/messages routes serve the default channel.
 static int http_route_messages_post(socket_t conn, const server_opt_t *ser_opt,
                                     const http_request_t *req) {
-  return http_handle_messages_post(conn, ser_opt, req);
+  message_store_channel_t *channel = message_store_channel(MESSAGE_STORE_DEFAULT_CHANNEL);
+  int exit_code = 1;
+
+  if (channel == NULL) {
+    return http_send_channel_error(conn, MESSAGE_STORE_DEFAULT_CHANNEL);
+  }
+  exit_code = http_handle_messages_post(conn, ser_opt, req, channel);
+  message_store_channel_release(channel);
+  return exit_code;
+}
+
+static int http_route_messages_list(socket_t conn, const server_opt_t *ser_opt,
+                                    const http_request_t *req) {
+  message_store_channel_t *channel = message_store_channel(MESSAGE_STORE_DEFAULT_CHANNEL);
+  int exit_code = 1;
+
+  (void)ser_opt;
+  if (channel == NULL) {
+    return http_send_channel_error(conn, MESSAGE_STORE_DEFAULT_CHANNEL);
+  }
+  exit_code = http_handle_messages_list(conn, req, channel);
+  message_store_channel_release(channel);
+  return exit_code;
 }
 
 static int http_route_messages_latest_get(socket_t conn,
                                           const server_opt_t *ser_opt,
                                           const http_request_t *req) {
+  message_store_channel_t *channel = message_store_channel(MESSAGE_STORE_DEFAULT_CHANNEL);
+  int exit_code = 1;
+
   (void)ser_opt;
-  (void)req;
-  return http_handle_messages_latest_get(conn);
+  if (channel == NULL) {
+    return http_send_channel_error(conn, MESSAGE_STORE_DEFAULT_CHANNEL);
+  }
+  exit_code = http_handle_messages_latest_get(conn, req, channel);
+  message_store_channel_release(channel);
+  return exit_code;
 }
 
 static int http_route_messages_stream(socket_t conn,
                                       const server_opt_t *ser_opt,
                                       const http_request_t *req) {
+  message_store_channel_t *channel = message_store_channel(MESSAGE_STORE_DEFAULT_CHANNEL);
+  int exit_code = 1;
+
   (void)ser_opt;
-  (void)req;
-  return http_handle_messages_stream(conn);
+  if (channel == NULL) {
+    return http_send_channel_error(conn, MESSAGE_STORE_DEFAULT_CHANNEL);
+  }
+  exit_code = http_handle_messages_stream(conn, req, channel);
+  message_store_channel_release(channel);
+  return exit_code;
 }
 
 static const http_exact_route_t http_exact_routes[] = {
   {"/api/files", "GET", http_route_files_list},
+  {"/api/files", "POST", http_route_files_upload},
+  {"/api/uploads", "POST", http_route_upload_create},
+  {"/api/archive", "GET", http_route_archive},
+  {"/api/search", "GET", http_route_search},
+  {"/api/stats", "GET", http_route_stats},
+  {"/api/messages", "GET", http_route_messages_list},
   {"/api/messages", "POST", http_route_messages_post},
   {"/api/messages/latest", "GET", http_route_messages_latest_get},
   {"/api/messages/stream", "GET", http_route_messages_stream},
+  {"/api/ws", "GET", http_route_websocket},
 };
 
 static int http_dispatch_exact_route(socket_t conn,
                                      const server_opt_t *ser_opt,
                                      const http_request_t *req) {
   size_t route_count = sizeof(http_exact_routes) / sizeof(http_exact_routes[0]);
+  int path_matched = 0;
 
   for (size_t i = 0; i < route_count; i++) {
     const http_exact_route_t *route = &http_exact_routes[i];
@@ -1490,15 +3172,75 @@ static int http_dispatch_exact_route(socket_t conn,
     if (strcmp(req->path, route->path) != 0) {
       continue;
     }
-    if (strcmp(req->method, route->method) != 0) {
-      return http_send_json_error(conn, 405, "Method Not Allowed", "method not allowed");
+    path_matched = 1;
+    if (strcmp(req->method, route->method) == 0) {
+      return route->handler(conn, ser_opt, req);
     }
-    return route->handler(conn, ser_opt, req);
   }
 
+  if (path_matched) {
+    return http_send_json_error(conn, 405, "Method Not Allowed", "method not allowed");
+  }
   return -1;
 }
 
+// /api/messages/<channel>[/latest|/stream] mirror the unnamed routes for
+// one named channel; /api/messages/<channel>/<version> serves one message's
+// content. Only posting or subscribing creates the channel, so reading one
+// nobody has posted to finds it empty without taking a slot.
+static int http_dispatch_message_route(socket_t conn, const server_opt_t *ser_opt,
+                                       const http_request_t *req) {
+  char name[MESSAGE_STORE_CHANNEL_NAME_MAX + 1u];
+  const char *rest = NULL;
+  const char *slash = NULL;
+  size_t name_len = 0;
+  message_store_channel_t *channel = NULL;
+  int creates = 0;
+  int exit_code = 1;
+
+  if (strncmp(req->path, "/api/messages/", 14) != 0) {
+    return -1;
+  }
+  rest = req->path + 14;
+  slash = strchr(rest, '/');
+  name_len = slash != NULL ? (size_t)(slash - rest) : strlen(rest);
+  if (name_len == 0 || name_len >= sizeof(name)) {
+    return http_send_json_error(conn, 400, "Bad Request", "invalid channel");
+  }
+  memcpy(name, rest, name_len);
+  name[name_len] = '\0';
+  rest = slash != NULL ? slash + 1 : "";
+  if (rest[0] != '\0' && strcmp(rest, "latest") != 0 && strcmp(rest, "stream") != 0 &&
+      (rest[0] < '0' || rest[0] > '9')) {
+    return -1;
+  }
+  if (!message_store_channel_name_valid(name)) {
+    return http_send_channel_error(conn, name);
+  }
+  creates = (rest[0] == '\0' && strcmp(req->method, "POST") == 0) ||
+            (strcmp(rest, "stream") == 0 && strcmp(req->method, "GET") == 0);
+  channel = creates ? message_store_channel(name) : message_store_channel_find(name);
+  if (creates && channel == NULL) {
+    return http_send_channel_error(conn, name);
+  }
+
+  if (rest[0] == '\0' && strcmp(req->method, "GET") == 0) {
+    exit_code = http_handle_messages_list(conn, req, channel);
+  } else if (rest[0] == '\0' && strcmp(req->method, "POST") == 0) {
+    exit_code = http_handle_messages_post(conn, ser_opt, req, channel);
+  } else if (strcmp(rest, "latest") == 0 && strcmp(req->method, "GET") == 0) {
+    exit_code = http_handle_messages_latest_get(conn, req, channel);
+  } else if (strcmp(rest, "stream") == 0 && strcmp(req->method, "GET") == 0) {
+    exit_code = http_handle_messages_stream(conn, req, channel);
+  } else if (rest[0] >= '0' && rest[0] <= '9' && strcmp(req->method, "GET") == 0) {
+    exit_code = http_handle_message_content(conn, channel, rest);
+  } else {
+    exit_code = http_send_json_error(conn, 405, "Method Not Allowed", "method not allowed");
+  }
+  message_store_channel_release(channel);
+  return exit_code;
+}
+
 static int http_dispatch_file_route(socket_t conn,
                                     const server_opt_t *ser_opt,
                                     const http_request_t *req) {
@@ -1511,7 +3253,10 @@ static int http_dispatch_file_route(socket_t conn,
     return http_send_json_error(conn, 400, "Bad Request", "invalid file name");
   }
   if (strcmp(req->method, "GET") == 0) {
-    return http_send_file(conn, ser_opt, route_name);
+    return http_send_file(conn, ser_opt, req, route_name, 0);
+  }
+  if (strcmp(req->method, "HEAD") == 0) {
+    return http_send_file(conn, ser_opt, req, route_name, 1);
   }
   if (strcmp(req->method, "PUT") == 0) {
     return http_handle_file_put(conn, ser_opt, req, route_name);
@@ -1521,6 +3266,8 @@ static int http_dispatch_file_route(socket_t conn,
 
 int handle_http_connection(socket_t conn, const server_opt_t *ser_opt) {
   char header_block[HF_HTTP_HEADER_MAX];
+  char arena_space[HF_HTTP_ARENA_INLINE];
+  arena_t arena;
   http_request_t req = {0};
   const webui_asset_t *asset = NULL;
   int read_res = http_read_header_block(conn, header_block, sizeof(header_block));
@@ -1538,6 +3285,8 @@ int handle_http_connection(socket_t conn, const server_opt_t *ser_opt) {
     return http_send_json_error(conn, 431, "Request Header Fields Too Large",
                                 "header too large");
   }
+  // Handlers time their own bodies; responses are not timed.
+  conn_deadline_enter(CONN_DEADLINE_NONE);
 
   parse_res = http_parse_request(header_block, &req);
   if (parse_res == 1) {
@@ -1551,19 +3300,27 @@ int handle_http_connection(socket_t conn, const server_opt_t *ser_opt) {
   if (strcmp(req.method, "GET") == 0) {
     asset = webui_find_asset(req.path);
     if (asset != NULL) {
-      return http_handle_webui_asset(conn, asset);
+      return http_handle_webui_asset(conn, asset, &req);
     }
   }
 
+  arena_init(&arena, arena_space, sizeof(arena_space));
+  req.arena = &arena;
+
   route_res = http_dispatch_exact_route(conn, ser_opt, &req);
-  if (route_res != -1) {
-    return route_res;
+  if (route_res == -1) {
+    route_res = http_dispatch_message_route(conn, ser_opt, &req);
   }
-
-  route_res = http_dispatch_file_route(conn, ser_opt, &req);
-  if (route_res != -1) {
-    return route_res;
+  if (route_res == -1) {
+    route_res = http_dispatch_file_route(conn, ser_opt, &req);
+  }
+  if (route_res == -1) {
+    route_res = http_dispatch_upload_route(conn, &req);
+  }
+  if (route_res == -1) {
+    route_res = http_send_json_error(conn, 404, "Not Found", "route not found");
   }
 
-  return http_send_json_error(conn, 404, "Not Found", "route not found");
+  arena_release(&arena);
+  return route_res;
 }
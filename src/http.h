@@ -4,6 +4,10 @@
 #include "cli.h"
 #include "net.h"
 
+// Returned when a handler handed the socket to another owner; the caller
+// must not close it.
+#define HTTP_CONN_DETACHED 2
+
 int handle_http_connection(socket_t conn, const server_opt_t *ser_opt);
 
 #endif  // HF_HTTP_H
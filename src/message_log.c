@@ -0,0 +1,400 @@
+#include "message_log.h"
+
+#include "crc32.h"
+#include "fs.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <process.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+// File: magic, then records of
+//   u32 len | u32 crc32(payload) | u64 version | u32 channel_len |
+//   u32 mime_len | payload (channel, mime, then text) | u32 len | u32 tag
+// all little-endian, len being the payload length. The trailing length lets
+// records be found from EOF.
+#define MESSAGE_LOG_MAGIC "HFMLOG3\n"
+#define MESSAGE_LOG_MAGIC_LEN 8u
+#define MESSAGE_LOG_HEAD_LEN 24u
+#define MESSAGE_LOG_TAIL_LEN 8u
+#define MESSAGE_LOG_TAIL_TAG 0x314D4648u
+#define MESSAGE_LOG_COMPACT_BYTES (16u * 1024u * 1024u)
+
+typedef struct {
+  int fd;
+  char path[4096];
+  uint64_t size;
+  uint64_t compacted_size;  // size after the last open or compaction
+} message_log_state_t;
+
+static message_log_state_t g_message_log = {.fd = -1};
+
+static void message_log_put32(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)(v & 0xFFu);
+  p[1] = (unsigned char)((v >> 8) & 0xFFu);
+  p[2] = (unsigned char)((v >> 16) & 0xFFu);
+  p[3] = (unsigned char)((v >> 24) & 0xFFu);
+}
+
+static void message_log_put64(unsigned char *p, uint64_t v) {
+  message_log_put32(p, (uint32_t)(v & 0xFFFFFFFFu));
+  message_log_put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t message_log_get32(const unsigned char *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint64_t message_log_get64(const unsigned char *p) {
+  return (uint64_t)message_log_get32(p) | ((uint64_t)message_log_get32(p + 4) << 32);
+}
+
+static int message_log_process_id(void) {
+#ifdef _WIN32
+  return _getpid();
+#else
+  return (int)getpid();
+#endif
+}
+
+static int message_log_open_append(const char *path) {
+  int flags = O_RDWR | O_CREAT | O_APPEND;
+#ifdef _WIN32
+  flags |= O_BINARY;
+#endif
+  return fs_open(path, flags, 0644);
+}
+
+static int message_log_write_record(int fd, const message_log_record_t *record,
+                                    uint64_t *size_io) {
+  size_t payload_len = 0;
+  size_t total = 0;
+  unsigned char *buf = NULL;
+  int exit_code = 1;
+
+  if ((uint64_t)record->channel_len + record->mime_len + record->len > UINT32_MAX ||
+      (uint64_t)record->channel_len + record->mime_len + record->len >
+        SIZE_MAX - MESSAGE_LOG_HEAD_LEN - MESSAGE_LOG_TAIL_LEN) {
+    return 1;
+  }
+  payload_len = record->channel_len + record->mime_len + record->len;
+  total = MESSAGE_LOG_HEAD_LEN + payload_len + MESSAGE_LOG_TAIL_LEN;
+  buf = (unsigned char *)malloc(total);
+  if (buf == NULL) {
+    return 1;
+  }
+
+  // One write per record, so a crash can only tear the newest one.
+  message_log_put32(buf, (uint32_t)payload_len);
+  message_log_put64(buf + 8, record->version);
+  message_log_put32(buf + 16, (uint32_t)record->channel_len);
+  message_log_put32(buf + 20, (uint32_t)record->mime_len);
+  memcpy(buf + MESSAGE_LOG_HEAD_LEN, record->channel, record->channel_len);
+  if (record->mime_len > 0) {
+    memcpy(buf + MESSAGE_LOG_HEAD_LEN + record->channel_len, record->mime, record->mime_len);
+  }
+  if (record->len > 0) {
+    memcpy(buf + MESSAGE_LOG_HEAD_LEN + record->channel_len + record->mime_len, record->text,
+           record->len);
+  }
+  message_log_put32(buf + 4, crc32_update(0, buf + MESSAGE_LOG_HEAD_LEN, payload_len));
+  message_log_put32(buf + total - 8u, (uint32_t)payload_len);
+  message_log_put32(buf + total - 4u, MESSAGE_LOG_TAIL_TAG);
+  if (fs_write_all(fd, buf, total) != (ssize_t)total) {
+    goto CLEANUP;
+  }
+  *size_io += total;
+  exit_code = 0;
+
+CLEANUP:
+  free(buf);
+  return exit_code;
+}
+
+// Decodes the record that ends at end. Only the newest record needs its
+// checksum verified: appends are ordered, so anything before it is whole.
+static int message_log_record_before(const unsigned char *data, uint64_t end,
+                                     int check_crc, uint64_t *start_out,
+                                     message_log_record_t *out) {
+  uint32_t len = 0;
+  uint32_t channel_len = 0;
+  uint32_t mime_len = 0;
+  uint64_t start = 0;
+
+  if (end < MESSAGE_LOG_MAGIC_LEN + MESSAGE_LOG_HEAD_LEN + MESSAGE_LOG_TAIL_LEN ||
+      message_log_get32(data + end - 4u) != MESSAGE_LOG_TAIL_TAG) {
+    return 1;
+  }
+  len = message_log_get32(data + end - 8u);
+  if ((uint64_t)len >
+      end - MESSAGE_LOG_MAGIC_LEN - MESSAGE_LOG_HEAD_LEN - MESSAGE_LOG_TAIL_LEN) {
+    return 1;
+  }
+  start = end - MESSAGE_LOG_TAIL_LEN - len - MESSAGE_LOG_HEAD_LEN;
+  channel_len = message_log_get32(data + start + 16u);
+  mime_len = message_log_get32(data + start + 20u);
+  if (message_log_get32(data + start) != len ||
+      (uint64_t)channel_len + mime_len > len) {
+    return 1;
+  }
+
+  out->channel = (const char *)data + start + MESSAGE_LOG_HEAD_LEN;
+  out->channel_len = channel_len;
+  out->version = message_log_get64(data + start + 8u);
+  out->mime = mime_len > 0 ? out->channel + channel_len : NULL;
+  out->mime_len = mime_len;
+  out->text = out->channel + channel_len + mime_len;
+  out->len = len - channel_len - mime_len;
+  if (check_crc && crc32_update(0, data + start + MESSAGE_LOG_HEAD_LEN, len) !=
+                     message_log_get32(data + start + 4u)) {
+    return 1;
+  }
+  *start_out = start;
+  return 0;
+}
+
+// Only used when the newest record is torn: scans forward for the end of
+// the last intact record.
+static uint64_t message_log_valid_end(const unsigned char *data, uint64_t size) {
+  uint64_t offset = MESSAGE_LOG_MAGIC_LEN;
+
+  while (size - offset >= MESSAGE_LOG_HEAD_LEN + MESSAGE_LOG_TAIL_LEN) {
+    uint32_t len = message_log_get32(data + offset);
+    uint64_t end = 0;
+
+    if ((uint64_t)len > size - offset - MESSAGE_LOG_HEAD_LEN - MESSAGE_LOG_TAIL_LEN) {
+      break;
+    }
+    end = offset + MESSAGE_LOG_HEAD_LEN + len + MESSAGE_LOG_TAIL_LEN;
+    if (message_log_get32(data + end - 8u) != len ||
+        message_log_get32(data + end - 4u) != MESSAGE_LOG_TAIL_TAG ||
+        (uint64_t)message_log_get32(data + offset + 16u) +
+            message_log_get32(data + offset + 20u) > len ||
+        crc32_update(0, data + offset + MESSAGE_LOG_HEAD_LEN, len) !=
+          message_log_get32(data + offset + 4u)) {
+      break;
+    }
+    offset = end;
+  }
+  return offset;
+}
+
+int message_log_open(const char *path, message_log_visit_fn visit, void *ctx) {
+  fs_path_info_t info;
+  const unsigned char *data = NULL;
+  uint64_t size = 0;
+  uint64_t end = 0;
+  int fd = -1;
+  int exit_code = 1;
+
+  if (path == NULL || visit == NULL || g_message_log.fd != -1) {
+    return 1;
+  }
+  if (snprintf(g_message_log.path, sizeof(g_message_log.path), "%s", path) >=
+      (int)sizeof(g_message_log.path)) {
+    return 1;
+  }
+
+  fd = message_log_open_append(path);
+  if (fd == -1 || fs_stat_path(path, &info) != 0) {
+    goto CLEANUP;
+  }
+  size = info.size;
+  if (size == 0) {
+    if (fs_write_all(fd, MESSAGE_LOG_MAGIC, MESSAGE_LOG_MAGIC_LEN) !=
+        (ssize_t)MESSAGE_LOG_MAGIC_LEN) {
+      goto CLEANUP;
+    }
+    size = MESSAGE_LOG_MAGIC_LEN;
+  }
+  if (size < MESSAGE_LOG_MAGIC_LEN || fs_map_readonly(fd, size, (const void **)&data) != 0) {
+    goto CLEANUP;
+  }
+  if (memcmp(data, MESSAGE_LOG_MAGIC, MESSAGE_LOG_MAGIC_LEN) != 0) {
+    goto CLEANUP;
+  }
+
+  for (;;) {
+    message_log_record_t record;
+    uint64_t start = 0;
+
+    if (size == MESSAGE_LOG_MAGIC_LEN ||
+        message_log_record_before(data, size, 1, &start, &record) == 0) {
+      break;
+    }
+
+    // The newest record is torn (the daemon died mid-append): cut it off.
+    uint64_t valid_end = message_log_valid_end(data, size);
+    if (valid_end == size) {
+      goto CLEANUP;
+    }
+    fs_unmap(data, size);
+    data = NULL;
+    if (fs_truncate(fd, valid_end) != 0) {
+      goto CLEANUP;
+    }
+    size = valid_end;
+    if (fs_map_readonly(fd, size, (const void **)&data) != 0) {
+      goto CLEANUP;
+    }
+  }
+
+  // Anything before a record that does not parse is unreachable; that can
+  // only be damage from outside, so it is left alone rather than guessed at.
+  end = size;
+  while (end > MESSAGE_LOG_MAGIC_LEN) {
+    message_log_record_t record;
+    uint64_t start = 0;
+
+    if (message_log_record_before(data, end, 0, &start, &record) != 0) {
+      break;
+    }
+    if (visit(ctx, &record) != 0) {
+      goto CLEANUP;
+    }
+    end = start;
+  }
+
+  g_message_log.fd = fd;
+  g_message_log.size = size;
+  g_message_log.compacted_size = size;
+  fd = -1;
+  exit_code = 0;
+
+CLEANUP:
+  if (data != NULL) {
+    fs_unmap(data, size);
+  }
+  if (fd != -1) {
+    (void)fs_close(fd);
+  }
+  return exit_code;
+}
+
+int message_log_append(const message_log_record_t *record) {
+  if (g_message_log.fd == -1 || record == NULL) {
+    return 1;
+  }
+  return message_log_write_record(g_message_log.fd, record, &g_message_log.size);
+}
+
+int message_log_needs_compaction(void) {
+  return g_message_log.fd != -1 && g_message_log.size >= MESSAGE_LOG_COMPACT_BYTES &&
+         g_message_log.size / 2u >= g_message_log.compacted_size;
+}
+
+uint64_t message_log_size(void) {
+  return g_message_log.size;
+}
+
+int message_log_compact_write(message_log_compaction_t *compaction, uint64_t base,
+                              const message_log_record_t *records, size_t count) {
+  if (compaction == NULL || (records == NULL && count > 0)) {
+    return 1;
+  }
+  compaction->fd = -1;
+  compaction->base = base;
+  compaction->size = MESSAGE_LOG_MAGIC_LEN;
+
+  for (int attempt = 0; attempt < 3; attempt++) {
+    if (fs_build_temp_path(compaction->path, sizeof(compaction->path), g_message_log.path,
+                           message_log_process_id(), attempt) != 0) {
+      return 1;
+    }
+    compaction->fd = fs_open_temp_file(compaction->path);
+    if (compaction->fd != -1 || errno != EEXIST) {
+      break;
+    }
+  }
+  if (compaction->fd == -1) {
+    return 1;
+  }
+
+  if (fs_write_all(compaction->fd, MESSAGE_LOG_MAGIC, MESSAGE_LOG_MAGIC_LEN) !=
+      (ssize_t)MESSAGE_LOG_MAGIC_LEN) {
+    goto FAIL;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (message_log_write_record(compaction->fd, &records[i], &compaction->size) != 0) {
+      goto FAIL;
+    }
+  }
+  return 0;
+
+FAIL:
+  (void)fs_close(compaction->fd);
+  compaction->fd = -1;
+  fs_remove_ignore_error(compaction->path);
+  return 1;
+}
+
+int message_log_compact_commit(message_log_compaction_t *compaction) {
+  unsigned char buf[16384];
+  uint64_t offset = 0;
+  int committed = 0;
+
+  if (compaction == NULL || compaction->fd == -1) {
+    return 1;
+  }
+  if (g_message_log.fd == -1 || compaction->base > g_message_log.size) {
+    goto FAIL;
+  }
+
+  // Records appended while the snapshot was being written carry over as is.
+  for (offset = compaction->base; offset < g_message_log.size;) {
+    uint64_t left = g_message_log.size - offset;
+    size_t want = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+    ssize_t n = fs_pread(g_message_log.fd, buf, want, offset);
+
+    if (n <= 0 || fs_write_all(compaction->fd, buf, (size_t)n) != n) {
+      goto FAIL;
+    }
+    offset += (uint64_t)n;
+    compaction->size += (uint64_t)n;
+  }
+  if (fs_close(compaction->fd) != 0) {
+    compaction->fd = -1;
+    goto FAIL;
+  }
+  compaction->fd = -1;
+
+  // Windows cannot replace a file that is still open.
+  (void)fs_close(g_message_log.fd);
+  committed = fs_commit_temp_file(compaction->path, g_message_log.path, NULL) == 0;
+  g_message_log.fd = message_log_open_append(g_message_log.path);
+  if (!committed) {
+    fs_remove_ignore_error(compaction->path);
+    return 1;
+  }
+  if (g_message_log.fd == -1) {
+    return 1;
+  }
+  g_message_log.size = compaction->size;
+  g_message_log.compacted_size = compaction->size;
+  return 0;
+
+FAIL:
+  if (compaction->fd != -1) {
+    (void)fs_close(compaction->fd);
+    compaction->fd = -1;
+  }
+  fs_remove_ignore_error(compaction->path);
+  return 1;
+}
+
+void message_log_close(void) {
+  if (g_message_log.fd != -1) {
+    (void)fs_close(g_message_log.fd);
+  }
+  g_message_log.fd = -1;
+  g_message_log.size = 0;
+  g_message_log.compacted_size = 0;
+}
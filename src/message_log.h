@@ -0,0 +1,51 @@
+#ifndef HF_MESSAGE_LOG_H
+#define HF_MESSAGE_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  const char *channel;  // not NUL-terminated
+  size_t channel_len;
+  uint64_t version;
+  const char *mime;  // NULL for text messages, not NUL-terminated
+  size_t mime_len;
+  const char *text;
+  size_t len;
+} message_log_record_t;
+
+// Records passed to visit are only valid for the duration of the call;
+// returning non-zero aborts the open.
+typedef int (*message_log_visit_fn)(void *ctx, const message_log_record_t *record);
+
+typedef struct {
+  char path[4096];
+  int fd;
+  uint64_t base;  // log size the records were taken at
+  uint64_t size;
+} message_log_compaction_t;
+
+// An append-only file of length-prefixed records, each tagged with its
+// channel. Every record also ends with its length, so opening walks
+// backwards from the end and only touches record headers until the reader
+// copies what it keeps. Compaction bounds how far that walk can go.
+// Callers serialize access, except for message_log_compact_write; the
+// message store holds its log lock.
+//
+// Visits every record newest first.
+int message_log_open(const char *path, message_log_visit_fn visit, void *ctx);
+int message_log_append(const message_log_record_t *record);
+// True once the log has grown well past what a compaction would leave.
+int message_log_needs_compaction(void);
+uint64_t message_log_size(void);
+// Compaction runs in two steps so appends only wait for the second. The
+// records, oldest first, are everything the log held at size base; writing
+// them out needs no lock. Committing does, and atomically replaces the log
+// with those records plus whatever was appended after base. Either step
+// cleans up after itself on failure.
+int message_log_compact_write(message_log_compaction_t *compaction, uint64_t base,
+                              const message_log_record_t *records, size_t count);
+int message_log_compact_commit(message_log_compaction_t *compaction);
+void message_log_close(void);
+
+#endif  // HF_MESSAGE_LOG_H
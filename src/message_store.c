@@ -1,46 +1,565 @@
 #include "message_store.h"
 
+#include "fs.h"
+#include "message_log.h"
+
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #ifdef _WIN32
+  #include <process.h>
   #include <windows.h>
 #else
+  #include <fcntl.h>
   #include <pthread.h>
   #include <time.h>
+  #include <unistd.h>
 #endif
 
-typedef struct {
-  char *message;
+// Recent messages live in a per-channel ring indexed by
+// version % MESSAGE_STORE_HISTORY; the oldest are also dropped once the ring
+// holds more than MESSAGE_STORE_HISTORY_BYTES, but the latest message is
+// always kept. All channels together hold at most MESSAGE_STORE_TOTAL_BYTES
+// of text and MESSAGE_STORE_SPILL_BYTES of binary payloads on disk.
+#define MESSAGE_STORE_HISTORY_BYTES (4u * 1024u * 1024u)
+#define MESSAGE_STORE_TOTAL_BYTES (256u * 1024u * 1024u)
+#define MESSAGE_STORE_SPILL_BYTES (1024ull * 1024u * 1024u)
+#define MESSAGE_STORE_MAX_CHANNELS 4096u
+#define MESSAGE_STORE_MIN_BUCKETS 64u
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION message_store_mutex_t;
+#else
+typedef pthread_mutex_t message_store_mutex_t;
+#endif
+
+// Readers only take a reference under the channel lock; nothing is copied.
+struct message_store_channel {
+  char name[MESSAGE_STORE_CHANNEL_NAME_MAX + 1u];
+  uint32_t hash;
+  message_store_blob_t *history[MESSAGE_STORE_HISTORY];
+  uint64_t oldest;  // oldest version still held, 0 while empty
+  size_t history_bytes;
   uint64_t version;
-  int initialized;
+  uint64_t logged;  // newest version in the log, under the log lock
+  size_t refs;      // under the table lock
   int shutting_down;
+  message_store_listener_t *listeners;
+  message_store_mutex_t mutex;
 #ifdef _WIN32
-  CRITICAL_SECTION mutex;
   CONDITION_VARIABLE cond;
 #else
-  pthread_mutex_t mutex;
   pthread_cond_t cond;
 #endif
+};
+
+// Channels sit in an open-addressing table (linear probing, power-of-two
+// size). A channel pointer stays valid without the table lock for as long as
+// its holder keeps a reference; one that never held a message is removed
+// with its last reference. Lock order: log, table, channel.
+typedef struct {
+  message_store_channel_t **buckets;
+  size_t bucket_count;
+  size_t channel_count;
+  volatile uint64_t total_bytes;
+  volatile uint64_t spill_bytes;
+  volatile uint64_t spill_seq;
+  int initialized;
+  int shutting_down;
+  int logging;     // fixed once anything can publish
+  int log_failed;  // this and the two below under log_mutex
+  int compact_requested;
+  int log_stopping;
+  message_store_mutex_t mutex;
+  message_store_mutex_t log_mutex;
+#ifdef _WIN32
+  CONDITION_VARIABLE log_cond;
+  HANDLE log_thread;
+#else
+  pthread_cond_t log_cond;
+  pthread_t log_thread;
+#endif
 } message_store_state_t;
 
 static message_store_state_t g_message_store = {0};
 
-static void message_store_lock(void) {
+static int message_store_mutex_init(message_store_mutex_t *mutex) {
+#ifdef _WIN32
+  InitializeCriticalSection(mutex);
+  return 0;
+#else
+  return pthread_mutex_init(mutex, NULL) == 0 ? 0 : 1;
+#endif
+}
+
+static void message_store_mutex_destroy(message_store_mutex_t *mutex) {
+#ifdef _WIN32
+  DeleteCriticalSection(mutex);
+#else
+  (void)pthread_mutex_destroy(mutex);
+#endif
+}
+
+static void message_store_lock(message_store_mutex_t *mutex) {
+#ifdef _WIN32
+  EnterCriticalSection(mutex);
+#else
+  (void)pthread_mutex_lock(mutex);
+#endif
+}
+
+static void message_store_unlock(message_store_mutex_t *mutex) {
+#ifdef _WIN32
+  LeaveCriticalSection(mutex);
+#else
+  (void)pthread_mutex_unlock(mutex);
+#endif
+}
+
+static void message_store_broadcast(message_store_channel_t *channel) {
+#ifdef _WIN32
+  WakeAllConditionVariable(&channel->cond);
+#else
+  (void)pthread_cond_broadcast(&channel->cond);
+#endif
+}
+
+// Caller holds the log lock.
+static void message_store_log_wait(void) {
+#ifdef _WIN32
+  (void)SleepConditionVariableCS(&g_message_store.log_cond, &g_message_store.log_mutex,
+                                 INFINITE);
+#else
+  (void)pthread_cond_wait(&g_message_store.log_cond, &g_message_store.log_mutex);
+#endif
+}
+
+static void message_store_log_wake(void) {
+#ifdef _WIN32
+  WakeAllConditionVariable(&g_message_store.log_cond);
+#else
+  (void)pthread_cond_broadcast(&g_message_store.log_cond);
+#endif
+}
+
+static uint64_t message_store_counter_add(volatile uint64_t *counter, uint64_t n) {
+#ifdef _WIN32
+  return (uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)counter, (LONG64)n) + n;
+#else
+  return __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+#endif
+}
+
+static void message_store_counter_sub(volatile uint64_t *counter, uint64_t n) {
+#ifdef _WIN32
+  (void)InterlockedExchangeAdd64((volatile LONG64 *)counter, -(LONG64)n);
+#else
+  (void)__atomic_sub_fetch(counter, n, __ATOMIC_RELAXED);
+#endif
+}
+
+// A binary blob keeps its MIME type after the empty text and, where an open
+// file cannot be unlinked, the spill path after that.
+static void message_store_blob_free(message_store_blob_t *blob) {
+  if (blob->fd >= 0) {
+    (void)fs_close(blob->fd);
+    if (blob->mime != NULL) {
+      const char *path = blob->mime + strlen(blob->mime) + 1u;
+      if (path[0] != '\0') {
+        fs_remove_ignore_error(path);
+      }
+    }
+  }
+  free(blob);
+}
+
+message_store_blob_t *message_store_ref(message_store_blob_t *blob) {
+  if (blob != NULL) {
 #ifdef _WIN32
-  EnterCriticalSection(&g_message_store.mutex);
+    (void)InterlockedIncrement64((volatile LONG64 *)&blob->refs);
 #else
-  (void)pthread_mutex_lock(&g_message_store.mutex);
+    (void)__atomic_fetch_add(&blob->refs, 1u, __ATOMIC_RELAXED);
 #endif
+  }
+  return blob;
 }
 
-static void message_store_unlock(void) {
+void message_store_unref(message_store_blob_t *blob) {
+  if (blob == NULL) {
+    return;
+  }
 #ifdef _WIN32
-  LeaveCriticalSection(&g_message_store.mutex);
+  if (InterlockedDecrement64((volatile LONG64 *)&blob->refs) == 0) {
+    message_store_blob_free(blob);
+  }
 #else
-  (void)pthread_mutex_unlock(&g_message_store.mutex);
+  if (__atomic_sub_fetch(&blob->refs, 1u, __ATOMIC_ACQ_REL) == 0) {
+    message_store_blob_free(blob);
+  }
+#endif
+}
+
+static message_store_blob_t *message_store_blob_new(const char *text, size_t len,
+                                                    uint64_t version) {
+  message_store_blob_t *blob =
+    (message_store_blob_t *)malloc(sizeof(*blob) + len + 1u);
+
+  if (blob == NULL) {
+    return NULL;
+  }
+  blob->refs = 1;
+  blob->version = version;
+  blob->len = len;
+  blob->mime = NULL;
+  blob->size = 0;
+  blob->fd = -1;
+  if (len > 0) {
+    memcpy(blob->text, text, len);
+  }
+  blob->text[len] = '\0';
+  return blob;
+}
+
+// What a binary message comes back as after a restart: its MIME type
+// survives in the log but its payload does not.
+static message_store_blob_t *message_store_blob_expired(const char *mime, size_t mime_len,
+                                                       uint64_t version) {
+  message_store_blob_t *blob =
+    (message_store_blob_t *)malloc(sizeof(*blob) + 1u + mime_len + 1u + 1u);
+
+  if (blob == NULL) {
+    return NULL;
+  }
+  blob->refs = 1;
+  blob->version = version;
+  blob->len = 0;
+  blob->text[0] = '\0';
+  memcpy(blob->text + 1, mime, mime_len);
+  blob->text[1 + mime_len] = '\0';
+  blob->text[1 + mime_len + 1] = '\0';
+  blob->mime = blob->text + 1;
+  blob->size = 0;
+  blob->fd = -1;
+  return blob;
+}
+
+// Caller holds the channel lock; returns a new reference.
+static message_store_blob_t *message_store_latest(message_store_channel_t *channel) {
+  if (channel->version == 0) {
+    return NULL;
+  }
+  return message_store_ref(channel->history[channel->version % MESSAGE_STORE_HISTORY]);
+}
+
+// Caller holds the channel lock; the ring takes over the reference.
+static void message_store_hold(message_store_channel_t *channel,
+                               message_store_blob_t *blob) {
+  channel->history[blob->version % MESSAGE_STORE_HISTORY] = blob;
+  channel->history_bytes += blob->len;
+  (void)message_store_counter_add(&g_message_store.total_bytes, blob->len);
+  (void)message_store_counter_add(&g_message_store.spill_bytes, blob->size);
+}
+
+// Caller holds the channel lock.
+static void message_store_drop_oldest(message_store_channel_t *channel) {
+  message_store_blob_t **slot = &channel->history[channel->oldest % MESSAGE_STORE_HISTORY];
+
+  channel->history_bytes -= (*slot)->len;
+  message_store_counter_sub(&g_message_store.total_bytes, (*slot)->len);
+  message_store_counter_sub(&g_message_store.spill_bytes, (*slot)->size);
+  message_store_unref(*slot);
+  *slot = NULL;
+  channel->oldest++;
+}
+
+// Caller holds the channel lock.
+static void message_store_notify_listeners(message_store_channel_t *channel) {
+  for (message_store_listener_t *l = channel->listeners; l != NULL; l = l->next) {
+    l->notify(l->ctx);
+  }
+}
+
+static uint32_t message_store_hash(const char *name) {
+  uint32_t hash = 2166136261u;
+
+  for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++) {
+    hash = (hash ^ *p) * 16777619u;
+  }
+  return hash;
+}
+
+// Caller holds the table lock.
+static message_store_channel_t *message_store_find(const char *name, uint32_t hash) {
+  size_t mask = g_message_store.bucket_count - 1u;
+
+  for (size_t i = hash & mask;; i = (i + 1u) & mask) {
+    message_store_channel_t *channel = g_message_store.buckets[i];
+    if (channel == NULL) {
+      return NULL;
+    }
+    if (channel->hash == hash && strcmp(channel->name, name) == 0) {
+      return channel;
+    }
+  }
+}
+
+// Caller holds the table lock.
+static void message_store_insert(message_store_channel_t **buckets, size_t bucket_count,
+                                 message_store_channel_t *channel) {
+  size_t mask = bucket_count - 1u;
+  size_t i = channel->hash & mask;
+
+  while (buckets[i] != NULL) {
+    i = (i + 1u) & mask;
+  }
+  buckets[i] = channel;
+}
+
+// Caller holds the table lock. Closes the gap left behind by shifting back
+// later entries of the probe run that could have lived in it.
+static void message_store_remove(message_store_channel_t *channel) {
+  size_t mask = g_message_store.bucket_count - 1u;
+  size_t hole = channel->hash & mask;
+
+  while (g_message_store.buckets[hole] != channel) {
+    hole = (hole + 1u) & mask;
+  }
+  g_message_store.buckets[hole] = NULL;
+  for (size_t i = (hole + 1u) & mask; g_message_store.buckets[i] != NULL;
+       i = (i + 1u) & mask) {
+    size_t home = g_message_store.buckets[i]->hash & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      g_message_store.buckets[hole] = g_message_store.buckets[i];
+      g_message_store.buckets[i] = NULL;
+      hole = i;
+    }
+  }
+  g_message_store.channel_count--;
+}
+
+// Caller holds the table lock. Keeps the load factor at or below 3/4.
+static int message_store_reserve(void) {
+  size_t count = g_message_store.bucket_count;
+  message_store_channel_t **buckets = NULL;
+
+  if ((g_message_store.channel_count + 1u) * 4u <= count * 3u) {
+    return 0;
+  }
+  count = count == 0 ? MESSAGE_STORE_MIN_BUCKETS : count * 2u;
+  buckets = (message_store_channel_t **)calloc(count, sizeof(*buckets));
+  if (buckets == NULL) {
+    return 1;
+  }
+  for (size_t i = 0; i < g_message_store.bucket_count; i++) {
+    if (g_message_store.buckets[i] != NULL) {
+      message_store_insert(buckets, count, g_message_store.buckets[i]);
+    }
+  }
+  free(g_message_store.buckets);
+  g_message_store.buckets = buckets;
+  g_message_store.bucket_count = count;
+  return 0;
+}
+
+static message_store_channel_t *message_store_channel_new(const char *name, uint32_t hash) {
+  message_store_channel_t *channel =
+    (message_store_channel_t *)calloc(1, sizeof(*channel));
+
+  if (channel == NULL) {
+    return NULL;
+  }
+  if (message_store_mutex_init(&channel->mutex) != 0) {
+    free(channel);
+    return NULL;
+  }
+#ifdef _WIN32
+  InitializeConditionVariable(&channel->cond);
+#else
+  if (pthread_cond_init(&channel->cond, NULL) != 0) {
+    message_store_mutex_destroy(&channel->mutex);
+    free(channel);
+    return NULL;
+  }
+#endif
+  (void)snprintf(channel->name, sizeof(channel->name), "%s", name);
+  channel->hash = hash;
+  return channel;
+}
+
+static void message_store_channel_free(message_store_channel_t *channel) {
+  while (channel->oldest != 0 && channel->oldest <= channel->version) {
+    message_store_drop_oldest(channel);
+  }
+#ifndef _WIN32
+  (void)pthread_cond_destroy(&channel->cond);
+#endif
+  message_store_mutex_destroy(&channel->mutex);
+  free(channel);
+}
+
+// Visited newest first. Each channel takes its newest record as its latest
+// message, then keeps older ones while they continue its version sequence
+// and fit its history; anything after the first gap is ignored.
+static int message_store_restore(void *ctx, const message_log_record_t *record) {
+  char name[MESSAGE_STORE_CHANNEL_NAME_MAX + 1u];
+  message_store_channel_t *channel = NULL;
+  message_store_blob_t *blob = NULL;
+  int keep = 0;
+
+  (void)ctx;
+  if (record->channel_len > MESSAGE_STORE_CHANNEL_NAME_MAX || record->version == 0 ||
+      record->mime_len > MESSAGE_STORE_MIME_MAX) {
+    return 0;
+  }
+  memcpy(name, record->channel, record->channel_len);
+  name[record->channel_len] = '\0';
+  channel = message_store_channel(name);
+  if (channel == NULL) {
+    return 0;
+  }
+
+  message_store_lock(&channel->mutex);
+  if (channel->version == 0) {
+    keep = 1;
+  } else {
+    keep = record->version + 1u == channel->oldest &&
+           channel->version - record->version < MESSAGE_STORE_HISTORY &&
+           channel->history_bytes + record->len <= MESSAGE_STORE_HISTORY_BYTES &&
+           g_message_store.total_bytes + record->len <= MESSAGE_STORE_TOTAL_BYTES;
+  }
+  if (keep && record->mime != NULL) {
+    blob = message_store_blob_expired(record->mime, record->mime_len, record->version);
+  } else if (keep) {
+    blob = message_store_blob_new(record->text, record->len, record->version);
+  }
+  if (blob != NULL) {
+    if (channel->version == 0) {
+      channel->version = record->version;
+      channel->logged = record->version;
+    }
+    channel->oldest = record->version;
+    message_store_hold(channel, blob);
+  }
+  message_store_unlock(&channel->mutex);
+  message_store_channel_release(channel);
+  return keep && blob == NULL ? 1 : 0;
+}
+
+// Caller holds the log lock, which is dropped while the new log is written.
+// Rewrites the log with what every channel still holds, channel by channel,
+// oldest first, up to what it has logged so far; versions still on their way
+// to the log are appended after the snapshot and carried over with it.
+static int message_store_compact_log(void) {
+  message_store_channel_t **channels = NULL;
+  message_log_record_t *records = NULL;
+  message_store_blob_t **blobs = NULL;
+  message_log_compaction_t compaction;
+  uint64_t base = message_log_size();
+  size_t channel_count = 0;
+  size_t count = 0;
+  size_t cap = 0;
+  int exit_code = 1;
+
+  message_store_lock(&g_message_store.mutex);
+  channels = (message_store_channel_t **)malloc(
+    (g_message_store.channel_count + 1u) * sizeof(*channels));
+  if (channels != NULL) {
+    for (size_t i = 0; i < g_message_store.bucket_count; i++) {
+      if (g_message_store.buckets[i] != NULL) {
+        channels[channel_count] = g_message_store.buckets[i];
+        channels[channel_count++]->refs++;
+      }
+    }
+  }
+  message_store_unlock(&g_message_store.mutex);
+  if (channels == NULL) {
+    return 1;
+  }
+
+  for (size_t c = 0; c < channel_count; c++) {
+    message_store_channel_t *channel = channels[c];
+
+    message_store_lock(&channel->mutex);
+    if (channel->oldest != 0 && channel->oldest <= channel->logged &&
+        count + (size_t)(channel->logged - channel->oldest + 1u) > cap) {
+      size_t grown = cap * 2u + MESSAGE_STORE_HISTORY;
+      message_log_record_t *more_records =
+        (message_log_record_t *)realloc(records, grown * sizeof(*records));
+      message_store_blob_t **more_blobs = NULL;
+
+      if (more_records != NULL) {
+        records = more_records;
+        more_blobs = (message_store_blob_t **)realloc(blobs, grown * sizeof(*blobs));
+      }
+      if (more_blobs == NULL) {
+        message_store_unlock(&channel->mutex);
+        goto CLEANUP;
+      }
+      blobs = more_blobs;
+      cap = grown;
+    }
+    for (uint64_t v = channel->oldest; v != 0 && v <= channel->logged; v++) {
+      blobs[count] = message_store_ref(channel->history[v % MESSAGE_STORE_HISTORY]);
+      records[count].channel = channel->name;
+      records[count].channel_len = strlen(channel->name);
+      records[count].version = v;
+      records[count].mime = blobs[count]->mime;
+      records[count].mime_len = blobs[count]->mime != NULL ? strlen(blobs[count]->mime) : 0;
+      records[count].text = blobs[count]->text;
+      records[count].len = blobs[count]->len;
+      count++;
+    }
+    message_store_unlock(&channel->mutex);
+  }
+  message_store_unlock(&g_message_store.log_mutex);
+  exit_code = message_log_compact_write(&compaction, base, records, count);
+  message_store_lock(&g_message_store.log_mutex);
+  if (exit_code == 0) {
+    exit_code = message_log_compact_commit(&compaction);
+  }
+
+CLEANUP:
+  for (size_t i = 0; i < count; i++) {
+    message_store_unref(blobs[i]);
+  }
+  for (size_t c = 0; c < channel_count; c++) {
+    message_store_channel_release(channels[c]);
+  }
+  free(blobs);
+  free(records);
+  free(channels);
+  return exit_code;
+}
+
+#ifdef _WIN32
+static unsigned __stdcall message_store_log_thread_main(void *arg) {
+#else
+static void *message_store_log_thread_main(void *arg) {
+#endif
+  (void)arg;
+
+  message_store_lock(&g_message_store.log_mutex);
+  while (!g_message_store.log_stopping) {
+    if (!g_message_store.compact_requested) {
+      message_store_log_wait();
+      continue;
+    }
+    g_message_store.compact_requested = 0;
+    if (!g_message_store.log_failed && message_log_needs_compaction() &&
+        message_store_compact_log() != 0) {
+      fprintf(stderr, "message log: compaction failed\n");
+    }
+  }
+  message_store_unlock(&g_message_store.log_mutex);
+
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
 #endif
 }
 
@@ -114,28 +633,35 @@ static size_t message_store_trailing_whitespace_bytes(const char *message,
   return message_store_is_unicode_whitespace(cp) ? seq_len : 0u;
 }
 
+
 int message_store_init(void) {
   if (g_message_store.initialized) {
     return 0;
   }
 
-#ifdef _WIN32
-  InitializeCriticalSection(&g_message_store.mutex);
-  InitializeConditionVariable(&g_message_store.cond);
-#else
-  if (pthread_mutex_init(&g_message_store.mutex, NULL) != 0) {
+  memset(&g_message_store, 0, sizeof(g_message_store));
+  if (message_store_mutex_init(&g_message_store.mutex) != 0) {
+    return 1;
+  }
+  if (message_store_mutex_init(&g_message_store.log_mutex) != 0) {
+    message_store_mutex_destroy(&g_message_store.mutex);
     return 1;
   }
-  if (pthread_cond_init(&g_message_store.cond, NULL) != 0) {
-    (void)pthread_mutex_destroy(&g_message_store.mutex);
+#ifdef _WIN32
+  InitializeConditionVariable(&g_message_store.log_cond);
+#else
+  if (pthread_cond_init(&g_message_store.log_cond, NULL) != 0) {
+    message_store_mutex_destroy(&g_message_store.log_mutex);
+    message_store_mutex_destroy(&g_message_store.mutex);
     return 1;
   }
 #endif
-
-  g_message_store.message = NULL;
-  g_message_store.version = 0;
-  g_message_store.shutting_down = 0;
   g_message_store.initialized = 1;
+  // The default channel keeps this reference, so it is never removed.
+  if (message_store_channel(MESSAGE_STORE_DEFAULT_CHANNEL) == NULL) {
+    message_store_cleanup();
+    return 1;
+  }
   return 0;
 }
 
@@ -144,14 +670,20 @@ void message_store_shutdown(void) {
     return;
   }
 
-  message_store_lock();
+  message_store_lock(&g_message_store.mutex);
   g_message_store.shutting_down = 1;
-#ifdef _WIN32
-  WakeAllConditionVariable(&g_message_store.cond);
-#else
-  (void)pthread_cond_broadcast(&g_message_store.cond);
-#endif
-  message_store_unlock();
+  for (size_t i = 0; i < g_message_store.bucket_count; i++) {
+    message_store_channel_t *channel = g_message_store.buckets[i];
+    if (channel == NULL) {
+      continue;
+    }
+    message_store_lock(&channel->mutex);
+    channel->shutting_down = 1;
+    message_store_broadcast(channel);
+    message_store_notify_listeners(channel);
+    message_store_unlock(&channel->mutex);
+  }
+  message_store_unlock(&g_message_store.mutex);
 }
 
 void message_store_cleanup(void) {
@@ -160,28 +692,257 @@ void message_store_cleanup(void) {
   }
 
   message_store_shutdown();
-  message_store_lock();
-  if (g_message_store.message != NULL) {
-    free(g_message_store.message);
-    g_message_store.message = NULL;
+  if (g_message_store.logging) {
+    message_store_lock(&g_message_store.log_mutex);
+    g_message_store.log_stopping = 1;
+    message_store_log_wake();
+    message_store_unlock(&g_message_store.log_mutex);
+#ifdef _WIN32
+    (void)WaitForSingleObject(g_message_store.log_thread, INFINITE);
+    CloseHandle(g_message_store.log_thread);
+#else
+    (void)pthread_join(g_message_store.log_thread, NULL);
+#endif
+  }
+  for (size_t i = 0; i < g_message_store.bucket_count; i++) {
+    if (g_message_store.buckets[i] != NULL) {
+      message_store_channel_free(g_message_store.buckets[i]);
+    }
+  }
+  free(g_message_store.buckets);
+  if (g_message_store.logging) {
+    message_log_close();
+  }
+#ifndef _WIN32
+  (void)pthread_cond_destroy(&g_message_store.log_cond);
+#endif
+  message_store_mutex_destroy(&g_message_store.log_mutex);
+  message_store_mutex_destroy(&g_message_store.mutex);
+  memset(&g_message_store, 0, sizeof(g_message_store));
+}
+
+int message_store_open_log(const char *path) {
+  int exit_code = 1;
+
+  if (!g_message_store.initialized || path == NULL || g_message_store.logging) {
+    return 1;
+  }
+
+  message_store_lock(&g_message_store.log_mutex);
+  if (message_log_open(path, message_store_restore, NULL) == 0) {
+    exit_code = 0;
+  }
+  message_store_unlock(&g_message_store.log_mutex);
+  if (exit_code != 0) {
+    return 1;
   }
-  message_store_unlock();
 
+  // Compaction runs on its own thread so no publish ever waits for a rewrite.
 #ifdef _WIN32
-  DeleteCriticalSection(&g_message_store.mutex);
+  {
+    uintptr_t handle =
+      _beginthreadex(NULL, 0, message_store_log_thread_main, NULL, 0, NULL);
+    if (handle == 0) {
+      fprintf(stderr, "_beginthreadex(message_log) failed\n");
+      message_log_close();
+      return 1;
+    }
+    g_message_store.log_thread = (HANDLE)handle;
+  }
 #else
-  (void)pthread_cond_destroy(&g_message_store.cond);
-  (void)pthread_mutex_destroy(&g_message_store.mutex);
+  {
+    int err = pthread_create(&g_message_store.log_thread, NULL,
+                             message_store_log_thread_main, NULL);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create(message_log): %s\n", strerror(err));
+      message_log_close();
+      return 1;
+    }
+  }
 #endif
+  g_message_store.logging = 1;
+  return 0;
+}
+
+int message_store_channel_name_valid(const char *name) {
+  size_t len = 0;
+
+  if (name == NULL) {
+    return 0;
+  }
+  for (; name[len] != '\0'; len++) {
+    char c = name[len];
+    if (len >= MESSAGE_STORE_CHANNEL_NAME_MAX ||
+        !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+          c == '.' || c == '_' || c == '-')) {
+      return 0;
+    }
+  }
+  return len > 0 && strcmp(name, "latest") != 0 && strcmp(name, "stream") != 0;
+}
+
+message_store_channel_t *message_store_channel(const char *name) {
+  message_store_channel_t *channel = NULL;
+  uint32_t hash = 0;
+
+  if (!g_message_store.initialized || !message_store_channel_name_valid(name)) {
+    return NULL;
+  }
+
+  hash = message_store_hash(name);
+  message_store_lock(&g_message_store.mutex);
+  if (g_message_store.bucket_count > 0) {
+    channel = message_store_find(name, hash);
+  }
+  if (channel == NULL && g_message_store.channel_count < MESSAGE_STORE_MAX_CHANNELS &&
+      message_store_reserve() == 0) {
+    channel = message_store_channel_new(name, hash);
+    if (channel != NULL) {
+      channel->shutting_down = g_message_store.shutting_down;
+      message_store_insert(g_message_store.buckets, g_message_store.bucket_count, channel);
+      g_message_store.channel_count++;
+    }
+  }
+  if (channel != NULL) {
+    channel->refs++;
+  }
+  message_store_unlock(&g_message_store.mutex);
+  return channel;
+}
+
+message_store_channel_t *message_store_channel_find(const char *name) {
+  message_store_channel_t *channel = NULL;
+  uint32_t hash = 0;
+
+  if (!g_message_store.initialized || !message_store_channel_name_valid(name)) {
+    return NULL;
+  }
+
+  hash = message_store_hash(name);
+  message_store_lock(&g_message_store.mutex);
+  if (g_message_store.bucket_count > 0) {
+    channel = message_store_find(name, hash);
+  }
+  if (channel != NULL) {
+    channel->refs++;
+  }
+  message_store_unlock(&g_message_store.mutex);
+  return channel;
+}
+
+message_store_channel_t *message_store_channel_ref(message_store_channel_t *channel) {
+  if (g_message_store.initialized && channel != NULL) {
+    message_store_lock(&g_message_store.mutex);
+    channel->refs++;
+    message_store_unlock(&g_message_store.mutex);
+  }
+  return channel;
+}
+
+void message_store_channel_release(message_store_channel_t *channel) {
+  int unused = 0;
+
+  if (!g_message_store.initialized || channel == NULL) {
+    return;
+  }
+
+  message_store_lock(&g_message_store.mutex);
+  if (--channel->refs == 0) {
+    message_store_lock(&channel->mutex);
+    unused = channel->version == 0 && channel->listeners == NULL;
+    message_store_unlock(&channel->mutex);
+    if (unused) {
+      message_store_remove(channel);
+    }
+  }
+  message_store_unlock(&g_message_store.mutex);
+  if (unused) {
+    message_store_channel_free(channel);
+  }
+}
+
+const char *message_store_channel_name(const message_store_channel_t *channel) {
+  return channel != NULL ? channel->name : "";
+}
+
+static int message_store_over_budget(const message_store_blob_t *blob) {
+  return g_message_store.total_bytes + blob->len > MESSAGE_STORE_TOTAL_BYTES ||
+         g_message_store.spill_bytes + blob->size > MESSAGE_STORE_SPILL_BYTES;
+}
 
-  g_message_store.initialized = 0;
+// Versions are handed out under the channel lock but appended after it is
+// released, so an append first waits for its channel's previous version and
+// the log keeps each channel's records in version order.
+static void message_store_log_append(message_store_channel_t *channel,
+                                     const message_store_blob_t *blob) {
+  message_store_lock(&g_message_store.log_mutex);
+  while (channel->logged + 1u < blob->version && !g_message_store.log_failed) {
+    message_store_log_wait();
+  }
+  // Binary messages are logged with their MIME type but not their payload;
+  // a restart brings them back as expired placeholders.
+  if (!g_message_store.log_failed) {
+    message_log_record_t record = {channel->name, strlen(channel->name), blob->version,
+                                   blob->mime, blob->mime != NULL ? strlen(blob->mime) : 0,
+                                   blob->text, blob->len};
+    // A log that cannot be written is given up rather than failing the
+    // publish; the message is still served from memory.
+    if (message_log_append(&record) != 0) {
+      fprintf(stderr, "message log: append failed, no longer persisting messages\n");
+      message_log_close();
+      g_message_store.log_failed = 1;
+    } else if (message_log_needs_compaction()) {
+      g_message_store.compact_requested = 1;
+    }
+  }
+  channel->logged = blob->version;
+  message_store_log_wake();
+  message_store_unlock(&g_message_store.log_mutex);
+}
+
+// Consumes the caller's reference to blob.
+static int message_store_publish(message_store_channel_t *channel,
+                                 message_store_blob_t *blob) {
+  message_store_lock(&channel->mutex);
+  // A full store first gives up this channel's own history.
+  while (message_store_over_budget(blob) &&
+         channel->oldest != 0 && channel->oldest <= channel->version) {
+    message_store_drop_oldest(channel);
+  }
+  if (message_store_over_budget(blob)) {
+    message_store_unlock(&channel->mutex);
+    message_store_unref(blob);
+    return 1;
+  }
+
+  channel->version++;
+  blob->version = channel->version;
+  if (channel->oldest == 0 || channel->oldest > channel->version - 1u) {
+    channel->oldest = channel->version;
+  } else if (channel->version - channel->oldest >= MESSAGE_STORE_HISTORY) {
+    message_store_drop_oldest(channel);
+  }
+  message_store_hold(channel, message_store_ref(blob));
+  while (channel->history_bytes > MESSAGE_STORE_HISTORY_BYTES &&
+         channel->oldest < channel->version) {
+    message_store_drop_oldest(channel);
+  }
+  message_store_broadcast(channel);
+  message_store_notify_listeners(channel);
+  message_store_unlock(&channel->mutex);
+
+  if (g_message_store.logging) {
+    message_store_log_append(channel, blob);
+  }
+  message_store_unref(blob);
+  return 0;
 }
 
-int message_store_set(const char *message) {
+int message_store_set(message_store_channel_t *channel, const char *message) {
   size_t len = 0;
-  char *copy = NULL;
+  message_store_blob_t *blob = NULL;
 
-  if (!g_message_store.initialized || message == NULL) {
+  if (!g_message_store.initialized || channel == NULL || message == NULL) {
     return 1;
   }
 
@@ -193,109 +954,180 @@ int message_store_set(const char *message) {
     }
     len -= trimmed;
   }
-  copy = (char *)malloc(len + 1u);
-  if (copy == NULL) {
+  blob = message_store_blob_new(message, len, 0);
+  if (blob == NULL) {
     return 1;
   }
-  if (len > 0) {
-    memcpy(copy, message, len);
+  return message_store_publish(channel, blob);
+}
+
+int message_store_mime_valid(const char *mime) {
+  size_t len = 0;
+  int has_slash = 0;
+
+  if (mime == NULL) {
+    return 0;
+  }
+  for (; mime[len] != '\0'; len++) {
+    unsigned char ch = (unsigned char)mime[len];
+    if (ch < 0x20u || ch > 0x7Eu || ch == '"' || ch == '\\') {
+      return 0;
+    }
+    has_slash |= ch == '/';
   }
-  copy[len] = '\0';
+  return len > 0 && len <= MESSAGE_STORE_MIME_MAX && has_slash;
+}
+
+// Spill files sit in dir under temp names, which listings and the watcher
+// already skip. Where the platform allows, the name is dropped at once and
+// the open descriptor is all that keeps the payload alive.
+int message_store_spill_open(message_store_spill_t *spill, const char *dir) {
+  char base[4096];
+  char name[64];
+  int pid = 0;
+  int flags = O_CREAT | O_RDWR | O_EXCL;
 
-  message_store_lock();
-  if (g_message_store.message != NULL) {
-    free(g_message_store.message);
+  if (spill == NULL || dir == NULL) {
+    return 1;
   }
-  g_message_store.message = copy;
-  g_message_store.version++;
+  memset(spill, 0, sizeof(*spill));
+  spill->fd = -1;
 #ifdef _WIN32
-  WakeAllConditionVariable(&g_message_store.cond);
+  pid = _getpid();
+  flags |= O_BINARY;
 #else
-  (void)pthread_cond_broadcast(&g_message_store.cond);
+  pid = (int)getpid();
+#endif
+  int n = snprintf(name, sizeof(name), ".hf-message-%" PRIu64,
+                   message_store_counter_add(&g_message_store.spill_seq, 1u));
+  if (n < 0 || (size_t)n >= sizeof(name) ||
+      fs_join_path(base, sizeof(base), dir, name) != 0) {
+    return 1;
+  }
+  for (int attempt = 0; attempt < 3 && spill->fd < 0; attempt++) {
+    if (fs_build_temp_path(spill->path, sizeof(spill->path), base, pid, attempt) != 0) {
+      return 1;
+    }
+    spill->fd = fs_open(spill->path, flags, 0600);
+    if (spill->fd < 0 && errno != EEXIST) {
+      break;
+    }
+  }
+  if (spill->fd < 0) {
+    spill->path[0] = '\0';
+    return 1;
+  }
+#ifndef _WIN32
+  if (unlink(spill->path) == 0) {
+    spill->path[0] = '\0';
+  }
 #endif
-  message_store_unlock();
   return 0;
 }
 
-int message_store_get_copy(char **message_out, int *has_message_out) {
-  return message_store_get_snapshot(message_out, has_message_out, NULL);
+void message_store_spill_abort(message_store_spill_t *spill) {
+  if (spill == NULL) {
+    return;
+  }
+  if (spill->fd >= 0) {
+    (void)fs_close(spill->fd);
+    spill->fd = -1;
+  }
+  if (spill->path[0] != '\0') {
+    fs_remove_ignore_error(spill->path);
+    spill->path[0] = '\0';
+  }
 }
 
-int message_store_get_snapshot(char **message_out, int *has_message_out,
-                               uint64_t *version_out) {
-  char *copy = NULL;
-  const char *src = NULL;
-  size_t len = 0;
+int message_store_set_binary(message_store_channel_t *channel, const char *mime,
+                             message_store_spill_t *spill) {
+  message_store_blob_t *blob = NULL;
+  size_t mime_len = 0;
+  size_t path_len = 0;
 
-  if (!g_message_store.initialized || message_out == NULL ||
-      has_message_out == NULL) {
+  if (spill == NULL) {
     return 1;
   }
-
-  *message_out = NULL;
-  *has_message_out = 0;
-
-  message_store_lock();
-  src = g_message_store.message;
-  if (src != NULL) {
-    len = strlen(src);
-    copy = (char *)malloc(len + 1u);
-    if (copy != NULL) {
-      memcpy(copy, src, len + 1u);
-    }
+  if (!g_message_store.initialized || channel == NULL || spill->fd < 0 ||
+      !message_store_mime_valid(mime)) {
+    message_store_spill_abort(spill);
+    return 1;
   }
-  if (version_out != NULL) {
-    *version_out = g_message_store.version;
+
+  mime_len = strlen(mime);
+  path_len = strlen(spill->path);
+  blob = (message_store_blob_t *)malloc(sizeof(*blob) + 1u + mime_len + 1u + path_len + 1u);
+  if (blob == NULL) {
+    message_store_spill_abort(spill);
+    return 1;
   }
-  message_store_unlock();
+  blob->refs = 1;
+  blob->version = 0;
+  blob->len = 0;
+  blob->text[0] = '\0';
+  memcpy(blob->text + 1, mime, mime_len + 1u);
+  memcpy(blob->text + 1 + mime_len + 1, spill->path, path_len + 1u);
+  blob->mime = blob->text + 1;
+  blob->size = spill->size;
+  blob->fd = spill->fd;
+  spill->fd = -1;
+  spill->path[0] = '\0';
+  return message_store_publish(channel, blob);
+}
 
-  if (src != NULL && copy == NULL) {
+int message_store_get_snapshot(message_store_channel_t *channel,
+                               message_store_blob_t **blob_out, uint64_t *version_out) {
+  if (!g_message_store.initialized || blob_out == NULL) {
     return 1;
   }
+  if (channel == NULL) {
+    *blob_out = NULL;
+    if (version_out != NULL) {
+      *version_out = 0;
+    }
+    return 0;
+  }
 
-  *message_out = copy;
-  *has_message_out = src != NULL ? 1 : 0;
+  message_store_lock(&channel->mutex);
+  *blob_out = message_store_latest(channel);
+  if (version_out != NULL) {
+    *version_out = channel->version;
+  }
+  message_store_unlock(&channel->mutex);
   return 0;
 }
 
-int message_store_wait_for_update(uint64_t known_version,
+int message_store_wait_for_update(message_store_channel_t *channel,
+                                  uint64_t known_version,
                                   uint32_t timeout_ms,
-                                  char **message_out,
-                                  int *has_message_out,
+                                  message_store_blob_t **blob_out,
                                   uint64_t *version_out) {
-  char *copy = NULL;
-  const char *src = NULL;
-  size_t len = 0;
-  int updated = 0;
-
-  if (!g_message_store.initialized || message_out == NULL ||
-      has_message_out == NULL || version_out == NULL) {
+  if (!g_message_store.initialized || channel == NULL || blob_out == NULL ||
+      version_out == NULL) {
     return 1;
   }
 
-  *message_out = NULL;
-  *has_message_out = 0;
+  *blob_out = NULL;
   *version_out = known_version;
 
-  message_store_lock();
+  message_store_lock(&channel->mutex);
 
-  while (g_message_store.version <= known_version) {
-    if (g_message_store.shutting_down) {
+  while (channel->version <= known_version) {
+    if (channel->shutting_down) {
       break;
     }
 #ifdef _WIN32
-    if (!SleepConditionVariableCS(&g_message_store.cond, &g_message_store.mutex,
-                                  timeout_ms)) {
+    if (!SleepConditionVariableCS(&channel->cond, &channel->mutex, timeout_ms)) {
       if (GetLastError() == ERROR_TIMEOUT) {
         break;
       }
-      message_store_unlock();
+      message_store_unlock(&channel->mutex);
       return 1;
     }
 #else
     struct timespec ts;
     if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
-      message_store_unlock();
+      message_store_unlock(&channel->mutex);
       return 1;
     }
     ts.tv_sec += (time_t)(timeout_ms / 1000u);
@@ -304,10 +1136,9 @@ int message_store_wait_for_update(uint64_t known_version,
       ts.tv_sec += 1;
       ts.tv_nsec -= 1000000000L;
     }
-    int err = pthread_cond_timedwait(&g_message_store.cond,
-                                     &g_message_store.mutex, &ts);
+    int err = pthread_cond_timedwait(&channel->cond, &channel->mutex, &ts);
     if (err != 0 && err != ETIMEDOUT) {
-      message_store_unlock();
+      message_store_unlock(&channel->mutex);
       return 1;
     }
     if (err == ETIMEDOUT) {
@@ -316,25 +1147,91 @@ int message_store_wait_for_update(uint64_t known_version,
 #endif
   }
 
-  if (g_message_store.version > known_version) {
-    updated = 1;
-    src = g_message_store.message;
-    if (src != NULL) {
-      len = strlen(src);
-      copy = (char *)malloc(len + 1u);
-      if (copy != NULL) {
-        memcpy(copy, src, len + 1u);
-      }
-    }
+  if (channel->version > known_version) {
+    *blob_out = message_store_latest(channel);
   }
-  *version_out = g_message_store.version;
-  message_store_unlock();
+  *version_out = channel->version;
+  message_store_unlock(&channel->mutex);
+  return 0;
+}
 
-  if (updated && src != NULL && copy == NULL) {
+int message_store_get_since(message_store_channel_t *channel, uint64_t since, size_t limit,
+                            message_store_history_t *out) {
+  uint64_t first = since + 1u;
+  size_t count = 0;
+
+  if (!g_message_store.initialized || out == NULL) {
     return 1;
   }
+  memset(out, 0, sizeof(*out));
+  if (channel == NULL) {
+    return 0;
+  }
+  if (limit > MESSAGE_STORE_HISTORY) {
+    limit = MESSAGE_STORE_HISTORY;
+  }
 
-  *message_out = copy;
-  *has_message_out = updated && src != NULL ? 1 : 0;
+  message_store_lock(&channel->mutex);
+  out->latest_version = channel->version;
+  out->oldest_version = channel->oldest;
+  if (channel->oldest != 0 && first < channel->oldest) {
+    first = channel->oldest;
+  }
+  if (channel->oldest != 0 && first <= channel->version) {
+    uint64_t available = channel->version - first + 1u;
+    count = available < (uint64_t)limit ? (size_t)available : limit;
+  }
+  for (size_t i = 0; i < count; i++) {
+    out->messages[i] =
+      message_store_ref(channel->history[(first + i) % MESSAGE_STORE_HISTORY]);
+  }
+  out->count = count;
+  out->has_more = first + count <= channel->version;
+  message_store_unlock(&channel->mutex);
   return 0;
 }
+
+void message_store_history_release(message_store_history_t *history) {
+  if (history == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < history->count; i++) {
+    message_store_unref(history->messages[i]);
+    history->messages[i] = NULL;
+  }
+  history->count = 0;
+}
+
+void message_store_add_listener(message_store_channel_t *channel,
+                                message_store_listener_t *listener) {
+  if (!g_message_store.initialized || channel == NULL || listener == NULL ||
+      listener->notify == NULL) {
+    return;
+  }
+
+  message_store_lock(&channel->mutex);
+  listener->next = channel->listeners;
+  channel->listeners = listener;
+  if (channel->shutting_down) {
+    listener->notify(listener->ctx);
+  }
+  message_store_unlock(&channel->mutex);
+}
+
+void message_store_remove_listener(message_store_channel_t *channel,
+                                   message_store_listener_t *listener) {
+  if (!g_message_store.initialized || channel == NULL || listener == NULL) {
+    return;
+  }
+
+  message_store_lock(&channel->mutex);
+  for (message_store_listener_t **slot = &channel->listeners; *slot != NULL;
+       slot = &(*slot)->next) {
+    if (*slot == listener) {
+      *slot = listener->next;
+      break;
+    }
+  }
+  message_store_unlock(&channel->mutex);
+  listener->next = NULL;
+}
@@ -1,19 +1,114 @@
 #ifndef HF_MESSAGE_STORE_H
 #define HF_MESSAGE_STORE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+// Each channel keeps up to this many recent messages, addressed by version.
+#define MESSAGE_STORE_HISTORY 64u
+#define MESSAGE_STORE_CHANNEL_NAME_MAX 64u
+#define MESSAGE_STORE_DEFAULT_CHANNEL "default"
+#define MESSAGE_STORE_MIME_MAX 127u
+
+// Listeners are told that something changed on their channel (a new message
+// or shutdown) and then read the store themselves. notify runs under the
+// channel lock, so it must only do something cheap and non-blocking, like
+// signal a waker.
+typedef struct message_store_listener {
+  void (*notify)(void *ctx);
+  void *ctx;
+  struct message_store_listener *next;
+} message_store_listener_t;
+
+// An immutable message shared by reference: the store holds one reference
+// and every reader takes its own, so fan-out never copies the text.
+// A binary message has empty text; its payload stays in a spill file that
+// readers serve from fd with positional reads, never from memory. One
+// restored from the message log has expired: it keeps its MIME type, but fd
+// is -1 and size 0.
+typedef struct {
+  volatile uint64_t refs;
+  uint64_t version;
+  size_t len;
+  const char *mime;  // NULL for text messages
+  uint64_t size;     // binary payload bytes
+  int fd;            // spill file, -1 for text messages
+  char text[];       // NUL-terminated
+} message_store_blob_t;
+
+// A binary payload on its way into the store. The caller writes size bytes
+// to fd, then hands the spill to message_store_set_binary or aborts it.
+typedef struct {
+  int fd;
+  uint64_t size;
+  char path[4096];  // empty once the file is unlinked
+} message_store_spill_t;
+
+// A named stream of messages with its own version counter, lock, wait queue
+// and listeners, so traffic on one channel never wakes readers of another.
+typedef struct message_store_channel message_store_channel_t;
+
+message_store_blob_t *message_store_ref(message_store_blob_t *blob);
+void message_store_unref(message_store_blob_t *blob);
+
 int message_store_init(void);
 void message_store_shutdown(void);
 void message_store_cleanup(void);
-int message_store_set(const char *message);
-int message_store_get_copy(char **message_out, int *has_message_out);
-int message_store_get_snapshot(char **message_out, int *has_message_out,
-                               uint64_t *version_out);
-int message_store_wait_for_update(uint64_t known_version,
+// Persists every message to an append-only log at path and first restores
+// the newest ones from it. Must be called before anything is published.
+int message_store_open_log(const char *path);
+
+// 1 to MESSAGE_STORE_CHANNEL_NAME_MAX of [A-Za-z0-9._-]; "latest" and
+// "stream" are reserved for the HTTP sub-routes.
+int message_store_channel_name_valid(const char *name);
+// Finds a channel, creating it on first use, and returns a reference the
+// caller releases. A channel that never held a message goes away with its
+// last reference, so only publishers and live subscribers create one.
+// NULL for an invalid name or once the channel limit is reached.
+message_store_channel_t *message_store_channel(const char *name);
+// Never creates: NULL when the channel does not exist, which the readers
+// below treat as a channel with no messages.
+message_store_channel_t *message_store_channel_find(const char *name);
+message_store_channel_t *message_store_channel_ref(message_store_channel_t *channel);
+void message_store_channel_release(message_store_channel_t *channel);
+const char *message_store_channel_name(const message_store_channel_t *channel);
+
+int message_store_set(message_store_channel_t *channel, const char *message);
+// A MIME type is 1 to MESSAGE_STORE_MIME_MAX printable ASCII bytes with a
+// '/', and no quotes or backslashes.
+int message_store_mime_valid(const char *mime);
+// Creates an anonymous spill file in dir.
+int message_store_spill_open(message_store_spill_t *spill, const char *dir);
+void message_store_spill_abort(message_store_spill_t *spill);
+// Takes over the spill whether or not it succeeds. The message log keeps
+// only the MIME type, never the payload.
+int message_store_set_binary(message_store_channel_t *channel, const char *mime,
+                             message_store_spill_t *spill);
+// *blob_out is a new reference to the latest message, or NULL if none.
+int message_store_get_snapshot(message_store_channel_t *channel,
+                               message_store_blob_t **blob_out, uint64_t *version_out);
+// *blob_out is set only when the version moved past known_version.
+int message_store_wait_for_update(message_store_channel_t *channel,
+                                  uint64_t known_version,
                                   uint32_t timeout_ms,
-                                  char **message_out,
-                                  int *has_message_out,
+                                  message_store_blob_t **blob_out,
                                   uint64_t *version_out);
 
+typedef struct {
+  message_store_blob_t *messages[MESSAGE_STORE_HISTORY];  // oldest first
+  size_t count;
+  uint64_t latest_version;
+  uint64_t oldest_version;  // oldest still held, 0 if none; older ones are gone
+  int has_more;             // newer messages exist beyond the limit
+} message_store_history_t;
+
+// References up to limit held messages with a version above since.
+int message_store_get_since(message_store_channel_t *channel, uint64_t since, size_t limit,
+                            message_store_history_t *out);
+void message_store_history_release(message_store_history_t *history);
+void message_store_add_listener(message_store_channel_t *channel,
+                                message_store_listener_t *listener);
+void message_store_remove_listener(message_store_channel_t *channel,
+                                   message_store_listener_t *listener);
+
 #endif  // HF_MESSAGE_STORE_H
@@ -0,0 +1,353 @@
+#ifdef __linux__
+  #ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+  #endif
+#endif
+
+#include "multipart.h"
+
+#include "buf_pool.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#define MULTIPART_HEADERS_MAX 8192u
+#define MULTIPART_PADDING_MAX 256u
+
+static const char *multipart_find_bytes(const char *haystack, size_t haystack_len,
+                                        const char *needle, size_t needle_len) {
+#ifdef _WIN32
+  const char *end = haystack + haystack_len;
+
+  if (needle_len == 0 || needle_len > haystack_len) {
+    return NULL;
+  }
+  for (const char *p = haystack; (size_t)(end - p) >= needle_len; p++) {
+    p = (const char *)memchr(p, needle[0], (size_t)(end - p) - needle_len + 1u);
+    if (p == NULL) {
+      return NULL;
+    }
+    if (memcmp(p, needle, needle_len) == 0) {
+      return p;
+    }
+  }
+  return NULL;
+#else
+  return (const char *)memmem(haystack, haystack_len, needle, needle_len);
+#endif
+}
+
+static int multipart_is_space(char ch) {
+  return ch == ' ' || ch == '\t';
+}
+
+static int multipart_name_equals(const char *name, size_t name_len, const char *expected) {
+  size_t expected_len = strlen(expected);
+
+  if (name_len != expected_len) {
+    return 0;
+  }
+  for (size_t i = 0; i < name_len; i++) {
+    if (tolower((unsigned char)name[i]) != tolower((unsigned char)expected[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Reads the parameter list that follows the first ';' of a header value.
+// Returns 0 when the parameter was found, 1 when absent, -1 on bad syntax.
+static int multipart_get_param(const char *p, const char *end, const char *param,
+                               char *out, size_t out_cap) {
+  p = memchr(p, ';', (size_t)(end - p));
+  if (p == NULL) {
+    return 1;
+  }
+
+  while (p < end && *p == ';') {
+    const char *name = NULL;
+    size_t name_len = 0;
+    size_t out_len = 0;
+    int wanted = 0;
+
+    p++;
+    while (p < end && multipart_is_space(*p)) p++;
+    name = p;
+    while (p < end && *p != '=' && *p != ';' && !multipart_is_space(*p)) p++;
+    name_len = (size_t)(p - name);
+    while (p < end && multipart_is_space(*p)) p++;
+    if (p == end || *p == ';') {
+      continue;
+    }
+    p++;
+    while (p < end && multipart_is_space(*p)) p++;
+
+    wanted = multipart_name_equals(name, name_len, param);
+    // Browsers percent-encode '"' in names and leave backslashes alone, so a
+    // quoted value simply runs to the next quote.
+    if (p < end && *p == '"') {
+      for (p++; p < end && *p != '"'; p++) {
+        if (wanted) {
+          if (out_len + 1u >= out_cap) {
+            return -1;
+          }
+          out[out_len++] = *p;
+        }
+      }
+      if (p == end) {
+        return -1;
+      }
+      p++;
+    } else {
+      const char *value = p;
+      while (p < end && *p != ';' && !multipart_is_space(*p)) p++;
+      if (wanted) {
+        out_len = (size_t)(p - value);
+        if (out_len + 1u > out_cap) {
+          return -1;
+        }
+        memcpy(out, value, out_len);
+      }
+    }
+    if (wanted) {
+      out[out_len] = '\0';
+      return 0;
+    }
+    while (p < end && multipart_is_space(*p)) p++;
+  }
+  return p < end ? -1 : 1;
+}
+
+static multipart_result_t multipart_parse_part_headers(const char *block, size_t len,
+                                                       char *name, size_t name_cap,
+                                                       char *filename, size_t filename_cap,
+                                                       int *has_filename) {
+  const char *end = block + len;
+  const char *line = block;
+  int has_disposition = 0;
+
+  *has_filename = 0;
+  name[0] = '\0';
+  while (line < end) {
+    const char *eol = multipart_find_bytes(line, (size_t)(end - line), "\r\n", 2);
+    const char *colon = NULL;
+    if (eol == NULL) {
+      eol = end;
+    }
+
+    colon = memchr(line, ':', (size_t)(eol - line));
+    if (colon != NULL &&
+        multipart_name_equals(line, (size_t)(colon - line), "content-disposition")) {
+      const char *value = colon + 1;
+      int rc = 0;
+
+      while (value < eol && multipart_is_space(*value)) value++;
+      if ((size_t)(eol - value) < 9u || !multipart_name_equals(value, 9u, "form-data") ||
+          (value + 9 < eol && value[9] != ';' && !multipart_is_space(value[9]))) {
+        return MULTIPART_ERR_MALFORMED;
+      }
+      rc = multipart_get_param(value, eol, "name", name, name_cap);
+      if (rc < 0) {
+        return MULTIPART_ERR_MALFORMED;
+      }
+      rc = multipart_get_param(value, eol, "filename", filename, filename_cap);
+      if (rc < 0) {
+        return MULTIPART_ERR_MALFORMED;
+      }
+      *has_filename = rc == 0;
+      has_disposition = 1;
+    }
+    line = eol == end ? end : eol + 2;
+  }
+
+  return has_disposition ? MULTIPART_OK : MULTIPART_ERR_MALFORMED;
+}
+
+int multipart_parse_boundary(const char *content_type, char *out, size_t out_cap) {
+  static const char media_type[] = "multipart/form-data";
+  const char *end = NULL;
+  int rc = 0;
+
+  if (content_type == NULL || out == NULL || out_cap == 0) {
+    return 1;
+  }
+  end = content_type + strlen(content_type);
+  if ((size_t)(end - content_type) < sizeof(media_type) - 1u ||
+      !multipart_name_equals(content_type, sizeof(media_type) - 1u, media_type)) {
+    return 1;
+  }
+
+  rc = multipart_get_param(content_type, end, "boundary", out, out_cap);
+  if (rc != 0 || out[0] == '\0' || strlen(out) > MULTIPART_BOUNDARY_MAX) {
+    return 1;
+  }
+  return 0;
+}
+
+multipart_result_t multipart_parser_init(multipart_parser_t *parser,
+                                         const char *boundary,
+                                         const multipart_callbacks_t *callbacks,
+                                         void *ctx) {
+  size_t boundary_len = 0;
+
+  if (parser == NULL || boundary == NULL || callbacks == NULL) {
+    return MULTIPART_ERR_MALFORMED;
+  }
+  memset(parser, 0, sizeof(*parser));
+
+  boundary_len = strlen(boundary);
+  if (boundary_len == 0 || boundary_len > MULTIPART_BOUNDARY_MAX) {
+    return MULTIPART_ERR_MALFORMED;
+  }
+  memcpy(parser->delimiter, "\r\n--", 4u);
+  memcpy(parser->delimiter + 4u, boundary, boundary_len);
+  parser->delimiter_len = boundary_len + 4u;
+  parser->callbacks = callbacks;
+  parser->ctx = ctx;
+
+  parser->buf = buf_pool_acquire();
+  if (parser->buf == NULL) {
+    return MULTIPART_ERR_ALLOC;
+  }
+  // The first delimiter may open the body without a preceding CRLF.
+  parser->buf[0] = '\r';
+  parser->buf[1] = '\n';
+  parser->len = 2u;
+  parser->state = MULTIPART_STATE_PREAMBLE;
+  return MULTIPART_OK;
+}
+
+char *multipart_parser_space(multipart_parser_t *parser, size_t *cap_out) {
+  if (parser == NULL || parser->buf == NULL || cap_out == NULL) {
+    return NULL;
+  }
+  *cap_out = BUF_POOL_BUF_SIZE - parser->len;
+  return parser->buf + parser->len;
+}
+
+multipart_result_t multipart_parser_commit(multipart_parser_t *parser, size_t n) {
+  const size_t keep = parser->delimiter_len - 1u;
+  multipart_result_t result = MULTIPART_OK;
+  size_t pos = 0;
+
+  parser->len += n;
+  while (result == MULTIPART_OK) {
+    const char *data = parser->buf + pos;
+    size_t avail = parser->len - pos;
+    const char *hit = NULL;
+
+    if (parser->state == MULTIPART_STATE_DONE) {
+      pos = parser->len;
+      break;
+    }
+
+    if (parser->state == MULTIPART_STATE_PREAMBLE) {
+      hit = multipart_find_bytes(data, avail, parser->delimiter, parser->delimiter_len);
+      if (hit == NULL) {
+        pos += avail > keep ? avail - keep : 0;
+        break;
+      }
+      pos += (size_t)(hit - data) + parser->delimiter_len;
+      parser->state = MULTIPART_STATE_AFTER_DELIMITER;
+    } else if (parser->state == MULTIPART_STATE_AFTER_DELIMITER) {
+      size_t i = 0;
+
+      if (avail < 2u) {
+        break;
+      }
+      if (data[0] == '-' && data[1] == '-') {
+        parser->state = MULTIPART_STATE_DONE;
+        continue;
+      }
+      while (i < avail && multipart_is_space(data[i])) i++;
+      if (i + 2u > avail) {
+        if (avail > MULTIPART_PADDING_MAX) {
+          result = MULTIPART_ERR_MALFORMED;
+        }
+        break;
+      }
+      if (data[i] != '\r' || data[i + 1u] != '\n') {
+        result = MULTIPART_ERR_MALFORMED;
+        break;
+      }
+      pos += i + 2u;
+      parser->state = MULTIPART_STATE_HEADERS;
+    } else if (parser->state == MULTIPART_STATE_HEADERS) {
+      char name[MULTIPART_FIELD_MAX];
+      char filename[MULTIPART_FIELD_MAX];
+      int has_filename = 0;
+      size_t block_len = 0;
+      size_t consumed = 0;
+
+      // A part may carry no headers at all: the blank line follows directly.
+      if (avail >= 2u && data[0] == '\r' && data[1] == '\n') {
+        consumed = 2u;
+      } else {
+        hit = multipart_find_bytes(data, avail, "\r\n\r\n", 4u);
+        if (hit == NULL) {
+          if (avail >= MULTIPART_HEADERS_MAX) {
+            result = MULTIPART_ERR_HEADERS_TOO_LARGE;
+          }
+          break;
+        }
+        block_len = (size_t)(hit - data);
+        consumed = block_len + 4u;
+      }
+      result = multipart_parse_part_headers(data, block_len, name, sizeof(name),
+                                            filename, sizeof(filename), &has_filename);
+      if (result != MULTIPART_OK) {
+        break;
+      }
+      pos += consumed;
+      if (parser->callbacks->part_begin != NULL &&
+          parser->callbacks->part_begin(parser->ctx, name,
+                                        has_filename ? filename : NULL) != 0) {
+        result = MULTIPART_ERR_CALLBACK;
+        break;
+      }
+      parser->state = MULTIPART_STATE_BODY;
+    } else {
+      size_t data_len = 0;
+
+      hit = multipart_find_bytes(data, avail, parser->delimiter, parser->delimiter_len);
+      data_len = hit != NULL ? (size_t)(hit - data) : (avail > keep ? avail - keep : 0);
+      if (data_len > 0 && parser->callbacks->part_data != NULL &&
+          parser->callbacks->part_data(parser->ctx, data, data_len) != 0) {
+        result = MULTIPART_ERR_CALLBACK;
+        break;
+      }
+      pos += data_len;
+      if (hit == NULL) {
+        break;
+      }
+
+      pos += parser->delimiter_len;
+      parser->state = MULTIPART_STATE_AFTER_DELIMITER;
+      if (parser->callbacks->part_end != NULL &&
+          parser->callbacks->part_end(parser->ctx) != 0) {
+        result = MULTIPART_ERR_CALLBACK;
+      }
+    }
+  }
+
+  if (pos > 0) {
+    memmove(parser->buf, parser->buf + pos, parser->len - pos);
+    parser->len -= pos;
+  }
+  return result;
+}
+
+int multipart_parser_done(const multipart_parser_t *parser) {
+  return parser != NULL && parser->state == MULTIPART_STATE_DONE;
+}
+
+void multipart_parser_cleanup(multipart_parser_t *parser) {
+  if (parser == NULL) {
+    return;
+  }
+  if (parser->buf != NULL) {
+    buf_pool_release(parser->buf);
+    parser->buf = NULL;
+  }
+  parser->len = 0;
+}
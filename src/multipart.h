@@ -0,0 +1,57 @@
+#ifndef HF_MULTIPART_H
+#define HF_MULTIPART_H
+
+#include <stddef.h>
+
+#define MULTIPART_BOUNDARY_MAX 70u
+#define MULTIPART_FIELD_MAX 1024u
+
+typedef enum {
+  MULTIPART_OK = 0,
+  MULTIPART_ERR_MALFORMED,
+  MULTIPART_ERR_HEADERS_TOO_LARGE,
+  MULTIPART_ERR_ALLOC,
+  MULTIPART_ERR_CALLBACK,
+} multipart_result_t;
+
+// filename is NULL for plain form fields. Any non-zero callback return stops
+// the parse with MULTIPART_ERR_CALLBACK.
+typedef struct {
+  int (*part_begin)(void *ctx, const char *name, const char *filename);
+  int (*part_data)(void *ctx, const char *data, size_t len);
+  int (*part_end)(void *ctx);
+} multipart_callbacks_t;
+
+typedef enum {
+  MULTIPART_STATE_PREAMBLE = 0,
+  MULTIPART_STATE_AFTER_DELIMITER,
+  MULTIPART_STATE_HEADERS,
+  MULTIPART_STATE_BODY,
+  MULTIPART_STATE_DONE,
+} multipart_state_t;
+
+// The parser owns one pooled buffer; callers receive straight into it with
+// multipart_parser_space() and hand the byte count to multipart_parser_commit().
+// Only a delimiter-sized tail (or a partial header block) is ever carried.
+typedef struct {
+  multipart_state_t state;
+  const multipart_callbacks_t *callbacks;
+  void *ctx;
+  char delimiter[MULTIPART_BOUNDARY_MAX + 4u];
+  size_t delimiter_len;
+  char *buf;
+  size_t len;
+} multipart_parser_t;
+
+int multipart_parse_boundary(const char *content_type, char *out, size_t out_cap);
+
+multipart_result_t multipart_parser_init(multipart_parser_t *parser,
+                                         const char *boundary,
+                                         const multipart_callbacks_t *callbacks,
+                                         void *ctx);
+char *multipart_parser_space(multipart_parser_t *parser, size_t *cap_out);
+multipart_result_t multipart_parser_commit(multipart_parser_t *parser, size_t n);
+int multipart_parser_done(const multipart_parser_t *parser);
+void multipart_parser_cleanup(multipart_parser_t *parser);
+
+#endif  // HF_MULTIPART_H
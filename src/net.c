@@ -5,6 +5,8 @@
 #endif
 
 #include "net.h"
+#include "buf_pool.h"
+#include "conn_deadline.h"
 #include "fs.h"
 
 #include <errno.h>
@@ -13,9 +15,15 @@
 #include <stdio.h>
 #include <string.h>
 
-#ifndef _WIN32
+#ifdef _WIN32
+  #include <process.h>
+  #include <windows.h>
+#else
+  #include <poll.h>
+  #include <pthread.h>
   #include <unistd.h>
   #if defined(__linux__)
+    #include <sys/ioctl.h>
     #include <sys/sendfile.h>
   #elif defined(__APPLE__)
     #include <sys/socket.h>
@@ -23,6 +31,13 @@
   #endif
 #endif
 
+#define NET_RECV_STACK_BUF_SIZE 8192u
+#define NET_RECV_PIPELINE_THRESHOLD (1024u * 1024u)
+#define NET_RECV_PIPELINE_DEPTH 4u
+#define NET_RECV_PIPELINE_BUF_SIZE (BUF_POOL_BUF_SIZE / NET_RECV_PIPELINE_DEPTH)
+// A blocking sendfile only returns once the whole request is queued, so
+// tracked sends hand it slices to keep progress moving.
+#define NET_SEND_TRACKED_SLICE (8u * 1024u * 1024u)
 
 bool is_socket_invalid(socket_t sock) {
 #ifdef _WIN32
@@ -89,6 +104,7 @@ ssize_t recv_all(
     }
 #endif
     if (n == 0) return (ssize_t)total;
+    conn_deadline_progress((uint64_t)n);
     total += (size_t)n;
   }
   return (ssize_t)total;
@@ -205,6 +221,184 @@ int net_wait_readable(socket_t sock, uint32_t timeout_ms, int *ready_out) {
   return 0;
 }
 
+// Windows select() only understands sockets, so the waker there is a UDP
+// socket connected to itself; POSIX uses a non-blocking pipe.
+int net_waker_open(net_waker_t *waker) {
+  if (waker == NULL) {
+    return 1;
+  }
+
+#ifdef _WIN32
+  struct sockaddr_in addr = {0};
+  int addr_len = (int)sizeof(addr);
+  u_long nonblocking = 1;
+
+  waker->sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (waker->sock == INVALID_SOCKET) {
+    return 1;
+  }
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(waker->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      getsockname(waker->sock, (struct sockaddr *)&addr, &addr_len) != 0 ||
+      connect(waker->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      ioctlsocket(waker->sock, FIONBIO, &nonblocking) != 0) {
+    closesocket(waker->sock);
+    waker->sock = INVALID_SOCKET;
+    return 1;
+  }
+  return 0;
+#else
+  if (pipe(waker->fds) != 0) {
+    waker->fds[0] = -1;
+    waker->fds[1] = -1;
+    return 1;
+  }
+  for (int i = 0; i < 2; i++) {
+    int flags = fcntl(waker->fds[i], F_GETFL, 0);
+    if (flags == -1 || fcntl(waker->fds[i], F_SETFL, flags | O_NONBLOCK) != 0 ||
+        fcntl(waker->fds[i], F_SETFD, FD_CLOEXEC) != 0) {
+      net_waker_close(waker);
+      return 1;
+    }
+  }
+  return 0;
+#endif
+}
+
+void net_waker_close(net_waker_t *waker) {
+  if (waker == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  if (waker->sock != INVALID_SOCKET) {
+    closesocket(waker->sock);
+    waker->sock = INVALID_SOCKET;
+  }
+#else
+  for (int i = 0; i < 2; i++) {
+    if (waker->fds[i] != -1) {
+      close(waker->fds[i]);
+      waker->fds[i] = -1;
+    }
+  }
+#endif
+}
+
+void net_waker_signal(net_waker_t *waker) {
+  char byte = 1;
+
+#ifdef _WIN32
+  (void)send(waker->sock, &byte, 1, 0);
+#else
+  // A full pipe already guarantees a pending wakeup.
+  ssize_t n = write(waker->fds[1], &byte, 1);
+  (void)n;
+#endif
+}
+
+void net_waker_drain(net_waker_t *waker) {
+  char buf[64];
+
+#ifdef _WIN32
+  while (recv(waker->sock, buf, (int)sizeof(buf), 0) > 0) {
+  }
+#else
+  while (read(waker->fds[0], buf, sizeof(buf)) > 0) {
+  }
+#endif
+}
+
+socket_t net_waker_handle(const net_waker_t *waker) {
+#ifdef _WIN32
+  return waker->sock;
+#else
+  return waker->fds[0];
+#endif
+}
+
+int net_set_nonblocking(socket_t sock) {
+#ifdef _WIN32
+  u_long nonblocking = 1;
+  return ioctlsocket(sock, FIONBIO, &nonblocking) == 0 ? 0 : 1;
+#else
+  int flags = fcntl(sock, F_GETFL, 0);
+  return flags != -1 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0 ? 0 : 1;
+#endif
+}
+
+ssize_t net_send_nonblocking(socket_t sock, const void *data, size_t len) {
+  for (;;) {
+#ifdef _WIN32
+    int n = send(sock, (const char *)data, len > (size_t)INT32_MAX ? INT32_MAX : (int)len, 0);
+    if (n == SOCKET_ERROR) {
+      int err = WSAGetLastError();
+      if (err == WSAEINTR) continue;
+      return err == WSAEWOULDBLOCK ? 0 : -1;
+    }
+    return n;
+#else
+    int flags = 0;
+  #ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+  #endif
+    ssize_t n = send(sock, data, len, flags);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    return n;
+#endif
+  }
+}
+
+int net_wait_readable_or_woken(socket_t sock, net_waker_t *waker, uint32_t timeout_ms,
+                               int *ready_out, int *woken_out) {
+  if (waker == NULL || ready_out == NULL || woken_out == NULL || is_socket_invalid(sock)) {
+    return 1;
+  }
+
+  *ready_out = 0;
+  *woken_out = 0;
+
+#ifdef _WIN32
+  fd_set readfds;
+  struct timeval tv;
+
+  FD_ZERO(&readfds);
+  FD_SET(sock, &readfds);
+  FD_SET(waker->sock, &readfds);
+  tv.tv_sec = (long)(timeout_ms / 1000u);
+  tv.tv_usec = (long)((timeout_ms % 1000u) * 1000u);
+  int rc = select(0, &readfds, NULL, NULL, &tv);
+  if (rc == SOCKET_ERROR) {
+    return WSAGetLastError() == WSAEINTR ? 0 : 1;
+  }
+  *ready_out = FD_ISSET(sock, &readfds) ? 1 : 0;
+  *woken_out = FD_ISSET(waker->sock, &readfds) ? 1 : 0;
+#else
+  struct pollfd fds[2];
+
+  fds[0].fd = sock;
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  fds[1].fd = waker->fds[0];
+  fds[1].events = POLLIN;
+  fds[1].revents = 0;
+  int rc = poll(fds, 2, timeout_ms > (uint32_t)INT32_MAX ? -1 : (int)timeout_ms);
+  if (rc < 0) {
+    return errno == EINTR ? 0 : 1;
+  }
+  *ready_out = (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+  *woken_out = (fds[1].revents & POLLIN) != 0;
+#endif
+
+  if (*woken_out) {
+    net_waker_drain(waker);
+  }
+  return 0;
+}
+
 int net_primary_ipv4(char *out, size_t out_cap) {
   struct sockaddr_in remote = {0};
   struct sockaddr_in local = {0};
@@ -253,9 +447,60 @@ int net_primary_ipv4(char *out, size_t out_cap) {
   return 0;
 }
 
+const char *net_io_path_name(net_io_path_t path) {
+  switch (path) {
+    case NET_IO_PATH_SENDFILE:
+      return "sendfile";
+    case NET_IO_PATH_SPLICE:
+      return "splice";
+    case NET_IO_PATH_BUFFERED:
+      return "buffered";
+    default:
+      return "none";
+  }
+}
+
+static void net_xfer_progress(net_transfer_t *xfer, uint64_t bytes) {
+  if (xfer == NULL || xfer->progress == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  (void)InterlockedExchangeAdd64((volatile LONG64 *)xfer->progress, (LONG64)bytes);
+#else
+  (void)__atomic_fetch_add(xfer->progress, bytes, __ATOMIC_RELAXED);
+#endif
+}
+
+// Paced transfers move at most what the rate limit grants per call and hand
+// back whatever the call did not use.
+static uint64_t net_xfer_acquire(net_transfer_t *xfer, uint64_t want) {
+  uint64_t wait_us = 0;
+  uint64_t grant = 0;
+
+  if (xfer == NULL || xfer->limit == NULL) {
+    return want;
+  }
+  grant = rate_limit_reserve(xfer->limit, want, &wait_us);
+  if (wait_us > 0) {
+    // A transfer held back by a shared limit can sit well below the body
+    // deadline's rate; that wait is ours, not the peer's.
+    conn_deadline_pause();
+    rate_limit_wait(wait_us);
+    conn_deadline_resume();
+  }
+  return grant;
+}
+
+static void net_xfer_release(net_transfer_t *xfer, uint64_t granted, uint64_t used) {
+  if (xfer != NULL && xfer->limit != NULL && used < granted) {
+    rate_limit_release(xfer->limit, granted - used);
+  }
+}
+
 static net_send_file_result_t net_send_file_all(socket_t sock,
                                                 int in_fd,
-                                                uint64_t content_size) {
+                                                uint64_t content_size,
+                                                net_transfer_t *xfer) {
   if (content_size == 0) {
     return NET_SEND_FILE_OK;
   }
@@ -264,6 +509,7 @@ static net_send_file_result_t net_send_file_all(socket_t sock,
   (void)sock;
   (void)in_fd;
   (void)content_size;
+  (void)xfer;
   return NET_SEND_FILE_UNSUPPORTED;
 #else
   if (is_socket_invalid(sock) || in_fd < 0) {
@@ -278,7 +524,12 @@ static net_send_file_result_t net_send_file_all(socket_t sock,
       size_t want = (remaining > (uint64_t)SIZE_MAX)
                       ? (size_t)SIZE_MAX
                       : (size_t)remaining;
+      if (xfer != NULL && want > NET_SEND_TRACKED_SLICE) {
+        want = NET_SEND_TRACKED_SLICE;
+      }
+      want = (size_t)net_xfer_acquire(xfer, want);
       ssize_t n = sendfile(sock, in_fd, &offset, want);
+      net_xfer_release(xfer, want, n > 0 ? (uint64_t)n : 0u);
       if (n < 0) {
         if ((errno == EINVAL || errno == ENOSYS || errno == ENOTSUP) &&
             offset == 0) {
@@ -290,6 +541,7 @@ static net_send_file_result_t net_send_file_all(socket_t sock,
       if (n == 0) {
         return NET_SEND_FILE_SOURCE_CHANGED;
       }
+      net_xfer_progress(xfer, (uint64_t)n);
       remaining -= (uint64_t)n;
     }
     return NET_SEND_FILE_OK;
@@ -299,18 +551,25 @@ static net_send_file_result_t net_send_file_all(socket_t sock,
       off_t want = (remaining > (uint64_t)INT64_MAX)
                      ? (off_t)INT64_MAX
                      : (off_t)remaining;
+      if (xfer != NULL && want > (off_t)NET_SEND_TRACKED_SLICE) {
+        want = (off_t)NET_SEND_TRACKED_SLICE;
+      }
+      want = (off_t)net_xfer_acquire(xfer, (uint64_t)want);
       off_t sent = want;
       int rc = sendfile(in_fd, sock, offset, &sent, NULL, 0);
+      net_xfer_release(xfer, (uint64_t)want, sent > 0 ? (uint64_t)sent : 0u);
       if (rc == 0) {
         if (sent <= 0) {
           return NET_SEND_FILE_SOURCE_CHANGED;
         }
+        net_xfer_progress(xfer, (uint64_t)sent);
         remaining -= (uint64_t)sent;
         offset += sent;
         continue;
       }
 
       if (sent > 0) {
+        net_xfer_progress(xfer, (uint64_t)sent);
         remaining -= (uint64_t)sent;
         offset += sent;
       }
@@ -332,6 +591,7 @@ static net_send_file_result_t net_send_file_all(socket_t sock,
     (void)sock;
     (void)in_fd;
     (void)content_size;
+    (void)xfer;
     return NET_SEND_FILE_UNSUPPORTED;
   #endif
 #endif
@@ -339,7 +599,8 @@ static net_send_file_result_t net_send_file_all(socket_t sock,
 
 static net_send_file_result_t net_send_file_buffered(socket_t sock,
                                                      int in_fd,
-                                                     uint64_t content_size) {
+                                                     uint64_t content_size,
+                                                     net_transfer_t *xfer) {
   int exit_code = NET_SEND_FILE_OK;
   char *buf = NULL;
   uint64_t remaining = content_size;
@@ -352,18 +613,20 @@ static net_send_file_result_t net_send_file_buffered(socket_t sock,
     return NET_SEND_FILE_OK;
   }
 
-  buf = (char *)malloc(CHUNK_SIZE);
+  buf = buf_pool_acquire();
   if (buf == NULL) {
     return NET_SEND_FILE_IO;
   }
 
   while (remaining > 0) {
-    size_t want = CHUNK_SIZE;
+    size_t want = BUF_POOL_BUF_SIZE;
     if ((uint64_t)want > remaining) {
       want = (size_t)remaining;
     }
+    want = (size_t)net_xfer_acquire(xfer, want);
 
-    ssize_t nr = fs_read(in_fd, buf, want);
+    ssize_t nr = fs_pread(in_fd, buf, want, content_size - remaining);
+    net_xfer_release(xfer, want, nr > 0 ? (uint64_t)nr : 0u);
     if (nr < 0) {
       exit_code = NET_SEND_FILE_IO;
       goto CLEANUP;
@@ -377,28 +640,195 @@ static net_send_file_result_t net_send_file_buffered(socket_t sock,
       goto CLEANUP;
     }
 
+    net_xfer_progress(xfer, (uint64_t)nr);
     remaining -= (uint64_t)nr;
   }
 
 CLEANUP:
-  free(buf);
+  buf_pool_release(buf);
   return (net_send_file_result_t)exit_code;
 }
 
+net_send_file_result_t net_send_file_tracked(socket_t sock,
+                                             int in_fd,
+                                             uint64_t content_size,
+                                             net_transfer_t *xfer) {
+  if (xfer != NULL) {
+    xfer->path = content_size == 0 ? NET_IO_PATH_NONE : NET_IO_PATH_SENDFILE;
+  }
+  net_send_file_result_t res = net_send_file_all(sock, in_fd, content_size, xfer);
+  if (res != NET_SEND_FILE_UNSUPPORTED) {
+    return res;
+  }
+
+  if (xfer != NULL) {
+    xfer->path = NET_IO_PATH_BUFFERED;
+  }
+  return net_send_file_buffered(sock, in_fd, content_size, xfer);
+}
+
 net_send_file_result_t net_send_file_best_effort(socket_t sock,
                                                  int in_fd,
                                                  uint64_t content_size) {
-  net_send_file_result_t res = net_send_file_all(sock, in_fd, content_size);
-  if (res != NET_SEND_FILE_UNSUPPORTED) {
-    return res;
+  return net_send_file_tracked(sock, in_fd, content_size, NULL);
+}
+
+int net_pipe_grow(int pipe_fd, uint64_t size) {
+#if defined(__linux__) && defined(F_SETPIPE_SZ)
+  return fcntl(pipe_fd, F_SETPIPE_SZ, (int)size) < 0 ? 1 : 0;
+#else
+  (void)pipe_fd;
+  (void)size;
+  return 1;
+#endif
+}
+
+int net_fd_wait_readable(int fd, uint32_t timeout_ms, int *ready_out) {
+  if (ready_out == NULL) {
+    return 1;
+  }
+#ifdef _WIN32
+  (void)fd;
+  (void)timeout_ms;
+  *ready_out = 1;
+  return 0;
+#else
+  struct pollfd pfd;
+  int n = 0;
+
+  *ready_out = 0;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  while ((n = poll(&pfd, 1, (int)timeout_ms)) < 0) {
+    if (errno != EINTR) {
+      return 1;
+    }
+  }
+  if (n > 0 && (pfd.revents & POLLNVAL) != 0) {
+    errno = EBADF;
+    return 1;
+  }
+  *ready_out = n > 0;
+  return 0;
+#endif
+}
+
+net_send_file_result_t net_pipe_wait(int pipe_fd, uint32_t timeout_ms,
+                                     uint64_t *queued_out) {
+#if defined(__linux__)
+  int queued = 0;
+  int ready = 0;
+
+  if (net_fd_wait_readable(pipe_fd, timeout_ms, &ready) != 0) {
+    return errno == EBADF ? NET_SEND_FILE_INVALID_ARGUMENT : NET_SEND_FILE_IO;
+  }
+  if (!ready) {
+    return NET_SEND_FILE_TIMEOUT;
+  }
+  if (ioctl(pipe_fd, FIONREAD, &queued) != 0 || queued < 0) {
+    return NET_SEND_FILE_UNSUPPORTED;
+  }
+  *queued_out = (uint64_t)queued;
+  return NET_SEND_FILE_OK;
+#else
+  (void)pipe_fd;
+  (void)timeout_ms;
+  (void)queued_out;
+  return NET_SEND_FILE_UNSUPPORTED;
+#endif
+}
+
+// For pipes that cannot splice: the bytes are already queued, so plain reads
+// return them without waiting on the writer.
+static net_send_file_result_t net_send_pipe_copy(socket_t sock, int pipe_fd, uint64_t len,
+                                                 net_transfer_t *xfer) {
+  char buf[NET_RECV_STACK_BUF_SIZE];
+
+  while (len > 0) {
+    size_t want = sizeof(buf);
+    if ((uint64_t)want > len) {
+      want = (size_t)len;
+    }
+    want = (size_t)net_xfer_acquire(xfer, want);
+    ssize_t n = fs_read(pipe_fd, buf, want);
+    net_xfer_release(xfer, want, n > 0 ? (uint64_t)n : 0u);
+    if (n < 0) {
+      return NET_SEND_FILE_IO;
+    }
+    if (n == 0) {
+      return NET_SEND_FILE_SOURCE_CHANGED;
+    }
+    if (send_all(sock, buf, (size_t)n) != n) {
+      return NET_SEND_FILE_IO;
+    }
+    net_xfer_progress(xfer, (uint64_t)n);
+    len -= (uint64_t)n;
+  }
+  return NET_SEND_FILE_OK;
+}
+
+net_send_file_result_t net_send_pipe(socket_t sock, int pipe_fd, uint64_t len,
+                                     net_transfer_t *xfer) {
+  if (is_socket_invalid(sock) || pipe_fd < 0) {
+    return NET_SEND_FILE_INVALID_ARGUMENT;
+  }
+#if defined(__linux__)
+  if (xfer == NULL || xfer->path != NET_IO_PATH_BUFFERED) {
+    while (len > 0) {
+      size_t want = CHUNK_SIZE;
+      if ((uint64_t)want > len) {
+        want = (size_t)len;
+      }
+      want = (size_t)net_xfer_acquire(xfer, want);
+      ssize_t n = splice(pipe_fd, NULL, sock, NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+      net_xfer_release(xfer, want, n > 0 ? (uint64_t)n : 0u);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EINVAL || errno == ENOSYS || errno == ENOTSUP) {
+          break;
+        }
+        return NET_SEND_FILE_IO;
+      }
+      if (n == 0) {
+        return NET_SEND_FILE_SOURCE_CHANGED;
+      }
+      if (xfer != NULL) {
+        xfer->path = NET_IO_PATH_SPLICE;
+      }
+      net_xfer_progress(xfer, (uint64_t)n);
+      len -= (uint64_t)n;
+    }
+    if (len == 0) {
+      return NET_SEND_FILE_OK;
+    }
+  }
+#endif
+  if (xfer != NULL) {
+    xfer->path = NET_IO_PATH_BUFFERED;
   }
+  return net_send_pipe_copy(sock, pipe_fd, len, xfer);
+}
 
-  return net_send_file_buffered(sock, in_fd, content_size);
+// Counts bytes that reached out_fd outside the pipeline and issues durable
+// writeback once a slice has accumulated.
+static void net_recv_body_advance(net_recv_body_t *body, uint64_t n) {
+  body->received += n;
+  if (body->writeback_slice > 0 &&
+      body->received - body->flushed >= body->writeback_slice) {
+    fs_writeback_range(body->out_fd, body->flushed, body->received - body->flushed);
+    body->flushed = body->received;
+  }
 }
 
 static net_recv_file_result_t net_recv_file_all(socket_t sock,
-                                                int out_fd,
+                                                net_recv_body_t *body,
                                                 uint64_t content_size) {
+  net_transfer_t *xfer = body->xfer;
+  int out_fd = body->out_fd;
+
   if (content_size == 0) {
     return NET_RECV_FILE_OK;
   }
@@ -412,7 +842,6 @@ static net_recv_file_result_t net_recv_file_all(socket_t sock,
   uint64_t remaining = content_size;
   uint64_t moved = 0;
   int use_pipe_fallback = 0;
-  off_t file_offset = 0;
 
   while (remaining > 0) {
     size_t want = CHUNK_SIZE;
@@ -421,9 +850,11 @@ static net_recv_file_result_t net_recv_file_all(socket_t sock,
     }
 
     ssize_t n;
+    want = (size_t)net_xfer_acquire(xfer, want);
     if (!use_pipe_fallback) {
-      n = splice(sock, NULL, out_fd, &file_offset, want,
+      n = splice(sock, NULL, out_fd, NULL, want,
                  SPLICE_F_MOVE | SPLICE_F_MORE);
+      net_xfer_release(xfer, want, n > 0 ? (uint64_t)n : 0u);
       if (n < 0) {
         if ((errno == EINVAL || errno == ENOSYS || errno == ENOTSUP) && moved == 0) {
           if (pipe(pipefd) != 0) {
@@ -443,12 +874,15 @@ static net_recv_file_result_t net_recv_file_all(socket_t sock,
       if (n == 0) {
         return NET_RECV_FILE_EOF;
       }
-      file_offset += n;
+      conn_deadline_progress((uint64_t)n);
+      net_xfer_progress(xfer, (uint64_t)n);
+      net_recv_body_advance(body, (uint64_t)n);
       remaining -= (uint64_t)n;
       moved += (uint64_t)n;
     } else {
       n = splice(sock, NULL, pipefd[1], NULL, want,
                  SPLICE_F_MOVE | SPLICE_F_MORE);
+      net_xfer_release(xfer, want, n > 0 ? (uint64_t)n : 0u);
       if (n < 0) {
         if ((errno == EINVAL || errno == ENOSYS || errno == ENOTSUP) && moved == 0) {
           close(pipefd[0]);
@@ -467,6 +901,7 @@ static net_recv_file_result_t net_recv_file_all(socket_t sock,
         close(pipefd[1]);
         return NET_RECV_FILE_EOF;
       }
+      conn_deadline_progress((uint64_t)n);
 
       ssize_t pipe_remaining = n;
       while (pipe_remaining > 0) {
@@ -485,6 +920,8 @@ static net_recv_file_result_t net_recv_file_all(socket_t sock,
           close(pipefd[1]);
           return NET_RECV_FILE_IO;
         }
+        net_xfer_progress(xfer, (uint64_t)written);
+        net_recv_body_advance(body, (uint64_t)written);
         pipe_remaining -= written;
         remaining -= (uint64_t)written;
         moved += (uint64_t)written;
@@ -500,88 +937,412 @@ static net_recv_file_result_t net_recv_file_all(socket_t sock,
 #else
   (void)sock;
   (void)out_fd;
-  (void)content_size;
+  (void)xfer;
   return NET_RECV_FILE_UNSUPPORTED;
 #endif
 }
 
-static net_recv_file_result_t net_recv_file_buffered(socket_t sock,
-                                                     int out_fd,
-                                                     uint64_t content_size) {
-  char stack_buf[8192];
-  char *buf = stack_buf;
-  size_t buf_cap = sizeof(stack_buf);
-  char *heap_buf = NULL;
-  uint64_t remaining = content_size;
+// Lives for a whole body, however many pieces it arrives in, so the ring and
+// the writer thread are set up once.
+struct net_recv_pipeline {
+  char *block;
+  char *bufs[NET_RECV_PIPELINE_DEPTH];
+  size_t lens[NET_RECV_PIPELINE_DEPTH];
+  unsigned head;
+  unsigned tail;
+  unsigned filled;
+  int producer_done;
+  int producer_failed;
+  int writer_failed;
+  int writer_errno;
+  int out_fd;
+  uint64_t written;  // writer stage, from the start of out_fd
+  uint64_t flushed;
+  uint64_t writeback_slice;
+#ifdef _WIN32
+  CRITICAL_SECTION mutex;
+  CONDITION_VARIABLE cond;
+  HANDLE writer;
+#else
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t writer;
+#endif
+};
 
-  if (is_socket_invalid(sock) || out_fd < 0) {
-    return NET_RECV_FILE_INVALID_ARGUMENT;
+static void net_recv_pipeline_lock(net_recv_pipeline_t *p) {
+#ifdef _WIN32
+  EnterCriticalSection(&p->mutex);
+#else
+  (void)pthread_mutex_lock(&p->mutex);
+#endif
+}
+
+static void net_recv_pipeline_unlock(net_recv_pipeline_t *p) {
+#ifdef _WIN32
+  LeaveCriticalSection(&p->mutex);
+#else
+  (void)pthread_mutex_unlock(&p->mutex);
+#endif
+}
+
+static void net_recv_pipeline_wait(net_recv_pipeline_t *p) {
+#ifdef _WIN32
+  (void)SleepConditionVariableCS(&p->cond, &p->mutex, INFINITE);
+#else
+  (void)pthread_cond_wait(&p->cond, &p->mutex);
+#endif
+}
+
+static void net_recv_pipeline_signal(net_recv_pipeline_t *p) {
+#ifdef _WIN32
+  WakeAllConditionVariable(&p->cond);
+#else
+  (void)pthread_cond_broadcast(&p->cond);
+#endif
+}
+
+// Disk stage: drains filled slots in order so the socket stage never waits
+// on a slow write unless every slot is already full.
+#ifdef _WIN32
+static unsigned __stdcall net_recv_pipeline_writer_main(void *arg) {
+#else
+static void *net_recv_pipeline_writer_main(void *arg) {
+#endif
+  net_recv_pipeline_t *p = (net_recv_pipeline_t *)arg;
+
+  net_recv_pipeline_lock(p);
+  for (;;) {
+    while (p->filled == 0 && !p->producer_done && !p->producer_failed) {
+      net_recv_pipeline_wait(p);
+    }
+    if (p->filled == 0 || p->producer_failed) {
+      break;
+    }
+
+    unsigned slot = p->tail;
+    size_t len = p->lens[slot];
+    net_recv_pipeline_unlock(p);
+
+    int ok = fs_write_all(p->out_fd, p->bufs[slot], len) == (ssize_t)len;
+    int err = errno;
+    if (ok) {
+      p->written += (uint64_t)len;
+      if (p->writeback_slice > 0 && p->written - p->flushed >= p->writeback_slice) {
+        fs_writeback_range(p->out_fd, p->flushed, p->written - p->flushed);
+        p->flushed = p->written;
+      }
+    }
+
+    net_recv_pipeline_lock(p);
+    if (!ok) {
+      p->writer_failed = 1;
+      p->writer_errno = err;
+      net_recv_pipeline_signal(p);
+      break;
+    }
+    p->tail = (slot + 1u) % NET_RECV_PIPELINE_DEPTH;
+    p->filled--;
+    net_recv_pipeline_signal(p);
   }
+  net_recv_pipeline_unlock(p);
 
-  if (content_size == 0) {
-    return NET_RECV_FILE_OK;
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+// NULL when the ring or the writer cannot be set up; the caller then
+// receives synchronously.
+static net_recv_pipeline_t *net_recv_pipeline_start(const net_recv_body_t *body) {
+  net_recv_pipeline_t *p = (net_recv_pipeline_t *)calloc(1, sizeof(*p));
+
+  if (p == NULL) {
+    return NULL;
+  }
+  p->block = buf_pool_acquire();
+  if (p->block == NULL) {
+    free(p);
+    return NULL;
+  }
+  for (unsigned i = 0; i < NET_RECV_PIPELINE_DEPTH; i++) {
+    p->bufs[i] = p->block + (size_t)i * NET_RECV_PIPELINE_BUF_SIZE;
   }
+  p->out_fd = body->out_fd;
+  p->written = body->received;
+  p->flushed = body->flushed;
+  p->writeback_slice = body->writeback_slice;
 
-  if (content_size > (uint64_t)(1024u * 1024u)) {
-    buf_cap = 256u * 1024u;
-    heap_buf = (char *)malloc(buf_cap);
-    if (heap_buf == NULL) {
-      return NET_RECV_FILE_IO;
-    }
-    buf = heap_buf;
+#ifdef _WIN32
+  InitializeCriticalSection(&p->mutex);
+  InitializeConditionVariable(&p->cond);
+  uintptr_t handle = _beginthreadex(NULL, 0, net_recv_pipeline_writer_main, p, 0, NULL);
+  if (handle == 0) {
+    DeleteCriticalSection(&p->mutex);
+    buf_pool_release(p->block);
+    free(p);
+    return NULL;
+  }
+  p->writer = (HANDLE)handle;
+#else
+  if (pthread_mutex_init(&p->mutex, NULL) != 0) {
+    buf_pool_release(p->block);
+    free(p);
+    return NULL;
+  }
+  if (pthread_cond_init(&p->cond, NULL) != 0) {
+    (void)pthread_mutex_destroy(&p->mutex);
+    buf_pool_release(p->block);
+    free(p);
+    return NULL;
+  }
+  if (pthread_create(&p->writer, NULL, net_recv_pipeline_writer_main, p) != 0) {
+    (void)pthread_cond_destroy(&p->cond);
+    (void)pthread_mutex_destroy(&p->mutex);
+    buf_pool_release(p->block);
+    free(p);
+    return NULL;
   }
+#endif
+  return p;
+}
 
-  while (remaining > 0) {
-    size_t want = buf_cap;
-    if ((uint64_t)want > remaining) {
-      want = (size_t)remaining;
-    }
+// Tells the writer to drain (or drop, after a failure), joins it and frees
+// the pipeline. A disk failure overrides an otherwise good result.
+static net_recv_file_result_t net_recv_pipeline_stop(net_recv_pipeline_t *p,
+                                                     net_recv_file_result_t result) {
+  net_recv_pipeline_lock(p);
+  if (result == NET_RECV_FILE_OK) {
+    p->producer_done = 1;
+  } else {
+    p->producer_failed = 1;
+  }
+  net_recv_pipeline_signal(p);
+  net_recv_pipeline_unlock(p);
 
 #ifdef _WIN32
-    int tmp = recv(sock, buf, (int)want, 0);
+  (void)WaitForSingleObject(p->writer, INFINITE);
+  CloseHandle(p->writer);
+  DeleteCriticalSection(&p->mutex);
+#else
+  (void)pthread_join(p->writer, NULL);
+  (void)pthread_cond_destroy(&p->cond);
+  (void)pthread_mutex_destroy(&p->mutex);
+#endif
+
+  if (result == NET_RECV_FILE_OK && p->writer_failed) {
+    result = NET_RECV_FILE_DISK_IO;
+  }
+  if (result == NET_RECV_FILE_DISK_IO && p->writer_failed) {
+    errno = p->writer_errno;
+  }
+  buf_pool_release(p->block);
+  free(p);
+  return result;
+}
+
+static net_recv_file_result_t net_recv_fill(socket_t sock, char *buf, size_t want,
+                                            size_t *got_out,
+                                            net_transfer_t *xfer) {
+  size_t got = 0;
+
+  while (got < want) {
+    size_t slice = (size_t)net_xfer_acquire(xfer, want - got);
+#ifdef _WIN32
+    int tmp = recv(sock, buf + got, (int)slice, 0);
+    net_xfer_release(xfer, slice, tmp > 0 ? (uint64_t)tmp : 0u);
     if (tmp == SOCKET_ERROR) {
-      int err = WSAGetLastError();
-      if (err == WSAEINTR) {
+      if (WSAGetLastError() == WSAEINTR) {
         continue;
       }
-      free(heap_buf);
+      *got_out = got;
       return NET_RECV_FILE_IO;
     }
     ssize_t n = (ssize_t)tmp;
 #else
-    ssize_t n = recv(sock, buf, want, 0);
+    ssize_t n = recv(sock, buf + got, slice, 0);
+    net_xfer_release(xfer, slice, n > 0 ? (uint64_t)n : 0u);
     if (n < 0) {
       if (errno == EINTR) {
         continue;
       }
-      free(heap_buf);
+      *got_out = got;
       return NET_RECV_FILE_IO;
     }
 #endif
     if (n == 0) {
-      free(heap_buf);
+      *got_out = got;
       return NET_RECV_FILE_EOF;
     }
+    conn_deadline_progress((uint64_t)n);
+    net_xfer_progress(xfer, (uint64_t)n);
+    got += (size_t)n;
+  }
 
-    if (fs_write_all(out_fd, buf, (size_t)n) != n) {
-      free(heap_buf);
-      return NET_RECV_FILE_IO;
+  *got_out = got;
+  return NET_RECV_FILE_OK;
+}
+
+// Socket stage: fills free slots with up to content_size bytes and hands
+// them to the writer.
+static net_recv_file_result_t net_recv_pipeline_push(net_recv_pipeline_t *p,
+                                                     socket_t sock,
+                                                     net_recv_body_t *body,
+                                                     uint64_t content_size) {
+  uint64_t remaining = content_size;
+
+  while (remaining > 0) {
+    unsigned slot = 0;
+    size_t want = NET_RECV_PIPELINE_BUF_SIZE;
+    size_t got = 0;
+
+    net_recv_pipeline_lock(p);
+    while (p->filled == NET_RECV_PIPELINE_DEPTH && !p->writer_failed) {
+      net_recv_pipeline_wait(p);
+    }
+    if (p->writer_failed) {
+      net_recv_pipeline_unlock(p);
+      return NET_RECV_FILE_DISK_IO;
     }
+    slot = p->head;
+    net_recv_pipeline_unlock(p);
 
-    remaining -= (uint64_t)n;
+    if ((uint64_t)want > remaining) {
+      want = (size_t)remaining;
+    }
+    net_recv_file_result_t result = net_recv_fill(sock, p->bufs[slot], want, &got, body->xfer);
+    if (result != NET_RECV_FILE_OK) {
+      return result;
+    }
+
+    net_recv_pipeline_lock(p);
+    p->lens[slot] = got;
+    p->head = (slot + 1u) % NET_RECV_PIPELINE_DEPTH;
+    p->filled++;
+    net_recv_pipeline_signal(p);
+    net_recv_pipeline_unlock(p);
+    body->received += (uint64_t)got;
+    remaining -= (uint64_t)got;
   }
 
-  free(heap_buf);
   return NET_RECV_FILE_OK;
 }
 
+static net_recv_file_result_t net_recv_file_small(socket_t sock,
+                                                  net_recv_body_t *body,
+                                                  uint64_t content_size) {
+  char buf[NET_RECV_STACK_BUF_SIZE];
+  uint64_t remaining = content_size;
+
+  while (remaining > 0) {
+    size_t want = sizeof(buf);
+    size_t got = 0;
+    if ((uint64_t)want > remaining) {
+      want = (size_t)remaining;
+    }
+
+    net_recv_file_result_t res = net_recv_fill(sock, buf, want, &got, body->xfer);
+    if (got > 0 && fs_write_all(body->out_fd, buf, got) != (ssize_t)got) {
+      return NET_RECV_FILE_DISK_IO;
+    }
+    net_recv_body_advance(body, (uint64_t)got);
+    if (res != NET_RECV_FILE_OK) {
+      return res;
+    }
+    remaining -= (uint64_t)got;
+  }
+
+  return NET_RECV_FILE_OK;
+}
+
+void net_recv_body_init(net_recv_body_t *body, int out_fd, uint64_t writeback_slice,
+                        int buffered, net_transfer_t *xfer) {
+  memset(body, 0, sizeof(*body));
+  body->out_fd = out_fd;
+  body->writeback_slice = writeback_slice;
+  body->buffered = buffered ? 1 : 0;
+  body->xfer = xfer;
+}
+
+net_recv_file_result_t net_recv_body_recv(net_recv_body_t *body, socket_t sock,
+                                          uint64_t len) {
+  if (body == NULL || is_socket_invalid(sock) || body->out_fd < 0) {
+    return NET_RECV_FILE_INVALID_ARGUMENT;
+  }
+  if (len == 0) {
+    return NET_RECV_FILE_OK;
+  }
+
+  if (!body->buffered) {
+    if (body->xfer != NULL) {
+      body->xfer->path = NET_IO_PATH_SPLICE;
+    }
+    net_recv_file_result_t res = net_recv_file_all(sock, body, len);
+    if (res != NET_RECV_FILE_UNSUPPORTED) {
+      return res;
+    }
+    body->buffered = 1;
+  }
+  if (body->xfer != NULL) {
+    body->xfer->path = NET_IO_PATH_BUFFERED;
+  }
+
+  // Small bodies are not worth a thread; the pipeline starts once the body
+  // outgrows the threshold and then stays up until the body is finished.
+  if (body->pipeline == NULL && body->received + len > NET_RECV_PIPELINE_THRESHOLD) {
+    body->pipeline = net_recv_pipeline_start(body);
+  }
+  if (body->pipeline == NULL) {
+    return net_recv_file_small(sock, body, len);
+  }
+  return net_recv_pipeline_push(body->pipeline, sock, body, len);
+}
+
+net_recv_file_result_t net_recv_body_finish(net_recv_body_t *body,
+                                            net_recv_file_result_t result) {
+  if (body == NULL || body->pipeline == NULL) {
+    return result;
+  }
+  result = net_recv_pipeline_stop(body->pipeline, result);
+  body->pipeline = NULL;
+  return result;
+}
+
+net_recv_file_result_t net_recv_file_buffered(socket_t sock,
+                                              int out_fd,
+                                              uint64_t content_size,
+                                              uint64_t writeback_slice,
+                                              net_transfer_t *xfer) {
+  net_recv_body_t body;
+
+  if (is_socket_invalid(sock) || out_fd < 0) {
+    return NET_RECV_FILE_INVALID_ARGUMENT;
+  }
+  net_recv_body_init(&body, out_fd, writeback_slice, 1, xfer);
+  return net_recv_body_finish(&body, net_recv_body_recv(&body, sock, content_size));
+}
+
+net_recv_file_result_t net_recv_file_tracked(socket_t sock,
+                                             int out_fd,
+                                             uint64_t content_size,
+                                             uint64_t writeback_slice,
+                                             net_transfer_t *xfer) {
+  net_recv_body_t body;
+
+  if (xfer != NULL) {
+    xfer->path = NET_IO_PATH_NONE;
+  }
+  if (content_size == 0) {
+    return NET_RECV_FILE_OK;
+  }
+  net_recv_body_init(&body, out_fd, writeback_slice, 0, xfer);
+  return net_recv_body_finish(&body, net_recv_body_recv(&body, sock, content_size));
+}
+
 net_recv_file_result_t net_recv_file_best_effort(socket_t sock,
                                                  int out_fd,
                                                  uint64_t content_size) {
-  net_recv_file_result_t res = net_recv_file_all(sock, out_fd, content_size);
-  if (res != NET_RECV_FILE_UNSUPPORTED) {
-    return res;
-  }
-
-  return net_recv_file_buffered(sock, out_fd, content_size);
+  return net_recv_file_tracked(sock, out_fd, content_size, 0, NULL);
 }
@@ -6,6 +6,8 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#include "rate_limit.h"
+
 #ifdef _WIN32
   #include <winsock2.h>
   #include <ws2tcpip.h>
@@ -39,7 +41,8 @@ typedef enum {
   NET_SEND_FILE_UNSUPPORTED,
   NET_SEND_FILE_SOURCE_CHANGED,
   NET_SEND_FILE_IO,
-  NET_SEND_FILE_INVALID_ARGUMENT
+  NET_SEND_FILE_INVALID_ARGUMENT,
+  NET_SEND_FILE_TIMEOUT
 } net_send_file_result_t;
 
 typedef enum {
@@ -47,7 +50,8 @@ typedef enum {
   NET_RECV_FILE_UNSUPPORTED,
   NET_RECV_FILE_EOF,
   NET_RECV_FILE_IO,
-  NET_RECV_FILE_INVALID_ARGUMENT
+  NET_RECV_FILE_INVALID_ARGUMENT,
+  NET_RECV_FILE_DISK_IO
 } net_recv_file_result_t;
 
 ssize_t send_all(
@@ -68,14 +72,113 @@ void socket_init(socket_t *s);
 int socket_close(socket_t s);
 
 int net_wait_readable(socket_t sock, uint32_t timeout_ms, int *ready_out);
+
+// Lets another thread interrupt a connection blocked in
+// net_wait_readable_or_woken. Signalling never blocks and may coalesce.
+typedef struct {
+#ifdef _WIN32
+  socket_t sock;
+#else
+  int fds[2];
+#endif
+} net_waker_t;
+
+int net_waker_open(net_waker_t *waker);
+void net_waker_close(net_waker_t *waker);
+void net_waker_signal(net_waker_t *waker);
+void net_waker_drain(net_waker_t *waker);
+// The readable end, for callers that poll the waker alongside other sockets.
+socket_t net_waker_handle(const net_waker_t *waker);
+int net_wait_readable_or_woken(socket_t sock, net_waker_t *waker, uint32_t timeout_ms,
+                               int *ready_out, int *woken_out);
 int net_primary_ipv4(char *out, size_t out_cap);
 
+int net_set_nonblocking(socket_t sock);
+// Returns the bytes accepted by the kernel, 0 when the send buffer is full,
+// or -1 on a connection error.
+ssize_t net_send_nonblocking(socket_t sock, const void *data, size_t len);
+
+// Which kernel path moved a file body.
+typedef enum {
+  NET_IO_PATH_NONE = 0,
+  NET_IO_PATH_SENDFILE,
+  NET_IO_PATH_SPLICE,
+  NET_IO_PATH_BUFFERED
+} net_io_path_t;
+
+// Telemetry and pacing for one file body. progress, when set, is bumped
+// atomically as bytes move, so several transfers can share a counter another
+// thread samples. limit, when set, paces every kernel call in bounded slices.
+typedef struct {
+  volatile uint64_t *progress;
+  rate_limit_t *limit;
+  net_io_path_t path;
+} net_transfer_t;
+
+const char *net_io_path_name(net_io_path_t path);
+
 net_send_file_result_t net_send_file_best_effort(socket_t sock,
                                                   int in_fd,
                                                   uint64_t content_size);
 net_recv_file_result_t net_recv_file_best_effort(socket_t sock,
                                                   int out_fd,
                                                   uint64_t content_size);
+// As above, reporting to and paced by xfer.
+net_send_file_result_t net_send_file_tracked(socket_t sock,
+                                             int in_fd,
+                                             uint64_t content_size,
+                                             net_transfer_t *xfer);
+// writeback_slice, when nonzero, starts durable writeback every that many
+// bytes; out_fd must be a fresh file written from offset 0.
+net_recv_file_result_t net_recv_file_tracked(socket_t sock,
+                                             int out_fd,
+                                             uint64_t content_size,
+                                             uint64_t writeback_slice,
+                                             net_transfer_t *xfer);
+
+// net_wait_readable for a file descriptor such as stdin. Always ready on
+// Windows, where a CRT descriptor cannot be polled.
+int net_fd_wait_readable(int fd, uint32_t timeout_ms, int *ready_out);
+// Pipes of unknown length. net_pipe_wait waits up to timeout_ms for pipe_fd
+// to become readable (TIMEOUT otherwise) and reports how many bytes are
+// queued, 0 at EOF; it is UNSUPPORTED where that cannot be asked (anything
+// but Linux). net_send_pipe then moves exactly len queued bytes with
+// splice, or copies once splice is refused, and leaves xfer->path at what
+// it used. Growing the pipe is best effort.
+int net_pipe_grow(int pipe_fd, uint64_t size);
+net_send_file_result_t net_pipe_wait(int pipe_fd, uint32_t timeout_ms,
+                                     uint64_t *queued_out);
+net_send_file_result_t net_send_pipe(socket_t sock, int pipe_fd, uint64_t len,
+                                     net_transfer_t *xfer);
+// One file body that arrives in several pieces, such as a stream's chunks.
+// The kernel path is picked on the first piece, and once the buffered
+// pipeline starts it keeps its ring and writer thread until finish, which
+// must follow every init. Writeback works as for net_recv_file_tracked.
+typedef struct net_recv_pipeline net_recv_pipeline_t;
+typedef struct {
+  int out_fd;
+  uint64_t writeback_slice;
+  uint64_t received;
+  uint64_t flushed;
+  int buffered;
+  net_recv_pipeline_t *pipeline;
+  net_transfer_t *xfer;
+} net_recv_body_t;
+
+void net_recv_body_init(net_recv_body_t *body, int out_fd, uint64_t writeback_slice,
+                        int buffered, net_transfer_t *xfer);
+net_recv_file_result_t net_recv_body_recv(net_recv_body_t *body, socket_t sock,
+                                          uint64_t len);
+// Waits for every received byte to reach out_fd. result is the outcome so
+// far; a write failure in the pipeline turns success into DISK_IO.
+net_recv_file_result_t net_recv_body_finish(net_recv_body_t *body,
+                                            net_recv_file_result_t result);
+// xfer may be NULL.
+net_recv_file_result_t net_recv_file_buffered(socket_t sock,
+                                              int out_fd,
+                                              uint64_t content_size,
+                                              uint64_t writeback_slice,
+                                              net_transfer_t *xfer);
 
 
 #endif  // HF_NET_H
@@ -325,12 +325,21 @@ protocol_result_t decode_header(protocol_header_t *header, const uint8_t *in) {
   header->msg_type = *base++;
   if (header->msg_type != HF_MSG_TYPE_TEXT_MESSAGE &&
       header->msg_type != HF_MSG_TYPE_SEND_FILE &&
-      header->msg_type != HF_MSG_TYPE_GET_FILE) {
+      header->msg_type != HF_MSG_TYPE_GET_FILE &&
+      header->msg_type != HF_MSG_TYPE_BINARY_MESSAGE &&
+      header->msg_type != HF_MSG_TYPE_LIST_FILES) {
     return PROTOCOL_ERR_HEADER_MSG_TYPE;
   }
   
   header->flags = *base++;
-  if (header->flags != HF_MSG_FLAG_NONE) {
+  if (header->flags != HF_MSG_FLAG_NONE &&
+      !(header->flags == HF_MSG_FLAG_CHANNEL &&
+        (header->msg_type == HF_MSG_TYPE_TEXT_MESSAGE ||
+         header->msg_type == HF_MSG_TYPE_BINARY_MESSAGE)) &&
+      !((header->flags == HF_MSG_FLAG_SYNC || header->flags == HF_MSG_FLAG_STREAM) &&
+        header->msg_type == HF_MSG_TYPE_SEND_FILE) &&
+      !(header->flags == HF_MSG_FLAG_HASH &&
+        header->msg_type == HF_MSG_TYPE_LIST_FILES)) {
     return PROTOCOL_ERR_HEADER_MSG_FLAG;
   }
 
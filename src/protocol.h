@@ -9,6 +9,13 @@
 #define HF_PROTOCOL_MAX_FILE_NAME_LEN 255u
 #define HF_MAX_FILE_SIZE 100ULL * 1024 * 1024 * 1024
 #define HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE (256u * 1024u)
+#define HF_PROTOCOL_MAX_CHANNEL_NAME_LEN 64u
+#define HF_PROTOCOL_MAX_BINARY_MESSAGE_SIZE (64ull * 1024u * 1024u)
+#define HF_PROTOCOL_MAX_MIME_LEN 127u
+#define HF_PROTOCOL_MAX_PATH_LEN 4095u
+#define HF_PROTOCOL_MAX_STREAM_CHUNK (16u * 1024u * 1024u)
+#define HF_PROTOCOL_STREAM_KEEPALIVE 0xFFFFFFFFu
+#define HF_PROTOCOL_STREAM_KEEPALIVE_MS 5000u
 #define HF_PROTOCOL_HEADER_SIZE 13u
 #define HF_PROTOCOL_RES_FRAME_SIZE 4u
 
@@ -18,8 +25,35 @@
 #define HF_MSG_TYPE_SEND_FILE 0x01u
 #define HF_MSG_TYPE_TEXT_MESSAGE 0x02u
 #define HF_MSG_TYPE_GET_FILE 0x03u
+// Payload: u8 MIME type length, the MIME type, the optional channel prefix,
+// then the binary body. The server answers READY before the body.
+#define HF_MSG_TYPE_BINARY_MESSAGE 0x04u
+// Payload: a directory, encoded like a GET_FILE name but as a relative path.
+// The server answers READY and then, in fs_path_cmp order, one entry per
+// regular file below it: u16 path length | path relative to the directory |
+// u64 size | u64 mtime | with HF_MSG_FLAG_HASH, the content's SHA-1. An empty
+// path ends the listing and FINAL follows. A missing directory lists empty.
+#define HF_MSG_TYPE_LIST_FILES 0x05u
 
 #define HF_MSG_FLAG_NONE 0x00u
+// Messages only: the payload carries a u8 channel name length and the name
+// (for text, first; for binary, after the MIME type); without it the message
+// goes to the default channel.
+#define HF_MSG_FLAG_CHANNEL 0x01u
+// Send file only: the name is a relative path whose missing parent
+// directories are created, and a u64 mtime follows the content size.
+#define HF_MSG_FLAG_SYNC 0x02u
+// List files only: every entry carries a content hash.
+#define HF_MSG_FLAG_HASH 0x04u
+// Send file only: the length is not known up front. The prefix carries a
+// content size of 0 and the payload size covers just the prefix; after
+// READY the body follows as u32 length-prefixed chunks, ended by an empty
+// one. A length of HF_PROTOCOL_STREAM_KEEPALIVE carries no data; the sender
+// emits one whenever its source has been idle for
+// HF_PROTOCOL_STREAM_KEEPALIVE_MS, well inside the server's recv timeout and
+// body window. The server only honours keepalives for a bounded total idle
+// time (CONN_DEADLINE_STREAM_IDLE_MS).
+#define HF_MSG_FLAG_STREAM 0x08u
 
 // protocol header struct
 typedef struct {
@@ -0,0 +1,175 @@
+#include "rate_limit.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef _WIN32
+  #include <time.h>
+#endif
+
+// A slice is an eighth of a second's worth, so pacing stays smooth without
+// giving up sendfile and splice for small copies.
+#define RATE_LIMIT_SLICE_DIVISOR 8u
+#define RATE_LIMIT_MIN_SLICE (4u * 1024u)
+#define RATE_LIMIT_MAX_SLICE (4u * 1024u * 1024u)
+
+static uint64_t rate_limit_now_us(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  (void)QueryPerformanceFrequency(&freq);
+  (void)QueryPerformanceCounter(&now);
+  return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000u +
+         (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000u / (uint64_t)freq.QuadPart;
+#else
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+#endif
+}
+
+static void rate_limit_sleep_us(uint64_t us) {
+#ifdef _WIN32
+  Sleep((DWORD)((us + 999u) / 1000u));
+#else
+  struct timespec ts = {(time_t)(us / 1000000u), (long)(us % 1000000u) * 1000L};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+#endif
+}
+
+static void rate_limit_lock(rate_limit_t *limit) {
+#ifdef _WIN32
+  EnterCriticalSection(&limit->mutex);
+#else
+  (void)pthread_mutex_lock(&limit->mutex);
+#endif
+}
+
+static void rate_limit_unlock(rate_limit_t *limit) {
+#ifdef _WIN32
+  LeaveCriticalSection(&limit->mutex);
+#else
+  (void)pthread_mutex_unlock(&limit->mutex);
+#endif
+}
+
+// Caller holds the lock.
+static void rate_limit_refill(rate_limit_t *limit) {
+  uint64_t now = rate_limit_now_us();
+
+  limit->tokens += (double)(now - limit->last_us) * (double)limit->rate / 1000000.0;
+  if (limit->tokens > (double)limit->burst) {
+    limit->tokens = (double)limit->burst;
+  }
+  limit->last_us = now;
+}
+
+int rate_limit_init(rate_limit_t *limit, uint64_t rate, rate_limit_t *parent) {
+  if (limit == NULL) {
+    return 1;
+  }
+  memset(limit, 0, sizeof(*limit));
+  limit->rate = rate;
+  limit->burst = rate / RATE_LIMIT_SLICE_DIVISOR;
+  if (limit->burst < RATE_LIMIT_MIN_SLICE) {
+    limit->burst = RATE_LIMIT_MIN_SLICE;
+  }
+  if (limit->burst > RATE_LIMIT_MAX_SLICE) {
+    limit->burst = RATE_LIMIT_MAX_SLICE;
+  }
+  limit->tokens = (double)limit->burst;
+  limit->last_us = rate_limit_now_us();
+  limit->parent = parent;
+#ifdef _WIN32
+  InitializeCriticalSection(&limit->mutex);
+#else
+  if (pthread_mutex_init(&limit->mutex, NULL) != 0) {
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+void rate_limit_destroy(rate_limit_t *limit) {
+  if (limit == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  DeleteCriticalSection(&limit->mutex);
+#else
+  (void)pthread_mutex_destroy(&limit->mutex);
+#endif
+}
+
+int rate_limit_active(const rate_limit_t *limit) {
+  for (; limit != NULL; limit = limit->parent) {
+    if (limit->rate != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Every bucket in the chain reserves the same slice up front, even when it
+// cannot cover it yet, and the caller sleeps off the largest deficit. That
+// keeps waiters roughly first come, first served.
+uint64_t rate_limit_reserve(rate_limit_t *limit, uint64_t want, uint64_t *wait_us_out) {
+  uint64_t grant = want > 0 ? want : 1u;
+  uint64_t wait_us = 0;
+
+  for (rate_limit_t *l = limit; l != NULL; l = l->parent) {
+    if (l->rate != 0 && grant > l->burst) {
+      grant = l->burst;
+    }
+  }
+  for (rate_limit_t *l = limit; l != NULL; l = l->parent) {
+    if (l->rate == 0) {
+      continue;
+    }
+    rate_limit_lock(l);
+    rate_limit_refill(l);
+    l->tokens -= (double)grant;
+    if (l->tokens < 0.0) {
+      uint64_t deficit_us = (uint64_t)(-l->tokens * 1000000.0 / (double)l->rate);
+      if (deficit_us > wait_us) {
+        wait_us = deficit_us;
+      }
+    }
+    rate_limit_unlock(l);
+  }
+  *wait_us_out = wait_us;
+  return grant;
+}
+
+void rate_limit_wait(uint64_t wait_us) {
+  if (wait_us > 0) {
+    rate_limit_sleep_us(wait_us);
+  }
+}
+
+uint64_t rate_limit_acquire(rate_limit_t *limit, uint64_t want) {
+  uint64_t wait_us = 0;
+  uint64_t grant = rate_limit_reserve(limit, want, &wait_us);
+
+  rate_limit_wait(wait_us);
+  return grant;
+}
+
+void rate_limit_release(rate_limit_t *limit, uint64_t unused) {
+  if (unused == 0) {
+    return;
+  }
+  for (rate_limit_t *l = limit; l != NULL; l = l->parent) {
+    if (l->rate == 0) {
+      continue;
+    }
+    rate_limit_lock(l);
+    l->tokens += (double)unused;
+    if (l->tokens > (double)l->burst) {
+      l->tokens = (double)l->burst;
+    }
+    rate_limit_unlock(l);
+  }
+}
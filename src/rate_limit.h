@@ -0,0 +1,45 @@
+#ifndef HF_RATE_LIMIT_H
+#define HF_RATE_LIMIT_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+// Lowest rate the CLI accepts, well above the server's body deadline rate.
+#define RATE_LIMIT_MIN_RATE (16u * 1024u)
+
+// A token bucket shared by any number of threads. Transfers reserve a slice
+// before each kernel call and give back what the call did not move. A bucket
+// with a parent draws from it too, so per-transfer limits can sit under a
+// global one; a rate of 0 passes everything through to the parent.
+typedef struct rate_limit {
+  uint64_t rate;   // bytes per second
+  uint64_t burst;  // largest slice handed out at once
+  double tokens;   // negative while reservations are being waited out
+  uint64_t last_us;
+  struct rate_limit *parent;
+#ifdef _WIN32
+  CRITICAL_SECTION mutex;
+#else
+  pthread_mutex_t mutex;
+#endif
+} rate_limit_t;
+
+int rate_limit_init(rate_limit_t *limit, uint64_t rate, rate_limit_t *parent);
+void rate_limit_destroy(rate_limit_t *limit);
+// True when acquiring from limit can ever wait.
+int rate_limit_active(const rate_limit_t *limit);
+// Waits until up to want bytes may move and returns how many, at least 1.
+uint64_t rate_limit_acquire(rate_limit_t *limit, uint64_t want);
+// rate_limit_acquire in two halves, for callers that need to know when it
+// is about to sleep: reserves the slice and reports how long to wait.
+uint64_t rate_limit_reserve(rate_limit_t *limit, uint64_t want, uint64_t *wait_us_out);
+void rate_limit_wait(uint64_t wait_us);
+// Hands back bytes acquired but never moved.
+void rate_limit_release(rate_limit_t *limit, uint64_t unused);
+
+#endif  // HF_RATE_LIMIT_H
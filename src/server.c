@@ -1,5 +1,6 @@
 #include "app_service.h"
 #include "cli.h"
+#include "conn_deadline.h"
 #include "control.h"
 #include "daemon_state.h"
 #include "http.h"
@@ -9,6 +10,10 @@
 #include "shutdown.h"
 #include "server.h"
 #include "server_conn_tracker.h"
+#include "sha1.h"
+#include "sse_hub.h"
+#include "upload_session.h"
+#include "webui.h"
 
 #include <stddef.h>
 #include <fcntl.h>
@@ -70,6 +75,14 @@ static protocol_result_t server_handle_get_file(
   socket_t conn,
   const server_opt_t *ser_opt,
   const protocol_header_t *proto_header);
+static protocol_result_t server_handle_binary_message(
+  socket_t conn,
+  const server_opt_t *ser_opt,
+  const protocol_header_t *proto_header);
+static protocol_result_t server_handle_list_files(
+  socket_t conn,
+  const server_opt_t *ser_opt,
+  const protocol_header_t *proto_header);
 static protocol_result_t server_send_response(socket_t conn,
                                               uint8_t phase,
                                               uint8_t status,
@@ -244,6 +257,14 @@ static int handle_protocol_connection(socket_t conn,
 
     case HF_MSG_TYPE_GET_FILE:
       return server_handle_get_file(conn, ser_opt, &proto_header) == PROTOCOL_OK ? 0 : 1;
+
+    case HF_MSG_TYPE_BINARY_MESSAGE:
+      return server_handle_binary_message(conn, ser_opt, &proto_header) == PROTOCOL_OK
+               ? 0
+               : 1;
+
+    case HF_MSG_TYPE_LIST_FILES:
+      return server_handle_list_files(conn, ser_opt, &proto_header) == PROTOCOL_OK ? 0 : 1;
   }
 
   return 1;
@@ -258,12 +279,17 @@ static void *server_connection_thread_main(void *arg) {
   socket_t conn = ctx->conn;
   server_opt_t opt = ctx->opt;
   server_conn_entry_t *entry = ctx->entry;
+  conn_deadline_t *deadline = conn_deadline_attach(conn);
+  server_conn_kind_t kind = SERVER_CONN_KIND_INVALID;
+  int owns_conn = 1;
 
   free(ctx);
 
-  switch (server_detect_connection_kind(conn)) {
+  kind = server_detect_connection_kind(conn);
+  conn_deadline_enter(CONN_DEADLINE_HEADER);
+  switch (kind) {
     case SERVER_CONN_KIND_HTTP:
-      (void)handle_http_connection(conn, &opt);
+      owns_conn = handle_http_connection(conn, &opt) != HTTP_CONN_DETACHED;
       break;
     case SERVER_CONN_KIND_PROTOCOL:
       (void)handle_protocol_connection(conn, &opt);
@@ -273,7 +299,10 @@ static void *server_connection_thread_main(void *arg) {
       break;
   }
 
-  socket_close(conn);
+  conn_deadline_detach(deadline);
+  if (owns_conn) {
+    socket_close(conn);
+  }
   server_conn_tracker_end(entry);
 
 #ifdef _WIN32
@@ -332,7 +361,11 @@ static int server_start_connection_thread(socket_t conn,
 
 static int server_handle_text_message(socket_t conn,
                                       const protocol_header_t *proto_header) {
+  char *payload = NULL;
   char *message = NULL;
+  char channel_name[HF_PROTOCOL_MAX_CHANNEL_NAME_LEN + 1u];
+  message_store_channel_t *channel = NULL;
+  uint64_t max_payload = HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE;
   protocol_result_t result = PROTOCOL_ERR_INVALID_ARGUMENT;
   uint8_t status = PROTO_STATUS_FAILED;
 
@@ -341,23 +374,27 @@ static int server_handle_text_message(socket_t conn,
     return 1;
   }
 
-  if (proto_header->payload_size > HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE) {
+  if (proto_header->flags == HF_MSG_FLAG_CHANNEL) {
+    max_payload += 1u + HF_PROTOCOL_MAX_CHANNEL_NAME_LEN;
+  }
+  if (proto_header->payload_size > max_payload) {
     fprintf(stderr, "protocol error: text message too large\n");
     result = PROTOCOL_ERR_MSG_TOO_LARGE;
     goto SEND_RESPONSE;
   }
 
-  size_t message_len = (size_t)proto_header->payload_size;
-  message = (char *)malloc(message_len + 1u);
-  if (message == NULL) {
+  size_t payload_len = (size_t)proto_header->payload_size;
+  payload = (char *)malloc(payload_len + 1u);
+  if (payload == NULL) {
     perror("malloc(message)");
     result = PROTOCOL_ERR_ALLOC;
     goto SEND_RESPONSE;
   }
 
-  if (message_len > 0) {
-    ssize_t n = recv_all(conn, message, message_len);
-    if (n != (ssize_t)message_len) {
+  conn_deadline_enter(CONN_DEADLINE_BODY);
+  if (payload_len > 0) {
+    ssize_t n = recv_all(conn, payload, payload_len);
+    if (n != (ssize_t)payload_len) {
       if (n < 0) {
         sock_perror("recv_all(message)");
         result = PROTOCOL_ERR_IO;
@@ -370,8 +407,30 @@ static int server_handle_text_message(socket_t conn,
     }
   }
 
-  message[message_len] = '\0';
-  result = app_submit_message(message);
+  conn_deadline_enter(CONN_DEADLINE_NONE);
+  payload[payload_len] = '\0';
+  message = payload;
+  (void)snprintf(channel_name, sizeof(channel_name), "%s", MESSAGE_STORE_DEFAULT_CHANNEL);
+  if (proto_header->flags == HF_MSG_FLAG_CHANNEL) {
+    size_t name_len = payload_len > 0 ? (unsigned char)payload[0] : 0u;
+
+    if (name_len == 0 || name_len >= payload_len ||
+        name_len > HF_PROTOCOL_MAX_CHANNEL_NAME_LEN) {
+      fprintf(stderr, "protocol error: invalid channel\n");
+      result = PROTOCOL_ERR_INVALID_ARGUMENT;
+      goto SEND_RESPONSE;
+    }
+    memcpy(channel_name, payload + 1, name_len);
+    channel_name[name_len] = '\0';
+    message = payload + 1 + name_len;
+  }
+  if (strlen(message) > HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE) {
+    result = PROTOCOL_ERR_MSG_TOO_LARGE;
+    goto SEND_RESPONSE;
+  }
+  channel = message_store_channel(channel_name);
+  result = app_submit_message(channel, message);
+  message_store_channel_release(channel);
   if (result != PROTOCOL_OK) {
     goto SEND_RESPONSE;
   }
@@ -383,7 +442,7 @@ SEND_RESPONSE:
   if (server_send_response(conn, PROTO_PHASE_FINAL, status, result) != PROTOCOL_OK) {
     sock_perror("send_res_frame(text_message_final)");
   }
-  if (message != NULL) free(message);
+  free(payload);
   return result == PROTOCOL_OK ? 0 : 1;
 }
 
@@ -408,6 +467,9 @@ static protocol_result_t server_handle_file_transfer(
   char saved_path[4096];
   uint64_t content_size = 0;
   uint64_t prefix_size = 0;
+  uint64_t mtime = 0;
+  int sync = proto_header->flags == HF_MSG_FLAG_SYNC;
+  int stream = proto_header->flags == HF_MSG_FLAG_STREAM;
   protocol_result_t result = PROTOCOL_ERR_IO;
 
   if (ser_opt == NULL) {
@@ -424,6 +486,16 @@ static protocol_result_t server_handle_file_transfer(
   }
 
   result = proto_recv_file_transfer_prefix(conn, &file_name, &content_size);
+  if (result == PROTOCOL_OK && sync) {
+    uint8_t mtime_buf[8];
+    ssize_t n = recv_all(conn, mtime_buf, sizeof(mtime_buf));
+    if (n == (ssize_t)sizeof(mtime_buf)) {
+      mtime = decode_u64_be(mtime_buf);
+    } else {
+      result = n < 0 ? PROTOCOL_ERR_IO : PROTOCOL_ERR_EOF;
+    }
+  }
+  conn_deadline_enter(CONN_DEADLINE_NONE);
   if (result != PROTOCOL_OK) {
     if (result == PROTOCOL_ERR_FILE_NAME_LEN) {
       fprintf(stderr, "protocol error: invalid file name length\n");
@@ -438,19 +510,34 @@ static protocol_result_t server_handle_file_transfer(
     goto CLEANUP;
   }
 
-  if (fs_validate_file_name(file_name) != 0) {
+  if (sync ? fs_validate_relative_path(file_name) != 0
+           : fs_validate_file_name(file_name) != 0) {
     fprintf(stderr, "invalid file name: %s\n", file_name);
     result = PROTOCOL_ERR_INVALID_FILE_NAME;
     goto SEND_READY_REJECT;
   }
 
   prefix_size = (uint64_t)proto_file_transfer_prefix_size((uint16_t)strlen(file_name));
+  if (sync) {
+    prefix_size += sizeof(uint64_t);
+  }
+  if (stream && content_size != 0) {
+    fprintf(stderr, "protocol error: stream with a content size\n");
+    result = PROTOCOL_ERR_PAYLOAD_SIZE_MISMATCH;
+    goto SEND_READY_REJECT;
+  }
   if (proto_header->payload_size != prefix_size + content_size) {
     fprintf(stderr, "protocol error: payload size mismatch\n");
     result = PROTOCOL_ERR_PAYLOAD_SIZE_MISMATCH;
     goto SEND_READY_REJECT;
   }
 
+  if (sync && fs_make_parent_dirs(ser_opt->path, file_name) != 0) {
+    perror("mkdir");
+    result = PROTOCOL_ERR_IO;
+    goto SEND_READY_REJECT;
+  }
+
   result = server_send_response(
     conn, PROTO_PHASE_READY, PROTO_STATUS_OK, PROTOCOL_OK);
   if (result != PROTOCOL_OK) {
@@ -458,9 +545,12 @@ static protocol_result_t server_handle_file_transfer(
     goto CLEANUP;
   }
 
+  conn_deadline_enter(CONN_DEADLINE_BODY);
   result = app_receive_file(conn, ser_opt->path, file_name, content_size,
-                            APP_UPLOAD_PROTOCOL, saved_path,
-                            sizeof(saved_path));
+                            sync ? &mtime : NULL,
+                            stream ? APP_UPLOAD_PROTOCOL_STREAM : APP_UPLOAD_PROTOCOL,
+                            saved_path, sizeof(saved_path));
+  conn_deadline_enter(CONN_DEADLINE_NONE);
   if (result != PROTOCOL_OK) {
     if (server_send_response(
           conn, PROTO_PHASE_FINAL, PROTO_STATUS_FAILED, result) != PROTOCOL_OK) {
@@ -490,6 +580,302 @@ CLEANUP:
   return result;
 }
 
+// Reads a u8 length and that many bytes, NUL-terminated into out.
+static protocol_result_t server_recv_short_string(socket_t conn, char *out,
+                                                  size_t max_len) {
+  uint8_t len = 0;
+  ssize_t n = recv_all(conn, &len, 1u);
+
+  if (n == 1 && len > 0 && (size_t)len <= max_len) {
+    n = recv_all(conn, out, len);
+    if (n == (ssize_t)len) {
+      out[len] = '\0';
+      return PROTOCOL_OK;
+    }
+  } else if (n == 1) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  if (n < 0) {
+    sock_perror("recv_all(binary_message_prefix)");
+    return PROTOCOL_ERR_IO;
+  }
+  fprintf(stderr, "protocol error: unexpected EOF while receiving binary message\n");
+  return PROTOCOL_ERR_EOF;
+}
+
+static protocol_result_t server_handle_binary_message(
+  socket_t conn,
+  const server_opt_t *ser_opt,
+  const protocol_header_t *proto_header) {
+  char mime[HF_PROTOCOL_MAX_MIME_LEN + 1u];
+  char channel_name[HF_PROTOCOL_MAX_CHANNEL_NAME_LEN + 1u];
+  message_store_channel_t *channel = NULL;
+  uint64_t prefix_size = 0;
+  uint64_t content_size = 0;
+  protocol_result_t result = PROTOCOL_ERR_INVALID_ARGUMENT;
+
+  if (ser_opt == NULL) {
+    fprintf(stderr, "invalid binary message handler arguments\n");
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+
+  conn_deadline_enter(CONN_DEADLINE_BODY);
+  result = server_recv_short_string(conn, mime, HF_PROTOCOL_MAX_MIME_LEN);
+  if (result == PROTOCOL_OK) {
+    prefix_size = 1u + strlen(mime);
+    (void)snprintf(channel_name, sizeof(channel_name), "%s",
+                   MESSAGE_STORE_DEFAULT_CHANNEL);
+    if (proto_header->flags == HF_MSG_FLAG_CHANNEL) {
+      result = server_recv_short_string(conn, channel_name,
+                                        HF_PROTOCOL_MAX_CHANNEL_NAME_LEN);
+      prefix_size += 1u + strlen(channel_name);
+    }
+  }
+  conn_deadline_enter(CONN_DEADLINE_NONE);
+  if (result == PROTOCOL_ERR_IO || result == PROTOCOL_ERR_EOF) {
+    return result;
+  }
+  if (result != PROTOCOL_OK || !message_store_mime_valid(mime)) {
+    fprintf(stderr, "protocol error: invalid binary message prefix\n");
+    result = PROTOCOL_ERR_INVALID_ARGUMENT;
+    goto SEND_READY_REJECT;
+  }
+  if (proto_header->payload_size < prefix_size) {
+    fprintf(stderr, "protocol error: payload size mismatch\n");
+    result = PROTOCOL_ERR_PAYLOAD_SIZE_MISMATCH;
+    goto SEND_READY_REJECT;
+  }
+  content_size = proto_header->payload_size - prefix_size;
+  if (content_size > HF_PROTOCOL_MAX_BINARY_MESSAGE_SIZE) {
+    fprintf(stderr, "protocol error: binary message too large\n");
+    result = PROTOCOL_ERR_MSG_TOO_LARGE;
+    goto SEND_READY_REJECT;
+  }
+  channel = message_store_channel(channel_name);
+  if (channel == NULL) {
+    fprintf(stderr, "protocol error: invalid channel\n");
+    result = PROTOCOL_ERR_INVALID_ARGUMENT;
+    goto SEND_READY_REJECT;
+  }
+
+  result = server_send_response(conn, PROTO_PHASE_READY, PROTO_STATUS_OK, PROTOCOL_OK);
+  if (result != PROTOCOL_OK) {
+    sock_perror("send_res_frame(binary_message_ready)");
+    message_store_channel_release(channel);
+    return result;
+  }
+
+  conn_deadline_enter(CONN_DEADLINE_BODY);
+  result = app_receive_binary_message(conn, ser_opt->path, channel, mime, content_size,
+                                      APP_UPLOAD_PROTOCOL);
+  conn_deadline_enter(CONN_DEADLINE_NONE);
+  message_store_channel_release(channel);
+  if (server_send_response(conn, PROTO_PHASE_FINAL,
+                           result == PROTOCOL_OK ? PROTO_STATUS_OK : PROTO_STATUS_FAILED,
+                           result) != PROTOCOL_OK) {
+    sock_perror("send_res_frame(binary_message_final)");
+    return PROTOCOL_ERR_IO;
+  }
+  return result;
+
+SEND_READY_REJECT:
+  if (server_send_response(conn, PROTO_PHASE_READY, PROTO_STATUS_REJECTED, result) !=
+      PROTOCOL_OK) {
+    sock_perror("send_res_frame(binary_message_ready_rejected)");
+  }
+  return result;
+}
+
+#define SERVER_LIST_BUF_SIZE (64u * 1024u)
+
+typedef struct {
+  socket_t conn;
+  const char *dir;
+  int hash;
+  int send_failed;
+  size_t len;
+  uint8_t buf[SERVER_LIST_BUF_SIZE];
+} server_list_ctx_t;
+
+static int server_list_flush(server_list_ctx_t *ctx) {
+  if (ctx->len > 0 && send_all(ctx->conn, ctx->buf, ctx->len) != (ssize_t)ctx->len) {
+    sock_perror("send(list_files)");
+    ctx->send_failed = 1;
+    return 1;
+  }
+  ctx->len = 0;
+  return 0;
+}
+
+static int server_list_visit(const char *relative_path, const fs_path_info_t *info,
+                             void *opaque) {
+  server_list_ctx_t *ctx = (server_list_ctx_t *)opaque;
+  size_t path_len = strlen(relative_path);
+  size_t entry_size = sizeof(uint16_t) + path_len + 2u * sizeof(uint64_t) +
+                      (ctx->hash ? SHA1_DIGEST_SIZE : 0u);
+  uint16_t net_len = htons((uint16_t)path_len);
+  uint8_t *p = NULL;
+
+  if (path_len > HF_PROTOCOL_MAX_PATH_LEN) {
+    return 0;
+  }
+  if (ctx->len + entry_size > sizeof(ctx->buf) && server_list_flush(ctx) != 0) {
+    return 1;
+  }
+  p = ctx->buf + ctx->len;
+
+  if (ctx->hash) {
+    char full_path[4096];
+    int fd = -1;
+    int rc = 0;
+
+    if (fs_join_relative_path(full_path, sizeof(full_path), ctx->dir, relative_path) != 0) {
+      return 0;
+    }
+#ifdef _WIN32
+    fd = fs_open(full_path, O_RDONLY | O_BINARY, 0);
+#else
+    fd = fs_open(full_path, O_RDONLY, 0);
+#endif
+    // Gone since the directory was read; the client will just send it again.
+    if (fd == -1) {
+      return 0;
+    }
+    rc = sha1_fd(fd, p + entry_size - SHA1_DIGEST_SIZE);
+    fs_close(fd);
+    if (rc != 0) {
+      perror("read(list_hash)");
+      return 1;
+    }
+  }
+
+  memcpy(p, &net_len, sizeof(net_len));
+  memcpy(p + sizeof(net_len), relative_path, path_len);
+  encode_u64_be(info->size, p + sizeof(net_len) + path_len);
+  encode_u64_be(info->mtime, p + sizeof(net_len) + path_len + sizeof(uint64_t));
+  ctx->len += entry_size;
+  return 0;
+}
+
+static protocol_result_t server_handle_list_files(
+  socket_t conn,
+  const server_opt_t *ser_opt,
+  const protocol_header_t *proto_header) {
+  char *dir_name = NULL;
+  char dir_path[4096];
+  fs_path_info_t info = {0};
+  server_list_ctx_t *ctx = NULL;
+  int exists = 0;
+  int walk_failed = 0;
+  protocol_result_t result = PROTOCOL_ERR_IO;
+
+  if (ser_opt == NULL) {
+    fprintf(stderr, "invalid list handler arguments\n");
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+
+  if (proto_header->payload_size < (uint64_t)proto_file_name_only_size(1)) {
+    fprintf(stderr, "protocol error: list payload size too small\n");
+    (void)server_send_response(
+      conn, PROTO_PHASE_READY, PROTO_STATUS_REJECTED, PROTOCOL_ERR_INVALID_ARGUMENT);
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+
+  result = proto_recv_file_name_only(conn, &dir_name);
+  conn_deadline_enter(CONN_DEADLINE_NONE);
+  if (result != PROTOCOL_OK) {
+    if (result == PROTOCOL_ERR_FILE_NAME_LEN) {
+      fprintf(stderr, "protocol error: invalid list directory length\n");
+    } else if (result == PROTOCOL_ERR_ALLOC) {
+      perror("malloc(dir_name)");
+    } else if (result == PROTOCOL_ERR_EOF) {
+      fprintf(stderr, "protocol error: unexpected EOF while receiving list request\n");
+    } else {
+      sock_perror("proto_recv_file_name_only");
+    }
+    goto SEND_READY_REJECT;
+  }
+
+  if (fs_join_relative_path(dir_path, sizeof(dir_path), ser_opt->path, dir_name) != 0) {
+    fprintf(stderr, "invalid list directory: %s\n", dir_name);
+    result = PROTOCOL_ERR_INVALID_FILE_NAME;
+    goto SEND_READY_REJECT;
+  }
+
+  if (proto_header->payload_size !=
+      (uint64_t)proto_file_name_only_size((uint16_t)strlen(dir_name))) {
+    fprintf(stderr, "protocol error: list payload size mismatch\n");
+    result = PROTOCOL_ERR_PAYLOAD_SIZE_MISMATCH;
+    goto SEND_READY_REJECT;
+  }
+
+  if (fs_stat_path(dir_path, &info) == 0) {
+    if (info.kind != FS_PATH_KIND_DIR) {
+      fprintf(stderr, "list target is not a directory: %s\n", dir_name);
+      result = PROTOCOL_ERR_INVALID_FILE_NAME;
+      goto SEND_READY_REJECT;
+    }
+    exists = 1;
+  }
+
+  ctx = (server_list_ctx_t *)calloc(1, sizeof(*ctx));
+  if (ctx == NULL) {
+    perror("calloc(list_ctx)");
+    result = PROTOCOL_ERR_ALLOC;
+    goto SEND_READY_REJECT;
+  }
+  ctx->conn = conn;
+  ctx->dir = dir_path;
+  ctx->hash = proto_header->flags == HF_MSG_FLAG_HASH;
+
+  result = server_send_response(conn, PROTO_PHASE_READY, PROTO_STATUS_OK, PROTOCOL_OK);
+  if (result != PROTOCOL_OK) {
+    sock_perror("send_res_frame(list_ready)");
+    goto CLEANUP;
+  }
+
+  if (exists && fs_walk_files(dir_path, server_list_visit, ctx) != 0) {
+    if (ctx->send_failed) {
+      result = PROTOCOL_ERR_IO;
+      goto CLEANUP;
+    }
+    perror("list_files");
+    walk_failed = 1;
+  }
+
+  // The empty path that ends the listing.
+  if (ctx->len + sizeof(uint16_t) > sizeof(ctx->buf) && server_list_flush(ctx) != 0) {
+    result = PROTOCOL_ERR_IO;
+    goto CLEANUP;
+  }
+  memset(ctx->buf + ctx->len, 0, sizeof(uint16_t));
+  ctx->len += sizeof(uint16_t);
+  if (server_list_flush(ctx) != 0) {
+    result = PROTOCOL_ERR_IO;
+    goto CLEANUP;
+  }
+
+  result = walk_failed ? PROTOCOL_ERR_IO : PROTOCOL_OK;
+  if (server_send_response(conn, PROTO_PHASE_FINAL,
+                           walk_failed ? PROTO_STATUS_FAILED : PROTO_STATUS_OK,
+                           result) != PROTOCOL_OK) {
+    sock_perror("send_res_frame(list_final)");
+    result = PROTOCOL_ERR_IO;
+  }
+  goto CLEANUP;
+
+SEND_READY_REJECT:
+  if (server_send_response(
+        conn, PROTO_PHASE_READY, PROTO_STATUS_REJECTED, result) != PROTOCOL_OK) {
+    sock_perror("send_res_frame(list_ready_rejected)");
+  }
+
+CLEANUP:
+  free(ctx);
+  if (dir_name != NULL) free(dir_name);
+  return result;
+}
+
 static protocol_result_t server_handle_get_file(
   socket_t conn,
   const server_opt_t *ser_opt,
@@ -511,6 +897,7 @@ static protocol_result_t server_handle_get_file(
   }
 
   result = proto_recv_file_name_only(conn, &file_name);
+  conn_deadline_enter(CONN_DEADLINE_NONE);
   if (result != PROTOCOL_OK) {
     if (result == PROTOCOL_ERR_FILE_NAME_LEN) {
       fprintf(stderr, "protocol error: invalid get file name length\n");
@@ -577,8 +964,7 @@ static protocol_result_t server_handle_get_file(
   }
 
   {
-    net_send_file_result_t send_res = net_send_file_best_effort(conn, download.fd,
-                                                                download.info.size);
+    net_send_file_result_t send_res = app_send_download(conn, &download);
     if (send_res != NET_SEND_FILE_OK) {
       result = PROTOCOL_ERR_IO;
       goto SEND_FINAL_FAILED;
@@ -1008,11 +1394,42 @@ static int server_run_process(const server_opt_t *ser_opt,
     exit_code = 1;
     goto CLEAN_UP;
   }
+  if (ser_opt->message_log_path != NULL &&
+      message_store_open_log(ser_opt->message_log_path) != 0) {
+    fprintf(stderr, "failed to open message log\n");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  if (upload_session_init() != 0) {
+    fprintf(stderr, "failed to initialize upload sessions\n");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  if (webui_init() != 0) {
+    fprintf(stderr, "failed to prepare web ui assets\n");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
   if (server_conn_tracker_init() != 0) {
     fprintf(stderr, "failed to initialize connection tracker\n");
     exit_code = 1;
     goto CLEAN_UP;
   }
+  if (sse_hub_start() != 0) {
+    fprintf(stderr, "failed to start event stream hub\n");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  if (conn_deadline_start() != 0) {
+    fprintf(stderr, "failed to start connection deadline timer\n");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
+  if (app_services_start(ser_opt) != 0) {
+    fprintf(stderr, "failed to start file index\n");
+    exit_code = 1;
+    goto CLEAN_UP;
+  }
 
   socket_t sock;
   socket_init(&sock);
@@ -1060,6 +1477,7 @@ CLOSE_SOCK:
   server_join_state_watcher(&state_watcher_thread, state_watcher_ctx);
   state_watcher_ctx = NULL;
   message_store_shutdown();
+  sse_hub_stop();
 
   socket_close(sock);
   server_conn_tracker_shutdown_all();
@@ -1072,8 +1490,13 @@ CLEAN_UP:
   if (daemon_mode) {
     daemon_state_cleanup_files();
   }
+  upload_session_cleanup();
+  app_services_stop();
+  sse_hub_stop();
   message_store_cleanup();
+  conn_deadline_stop();
   server_conn_tracker_cleanup();
+  webui_cleanup();
   return exit_code;
 }
 
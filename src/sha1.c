@@ -0,0 +1,137 @@
+#include "sha1.h"
+
+#include "fs.h"
+
+#include <string.h>
+
+static uint32_t sha1_rol(uint32_t v, unsigned n) {
+  return (v << n) | (v >> (32u - n));
+}
+
+static void sha1_block(uint32_t h[5], const unsigned char *p) {
+  uint32_t w[80];
+  uint32_t a = h[0];
+  uint32_t b = h[1];
+  uint32_t c = h[2];
+  uint32_t d = h[3];
+  uint32_t e = h[4];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16) |
+           ((uint32_t)p[4 * i + 2] << 8) | (uint32_t)p[4 * i + 3];
+  }
+  for (int i = 16; i < 80; i++) {
+    w[i] = sha1_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  for (int i = 0; i < 80; i++) {
+    uint32_t f = 0;
+    uint32_t k = 0;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999u;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1u;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDCu;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6u;
+    }
+    uint32_t t = sha1_rol(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = sha1_rol(b, 30);
+    b = a;
+    a = t;
+  }
+
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+}
+
+void sha1_init(sha1_ctx_t *ctx) {
+  ctx->h[0] = 0x67452301u;
+  ctx->h[1] = 0xEFCDAB89u;
+  ctx->h[2] = 0x98BADCFEu;
+  ctx->h[3] = 0x10325476u;
+  ctx->h[4] = 0xC3D2E1F0u;
+  ctx->len = 0;
+  ctx->buf_len = 0;
+}
+
+void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char *)data;
+
+  ctx->len += len;
+  if (ctx->buf_len > 0) {
+    size_t take = 64u - ctx->buf_len < len ? 64u - ctx->buf_len : len;
+    memcpy(ctx->buf + ctx->buf_len, p, take);
+    ctx->buf_len += take;
+    p += take;
+    len -= take;
+    if (ctx->buf_len < 64u) {
+      return;
+    }
+    sha1_block(ctx->h, ctx->buf);
+    ctx->buf_len = 0;
+  }
+  for (; len >= 64u; p += 64u, len -= 64u) {
+    sha1_block(ctx->h, p);
+  }
+  memcpy(ctx->buf, p, len);
+  ctx->buf_len = len;
+}
+
+void sha1_final(sha1_ctx_t *ctx, uint8_t out[SHA1_DIGEST_SIZE]) {
+  unsigned char tail[128];
+  size_t tail_len = ctx->buf_len < 56u ? 64u : 128u;
+  uint64_t bits = ctx->len * 8u;
+
+  memset(tail, 0, sizeof(tail));
+  memcpy(tail, ctx->buf, ctx->buf_len);
+  tail[ctx->buf_len] = 0x80u;
+  for (int i = 0; i < 8; i++) {
+    tail[tail_len - 1u - (size_t)i] = (unsigned char)(bits >> (8 * i));
+  }
+  sha1_block(ctx->h, tail);
+  if (tail_len == 128u) {
+    sha1_block(ctx->h, tail + 64);
+  }
+
+  for (int i = 0; i < 5; i++) {
+    out[4 * i] = (uint8_t)(ctx->h[i] >> 24);
+    out[4 * i + 1] = (uint8_t)(ctx->h[i] >> 16);
+    out[4 * i + 2] = (uint8_t)(ctx->h[i] >> 8);
+    out[4 * i + 3] = (uint8_t)ctx->h[i];
+  }
+}
+
+void sha1_digest(const void *data, size_t len, uint8_t out[SHA1_DIGEST_SIZE]) {
+  sha1_ctx_t ctx;
+
+  sha1_init(&ctx);
+  sha1_update(&ctx, data, len);
+  sha1_final(&ctx, out);
+}
+
+int sha1_fd(int fd, uint8_t out[SHA1_DIGEST_SIZE]) {
+  unsigned char buf[64u * 1024u];
+  sha1_ctx_t ctx;
+  ssize_t n = 0;
+
+  sha1_init(&ctx);
+  while ((n = fs_read(fd, buf, sizeof(buf))) > 0) {
+    sha1_update(&ctx, buf, (size_t)n);
+  }
+  if (n < 0) {
+    return 1;
+  }
+  sha1_final(&ctx, out);
+  return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef HF_SHA1_H
+#define HF_SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA1_DIGEST_SIZE 20u
+
+// Used for the WebSocket handshake, which mandates SHA-1, and by sync to spot
+// changed content; not for anything that needs collision resistance.
+typedef struct {
+  uint32_t h[5];
+  uint64_t len;
+  unsigned char buf[64];
+  size_t buf_len;
+} sha1_ctx_t;
+
+void sha1_init(sha1_ctx_t *ctx);
+void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len);
+void sha1_final(sha1_ctx_t *ctx, uint8_t out[SHA1_DIGEST_SIZE]);
+void sha1_digest(const void *data, size_t len, uint8_t out[SHA1_DIGEST_SIZE]);
+// Hashes fd from its current offset to the end.
+int sha1_fd(int fd, uint8_t out[SHA1_DIGEST_SIZE]);
+
+#endif  // HF_SHA1_H
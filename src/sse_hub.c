@@ -0,0 +1,791 @@
+#include "sse_hub.h"
+
+#include "message_store.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <process.h>
+  #include <windows.h>
+#else
+  #include <poll.h>
+  #include <pthread.h>
+  #include <time.h>
+#endif
+
+#define SSE_HUB_KEEPALIVE_MS 15000u
+#define SSE_HUB_STALL_TIMEOUT_MS 30000u
+#define SSE_HUB_STALL_CHECK_MS 1000u
+
+#ifdef _WIN32
+typedef WSAPOLLFD sse_hub_pollfd_t;
+  #define sse_hub_poll WSAPoll
+#else
+typedef struct pollfd sse_hub_pollfd_t;
+  #define sse_hub_poll poll
+#endif
+
+// Events are created and released on the hub thread only, so the reference
+// count needs no atomics.
+typedef struct {
+  size_t refs;
+  uint64_t version;  // newest message carried, 0 for comments
+  size_t len;
+  char data[];
+} sse_hub_event_t;
+
+// One per channel that has subscribers. Its store listener only marks it
+// dirty, so a message refreshes that channel and reaches its subscribers
+// alone.
+typedef struct {
+  message_store_channel_t *channel;
+  message_store_listener_t listener;
+  sse_hub_event_t *latest;
+  uint64_t version;
+  size_t subscribers;
+  int dirty;    // under the hub lock
+  int refresh;  // hub thread only
+} sse_hub_channel_t;
+
+typedef struct {
+  socket_t sock;
+  sse_hub_channel_t *channel;
+  sse_hub_event_t *current;  // partially written
+  size_t offset;
+  sse_hub_event_t *queued;   // newest event behind current; replaced, never chained
+  uint64_t version;          // newest message handed to this subscriber
+  uint64_t stalled_since_ms;
+} sse_hub_subscriber_t;
+
+typedef struct {
+  socket_t sock;
+  message_store_channel_t *channel;
+  int catch_up;
+  uint64_t since;
+} sse_hub_pending_t;
+
+typedef struct {
+  int initialized;
+  int stopping;
+  net_waker_t waker;
+  sse_hub_pending_t *pending;
+  size_t pending_count;
+  size_t pending_cap;
+#ifdef _WIN32
+  CRITICAL_SECTION mutex;
+  HANDLE thread;
+#else
+  pthread_mutex_t mutex;
+  pthread_t thread;
+#endif
+} sse_hub_state_t;
+
+// Owned by the hub thread.
+typedef struct {
+  sse_hub_subscriber_t *subs;
+  size_t count;
+  size_t cap;
+  sse_hub_pollfd_t *pfds;
+  sse_hub_channel_t **channels;
+  size_t channel_count;
+  size_t channel_cap;
+  sse_hub_event_t *keepalive;
+} sse_hub_loop_t;
+
+static sse_hub_state_t g_sse_hub = {0};
+
+static void sse_hub_lock(void) {
+#ifdef _WIN32
+  EnterCriticalSection(&g_sse_hub.mutex);
+#else
+  (void)pthread_mutex_lock(&g_sse_hub.mutex);
+#endif
+}
+
+static void sse_hub_unlock(void) {
+#ifdef _WIN32
+  LeaveCriticalSection(&g_sse_hub.mutex);
+#else
+  (void)pthread_mutex_unlock(&g_sse_hub.mutex);
+#endif
+}
+
+static uint64_t sse_hub_now_ms(void) {
+#ifdef _WIN32
+  return (uint64_t)GetTickCount64();
+#else
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+#endif
+}
+
+static sse_hub_event_t *sse_hub_event_new(size_t cap) {
+  sse_hub_event_t *event = (sse_hub_event_t *)malloc(sizeof(*event) + cap);
+  if (event == NULL) {
+    return NULL;
+  }
+  event->refs = 1;
+  event->version = 0;
+  event->len = 0;
+  return event;
+}
+
+static sse_hub_event_t *sse_hub_event_ref(sse_hub_event_t *event) {
+  if (event != NULL) {
+    event->refs++;
+  }
+  return event;
+}
+
+static void sse_hub_event_unref(sse_hub_event_t *event) {
+  if (event != NULL && --event->refs == 0) {
+    free(event);
+  }
+}
+
+static void sse_hub_event_append(sse_hub_event_t *event, const char *data, size_t len) {
+  memcpy(event->data + event->len, data, len);
+  event->len += len;
+}
+
+// Every line of the message becomes its own "data:" field; the version is the
+// event id, so a reconnecting EventSource reports it as Last-Event-ID.
+// A valid MIME type has no quotes, backslashes or control characters, so it
+// goes into the JSON as is.
+static sse_hub_event_t *sse_hub_binary_event(const message_store_blob_t *blob) {
+  char text[MESSAGE_STORE_MIME_MAX + 128u];
+  sse_hub_event_t *event = NULL;
+  int n = snprintf(text, sizeof(text),
+                   "id: %" PRIu64 "\nevent: binary\ndata: {\"mime\":\"%s\",\"size\":%" PRIu64
+                   "}\n\n",
+                   blob->version, blob->mime, blob->size);
+
+  if (n < 0 || (size_t)n >= sizeof(text)) {
+    return NULL;
+  }
+  event = sse_hub_event_new((size_t)n);
+  if (event == NULL) {
+    return NULL;
+  }
+  event->version = blob->version;
+  sse_hub_event_append(event, text, (size_t)n);
+  return event;
+}
+
+static sse_hub_event_t *sse_hub_message_event(const message_store_blob_t *blob) {
+  static const char next_line[] = "\ndata: ";
+  char head[64];
+  int head_len = snprintf(head, sizeof(head), "id: %" PRIu64 "\nevent: message\ndata: ",
+                          blob->version);
+  const char *message = blob->text;
+  size_t message_len = blob->len;
+  const char *message_end = message + message_len;
+  size_t lines = 1;
+  sse_hub_event_t *event = NULL;
+
+  if (blob->mime != NULL) {
+    return sse_hub_binary_event(blob);
+  }
+  for (const char *p = message;
+       (p = memchr(p, '\n', (size_t)(message_end - p))) != NULL; p++) {
+    lines++;
+  }
+  if (head_len < 0 || (size_t)head_len >= sizeof(head)) {
+    return NULL;
+  }
+  event = sse_hub_event_new((size_t)head_len + message_len +
+                            (lines - 1u) * (sizeof(next_line) - 2u) + 2u);
+  if (event == NULL) {
+    return NULL;
+  }
+
+  event->version = blob->version;
+  sse_hub_event_append(event, head, (size_t)head_len);
+  for (const char *line = message;;) {
+    const char *end = memchr(line, '\n', (size_t)(message_end - line));
+    if (end == NULL) {
+      sse_hub_event_append(event, line, (size_t)(message_end - line));
+      break;
+    }
+    sse_hub_event_append(event, line, (size_t)(end - line));
+    sse_hub_event_append(event, next_line, sizeof(next_line) - 1u);
+    line = end + 1;
+  }
+  sse_hub_event_append(event, "\n\n", 2u);
+  return event;
+}
+
+static void sse_hub_enqueue(sse_hub_subscriber_t *sub, sse_hub_event_t *event) {
+  if (event->version != 0) {
+    // Already covered by this subscriber's catch-up.
+    if (event->version <= sub->version) {
+      return;
+    }
+    sub->version = event->version;
+  }
+  if (sub->current == NULL) {
+    sub->current = sse_hub_event_ref(event);
+    sub->offset = 0;
+    return;
+  }
+  // Only the latest message matters, so a backlog collapses to one event.
+  sse_hub_event_unref(sub->queued);
+  sub->queued = sse_hub_event_ref(event);
+}
+
+static int sse_hub_flush(sse_hub_subscriber_t *sub, uint64_t now_ms) {
+  while (sub->current != NULL) {
+    ssize_t n = net_send_nonblocking(sub->sock, sub->current->data + sub->offset,
+                                     sub->current->len - sub->offset);
+    if (n < 0) {
+      return 1;
+    }
+    if (n == 0) {
+      if (sub->stalled_since_ms == 0) {
+        sub->stalled_since_ms = now_ms;
+      }
+      return 0;
+    }
+    sub->stalled_since_ms = 0;
+    sub->offset += (size_t)n;
+    if (sub->offset == sub->current->len) {
+      sse_hub_event_unref(sub->current);
+      sub->current = sub->queued;
+      sub->queued = NULL;
+      sub->offset = 0;
+    }
+  }
+  sub->stalled_since_ms = 0;
+  return 0;
+}
+
+// Channels are only released by sse_hub_sweep_channels, so one can never
+// disappear while its message is being published.
+static void sse_hub_drop(sse_hub_loop_t *loop, size_t index) {
+  sse_hub_subscriber_t *sub = &loop->subs[index];
+
+  sub->channel->subscribers--;
+  socket_close(sub->sock);
+  sse_hub_event_unref(sub->current);
+  sse_hub_event_unref(sub->queued);
+  loop->subs[index] = loop->subs[--loop->count];
+}
+
+// Joins every held message newer than since into one event. Returns 1 when
+// the catch-up cannot be served, e.g. since comes from an earlier daemon run,
+// and the caller should fall back to the latest message.
+static int sse_hub_catch_up(message_store_channel_t *channel, uint64_t since,
+                            sse_hub_event_t **event_out) {
+  message_store_history_t history;
+  sse_hub_event_t **parts = NULL;
+  sse_hub_event_t *event = NULL;
+  size_t total = 0;
+  int exit_code = 1;
+
+  *event_out = NULL;
+  if (message_store_get_since(channel, since, MESSAGE_STORE_HISTORY, &history) != 0) {
+    return 1;
+  }
+  if (since > history.latest_version) {
+    goto CLEANUP;
+  }
+  if (history.count == 0) {
+    exit_code = 0;
+    goto CLEANUP;
+  }
+
+  parts = (sse_hub_event_t **)calloc(history.count, sizeof(*parts));
+  if (parts == NULL) {
+    goto CLEANUP;
+  }
+  for (size_t i = 0; i < history.count; i++) {
+    parts[i] = sse_hub_message_event(history.messages[i]);
+    if (parts[i] == NULL) {
+      goto CLEANUP;
+    }
+    total += parts[i]->len;
+  }
+  event = sse_hub_event_new(total);
+  if (event == NULL) {
+    goto CLEANUP;
+  }
+  for (size_t i = 0; i < history.count; i++) {
+    sse_hub_event_append(event, parts[i]->data, parts[i]->len);
+  }
+  event->version = history.messages[history.count - 1u]->version;
+  *event_out = event;
+  exit_code = 0;
+
+CLEANUP:
+  if (parts != NULL) {
+    for (size_t i = 0; i < history.count; i++) {
+      sse_hub_event_unref(parts[i]);
+    }
+    free(parts);
+  }
+  message_store_history_release(&history);
+  return exit_code;
+}
+
+static void sse_hub_channel_notify(void *ctx) {
+  sse_hub_lock();
+  ((sse_hub_channel_t *)ctx)->dirty = 1;
+  sse_hub_unlock();
+  net_waker_signal(&g_sse_hub.waker);
+}
+
+static sse_hub_channel_t *sse_hub_channel_for(sse_hub_loop_t *loop,
+                                              message_store_channel_t *channel) {
+  sse_hub_channel_t *hub_channel = NULL;
+  message_store_blob_t *blob = NULL;
+
+  for (size_t i = 0; i < loop->channel_count; i++) {
+    if (loop->channels[i]->channel == channel) {
+      return loop->channels[i];
+    }
+  }
+  if (loop->channel_count == loop->channel_cap) {
+    size_t cap = loop->channel_cap == 0 ? 16u : loop->channel_cap * 2u;
+    sse_hub_channel_t **channels =
+      (sse_hub_channel_t **)realloc(loop->channels, cap * sizeof(*channels));
+    if (channels == NULL) {
+      return NULL;
+    }
+    loop->channels = channels;
+    loop->channel_cap = cap;
+  }
+  hub_channel = (sse_hub_channel_t *)calloc(1, sizeof(*hub_channel));
+  if (hub_channel == NULL) {
+    return NULL;
+  }
+
+  // Listen first, so a message landing before the snapshot still marks the
+  // channel dirty and is picked up by the next refresh.
+  hub_channel->channel = message_store_channel_ref(channel);
+  hub_channel->listener.notify = sse_hub_channel_notify;
+  hub_channel->listener.ctx = hub_channel;
+  message_store_add_listener(channel, &hub_channel->listener);
+  if (message_store_get_snapshot(channel, &blob, &hub_channel->version) == 0 &&
+      blob != NULL) {
+    hub_channel->latest = sse_hub_message_event(blob);
+    if (hub_channel->latest == NULL) {
+      hub_channel->version = blob->version - 1u;
+    }
+    message_store_unref(blob);
+  }
+  loop->channels[loop->channel_count++] = hub_channel;
+  return hub_channel;
+}
+
+static void sse_hub_channel_free(sse_hub_channel_t *hub_channel) {
+  message_store_remove_listener(hub_channel->channel, &hub_channel->listener);
+  message_store_channel_release(hub_channel->channel);
+  sse_hub_event_unref(hub_channel->latest);
+  free(hub_channel);
+}
+
+static void sse_hub_sweep_channels(sse_hub_loop_t *loop) {
+  size_t i = 0;
+
+  while (i < loop->channel_count) {
+    if (loop->channels[i]->subscribers == 0) {
+      sse_hub_channel_free(loop->channels[i]);
+      loop->channels[i] = loop->channels[--loop->channel_count];
+      continue;
+    }
+    i++;
+  }
+}
+
+static int sse_hub_add(sse_hub_loop_t *loop, const sse_hub_pending_t *pending,
+                       uint64_t now_ms) {
+  sse_hub_subscriber_t *sub = NULL;
+  sse_hub_channel_t *hub_channel = NULL;
+  sse_hub_event_t *catch_up = NULL;
+  int caught_up = 0;
+
+  hub_channel = sse_hub_channel_for(loop, pending->channel);
+  if (hub_channel == NULL) {
+    return 1;
+  }
+  if (loop->count == loop->cap) {
+    size_t cap = loop->cap == 0 ? 16u : loop->cap * 2u;
+    sse_hub_subscriber_t *subs =
+      (sse_hub_subscriber_t *)realloc(loop->subs, cap * sizeof(*subs));
+    if (subs == NULL) {
+      return 1;
+    }
+    loop->subs = subs;
+    sse_hub_pollfd_t *pfds =
+      (sse_hub_pollfd_t *)realloc(loop->pfds, (cap + 1u) * sizeof(*pfds));
+    if (pfds == NULL) {
+      return 1;
+    }
+    loop->pfds = pfds;
+    loop->cap = cap;
+  }
+
+  sub = &loop->subs[loop->count++];
+  memset(sub, 0, sizeof(*sub));
+  sub->sock = pending->sock;
+  sub->channel = hub_channel;
+  hub_channel->subscribers++;
+  if (pending->catch_up &&
+      sse_hub_catch_up(pending->channel, pending->since, &catch_up) == 0) {
+    sub->version = pending->since;
+    caught_up = 1;
+    if (catch_up != NULL) {
+      sse_hub_enqueue(sub, catch_up);
+      sse_hub_event_unref(catch_up);
+    }
+  }
+  if (!caught_up && hub_channel->latest != NULL) {
+    sse_hub_enqueue(sub, hub_channel->latest);
+  }
+  if (sub->current != NULL && sse_hub_flush(sub, now_ms) != 0) {
+    sse_hub_drop(loop, loop->count - 1u);
+  }
+  return 0;
+}
+
+static void sse_hub_publish(sse_hub_loop_t *loop, const sse_hub_channel_t *hub_channel,
+                            sse_hub_event_t *event, uint64_t now_ms) {
+  size_t i = 0;
+
+  while (i < loop->count) {
+    if (loop->subs[i].channel != hub_channel) {
+      i++;
+      continue;
+    }
+    sse_hub_enqueue(&loop->subs[i], event);
+    if (sse_hub_flush(&loop->subs[i], now_ms) != 0) {
+      sse_hub_drop(loop, i);
+      continue;
+    }
+    i++;
+  }
+}
+
+// Publishes every message that arrived on a channel since its last refresh,
+// in order.
+static void sse_hub_refresh_channel(sse_hub_loop_t *loop, sse_hub_channel_t *hub_channel,
+                                    uint64_t now_ms) {
+  message_store_history_t history;
+
+  if (message_store_get_since(hub_channel->channel, hub_channel->version,
+                              MESSAGE_STORE_HISTORY, &history) != 0) {
+    return;
+  }
+  for (size_t i = 0; i < history.count; i++) {
+    sse_hub_event_t *event = sse_hub_message_event(history.messages[i]);
+    if (event == NULL) {
+      break;
+    }
+    hub_channel->version = event->version;
+    sse_hub_event_unref(hub_channel->latest);
+    hub_channel->latest = event;
+    sse_hub_publish(loop, hub_channel, event, now_ms);
+  }
+  message_store_history_release(&history);
+}
+
+static void sse_hub_refresh(sse_hub_loop_t *loop, uint64_t now_ms) {
+  sse_hub_lock();
+  for (size_t i = 0; i < loop->channel_count; i++) {
+    loop->channels[i]->refresh = loop->channels[i]->dirty;
+    loop->channels[i]->dirty = 0;
+  }
+  sse_hub_unlock();
+
+  for (size_t i = 0; i < loop->channel_count; i++) {
+    if (loop->channels[i]->refresh) {
+      sse_hub_refresh_channel(loop, loop->channels[i], now_ms);
+    }
+  }
+}
+
+// Idle subscribers get a comment so proxies keep the stream open; busy ones
+// are already receiving bytes.
+static void sse_hub_send_keepalives(sse_hub_loop_t *loop, uint64_t now_ms) {
+  size_t i = 0;
+
+  while (i < loop->count) {
+    sse_hub_subscriber_t *sub = &loop->subs[i];
+    if (sub->current == NULL) {
+      sse_hub_enqueue(sub, loop->keepalive);
+      if (sse_hub_flush(sub, now_ms) != 0) {
+        sse_hub_drop(loop, i);
+        continue;
+      }
+    }
+    i++;
+  }
+}
+
+// Subscribers never send anything meaningful; reading only detects hangups.
+static int sse_hub_peer_closed(socket_t sock) {
+  char buf[256];
+#ifdef _WIN32
+  int n = recv(sock, buf, (int)sizeof(buf), 0);
+  if (n == SOCKET_ERROR) {
+    return WSAGetLastError() != WSAEWOULDBLOCK;
+  }
+#else
+  ssize_t n = recv(sock, buf, sizeof(buf), 0);
+  if (n < 0) {
+    return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+  }
+#endif
+  return n == 0;
+}
+
+static int sse_hub_take_pending(sse_hub_loop_t *loop, uint64_t now_ms) {
+  sse_hub_pending_t *pending = NULL;
+  size_t count = 0;
+  int stopping = 0;
+
+  sse_hub_lock();
+  stopping = g_sse_hub.stopping;
+  pending = g_sse_hub.pending;
+  count = g_sse_hub.pending_count;
+  g_sse_hub.pending = NULL;
+  g_sse_hub.pending_count = 0;
+  g_sse_hub.pending_cap = 0;
+  sse_hub_unlock();
+
+  for (size_t i = 0; i < count; i++) {
+    if (stopping || sse_hub_add(loop, &pending[i], now_ms) != 0) {
+      socket_close(pending[i].sock);
+    }
+    message_store_channel_release(pending[i].channel);
+  }
+  free(pending);
+  return stopping;
+}
+
+static void sse_hub_run(sse_hub_loop_t *loop) {
+  uint64_t next_keepalive_ms = sse_hub_now_ms() + SSE_HUB_KEEPALIVE_MS;
+
+  for (;;) {
+    uint64_t now_ms = sse_hub_now_ms();
+    uint64_t timeout_ms = 0;
+    int writing = 0;
+    int rc = 0;
+
+    if (sse_hub_take_pending(loop, now_ms)) {
+      return;
+    }
+
+    loop->pfds[0].fd = net_waker_handle(&g_sse_hub.waker);
+    loop->pfds[0].events = POLLIN;
+    loop->pfds[0].revents = 0;
+    for (size_t i = 0; i < loop->count; i++) {
+      loop->pfds[i + 1u].fd = loop->subs[i].sock;
+      loop->pfds[i + 1u].events = POLLIN;
+      if (loop->subs[i].current != NULL) {
+        loop->pfds[i + 1u].events |= POLLOUT;
+        writing = 1;
+      }
+      loop->pfds[i + 1u].revents = 0;
+    }
+
+    timeout_ms = next_keepalive_ms > now_ms ? next_keepalive_ms - now_ms : 0;
+    if (writing && timeout_ms > SSE_HUB_STALL_CHECK_MS) {
+      timeout_ms = SSE_HUB_STALL_CHECK_MS;
+    }
+    rc = sse_hub_poll(loop->pfds, (unsigned long)(loop->count + 1u), (int)timeout_ms);
+    if (rc < 0) {
+#ifdef _WIN32
+      if (WSAGetLastError() != WSAEINTR) {
+#else
+      if (errno != EINTR) {
+#endif
+        fprintf(stderr, "sse hub poll failed\n");
+        return;
+      }
+      continue;
+    }
+
+    now_ms = sse_hub_now_ms();
+    // Walk backwards so dropping (swap with the last entry) keeps the
+    // pollfd indices of unvisited subscribers valid.
+    for (size_t i = loop->count; i-- > 0;) {
+      sse_hub_subscriber_t *sub = &loop->subs[i];
+      short revents = loop->pfds[i + 1u].revents;
+      int drop = 0;
+
+      if ((revents & (POLLERR | POLLHUP | POLLNVAL)) != 0) {
+        drop = 1;
+      } else if ((revents & POLLIN) != 0 && sse_hub_peer_closed(sub->sock)) {
+        drop = 1;
+      } else if ((revents & POLLOUT) != 0 && sse_hub_flush(sub, now_ms) != 0) {
+        drop = 1;
+      } else if (sub->stalled_since_ms != 0 &&
+                 now_ms - sub->stalled_since_ms >= SSE_HUB_STALL_TIMEOUT_MS) {
+        drop = 1;
+      }
+      if (drop) {
+        sse_hub_drop(loop, i);
+      }
+    }
+
+    if ((loop->pfds[0].revents & POLLIN) != 0) {
+      net_waker_drain(&g_sse_hub.waker);
+      sse_hub_refresh(loop, now_ms);
+    }
+    if (now_ms >= next_keepalive_ms) {
+      sse_hub_send_keepalives(loop, now_ms);
+      next_keepalive_ms = now_ms + SSE_HUB_KEEPALIVE_MS;
+    }
+    sse_hub_sweep_channels(loop);
+  }
+}
+
+#ifdef _WIN32
+static unsigned __stdcall sse_hub_thread_main(void *arg) {
+#else
+static void *sse_hub_thread_main(void *arg) {
+#endif
+  static const char keepalive[] = ": keep-alive\n\n";
+  sse_hub_loop_t loop = {0};
+
+  (void)arg;
+  loop.keepalive = sse_hub_event_new(sizeof(keepalive) - 1u);
+  loop.pfds = (sse_hub_pollfd_t *)malloc(sizeof(*loop.pfds));
+  if (loop.keepalive != NULL && loop.pfds != NULL) {
+    sse_hub_event_append(loop.keepalive, keepalive, sizeof(keepalive) - 1u);
+    sse_hub_run(&loop);
+  }
+
+  while (loop.count > 0) {
+    sse_hub_drop(&loop, loop.count - 1u);
+  }
+  sse_hub_sweep_channels(&loop);
+  sse_hub_event_unref(loop.keepalive);
+  free(loop.channels);
+  free(loop.subs);
+  free(loop.pfds);
+
+  // Late subscribers are refused once stopping is set; close any stragglers.
+  sse_hub_lock();
+  g_sse_hub.stopping = 1;
+  sse_hub_unlock();
+  (void)sse_hub_take_pending(&loop, 0);
+
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+int sse_hub_start(void) {
+  if (g_sse_hub.initialized) {
+    return 1;
+  }
+
+  memset(&g_sse_hub, 0, sizeof(g_sse_hub));
+  if (net_waker_open(&g_sse_hub.waker) != 0) {
+    return 1;
+  }
+
+#ifdef _WIN32
+  InitializeCriticalSection(&g_sse_hub.mutex);
+  {
+    uintptr_t handle = _beginthreadex(NULL, 0, sse_hub_thread_main, NULL, 0, NULL);
+    if (handle == 0) {
+      fprintf(stderr, "_beginthreadex(sse_hub) failed\n");
+      DeleteCriticalSection(&g_sse_hub.mutex);
+      net_waker_close(&g_sse_hub.waker);
+      return 1;
+    }
+    g_sse_hub.thread = (HANDLE)handle;
+  }
+#else
+  if (pthread_mutex_init(&g_sse_hub.mutex, NULL) != 0) {
+    net_waker_close(&g_sse_hub.waker);
+    return 1;
+  }
+  {
+    int err = pthread_create(&g_sse_hub.thread, NULL, sse_hub_thread_main, NULL);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create(sse_hub): %s\n", strerror(err));
+      (void)pthread_mutex_destroy(&g_sse_hub.mutex);
+      net_waker_close(&g_sse_hub.waker);
+      return 1;
+    }
+  }
+#endif
+
+  g_sse_hub.initialized = 1;
+  return 0;
+}
+
+void sse_hub_stop(void) {
+  if (!g_sse_hub.initialized) {
+    return;
+  }
+
+  sse_hub_lock();
+  g_sse_hub.stopping = 1;
+  sse_hub_unlock();
+  net_waker_signal(&g_sse_hub.waker);
+
+#ifdef _WIN32
+  (void)WaitForSingleObject(g_sse_hub.thread, INFINITE);
+  CloseHandle(g_sse_hub.thread);
+  DeleteCriticalSection(&g_sse_hub.mutex);
+#else
+  (void)pthread_join(g_sse_hub.thread, NULL);
+  (void)pthread_mutex_destroy(&g_sse_hub.mutex);
+#endif
+  net_waker_close(&g_sse_hub.waker);
+  g_sse_hub.initialized = 0;
+}
+
+int sse_hub_subscribe(socket_t conn, message_store_channel_t *channel,
+                      const uint64_t *since) {
+  int exit_code = 1;
+
+  if (!g_sse_hub.initialized || channel == NULL || net_set_nonblocking(conn) != 0) {
+    return 1;
+  }
+
+  // The pending entry holds its own reference, taken outside the hub lock
+  // because store listeners take that lock under a channel's.
+  (void)message_store_channel_ref(channel);
+  sse_hub_lock();
+  if (g_sse_hub.stopping) {
+    goto UNLOCK;
+  }
+  if (g_sse_hub.pending_count == g_sse_hub.pending_cap) {
+    size_t cap = g_sse_hub.pending_cap == 0 ? 16u : g_sse_hub.pending_cap * 2u;
+    sse_hub_pending_t *pending =
+      (sse_hub_pending_t *)realloc(g_sse_hub.pending, cap * sizeof(*pending));
+    if (pending == NULL) {
+      goto UNLOCK;
+    }
+    g_sse_hub.pending = pending;
+    g_sse_hub.pending_cap = cap;
+  }
+  g_sse_hub.pending[g_sse_hub.pending_count].sock = conn;
+  g_sse_hub.pending[g_sse_hub.pending_count].channel = channel;
+  g_sse_hub.pending[g_sse_hub.pending_count].catch_up = since != NULL;
+  g_sse_hub.pending[g_sse_hub.pending_count].since = since != NULL ? *since : 0;
+  g_sse_hub.pending_count++;
+  exit_code = 0;
+
+UNLOCK:
+  sse_hub_unlock();
+  if (exit_code == 0) {
+    net_waker_signal(&g_sse_hub.waker);
+  } else {
+    message_store_channel_release(channel);
+  }
+  return exit_code;
+}
@@ -0,0 +1,23 @@
+#ifndef HF_SSE_HUB_H
+#define HF_SSE_HUB_H
+
+#include "message_store.h"
+#include "net.h"
+
+#include <stdint.h>
+
+// One thread serves every message stream subscriber, on any channel. Each
+// message is serialized once into a shared event and written with
+// non-blocking sends; a subscriber that falls behind only ever holds the
+// newest event, and one that stops reading altogether is dropped.
+int sse_hub_start(void);
+void sse_hub_stop(void);
+
+// Takes ownership of conn (the SSE response headers already sent) and
+// returns 0. On failure the caller still owns conn. With since, the stream
+// starts with every held message on the channel newer than that version;
+// without it, with the latest message only.
+int sse_hub_subscribe(socket_t conn, message_store_channel_t *channel,
+                      const uint64_t *since);
+
+#endif  // HF_SSE_HUB_H
@@ -0,0 +1,217 @@
+#include "text_scan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define TEXT_SCAN_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+// AVX2 needs per-function target attributes, so it is only built with
+// GCC/Clang and selected once per process after a CPU check.
+#if defined(TEXT_SCAN_SSE2) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+  #define TEXT_SCAN_AVX2 1
+  #include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+  #include <windows.h>
+  #ifdef TEXT_SCAN_SSE2
+    #include <intrin.h>
+  #endif
+#elif defined(TEXT_SCAN_AVX2)
+  #include <pthread.h>
+#endif
+
+typedef size_t (*text_scan_fn)(const unsigned char *s, size_t len);
+
+static size_t text_scan_json_plain_scalar(const unsigned char *s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    unsigned char c = s[i];
+    if (c < 0x20u || c == '"' || c == '\\') break;
+    i++;
+  }
+  return i;
+}
+
+static size_t text_scan_ascii_scalar(const unsigned char *s, size_t len) {
+  size_t i = 0;
+  // Eight bytes at a time while no high bit is set.
+  while (i + 8u <= len) {
+    uint64_t word = 0;
+    memcpy(&word, s + i, sizeof(word));
+    if ((word & 0x8080808080808080ull) != 0) break;
+    i += 8u;
+  }
+  while (i < len && s[i] < 0x80u) i++;
+  return i;
+}
+
+#ifdef TEXT_SCAN_SSE2
+static unsigned text_scan_first_bit(unsigned mask) {
+  #ifdef _MSC_VER
+  unsigned long index = 0;
+  _BitScanForward(&index, mask);
+  return (unsigned)index;
+  #else
+  return (unsigned)__builtin_ctz(mask);
+  #endif
+}
+
+static size_t text_scan_json_plain_sse2(const unsigned char *s, size_t len) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i ctrl_max = _mm_set1_epi8(0x1F);
+  size_t i = 0;
+
+  for (; i + 16u <= len; i += 16u) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max);
+    __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                            _mm_cmpeq_epi8(v, backslash)),
+                               ctrl);
+    unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+    if (mask != 0) return i + text_scan_first_bit(mask);
+  }
+  return i + text_scan_json_plain_scalar(s + i, len - i);
+}
+
+static size_t text_scan_ascii_sse2(const unsigned char *s, size_t len) {
+  size_t i = 0;
+  for (; i + 16u <= len; i += 16u) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+    unsigned mask = (unsigned)_mm_movemask_epi8(v);
+    if (mask != 0) return i + text_scan_first_bit(mask);
+  }
+  return i + text_scan_ascii_scalar(s + i, len - i);
+}
+#endif
+
+#ifdef TEXT_SCAN_AVX2
+__attribute__((target("avx2"))) static size_t text_scan_json_plain_avx2(
+    const unsigned char *s, size_t len) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i ctrl_max = _mm256_set1_epi8(0x1F);
+  size_t i = 0;
+
+  for (; i + 32u <= len; i += 32u) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(s + i));
+    __m256i ctrl = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl_max), ctrl_max);
+    __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                                  _mm256_cmpeq_epi8(v, backslash)),
+                                  ctrl);
+    unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+    if (mask != 0) return i + text_scan_first_bit(mask);
+  }
+  return i + text_scan_json_plain_sse2(s + i, len - i);
+}
+
+__attribute__((target("avx2"))) static size_t text_scan_ascii_avx2(const unsigned char *s,
+                                                                   size_t len) {
+  size_t i = 0;
+  for (; i + 32u <= len; i += 32u) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(s + i));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(v);
+    if (mask != 0) return i + text_scan_first_bit(mask);
+  }
+  return i + text_scan_ascii_sse2(s + i, len - i);
+}
+#endif
+
+#if defined(TEXT_SCAN_AVX2)
+static text_scan_fn g_text_scan_json_plain = text_scan_json_plain_sse2;
+static text_scan_fn g_text_scan_ascii = text_scan_ascii_sse2;
+#elif defined(TEXT_SCAN_SSE2)
+  #define g_text_scan_json_plain text_scan_json_plain_sse2
+  #define g_text_scan_ascii text_scan_ascii_sse2
+#else
+  #define g_text_scan_json_plain text_scan_json_plain_scalar
+  #define g_text_scan_ascii text_scan_ascii_scalar
+#endif
+
+#ifdef TEXT_SCAN_AVX2
+  #ifdef _WIN32
+static INIT_ONCE g_text_scan_once = INIT_ONCE_STATIC_INIT;
+  #else
+static pthread_once_t g_text_scan_once = PTHREAD_ONCE_INIT;
+  #endif
+
+static void text_scan_pick(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    g_text_scan_json_plain = text_scan_json_plain_avx2;
+    g_text_scan_ascii = text_scan_ascii_avx2;
+  }
+}
+
+  #ifdef _WIN32
+static BOOL CALLBACK text_scan_init(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+  (void)once;
+  (void)param;
+  (void)ctx;
+  text_scan_pick();
+  return TRUE;
+}
+  #endif
+
+static void text_scan_ensure_init(void) {
+  #ifdef _WIN32
+  (void)InitOnceExecuteOnce(&g_text_scan_once, text_scan_init, NULL, NULL);
+  #else
+  (void)pthread_once(&g_text_scan_once, text_scan_pick);
+  #endif
+}
+#else
+static void text_scan_ensure_init(void) {}
+#endif
+
+size_t text_scan_json_plain(const char *s, size_t len) {
+  text_scan_ensure_init();
+  return g_text_scan_json_plain((const unsigned char *)s, len);
+}
+
+// Length of the well-formed multibyte sequence at s, or 0.
+static size_t text_scan_utf8_sequence(const unsigned char *s, size_t len) {
+  unsigned char c = s[0];
+
+  if (c >= 0xC2u && c <= 0xDFu) {
+    return (len >= 2u && (s[1] & 0xC0u) == 0x80u) ? 2u : 0u;
+  }
+  if (c >= 0xE0u && c <= 0xEFu) {
+    unsigned char lo = (c == 0xE0u) ? 0xA0u : 0x80u;
+    unsigned char hi = (c == 0xEDu) ? 0x9Fu : 0xBFu;
+    if (len < 3u || s[1] < lo || s[1] > hi || (s[2] & 0xC0u) != 0x80u) return 0;
+    return 3u;
+  }
+  if (c >= 0xF0u && c <= 0xF4u) {
+    unsigned char lo = (c == 0xF0u) ? 0x90u : 0x80u;
+    unsigned char hi = (c == 0xF4u) ? 0x8Fu : 0xBFu;
+    if (len < 4u || s[1] < lo || s[1] > hi || (s[2] & 0xC0u) != 0x80u ||
+        (s[3] & 0xC0u) != 0x80u) {
+      return 0;
+    }
+    return 4u;
+  }
+  return 0;
+}
+
+int text_scan_utf8_valid(const char *s, size_t len) {
+  const unsigned char *p = (const unsigned char *)s;
+  size_t i = 0;
+
+  text_scan_ensure_init();
+  while (i < len) {
+    i += g_text_scan_ascii(p + i, len - i);
+    // Decode multibyte sequences one by one until ASCII resumes.
+    while (i < len && p[i] >= 0x80u) {
+      size_t n = text_scan_utf8_sequence(p + i, len - i);
+      if (n == 0) return 0;
+      i += n;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,19 @@
+#ifndef HF_TEXT_SCAN_H
+#define HF_TEXT_SCAN_H
+
+#include <stddef.h>
+
+// Vectorized scans over message text. On x86 the SSE2 paths are always
+// available and AVX2 is picked at runtime where the CPU has it; other
+// targets use the scalar loops.
+
+// Length of the leading run that can be copied into (or out of) a JSON
+// string verbatim: it stops at '"', '\\' and any byte below 0x20, NUL
+// included.
+size_t text_scan_json_plain(const char *s, size_t len);
+
+// Returns 1 when s is well-formed UTF-8: no overlong forms, surrogates or
+// code points above U+10FFFF.
+int text_scan_utf8_valid(const char *s, size_t len);
+
+#endif  // HF_TEXT_SCAN_H
@@ -1,86 +1,157 @@
 #include "transfer_io.h"
 
+#include "conn_deadline.h"
 #include "fs.h"
+#include "rate_limit.h"
 
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
-#include <stdlib.h>
 
 #ifdef _WIN32
   #include <process.h>
 #else
+  #include <pthread.h>
   #include <unistd.h>
 #endif
 
-static protocol_result_t transfer_recv_socket_http_file_buffered(
-  socket_t conn,
-  int out,
-  uint64_t content_size,
-  const char *recv_ctx,
-  const char *short_read_message) {
-  char stack_buf[STACK_BUF_SIZE];
-  char *heap_buf = NULL;
-  char *buf = stack_buf;
-  size_t buf_cap = STACK_BUF_SIZE;
-  uint64_t remaining = content_size;
-
-  if (content_size > HEAP_THRESHOLD) {
-    heap_buf = (char *)malloc(HEAP_BUF_SIZE);
-    if (heap_buf == NULL) {
-      fprintf(stderr, "heap buf malloc failed\n");
-      return PROTOCOL_ERR_ALLOC;
-    }
-    buf = heap_buf;
-    buf_cap = HEAP_BUF_SIZE;
+#define TRANSFER_WRITEBACK_SLICE (8u * 1024u * 1024u)
+
+typedef struct transfer_dir_sync_ticket {
+  const char *dir;
+  int done;
+  int failed;
+  struct transfer_dir_sync_ticket *next;
+} transfer_dir_sync_ticket_t;
+
+static int g_transfer_durable = 0;
+static uint64_t g_transfer_rate_limit = 0;
+static rate_limit_t g_transfer_global_rate;  // rate 0 until configured
+
+#ifndef _WIN32
+static pthread_mutex_t g_transfer_dir_sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_transfer_dir_sync_cond = PTHREAD_COND_INITIALIZER;
+static transfer_dir_sync_ticket_t *g_transfer_dir_sync_pending = NULL;
+static int g_transfer_dir_sync_leader = 0;
+#endif
+
+void transfer_set_durable(int enabled) {
+  g_transfer_durable = enabled ? 1 : 0;
+}
+
+int transfer_set_rate_limits(uint64_t per_transfer, uint64_t global) {
+  g_transfer_rate_limit = per_transfer;
+  if (global == 0) {
+    return 0;
   }
+  return rate_limit_init(&g_transfer_global_rate, global, NULL);
+}
 
-  while (remaining > 0) {
-    size_t want = buf_cap;
-    if ((uint64_t)want > remaining) {
-      want = (size_t)remaining;
-    }
+// Leaves xfer unpaced when neither limit is set.
+static int transfer_pace_open(rate_limit_t *limit, net_transfer_t *xfer) {
+  memset(xfer, 0, sizeof(*xfer));
+  if (g_transfer_rate_limit == 0 && !rate_limit_active(&g_transfer_global_rate)) {
+    return 0;
+  }
+  if (rate_limit_init(limit, g_transfer_rate_limit, &g_transfer_global_rate) != 0) {
+    fprintf(stderr, "failed to initialize rate limit\n");
+    return 1;
+  }
+  xfer->limit = limit;
+  return 0;
+}
+
+static void transfer_pace_close(rate_limit_t *limit, net_transfer_t *xfer) {
+  if (xfer->limit != NULL) {
+    rate_limit_destroy(limit);
+    xfer->limit = NULL;
+  }
+}
 
+// Concurrent commits share directory fsyncs: a committer that finds no sync
+// in flight flushes every directory queued so far while the rest wait.
+static int transfer_sync_parent_dir(const char *full_path) {
 #ifdef _WIN32
-    int tmp = recv(conn, buf, (int)want, 0);
-    if (tmp == SOCKET_ERROR) {
-      int err = WSAGetLastError();
-      if (err == WSAEINTR) {
-        continue;
-      }
-      sock_perror(recv_ctx);
-      free(heap_buf);
-      return PROTOCOL_ERR_IO;
-    }
-    ssize_t n = (ssize_t)tmp;
+  (void)full_path;
+  return 0;
 #else
-    ssize_t n = recv(conn, buf, want, 0);
-    if (n < 0) {
-      if (errno == EINTR) {
-        continue;
-      }
-      sock_perror(recv_ctx);
-      free(heap_buf);
-      return PROTOCOL_ERR_IO;
+  char dir[4096];
+  const char *slash = strrchr(full_path, '/');
+  transfer_dir_sync_ticket_t ticket = {0};
+
+  if (slash == NULL) {
+    (void)snprintf(dir, sizeof(dir), ".");
+  } else if (slash == full_path) {
+    (void)snprintf(dir, sizeof(dir), "/");
+  } else {
+    size_t len = (size_t)(slash - full_path);
+    if (len >= sizeof(dir)) {
+      return 1;
     }
-#endif
-    if (n == 0) {
-      fprintf(stderr, "%s\n", short_read_message);
-      free(heap_buf);
-      return PROTOCOL_ERR_EOF;
+    memcpy(dir, full_path, len);
+    dir[len] = '\0';
+  }
+  ticket.dir = dir;
+
+  (void)pthread_mutex_lock(&g_transfer_dir_sync_mutex);
+  ticket.next = g_transfer_dir_sync_pending;
+  g_transfer_dir_sync_pending = &ticket;
+
+  while (!ticket.done) {
+    if (g_transfer_dir_sync_leader) {
+      (void)pthread_cond_wait(&g_transfer_dir_sync_cond, &g_transfer_dir_sync_mutex);
+      continue;
     }
 
-    if (fs_write_all(out, buf, (size_t)n) != n) {
-      perror("write_all");
-      free(heap_buf);
-      return PROTOCOL_ERR_IO;
+    transfer_dir_sync_ticket_t *batch = g_transfer_dir_sync_pending;
+    g_transfer_dir_sync_pending = NULL;
+    g_transfer_dir_sync_leader = 1;
+    (void)pthread_mutex_unlock(&g_transfer_dir_sync_mutex);
+
+    for (transfer_dir_sync_ticket_t *t = batch; t != NULL; t = t->next) {
+      transfer_dir_sync_ticket_t *same = batch;
+      while (same != t && strcmp(same->dir, t->dir) != 0) {
+        same = same->next;
+      }
+      t->failed = same != t ? same->failed : fs_sync_dir(t->dir);
     }
 
-    remaining -= (uint64_t)n;
+    (void)pthread_mutex_lock(&g_transfer_dir_sync_mutex);
+    while (batch != NULL) {
+      transfer_dir_sync_ticket_t *next = batch->next;
+      batch->done = 1;
+      batch = next;
+    }
+    g_transfer_dir_sync_leader = 0;
+    (void)pthread_cond_broadcast(&g_transfer_dir_sync_cond);
   }
+  (void)pthread_mutex_unlock(&g_transfer_dir_sync_mutex);
+  return ticket.failed;
+#endif
+}
 
-  free(heap_buf);
-  return PROTOCOL_OK;
+static protocol_result_t transfer_map_recv_result(net_recv_file_result_t recv_res,
+                                                  const char *recv_ctx,
+                                                  const char *short_read_message) {
+  if (recv_res == NET_RECV_FILE_OK) {
+    return PROTOCOL_OK;
+  }
+  if (recv_res == NET_RECV_FILE_EOF) {
+    fprintf(stderr, "%s\n", short_read_message);
+    return PROTOCOL_ERR_EOF;
+  }
+  if (recv_res == NET_RECV_FILE_IO) {
+    sock_perror(recv_ctx);
+    return PROTOCOL_ERR_IO;
+  }
+  if (recv_res == NET_RECV_FILE_DISK_IO) {
+    perror("write(file_body)");
+    return PROTOCOL_ERR_IO;
+  }
+  if (recv_res == NET_RECV_FILE_INVALID_ARGUMENT) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  return PROTOCOL_ERR_IO;
 }
 
 static protocol_result_t transfer_prepare_output(const char *base_dir,
@@ -134,10 +205,14 @@ static protocol_result_t transfer_prepare_output(const char *base_dir,
 static protocol_result_t transfer_finalize_output(int *out_fd,
                                                   const char *tmp_path,
                                                   const char *full_path,
+                                                  const uint64_t *mtime,
                                                   char *full_path_out,
                                                   size_t full_path_cap) {
   size_t full_path_len = 0;
 
+  // The whole body is in; a slow fsync or rename must not count against the
+  // connection's body rate.
+  conn_deadline_enter(CONN_DEADLINE_NONE);
   if (out_fd == NULL || tmp_path == NULL || full_path == NULL ||
       full_path_out == NULL || full_path_cap == 0) {
     return PROTOCOL_ERR_INVALID_ARGUMENT;
@@ -149,6 +224,16 @@ static protocol_result_t transfer_finalize_output(int *out_fd,
     return PROTOCOL_ERR_INVALID_ARGUMENT;
   }
 
+  if (mtime != NULL && *out_fd != -1 && fs_set_mtime(*out_fd, *mtime) != 0) {
+    perror("futimens(temp)");
+    return PROTOCOL_ERR_IO;
+  }
+
+  if (g_transfer_durable && *out_fd != -1 && fs_sync_file(*out_fd) != 0) {
+    perror("fsync(temp)");
+    return PROTOCOL_ERR_IO;
+  }
+
   if (*out_fd != -1 && fs_close(*out_fd) != 0) {
     perror("close(temp)");
     *out_fd = -1;
@@ -161,6 +246,11 @@ static protocol_result_t transfer_finalize_output(int *out_fd,
     return PROTOCOL_ERR_IO;
   }
 
+  if (g_transfer_durable && transfer_sync_parent_dir(full_path) != 0) {
+    perror("fsync(dir)");
+    return PROTOCOL_ERR_IO;
+  }
+
   memcpy(full_path_out, full_path, full_path_len + 1u);
   return PROTOCOL_OK;
 }
@@ -169,6 +259,7 @@ protocol_result_t transfer_recv_socket_file(socket_t conn,
                                             const char *base_dir,
                                             const char *file_name,
                                             uint64_t content_size,
+                                            const uint64_t *mtime,
                                             const char *recv_ctx,
                                             const char *short_read_message,
                                             char *full_path_out,
@@ -177,6 +268,8 @@ protocol_result_t transfer_recv_socket_file(socket_t conn,
   char tmp_path[4096];
   int out = -1;
   protocol_result_t result = PROTOCOL_ERR_IO;
+  rate_limit_t limit;
+  net_transfer_t xfer = {0};
 
   if (base_dir == NULL || file_name == NULL || recv_ctx == NULL ||
       short_read_message == NULL || full_path_out == NULL || full_path_cap == 0) {
@@ -191,25 +284,113 @@ protocol_result_t transfer_recv_socket_file(socket_t conn,
     return result;
   }
 
-  net_recv_file_result_t recv_res = net_recv_file_best_effort(conn, out, content_size);
-  if (recv_res == NET_RECV_FILE_OK) {
-    result = PROTOCOL_OK;
-  } else if (recv_res == NET_RECV_FILE_EOF) {
-    fprintf(stderr, "%s\n", short_read_message);
-    result = PROTOCOL_ERR_EOF;
-  } else if (recv_res == NET_RECV_FILE_IO) {
-    sock_perror(recv_ctx);
+  if (transfer_pace_open(&limit, &xfer) != 0) {
     result = PROTOCOL_ERR_IO;
-  } else if (recv_res == NET_RECV_FILE_INVALID_ARGUMENT) {
-    result = PROTOCOL_ERR_INVALID_ARGUMENT;
-  } else {
+    goto CLEANUP;
+  }
+
+  result = transfer_map_recv_result(
+    net_recv_file_tracked(conn, out, content_size,
+                          g_transfer_durable ? TRANSFER_WRITEBACK_SLICE : 0, &xfer),
+    recv_ctx, short_read_message);
+  if (result != PROTOCOL_OK) {
+    goto CLEANUP;
+  }
+
+  result = transfer_finalize_output(&out, tmp_path, full_path, mtime, full_path_out,
+                                    full_path_cap);
+  if (result != PROTOCOL_OK) {
+    goto CLEANUP;
+  }
+
+  result = PROTOCOL_OK;
+
+CLEANUP:
+  transfer_pace_close(&limit, &xfer);
+  if (out != -1) {
+    fs_close(out);
+  }
+  if (result != PROTOCOL_OK && tmp_path[0] != '\0') {
+    fs_remove_ignore_error(tmp_path);
+  }
+  return result;
+}
+
+protocol_result_t transfer_recv_socket_stream(socket_t conn,
+                                              const char *base_dir,
+                                              const char *file_name,
+                                              const char *recv_ctx,
+                                              const char *short_read_message,
+                                              char *full_path_out,
+                                              size_t full_path_cap) {
+  char full_path[4096];
+  char tmp_path[4096];
+  int out = -1;
+  protocol_result_t result = PROTOCOL_ERR_IO;
+  rate_limit_t limit;
+  net_transfer_t xfer = {0};
+  net_recv_file_result_t recv_res = NET_RECV_FILE_OK;
+  net_recv_body_t body;
+  uint64_t received = 0;
+
+  if (base_dir == NULL || file_name == NULL || recv_ctx == NULL ||
+      short_read_message == NULL || full_path_out == NULL || full_path_cap == 0) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+
+  tmp_path[0] = '\0';
+  result = transfer_prepare_output(base_dir, file_name, full_path, sizeof(full_path),
+                                   tmp_path, sizeof(tmp_path), &out);
+  if (result != PROTOCOL_OK) {
+    return result;
+  }
+  if (transfer_pace_open(&limit, &xfer) != 0) {
     result = PROTOCOL_ERR_IO;
+    goto CLEANUP;
+  }
+
+  net_recv_body_init(&body, out, g_transfer_durable ? TRANSFER_WRITEBACK_SLICE : 0, 0,
+                     &xfer);
+  for (;;) {
+    uint8_t len_buf[4];
+    ssize_t n = 0;
+
+    n = recv_all(conn, len_buf, sizeof(len_buf));
+    if (n != (ssize_t)sizeof(len_buf)) {
+      recv_res = n < 0 ? NET_RECV_FILE_IO : NET_RECV_FILE_EOF;
+      break;
+    }
+    uint32_t len = ((uint32_t)len_buf[0] << 24) | ((uint32_t)len_buf[1] << 16) |
+                   ((uint32_t)len_buf[2] << 8) | (uint32_t)len_buf[3];
+    if (len == 0) {
+      break;
+    }
+    if (len == HF_PROTOCOL_STREAM_KEEPALIVE) {
+      if (conn_deadline_keepalive() != 0) {
+        recv_res = NET_RECV_FILE_IO;
+        break;
+      }
+      continue;
+    }
+    if (len > HF_PROTOCOL_MAX_STREAM_CHUNK || received + len > HF_MAX_FILE_SIZE) {
+      (void)net_recv_body_finish(&body, NET_RECV_FILE_IO);
+      fprintf(stderr, "protocol error: stream chunk too large\n");
+      result = PROTOCOL_ERR_MSG_TOO_LARGE;
+      goto CLEANUP;
+    }
+    recv_res = net_recv_body_recv(&body, conn, len);
+    if (recv_res != NET_RECV_FILE_OK) {
+      break;
+    }
+    received += len;
   }
+  recv_res = net_recv_body_finish(&body, recv_res);
+  result = transfer_map_recv_result(recv_res, recv_ctx, short_read_message);
   if (result != PROTOCOL_OK) {
     goto CLEANUP;
   }
 
-  result = transfer_finalize_output(&out, tmp_path, full_path, full_path_out,
+  result = transfer_finalize_output(&out, tmp_path, full_path, NULL, full_path_out,
                                     full_path_cap);
   if (result != PROTOCOL_OK) {
     goto CLEANUP;
@@ -218,6 +399,7 @@ protocol_result_t transfer_recv_socket_file(socket_t conn,
   result = PROTOCOL_OK;
 
 CLEANUP:
+  transfer_pace_close(&limit, &xfer);
   if (out != -1) {
     fs_close(out);
   }
@@ -231,6 +413,7 @@ protocol_result_t transfer_recv_socket_http_file(socket_t conn,
                                                  const char *base_dir,
                                                  const char *file_name,
                                                  uint64_t content_size,
+                                                 const uint64_t *mtime,
                                                  const char *recv_ctx,
                                                  const char *short_read_message,
                                                  char *full_path_out,
@@ -239,6 +422,8 @@ protocol_result_t transfer_recv_socket_http_file(socket_t conn,
   char tmp_path[4096];
   int out = -1;
   protocol_result_t result = PROTOCOL_ERR_IO;
+  rate_limit_t limit;
+  net_transfer_t xfer = {0};
 
   if (base_dir == NULL || file_name == NULL || recv_ctx == NULL ||
       short_read_message == NULL || full_path_out == NULL || full_path_cap == 0) {
@@ -252,13 +437,19 @@ protocol_result_t transfer_recv_socket_http_file(socket_t conn,
     return result;
   }
 
-  result = transfer_recv_socket_http_file_buffered(
-    conn, out, content_size, recv_ctx, short_read_message);
+  if (transfer_pace_open(&limit, &xfer) != 0) {
+    result = PROTOCOL_ERR_IO;
+    goto CLEANUP;
+  }
+  result = transfer_map_recv_result(
+    net_recv_file_buffered(conn, out, content_size,
+                           g_transfer_durable ? TRANSFER_WRITEBACK_SLICE : 0, &xfer),
+    recv_ctx, short_read_message);
   if (result != PROTOCOL_OK) {
     goto CLEANUP;
   }
 
-  result = transfer_finalize_output(&out, tmp_path, full_path, full_path_out,
+  result = transfer_finalize_output(&out, tmp_path, full_path, mtime, full_path_out,
                                     full_path_cap);
   if (result != PROTOCOL_OK) {
     goto CLEANUP;
@@ -267,6 +458,7 @@ protocol_result_t transfer_recv_socket_http_file(socket_t conn,
   result = PROTOCOL_OK;
 
 CLEANUP:
+  transfer_pace_close(&limit, &xfer);
   if (out != -1) {
     fs_close(out);
   }
@@ -275,3 +467,109 @@ CLEANUP:
   }
   return result;
 }
+
+protocol_result_t transfer_output_open(transfer_output_t *out,
+                                       const char *base_dir,
+                                       const char *file_name) {
+  protocol_result_t result = PROTOCOL_ERR_IO;
+
+  if (out == NULL) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+
+  out->fd = -1;
+  out->written = 0;
+  out->flushed = 0;
+  out->tmp_path[0] = '\0';
+  result = transfer_prepare_output(base_dir, file_name, out->full_path,
+                                   sizeof(out->full_path), out->tmp_path,
+                                   sizeof(out->tmp_path), &out->fd);
+  if (result != PROTOCOL_OK) {
+    out->tmp_path[0] = '\0';
+  }
+  return result;
+}
+
+protocol_result_t transfer_output_write(transfer_output_t *out,
+                                        const void *data,
+                                        size_t len) {
+  if (out == NULL || out->fd == -1 || (data == NULL && len > 0)) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  if (len == 0) {
+    return PROTOCOL_OK;
+  }
+
+  if (fs_write_all(out->fd, data, len) != (ssize_t)len) {
+    perror("write(file_body)");
+    return PROTOCOL_ERR_IO;
+  }
+  out->written += len;
+
+  if (g_transfer_durable && out->written - out->flushed >= TRANSFER_WRITEBACK_SLICE) {
+    fs_writeback_range(out->fd, out->flushed, out->written - out->flushed);
+    out->flushed = out->written;
+  }
+  return PROTOCOL_OK;
+}
+
+protocol_result_t transfer_output_reserve(transfer_output_t *out, uint64_t offset,
+                                          uint64_t len) {
+  if (out == NULL || out->fd == -1) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  if (fs_preallocate(out->fd, offset, len) != 0) {
+    perror("preallocate(file_body)");
+    return PROTOCOL_ERR_IO;
+  }
+  return PROTOCOL_OK;
+}
+
+// Positioned writes leave the sequential counters alone, so several threads
+// may fill disjoint ranges of one reserved file at once.
+protocol_result_t transfer_output_write_at(transfer_output_t *out,
+                                           uint64_t offset,
+                                           const void *data,
+                                           size_t len) {
+  if (out == NULL || out->fd == -1 || (data == NULL && len > 0)) {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+  if (fs_pwrite_all(out->fd, data, len, offset) != (ssize_t)len) {
+    perror("pwrite(file_body)");
+    return PROTOCOL_ERR_IO;
+  }
+  return PROTOCOL_OK;
+}
+
+protocol_result_t transfer_output_commit(transfer_output_t *out,
+                                         char *full_path_out,
+                                         size_t full_path_cap) {
+  protocol_result_t result = PROTOCOL_ERR_IO;
+
+  if (out == NULL || out->tmp_path[0] == '\0') {
+    return PROTOCOL_ERR_INVALID_ARGUMENT;
+  }
+
+  result = transfer_finalize_output(&out->fd, out->tmp_path, out->full_path, NULL,
+                                    full_path_out, full_path_cap);
+  if (result != PROTOCOL_OK) {
+    transfer_output_abort(out);
+    return result;
+  }
+  out->tmp_path[0] = '\0';
+  return PROTOCOL_OK;
+}
+
+void transfer_output_abort(transfer_output_t *out) {
+  if (out == NULL) {
+    return;
+  }
+  if (out->fd != -1) {
+    fs_close(out->fd);
+    out->fd = -1;
+  }
+  if (out->tmp_path[0] != '\0') {
+    fs_remove_ignore_error(out->tmp_path);
+    out->tmp_path[0] = '\0';
+  }
+}
@@ -7,14 +7,18 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define STACK_BUF_SIZE 8192u
-#define HEAP_BUF_SIZE (256u * 1024u)
-#define HEAP_THRESHOLD (1u * 1024u * 1024u)
+void transfer_set_durable(int enabled);
+// Paces received file bodies, in bytes per second per transfer and across
+// all of them; 0 leaves either unlimited. Call before any transfer starts.
+int transfer_set_rate_limits(uint64_t per_transfer, uint64_t global);
+
+// When mtime is set, the received file keeps that modification time.
 
 protocol_result_t transfer_recv_socket_file(socket_t conn,
                                             const char *base_dir,
                                             const char *file_name,
                                             uint64_t content_size,
+                                            const uint64_t *mtime,
                                             const char *recv_ctx,
                                             const char *short_read_message,
                                             char *full_path_out,
@@ -24,9 +28,47 @@ protocol_result_t transfer_recv_socket_http_file(socket_t conn,
                                                  const char *base_dir,
                                                  const char *file_name,
                                                  uint64_t content_size,
+                                                 const uint64_t *mtime,
                                                  const char *recv_ctx,
                                                  const char *short_read_message,
                                                  char *full_path_out,
                                                  size_t full_path_cap);
 
+// The body arrives as HF_MSG_FLAG_STREAM chunks; each one is received
+// straight into the file like a sized body.
+protocol_result_t transfer_recv_socket_stream(socket_t conn,
+                                              const char *base_dir,
+                                              const char *file_name,
+                                              const char *recv_ctx,
+                                              const char *short_read_message,
+                                              char *full_path_out,
+                                              size_t full_path_cap);
+
+// Incremental writer for bodies that do not arrive as one contiguous stream
+// (multipart parts). Data lands in a temp file that commit renames into place.
+typedef struct {
+  int fd;
+  uint64_t written;
+  uint64_t flushed;
+  char full_path[4096];
+  char tmp_path[4096];
+} transfer_output_t;
+
+protocol_result_t transfer_output_open(transfer_output_t *out,
+                                       const char *base_dir,
+                                       const char *file_name);
+protocol_result_t transfer_output_write(transfer_output_t *out,
+                                        const void *data,
+                                        size_t len);
+protocol_result_t transfer_output_reserve(transfer_output_t *out, uint64_t offset,
+                                          uint64_t len);
+protocol_result_t transfer_output_write_at(transfer_output_t *out,
+                                           uint64_t offset,
+                                           const void *data,
+                                           size_t len);
+protocol_result_t transfer_output_commit(transfer_output_t *out,
+                                         char *full_path_out,
+                                         size_t full_path_cap);
+void transfer_output_abort(transfer_output_t *out);
+
 #endif  // HF_TRANSFER_IO_H
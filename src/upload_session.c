@@ -0,0 +1,439 @@
+#ifdef _WIN32
+  #define _CRT_RAND_S
+#endif
+
+#include "upload_session.h"
+
+#include "app_service.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+
+#define UPLOAD_SESSION_MAX_ACTIVE 256u
+#define UPLOAD_SESSION_IDLE_EXPIRY_SECONDS (24 * 60 * 60)
+
+struct upload_session {
+  char id[UPLOAD_SESSION_ID_LEN + 1u];
+  app_upload_t upload;
+  uint64_t size;
+  uint64_t chunk_size;
+  uint64_t chunk_count;
+  uint64_t received_count;
+  uint8_t *received;
+  time_t last_used;
+  // The table holds one reference while the session is listed.
+  size_t refs;
+  int listed;
+  int committed;
+  struct upload_session *next;
+};
+
+typedef struct {
+  int initialized;
+  upload_session_t *sessions;
+  size_t count;
+#ifdef _WIN32
+  CRITICAL_SECTION mutex;
+#else
+  pthread_mutex_t mutex;
+#endif
+} upload_session_state_t;
+
+static upload_session_state_t g_upload_sessions = {0};
+
+static void upload_session_lock(void) {
+#ifdef _WIN32
+  EnterCriticalSection(&g_upload_sessions.mutex);
+#else
+  (void)pthread_mutex_lock(&g_upload_sessions.mutex);
+#endif
+}
+
+static void upload_session_unlock(void) {
+#ifdef _WIN32
+  LeaveCriticalSection(&g_upload_sessions.mutex);
+#else
+  (void)pthread_mutex_unlock(&g_upload_sessions.mutex);
+#endif
+}
+
+static int upload_session_random(uint8_t *out, size_t len) {
+#ifdef _WIN32
+  for (size_t i = 0; i < len; i += sizeof(unsigned int)) {
+    unsigned int value = 0;
+    size_t n = len - i < sizeof(value) ? len - i : sizeof(value);
+    if (rand_s(&value) != 0) {
+      return 1;
+    }
+    memcpy(out + i, &value, n);
+  }
+  return 0;
+#else
+  int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  size_t got = 0;
+
+  if (fd < 0) {
+    return 1;
+  }
+  while (got < len) {
+    ssize_t n = read(fd, out + got, len - got);
+    if (n <= 0) {
+      break;
+    }
+    got += (size_t)n;
+  }
+  close(fd);
+  return got == len ? 0 : 1;
+#endif
+}
+
+static void upload_session_destroy(upload_session_t *session) {
+  if (!session->committed) {
+    app_abort_upload(&session->upload);
+  }
+  free(session->received);
+  free(session);
+}
+
+// Caller holds the lock.
+static void upload_session_unlink(upload_session_t *session) {
+  for (upload_session_t **it = &g_upload_sessions.sessions; *it != NULL;
+       it = &(*it)->next) {
+    if (*it == session) {
+      *it = session->next;
+      break;
+    }
+  }
+  session->next = NULL;
+  session->listed = 0;
+  session->refs--;
+  g_upload_sessions.count--;
+}
+
+// Caller holds the lock; returns the sessions that can be destroyed now.
+static upload_session_t *upload_session_reap_expired(time_t now) {
+  upload_session_t *expired = NULL;
+  upload_session_t *session = g_upload_sessions.sessions;
+
+  while (session != NULL) {
+    upload_session_t *next = session->next;
+    if (session->refs == 1u &&
+        now - session->last_used >= UPLOAD_SESSION_IDLE_EXPIRY_SECONDS) {
+      upload_session_unlink(session);
+      session->next = expired;
+      expired = session;
+    }
+    session = next;
+  }
+  return expired;
+}
+
+int upload_session_init(void) {
+  if (g_upload_sessions.initialized) {
+    return 0;
+  }
+  memset(&g_upload_sessions, 0, sizeof(g_upload_sessions));
+#ifdef _WIN32
+  InitializeCriticalSection(&g_upload_sessions.mutex);
+#else
+  if (pthread_mutex_init(&g_upload_sessions.mutex, NULL) != 0) {
+    return 1;
+  }
+#endif
+  g_upload_sessions.initialized = 1;
+  return 0;
+}
+
+// Unfinished sessions do not survive a restart; their temp files go too.
+void upload_session_cleanup(void) {
+  upload_session_t *session = NULL;
+
+  if (!g_upload_sessions.initialized) {
+    return;
+  }
+
+  session = g_upload_sessions.sessions;
+  while (session != NULL) {
+    upload_session_t *next = session->next;
+    upload_session_destroy(session);
+    session = next;
+  }
+  g_upload_sessions.sessions = NULL;
+  g_upload_sessions.count = 0;
+
+#ifdef _WIN32
+  DeleteCriticalSection(&g_upload_sessions.mutex);
+#else
+  (void)pthread_mutex_destroy(&g_upload_sessions.mutex);
+#endif
+  g_upload_sessions.initialized = 0;
+}
+
+upload_session_result_t upload_session_create(const char *base_dir,
+                                              const char *relative_path,
+                                              uint64_t size,
+                                              uint64_t chunk_size,
+                                              upload_session_t **session_out) {
+  static const char hex[] = "0123456789abcdef";
+  upload_session_t *session = NULL;
+  upload_session_t *expired = NULL;
+  uint8_t id_bytes[UPLOAD_SESSION_ID_LEN / 2u];
+  size_t bitmap_len = 0;
+  time_t now = time(NULL);
+
+  if (!g_upload_sessions.initialized || base_dir == NULL || relative_path == NULL ||
+      session_out == NULL || chunk_size < UPLOAD_SESSION_MIN_CHUNK ||
+      chunk_size > UPLOAD_SESSION_MAX_CHUNK) {
+    return UPLOAD_SESSION_ERR_INVALID;
+  }
+
+  upload_session_lock();
+  expired = upload_session_reap_expired(now);
+  upload_session_unlock();
+  while (expired != NULL) {
+    upload_session_t *next = expired->next;
+    upload_session_destroy(expired);
+    expired = next;
+  }
+
+  session = (upload_session_t *)calloc(1, sizeof(*session));
+  if (session == NULL) {
+    return UPLOAD_SESSION_ERR_IO;
+  }
+  session->size = size;
+  session->chunk_size = chunk_size;
+  session->chunk_count = size / chunk_size + (size % chunk_size != 0 ? 1u : 0u);
+  bitmap_len = (size_t)((session->chunk_count + 7u) / 8u);
+  session->received = (uint8_t *)calloc(bitmap_len > 0 ? bitmap_len : 1u, 1u);
+  if (session->received == NULL || upload_session_random(id_bytes, sizeof(id_bytes)) != 0) {
+    free(session->received);
+    free(session);
+    return UPLOAD_SESSION_ERR_IO;
+  }
+  for (size_t i = 0; i < sizeof(id_bytes); i++) {
+    session->id[i * 2u] = hex[id_bytes[i] >> 4];
+    session->id[i * 2u + 1u] = hex[id_bytes[i] & 0x0Fu];
+  }
+  session->id[UPLOAD_SESSION_ID_LEN] = '\0';
+
+  if (app_begin_upload(&session->upload, base_dir, relative_path) != PROTOCOL_OK) {
+    free(session->received);
+    free(session);
+    return UPLOAD_SESSION_ERR_INVALID;
+  }
+
+  session->last_used = now;
+  session->refs = 2u;
+  session->listed = 1;
+  upload_session_lock();
+  if (g_upload_sessions.count >= UPLOAD_SESSION_MAX_ACTIVE) {
+    upload_session_unlock();
+    upload_session_destroy(session);
+    return UPLOAD_SESSION_ERR_TOO_MANY;
+  }
+  session->next = g_upload_sessions.sessions;
+  g_upload_sessions.sessions = session;
+  g_upload_sessions.count++;
+  upload_session_unlock();
+
+  *session_out = session;
+  return UPLOAD_SESSION_OK;
+}
+
+upload_session_t *upload_session_acquire(const char *id) {
+  upload_session_t *found = NULL;
+
+  if (!g_upload_sessions.initialized || id == NULL ||
+      strlen(id) != UPLOAD_SESSION_ID_LEN) {
+    return NULL;
+  }
+
+  upload_session_lock();
+  for (upload_session_t *session = g_upload_sessions.sessions; session != NULL;
+       session = session->next) {
+    if (memcmp(session->id, id, UPLOAD_SESSION_ID_LEN) == 0) {
+      session->refs++;
+      session->last_used = time(NULL);
+      found = session;
+      break;
+    }
+  }
+  upload_session_unlock();
+  return found;
+}
+
+void upload_session_release(upload_session_t *session) {
+  size_t refs = 0;
+
+  if (session == NULL) {
+    return;
+  }
+  upload_session_lock();
+  refs = --session->refs;
+  upload_session_unlock();
+  if (refs == 0) {
+    upload_session_destroy(session);
+  }
+}
+
+const char *upload_session_id(const upload_session_t *session) {
+  return session->id;
+}
+
+const char *upload_session_path(const upload_session_t *session) {
+  return session->upload.relative_path;
+}
+
+uint64_t upload_session_size(const upload_session_t *session) {
+  return session->size;
+}
+
+uint64_t upload_session_chunk_size(const upload_session_t *session) {
+  return session->chunk_size;
+}
+
+int upload_session_chunk_index(const upload_session_t *session, uint64_t offset,
+                               uint64_t len, uint64_t *index_out) {
+  uint64_t index = 0;
+  uint64_t expected = 0;
+
+  if (session == NULL || index_out == NULL || offset % session->chunk_size != 0) {
+    return 1;
+  }
+  index = offset / session->chunk_size;
+  if (index >= session->chunk_count) {
+    return 1;
+  }
+  expected = session->size - offset;
+  if (expected > session->chunk_size) {
+    expected = session->chunk_size;
+  }
+  if (len != expected) {
+    return 1;
+  }
+  *index_out = index;
+  return 0;
+}
+
+upload_session_result_t upload_session_reserve_chunk(upload_session_t *session,
+                                                     uint64_t index) {
+  uint64_t offset = 0;
+  uint64_t len = 0;
+
+  if (session == NULL || index >= session->chunk_count) {
+    return UPLOAD_SESSION_ERR_INVALID;
+  }
+  offset = index * session->chunk_size;
+  len = session->size - offset < session->chunk_size ? session->size - offset
+                                                     : session->chunk_size;
+  return app_reserve_upload(&session->upload, offset, len) == PROTOCOL_OK
+           ? UPLOAD_SESSION_OK
+           : UPLOAD_SESSION_ERR_IO;
+}
+
+upload_session_result_t upload_session_write(upload_session_t *session, uint64_t offset,
+                                             const void *data, size_t len) {
+  if (session == NULL || offset > session->size || len > session->size - offset) {
+    return UPLOAD_SESSION_ERR_INVALID;
+  }
+  return app_write_upload_at(&session->upload, offset, data, len) == PROTOCOL_OK
+           ? UPLOAD_SESSION_OK
+           : UPLOAD_SESSION_ERR_IO;
+}
+
+void upload_session_mark_received(upload_session_t *session, uint64_t index) {
+  uint8_t bit = 0;
+
+  if (session == NULL || index >= session->chunk_count) {
+    return;
+  }
+  bit = (uint8_t)(1u << (index % 8u));
+  upload_session_lock();
+  if ((session->received[index / 8u] & bit) == 0) {
+    session->received[index / 8u] |= bit;
+    session->received_count++;
+  }
+  session->last_used = time(NULL);
+  upload_session_unlock();
+}
+
+int upload_session_visit_received(upload_session_t *session, upload_session_range_fn visit,
+                                  void *ctx) {
+  uint64_t run_start = 0;
+  int in_run = 0;
+  int rc = 0;
+
+  if (session == NULL || visit == NULL) {
+    return 1;
+  }
+
+  upload_session_lock();
+  for (uint64_t i = 0; i <= session->chunk_count && rc == 0; i++) {
+    int have = i < session->chunk_count &&
+               (session->received[i / 8u] & (1u << (i % 8u))) != 0;
+    if (have && !in_run) {
+      run_start = i;
+      in_run = 1;
+    } else if (!have && in_run) {
+      uint64_t end = i * session->chunk_size;
+      rc = visit(ctx, run_start * session->chunk_size,
+                 end < session->size ? end : session->size);
+      in_run = 0;
+    }
+  }
+  upload_session_unlock();
+  return rc;
+}
+
+upload_session_result_t upload_session_finalize(upload_session_t *session,
+                                                char *saved_path_out,
+                                                size_t saved_path_cap) {
+  if (session == NULL) {
+    return UPLOAD_SESSION_ERR_INVALID;
+  }
+
+  upload_session_lock();
+  if (!session->listed) {
+    upload_session_unlock();
+    return UPLOAD_SESSION_ERR_GONE;
+  }
+  if (session->received_count != session->chunk_count) {
+    upload_session_unlock();
+    return UPLOAD_SESSION_ERR_INCOMPLETE;
+  }
+  // The table and the caller; anyone else is still writing a chunk.
+  if (session->refs > 2u) {
+    upload_session_unlock();
+    return UPLOAD_SESSION_ERR_BUSY;
+  }
+  upload_session_unlink(session);
+  upload_session_unlock();
+
+  // Only this caller holds the session now.
+  if (app_commit_upload(&session->upload, saved_path_out, saved_path_cap) != PROTOCOL_OK) {
+    return UPLOAD_SESSION_ERR_IO;
+  }
+  session->committed = 1;
+  return UPLOAD_SESSION_OK;
+}
+
+void upload_session_abort(upload_session_t *session) {
+  if (session == NULL) {
+    return;
+  }
+  upload_session_lock();
+  if (session->listed) {
+    upload_session_unlink(session);
+  }
+  upload_session_unlock();
+}
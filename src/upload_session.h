@@ -0,0 +1,69 @@
+#ifndef HF_UPLOAD_SESSION_H
+#define HF_UPLOAD_SESSION_H
+
+#include "protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UPLOAD_SESSION_ID_LEN 32u
+#define UPLOAD_SESSION_MIN_CHUNK (64u * 1024u)
+#define UPLOAD_SESSION_MAX_CHUNK (64u * 1024u * 1024u)
+#define UPLOAD_SESSION_DEFAULT_CHUNK (8u * 1024u * 1024u)
+
+typedef enum {
+  UPLOAD_SESSION_OK = 0,
+  UPLOAD_SESSION_ERR_INVALID,
+  UPLOAD_SESSION_ERR_TOO_MANY,
+  UPLOAD_SESSION_ERR_INCOMPLETE,
+  UPLOAD_SESSION_ERR_BUSY,
+  UPLOAD_SESSION_ERR_GONE,
+  UPLOAD_SESSION_ERR_IO,
+} upload_session_result_t;
+
+// A resumable upload: chunks of chunk_size bytes are written into a temp
+// file at their offsets in any order and from any number of connections, and
+// finalize renames the temp file into place once every chunk has arrived.
+// Space is reserved one chunk at a time as each arrives, never for the whole
+// declared size up front. Sessions live in memory and
+// expire after a day without activity.
+typedef struct upload_session upload_session_t;
+
+typedef int (*upload_session_range_fn)(void *ctx, uint64_t start, uint64_t end);
+
+int upload_session_init(void);
+void upload_session_cleanup(void);
+
+upload_session_result_t upload_session_create(const char *base_dir,
+                                              const char *relative_path,
+                                              uint64_t size,
+                                              uint64_t chunk_size,
+                                              upload_session_t **session_out);
+// Every acquire or successful create must be paired with a release.
+upload_session_t *upload_session_acquire(const char *id);
+void upload_session_release(upload_session_t *session);
+
+const char *upload_session_id(const upload_session_t *session);
+const char *upload_session_path(const upload_session_t *session);
+uint64_t upload_session_size(const upload_session_t *session);
+uint64_t upload_session_chunk_size(const upload_session_t *session);
+
+// Checks that [offset, offset + len) is exactly one chunk.
+int upload_session_chunk_index(const upload_session_t *session, uint64_t offset,
+                               uint64_t len, uint64_t *index_out);
+// Reserves disk space for one chunk before its body is written.
+upload_session_result_t upload_session_reserve_chunk(upload_session_t *session,
+                                                     uint64_t index);
+upload_session_result_t upload_session_write(upload_session_t *session, uint64_t offset,
+                                             const void *data, size_t len);
+void upload_session_mark_received(upload_session_t *session, uint64_t index);
+// Visits received byte ranges as merged, half-open [start, end) intervals.
+int upload_session_visit_received(upload_session_t *session, upload_session_range_fn visit,
+                                  void *ctx);
+
+upload_session_result_t upload_session_finalize(upload_session_t *session,
+                                                char *saved_path_out,
+                                                size_t saved_path_cap);
+void upload_session_abort(upload_session_t *session);
+
+#endif  // HF_UPLOAD_SESSION_H
@@ -0,0 +1,155 @@
+#include "websocket.h"
+
+#include "sha1.h"
+
+#include <string.h>
+
+static const char websocket_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+static void websocket_base64(const uint8_t *in, size_t len, char *out) {
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t o = 0;
+
+  for (size_t i = 0; i < len; i += 3u) {
+    uint32_t v = (uint32_t)in[i] << 16;
+    if (i + 1u < len) v |= (uint32_t)in[i + 1u] << 8;
+    if (i + 2u < len) v |= (uint32_t)in[i + 2u];
+    out[o++] = alphabet[(v >> 18) & 0x3Fu];
+    out[o++] = alphabet[(v >> 12) & 0x3Fu];
+    out[o++] = i + 1u < len ? alphabet[(v >> 6) & 0x3Fu] : '=';
+    out[o++] = i + 2u < len ? alphabet[v & 0x3Fu] : '=';
+  }
+  out[o] = '\0';
+}
+
+int websocket_accept_key(const char *client_key, char out[WEBSOCKET_ACCEPT_LEN + 1u]) {
+  char joined[128];
+  uint8_t digest[SHA1_DIGEST_SIZE];
+  size_t key_len = 0;
+
+  if (client_key == NULL || out == NULL) {
+    return 1;
+  }
+  // A valid key is the base64 form of 16 random bytes.
+  key_len = strlen(client_key);
+  if (key_len != 24u) {
+    return 1;
+  }
+
+  memcpy(joined, client_key, key_len);
+  memcpy(joined + key_len, websocket_guid, sizeof(websocket_guid) - 1u);
+  sha1_digest(joined, key_len + sizeof(websocket_guid) - 1u, digest);
+  websocket_base64(digest, sizeof(digest), out);
+  return 0;
+}
+
+size_t websocket_frame_header(websocket_opcode_t opcode, uint64_t payload_len,
+                              uint8_t out[WEBSOCKET_FRAME_HEADER_MAX]) {
+  out[0] = (uint8_t)(0x80u | (unsigned)opcode);
+  if (payload_len < 126u) {
+    out[1] = (uint8_t)payload_len;
+    return 2u;
+  }
+  if (payload_len <= 0xFFFFu) {
+    out[1] = 126u;
+    out[2] = (uint8_t)(payload_len >> 8);
+    out[3] = (uint8_t)payload_len;
+    return 4u;
+  }
+  out[1] = 127u;
+  encode_u64_be(payload_len, out + 2);
+  return 10u;
+}
+
+int websocket_send_frame(socket_t conn, websocket_opcode_t opcode, const void *payload,
+                         size_t len) {
+  uint8_t header[WEBSOCKET_FRAME_HEADER_MAX];
+  size_t header_len = websocket_frame_header(opcode, len, header);
+
+  // Small frames go out in one send so they are not split across segments.
+  if (len <= 512u) {
+    uint8_t frame[WEBSOCKET_FRAME_HEADER_MAX + 512u];
+    memcpy(frame, header, header_len);
+    if (len > 0) {
+      memcpy(frame + header_len, payload, len);
+    }
+    return send_all(conn, frame, header_len + len) == (ssize_t)(header_len + len) ? 0 : 1;
+  }
+
+  if (send_all(conn, header, header_len) != (ssize_t)header_len) {
+    return 1;
+  }
+  return send_all(conn, payload, len) == (ssize_t)len ? 0 : 1;
+}
+
+int websocket_send_close(socket_t conn, websocket_close_code_t code) {
+  uint8_t payload[2];
+
+  payload[0] = (uint8_t)((unsigned)code >> 8);
+  payload[1] = (uint8_t)((unsigned)code & 0xFFu);
+  return websocket_send_frame(conn, WEBSOCKET_OP_CLOSE, payload, sizeof(payload));
+}
+
+int websocket_recv_frame_header(socket_t conn, websocket_frame_t *frame) {
+  uint8_t head[2];
+  uint8_t ext[8];
+  unsigned len7 = 0;
+
+  if (recv_all(conn, head, sizeof(head)) != (ssize_t)sizeof(head)) {
+    return 1;
+  }
+
+  memset(frame, 0, sizeof(*frame));
+  frame->fin = (head[0] & 0x80u) != 0;
+  frame->opcode = (websocket_opcode_t)(head[0] & 0x0Fu);
+  frame->masked = (head[1] & 0x80u) != 0;
+  len7 = head[1] & 0x7Fu;
+
+  // No extensions are negotiated, so RSV bits must be clear.
+  if ((head[0] & 0x70u) != 0) {
+    return 2;
+  }
+
+  if (len7 == 126u) {
+    if (recv_all(conn, ext, 2) != 2) {
+      return 1;
+    }
+    frame->payload_len = ((uint64_t)ext[0] << 8) | ext[1];
+  } else if (len7 == 127u) {
+    if (recv_all(conn, ext, 8) != 8) {
+      return 1;
+    }
+    frame->payload_len = decode_u64_be(ext);
+    if (frame->payload_len >> 63) {
+      return 2;
+    }
+  } else {
+    frame->payload_len = len7;
+  }
+
+  if (frame->opcode >= WEBSOCKET_OP_CLOSE &&
+      (!frame->fin || frame->payload_len > WEBSOCKET_CONTROL_MAX)) {
+    return 2;
+  }
+
+  if (frame->masked && recv_all(conn, frame->mask, 4) != 4) {
+    return 1;
+  }
+  return 0;
+}
+
+int websocket_recv_payload(socket_t conn, const websocket_frame_t *frame, void *out) {
+  uint8_t *p = (uint8_t *)out;
+  size_t len = (size_t)frame->payload_len;
+
+  if (len > 0 && recv_all(conn, p, len) != (ssize_t)len) {
+    return 1;
+  }
+  if (frame->masked) {
+    for (size_t i = 0; i < len; i++) {
+      p[i] ^= frame->mask[i & 3u];
+    }
+  }
+  return 0;
+}
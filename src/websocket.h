@@ -0,0 +1,53 @@
+#ifndef HF_WEBSOCKET_H
+#define HF_WEBSOCKET_H
+
+#include "net.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WEBSOCKET_ACCEPT_LEN 28u
+#define WEBSOCKET_FRAME_HEADER_MAX 10u
+#define WEBSOCKET_CONTROL_MAX 125u
+
+typedef enum {
+  WEBSOCKET_OP_CONTINUATION = 0x0,
+  WEBSOCKET_OP_TEXT = 0x1,
+  WEBSOCKET_OP_BINARY = 0x2,
+  WEBSOCKET_OP_CLOSE = 0x8,
+  WEBSOCKET_OP_PING = 0x9,
+  WEBSOCKET_OP_PONG = 0xA,
+} websocket_opcode_t;
+
+typedef enum {
+  WEBSOCKET_CLOSE_NORMAL = 1000,
+  WEBSOCKET_CLOSE_GOING_AWAY = 1001,
+  WEBSOCKET_CLOSE_PROTOCOL_ERROR = 1002,
+  WEBSOCKET_CLOSE_UNSUPPORTED = 1003,
+  WEBSOCKET_CLOSE_INVALID_PAYLOAD = 1007,
+  WEBSOCKET_CLOSE_TOO_BIG = 1009,
+} websocket_close_code_t;
+
+typedef struct {
+  int fin;
+  websocket_opcode_t opcode;
+  uint64_t payload_len;
+  uint8_t mask[4];
+  int masked;
+} websocket_frame_t;
+
+// out receives the NUL-terminated Sec-WebSocket-Accept value.
+int websocket_accept_key(const char *client_key, char out[WEBSOCKET_ACCEPT_LEN + 1u]);
+
+// Builds an unmasked, final server frame header and returns its length.
+size_t websocket_frame_header(websocket_opcode_t opcode, uint64_t payload_len,
+                              uint8_t out[WEBSOCKET_FRAME_HEADER_MAX]);
+int websocket_send_frame(socket_t conn, websocket_opcode_t opcode, const void *payload,
+                         size_t len);
+int websocket_send_close(socket_t conn, websocket_close_code_t code);
+
+// Returns 0 on success, 1 on EOF or I/O error, 2 on a protocol violation.
+int websocket_recv_frame_header(socket_t conn, websocket_frame_t *frame);
+int websocket_recv_payload(socket_t conn, const websocket_frame_t *frame, void *out);
+
+#endif  // HF_WEBSOCKET_H
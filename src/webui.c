@@ -1,5 +1,11 @@
 #include "webui.h"
 
+#include "gzip.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static const char webui_index_html[] =
@@ -25,7 +31,7 @@ static const char webui_index_html[] =
   "        <label for=\"file-input\" class=\"button choose-btn\">Choose File</label>\n"
   "        <button id=\"upload-btn\" type=\"button\" class=\"send-btn\">Send File</button>\n"
   "      </div>\n"
-  "      <input id=\"file-input\" type=\"file\" class=\"sr-only\">\n"
+  "      <input id=\"file-input\" type=\"file\" class=\"sr-only\" multiple>\n"
   "    </section>\n"
   "    <section class=\"card stack\">\n"
   "      <div class=\"section-head\">\n"
@@ -47,6 +53,7 @@ static const char webui_index_html[] =
   "        <div class=\"section-actions\">\n"
   "          <button id=\"up-dir\" type=\"button\" class=\"quiet\" disabled>Up</button>\n"
   "          <button id=\"refresh-files\" type=\"button\" class=\"quiet\">Refresh</button>\n"
+  "          <button id=\"download-dir\" type=\"button\" class=\"quiet\">Zip</button>\n"
   "        </div>\n"
   "      </div>\n"
   "      <p id=\"current-dir\" class=\"inline-status\">Current Folder: /</p>\n"
@@ -279,6 +286,12 @@ static const char webui_styles_css[] =
   ".message-card.empty {\n"
   "  color: var(--muted);\n"
   "}\n"
+  ".message-card img {\n"
+  "  display: block;\n"
+  "  max-width: 100%;\n"
+  "  margin-top: 10px;\n"
+  "  border-radius: 10px;\n"
+  "}\n"
   "@media (hover: hover) and (pointer: fine) {\n"
   "  .button,\n"
   "  button,\n"
@@ -332,6 +345,7 @@ static const char webui_app_js[] =
   "const upDirBtn = document.getElementById('up-dir');\n"
   "const fileRows = new Map();\n"
   "let latestMessageStream = null;\n"
+  "let messageSocket = null;\n"
   "let latestMessageValue = '';\n"
   "let currentDir = '';\n"
   "\n"
@@ -462,25 +476,102 @@ static const char webui_app_js[] =
   "  syncFileList(files);\n"
   "}\n"
   "\n"
+  "const UPLOAD_CHUNK_SIZE = 8 * 1024 * 1024;\n"
+  "const UPLOAD_PARALLEL = 4;\n"
+  "const UPLOAD_RETRIES = 6;\n"
+  "\n"
+  "function sleep(ms) {\n"
+  "  return new Promise((resolve) => setTimeout(resolve, ms));\n"
+  "}\n"
+  "\n"
+  "// The session id is remembered per file so a reload or a dropped network\n"
+  "// picks up from the chunks the server already has.\n"
+  "async function openUploadSession(file, path) {\n"
+  "  const key = `hf-upload:${path}:${file.size}:${file.lastModified}`;\n"
+  "  const savedId = localStorage.getItem(key);\n"
+  "  if (savedId) {\n"
+  "    const res = await fetch(`/api/uploads/${savedId}`, { cache: 'no-store' });\n"
+  "    if (res.ok) return { key, session: await res.json() };\n"
+  "    localStorage.removeItem(key);\n"
+  "  }\n"
+  "  const query = `path=${encodeURIComponent(path)}&size=${file.size}&chunk_size=${UPLOAD_CHUNK_SIZE}`;\n"
+  "  const res = await fetch(`/api/uploads?${query}`, { method: 'POST' });\n"
+  "  const payload = await res.json().catch(() => ({}));\n"
+  "  if (!res.ok) throw new Error(payload.error || 'Upload failed.');\n"
+  "  localStorage.setItem(key, payload.id);\n"
+  "  return { key, session: payload };\n"
+  "}\n"
+  "\n"
+  "async function putChunk(file, session, index) {\n"
+  "  const start = index * session.chunk_size;\n"
+  "  const end = Math.min(start + session.chunk_size, file.size);\n"
+  "  for (let attempt = 0; ; attempt++) {\n"
+  "    let res = null;\n"
+  "    try {\n"
+  "      res = await fetch(`/api/uploads/${session.id}`, {\n"
+  "        method: 'PUT',\n"
+  "        headers: { 'Content-Range': `bytes ${start}-${end - 1}/${file.size}` },\n"
+  "        body: file.slice(start, end),\n"
+  "      });\n"
+  "    } catch (err) {\n"
+  "      if (attempt >= UPLOAD_RETRIES) throw err;\n"
+  "    }\n"
+  "    if (res && res.ok) return;\n"
+  "    if (res && res.status < 500) {\n"
+  "      const payload = await res.json().catch(() => ({}));\n"
+  "      throw new Error(payload.error || 'Upload failed.');\n"
+  "    }\n"
+  "    if (res && attempt >= UPLOAD_RETRIES) throw new Error('Upload failed.');\n"
+  "    await sleep(Math.min(500 * 2 ** attempt, 15000));\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "async function uploadOneFile(file, onProgress) {\n"
+  "  const path = currentDir ? `${currentDir}/${file.name}` : file.name;\n"
+  "  const { key, session } = await openUploadSession(file, path);\n"
+  "  const total = Math.ceil(file.size / session.chunk_size);\n"
+  "  const have = new Set();\n"
+  "  for (const [start, end] of session.received) {\n"
+  "    for (let i = start / session.chunk_size; i * session.chunk_size < end; i++) have.add(i);\n"
+  "  }\n"
+  "  const queue = [];\n"
+  "  for (let i = 0; i < total; i++) {\n"
+  "    if (!have.has(i)) queue.push(i);\n"
+  "  }\n"
+  "  onProgress(have.size, total);\n"
+  "  const worker = async () => {\n"
+  "    while (queue.length > 0) {\n"
+  "      const index = queue.shift();\n"
+  "      await putChunk(file, session, index);\n"
+  "      have.add(index);\n"
+  "      onProgress(have.size, total);\n"
+  "    }\n"
+  "  };\n"
+  "  const workers = [];\n"
+  "  for (let i = 0; i < Math.min(UPLOAD_PARALLEL, queue.length); i++) workers.push(worker());\n"
+  "  await Promise.all(workers);\n"
+  "\n"
+  "  const res = await fetch(`/api/uploads/${session.id}`, { method: 'POST' });\n"
+  "  const payload = await res.json().catch(() => ({}));\n"
+  "  if (!res.ok) throw new Error(payload.error || 'Upload failed.');\n"
+  "  localStorage.removeItem(key);\n"
+  "}\n"
+  "\n"
   "async function uploadFile() {\n"
-  "  const file = fileInput.files && fileInput.files[0];\n"
-  "  if (!file) {\n"
+  "  const files = fileInput.files ? Array.from(fileInput.files) : [];\n"
+  "  if (files.length === 0) {\n"
   "    uploadStatus.textContent = 'Pick a file first.';\n"
   "    return;\n"
   "  }\n"
-  "  const targetPath = currentDir ? `${currentDir}/${file.name}` : file.name;\n"
-  "  uploadStatus.textContent = `Uploading ${targetPath}...`;\n"
-  "  const res = await fetch(`/api/files/${encodeURIComponent(targetPath)}`, {\n"
-  "    method: 'PUT',\n"
-  "    headers: { 'Content-Type': 'application/octet-stream' },\n"
-  "    body: file,\n"
-  "  });\n"
-  "  const payload = await res.json().catch(() => ({}));\n"
-  "  if (!res.ok) {\n"
-  "    uploadStatus.textContent = payload.error || 'Upload failed.';\n"
-  "    return;\n"
+  "  for (const file of files) {\n"
+  "    uploadStatus.textContent = `Uploading ${file.name}...`;\n"
+  "    await uploadOneFile(file, (done, total) => {\n"
+  "      const pct = total === 0 ? 100 : Math.floor((done * 100) / total);\n"
+  "      uploadStatus.textContent = `Uploading ${file.name}... ${pct}%`;\n"
+  "    });\n"
   "  }\n"
-  "  uploadStatus.textContent = `Saved ${targetPath}.`;\n"
+  "  const label = files.length === 1 ? files[0].name : `${files.length} files`;\n"
+  "  uploadStatus.textContent = `Saved ${label}.`;\n"
   "  fileInput.value = '';\n"
   "  await loadFiles(currentDir);\n"
   "}\n"
@@ -488,6 +579,10 @@ static const char webui_app_js[] =
   "async function postMessage() {\n"
   "  const message = messageInput.value;\n"
   "  messageStatus.textContent = 'Posting message...';\n"
+  "  if (messageSocket && messageSocket.readyState === WebSocket.OPEN) {\n"
+  "    messageSocket.send(JSON.stringify({ message }));\n"
+  "    return;\n"
+  "  }\n"
   "  const res = await fetch('/api/messages', {\n"
   "    method: 'POST',\n"
   "    headers: { 'Content-Type': 'application/json' },\n"
@@ -503,6 +598,36 @@ static const char webui_app_js[] =
   "  await loadLatestMessage();\n"
   "}\n"
   "\n"
+  "async function postBinaryMessage(file) {\n"
+  "  messageStatus.textContent = 'Posting attachment...';\n"
+  "  const res = await fetch('/api/messages', {\n"
+  "    method: 'POST',\n"
+  "    headers: { 'Content-Type': file.type || 'application/octet-stream' },\n"
+  "    body: file,\n"
+  "  });\n"
+  "  const payload = await res.json().catch(() => ({}));\n"
+  "  messageStatus.textContent = res.ok ? 'Attachment saved.' : (payload.error || 'Attachment failed.');\n"
+  "}\n"
+  "\n"
+  "function renderBinaryMessage(payload) {\n"
+  "  if (payload.expired) {\n"
+  "    latestMessageNode.textContent = `${payload.mime} · payload expired`;\n"
+  "    return;\n"
+  "  }\n"
+  "  const url = `/api/messages/default/${payload.version}`;\n"
+  "  const link = document.createElement('a');\n"
+  "  link.href = url;\n"
+  "  link.target = '_blank';\n"
+  "  link.textContent = `${payload.mime} · ${fmtSize(payload.size)}`;\n"
+  "  latestMessageNode.replaceChildren(link);\n"
+  "  if (String(payload.mime).startsWith('image/')) {\n"
+  "    const img = document.createElement('img');\n"
+  "    img.src = url;\n"
+  "    img.alt = payload.mime;\n"
+  "    latestMessageNode.appendChild(img);\n"
+  "  }\n"
+  "}\n"
+  "\n"
   "function renderLatestMessage(payload) {\n"
   "  if (!payload || !payload.has_message) {\n"
   "    latestMessageValue = '';\n"
@@ -514,8 +639,13 @@ static const char webui_app_js[] =
   "  }\n"
   "  latestMessageValue = String(payload.message || '');\n"
   "  latestMessageNode.className = 'message-card';\n"
-  "  latestMessageNode.textContent = latestMessageValue;\n"
   "  latestMessageStatus.textContent = '';\n"
+  "  if (payload.mime) {\n"
+  "    renderBinaryMessage(payload);\n"
+  "    copyLatestMessageBtn.disabled = true;\n"
+  "    return;\n"
+  "  }\n"
+  "  latestMessageNode.textContent = latestMessageValue;\n"
   "  copyLatestMessageBtn.disabled = false;\n"
   "}\n"
   "\n"
@@ -526,6 +656,37 @@ static const char webui_app_js[] =
   "  renderLatestMessage(payload);\n"
   "}\n"
   "\n"
+  "function connectMessageSocket() {\n"
+  "  const scheme = window.location.protocol === 'https:' ? 'wss' : 'ws';\n"
+  "  const socket = new WebSocket(`${scheme}://${window.location.host}/api/ws`);\n"
+  "  let opened = false;\n"
+  "  socket.onopen = () => {\n"
+  "    opened = true;\n"
+  "    messageSocket = socket;\n"
+  "    latestMessageStatus.textContent = '';\n"
+  "  };\n"
+  "  socket.onmessage = (event) => {\n"
+  "    const payload = JSON.parse(event.data);\n"
+  "    if (payload.type === 'message') {\n"
+  "      renderLatestMessage({ ...payload, has_message: true });\n"
+  "    } else if (payload.type === 'ack') {\n"
+  "      messageStatus.textContent = 'Message saved.';\n"
+  "      messageInput.value = '';\n"
+  "    } else if (payload.type === 'error') {\n"
+  "      messageStatus.textContent = payload.error || 'Message failed.';\n"
+  "    }\n"
+  "  };\n"
+  "  socket.onclose = () => {\n"
+  "    messageSocket = null;\n"
+  "    if (!opened) {\n"
+  "      connectLatestMessageStream();\n"
+  "      return;\n"
+  "    }\n"
+  "    latestMessageStatus.textContent = 'Live message stream reconnecting...';\n"
+  "    setTimeout(connectMessageSocket, 2000);\n"
+  "  };\n"
+  "}\n"
+  "\n"
   "function connectLatestMessageStream() {\n"
   "  if (latestMessageStream) {\n"
   "    latestMessageStream.close();\n"
@@ -534,6 +695,10 @@ static const char webui_app_js[] =
   "  latestMessageStream.addEventListener('message', (event) => {\n"
   "    renderLatestMessage({ has_message: true, message: event.data });\n"
   "  });\n"
+  "  latestMessageStream.addEventListener('binary', (event) => {\n"
+  "    const version = Number(event.lastEventId);\n"
+  "    renderLatestMessage({ ...JSON.parse(event.data), has_message: true, version });\n"
+  "  });\n"
   "  latestMessageStream.onerror = () => {\n"
   "    latestMessageStatus.textContent = 'Live message stream reconnecting...';\n"
   "  };\n"
@@ -566,18 +731,33 @@ static const char webui_app_js[] =
   "}\n"
   "\n"
   "fileInput.addEventListener('change', () => {\n"
-  "  const file = fileInput.files && fileInput.files[0];\n"
-  "  uploadStatus.textContent = file ? `Ready: ${file.name}` : '';\n"
+  "  const files = fileInput.files ? Array.from(fileInput.files) : [];\n"
+  "  uploadStatus.textContent = files.length > 0\n"
+  "    ? `Ready: ${files.map((file) => file.name).join(', ')}`\n"
+  "    : '';\n"
   "});\n"
   "document.getElementById('upload-btn').addEventListener('click', () => {\n"
   "  uploadFile().catch((err) => { uploadStatus.textContent = err.message; });\n"
   "});\n"
+  "messageInput.addEventListener('paste', (event) => {\n"
+  "  const items = event.clipboardData ? Array.from(event.clipboardData.items) : [];\n"
+  "  const item = items.find((entry) => entry.kind === 'file');\n"
+  "  const file = item ? item.getAsFile() : null;\n"
+  "  if (!file) {\n"
+  "    return;\n"
+  "  }\n"
+  "  event.preventDefault();\n"
+  "  postBinaryMessage(file).catch((err) => { messageStatus.textContent = err.message; });\n"
+  "});\n"
   "document.getElementById('message-btn').addEventListener('click', () => {\n"
   "  postMessage().catch((err) => { messageStatus.textContent = err.message; });\n"
   "});\n"
   "document.getElementById('refresh-files').addEventListener('click', () => {\n"
   "  loadFiles(currentDir).catch((err) => { uploadStatus.textContent = err.message; });\n"
   "});\n"
+  "document.getElementById('download-dir').addEventListener('click', () => {\n"
+  "  window.location.href = `/api/archive?path=${encodeURIComponent(currentDir)}`;\n"
+  "});\n"
   "upDirBtn.addEventListener('click', () => {\n"
   "  loadFiles(parentDir(currentDir)).catch((err) => { uploadStatus.textContent = err.message; });\n"
   "});\n"
@@ -595,7 +775,11 @@ static const char webui_app_js[] =
   "renderCurrentDir();\n"
   "loadFiles().catch((err) => { uploadStatus.textContent = err.message; });\n"
   "loadLatestMessage().catch((err) => { messageStatus.textContent = err.message; });\n"
-  "connectLatestMessageStream();\n";
+  "if ('WebSocket' in window) {\n"
+  "  connectMessageSocket();\n"
+  "} else {\n"
+  "  connectLatestMessageStream();\n"
+  "}\n";
 
 static const webui_asset_t webui_assets[] = {
   {
@@ -624,8 +808,120 @@ static const webui_asset_t webui_assets[] = {
   },
 };
 
+#define WEBUI_ASSET_COUNT (sizeof(webui_assets) / sizeof(webui_assets[0]))
+
+static webui_variant_t webui_variants[WEBUI_ASSET_COUNT][WEBUI_ENCODING_COUNT];
+
+static uint64_t webui_hash_body(const char *body, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)body[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static void webui_free_variant(webui_variant_t *variant) {
+  free(variant->response);
+  free(variant->not_modified);
+  memset(variant, 0, sizeof(*variant));
+}
+
+static int webui_build_variant(webui_variant_t *variant,
+                               const webui_asset_t *asset,
+                               const char *etag_suffix,
+                               const char *content_encoding,
+                               const char *body,
+                               size_t body_len) {
+  char header[512];
+  int n = snprintf(variant->etag, sizeof(variant->etag), "\"%016" PRIx64 "%s\"",
+                   webui_hash_body(asset->body, asset->body_len), etag_suffix);
+  if (n < 0 || (size_t)n >= sizeof(variant->etag)) {
+    return 1;
+  }
+
+  n = snprintf(header, sizeof(header),
+               "HTTP/1.1 200 OK\r\n"
+               "Content-Type: %s\r\n"
+               "Content-Length: %zu\r\n"
+               "Connection: close\r\n"
+               "Cache-Control: no-cache\r\n"
+               "ETag: %s\r\n"
+               "Vary: Accept-Encoding\r\n"
+               "%s%s%s"
+               "\r\n",
+               asset->content_type, body_len, variant->etag,
+               content_encoding != NULL ? "Content-Encoding: " : "",
+               content_encoding != NULL ? content_encoding : "",
+               content_encoding != NULL ? "\r\n" : "");
+  if (n < 0 || (size_t)n >= sizeof(header)) {
+    return 1;
+  }
+  variant->response = (char *)malloc((size_t)n + body_len);
+  if (variant->response == NULL) {
+    return 1;
+  }
+  memcpy(variant->response, header, (size_t)n);
+  memcpy(variant->response + n, body, body_len);
+  variant->response_len = (size_t)n + body_len;
+
+  n = snprintf(header, sizeof(header),
+               "HTTP/1.1 304 Not Modified\r\n"
+               "Connection: close\r\n"
+               "Cache-Control: no-cache\r\n"
+               "ETag: %s\r\n"
+               "Vary: Accept-Encoding\r\n"
+               "\r\n",
+               variant->etag);
+  if (n < 0 || (size_t)n >= sizeof(header)) {
+    return 1;
+  }
+  variant->not_modified = (char *)malloc((size_t)n);
+  if (variant->not_modified == NULL) {
+    return 1;
+  }
+  memcpy(variant->not_modified, header, (size_t)n);
+  variant->not_modified_len = (size_t)n;
+  return 0;
+}
+
+int webui_init(void) {
+  for (size_t i = 0; i < WEBUI_ASSET_COUNT; i++) {
+    const webui_asset_t *asset = &webui_assets[i];
+    webui_variant_t *variants = webui_variants[i];
+    char *gz = NULL;
+    size_t gz_len = 0;
+
+    if (webui_build_variant(&variants[WEBUI_ENCODING_IDENTITY], asset, "", NULL,
+                            asset->body, asset->body_len) != 0) {
+      webui_cleanup();
+      return 1;
+    }
+
+    // A failed or unprofitable compression just leaves the asset identity-only.
+    if (gzip_compress(asset->body, asset->body_len, &gz, &gz_len) == 0) {
+      if (gz_len < asset->body_len &&
+          webui_build_variant(&variants[WEBUI_ENCODING_GZIP], asset, "-gz",
+                              "gzip", gz, gz_len) != 0) {
+        webui_free_variant(&variants[WEBUI_ENCODING_GZIP]);
+      }
+      free(gz);
+    }
+  }
+
+  return 0;
+}
+
+void webui_cleanup(void) {
+  for (size_t i = 0; i < WEBUI_ASSET_COUNT; i++) {
+    for (size_t e = 0; e < WEBUI_ENCODING_COUNT; e++) {
+      webui_free_variant(&webui_variants[i][e]);
+    }
+  }
+}
+
 const webui_asset_t *webui_find_asset(const char *path) {
-  size_t count = sizeof(webui_assets) / sizeof(webui_assets[0]);
+  size_t count = WEBUI_ASSET_COUNT;
 
   if (path == NULL) {
     return NULL;
@@ -639,3 +935,20 @@ const webui_asset_t *webui_find_asset(const char *path) {
 
   return NULL;
 }
+
+const webui_variant_t *webui_select_variant(const webui_asset_t *asset, int accepts_gzip) {
+  const webui_variant_t *variants = NULL;
+
+  if (asset == NULL || asset < webui_assets || asset >= webui_assets + WEBUI_ASSET_COUNT) {
+    return NULL;
+  }
+
+  variants = webui_variants[asset - webui_assets];
+  if (accepts_gzip && variants[WEBUI_ENCODING_GZIP].response != NULL) {
+    return &variants[WEBUI_ENCODING_GZIP];
+  }
+  if (variants[WEBUI_ENCODING_IDENTITY].response != NULL) {
+    return &variants[WEBUI_ENCODING_IDENTITY];
+  }
+  return NULL;
+}
@@ -3,6 +3,21 @@
 
 #include <stddef.h>
 
+typedef enum {
+  WEBUI_ENCODING_IDENTITY = 0,
+  WEBUI_ENCODING_GZIP,
+  WEBUI_ENCODING_COUNT,
+} webui_encoding_t;
+
+// Prebuilt status line, headers and body, sent with a single write.
+typedef struct {
+  char etag[32];
+  char *response;
+  size_t response_len;
+  char *not_modified;
+  size_t not_modified_len;
+} webui_variant_t;
+
 typedef struct {
   const char *path;
   const char *content_type;
@@ -10,6 +25,9 @@ typedef struct {
   size_t body_len;
 } webui_asset_t;
 
+int webui_init(void);
+void webui_cleanup(void);
 const webui_asset_t *webui_find_asset(const char *path);
+const webui_variant_t *webui_select_variant(const webui_asset_t *asset, int accepts_gzip);
 
 #endif  // HF_WEBUI_H
@@ -214,10 +214,12 @@ def run_hf(
     timeout: float = 10.0,
     env: dict[str, str] | None = None,
     cwd: Path | None = None,
+    input_text: str | None = None,
 ) -> RunResult:
     argv = [str(hf_path), *[str(a) for a in args]]
     p = subprocess.run(
         argv,
+        input=input_text,
         stdout=subprocess.PIPE,
         stderr=subprocess.PIPE,
         text=True,
@@ -303,6 +305,7 @@ class HFileServer:
         port: int | None = None,
         log_path: Path | None = None,
         extra_args: Sequence[os.PathLike[str] | str] = (),
+        env: dict[str, str] | None = None,
     ) -> None:
         self.hf_path = Path(hf_path)
         self.out_dir = Path(out_dir)
@@ -311,6 +314,7 @@ class HFileServer:
         self.log_path = Path(log_path) if log_path is not None else None
         self._startup_log_path: Path | None = None
         self.extra_args = tuple(str(arg) for arg in extra_args)
+        self.env = dict(env) if env is not None else None
         self._proc: subprocess.Popen[str] | None = None
         self._log_fh = None
         self._pid: int | None = None
@@ -352,6 +356,7 @@ class HFileServer:
             argv,
             stdout=self._log_fh,
             stderr=subprocess.STDOUT,
+            env=(os.environ | self.env) if self.env is not None else None,
             text=True,
             encoding="utf-8",
             errors="replace",
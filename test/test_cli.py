@@ -1,9 +1,13 @@
 from __future__ import annotations
 
+import json
 import os
 import socket
 import subprocess
+import threading
 import unittest
+import urllib.error
+import urllib.request
 from pathlib import Path
 
 from test.support.hf import (
@@ -77,7 +81,7 @@ class TestCLI(unittest.TestCase):
                 "args": ["-c", "in", "-g", "out"],
                 "rc": 1,
                 "stderr_contains": [
-                    "must choose exactly one client action: -c, -g, or -m",
+                    "must choose exactly one client action: -c, -g, -m, or -b",
                     "usage:",
                 ],
             },
@@ -93,6 +97,72 @@ class TestCLI(unittest.TestCase):
                 "rc": 1,
                 "stderr_contains": ["invalid port", "usage:"],
             },
+            {
+                "name": "durable_requires_server",
+                "args": ["-c", "in", "-s"],
+                "rc": 1,
+                "stderr_contains": ["-s requires -d", "usage:"],
+            },
+            {
+                "name": "message_log_requires_server",
+                "args": ["-m", "hi", "-l", "x.log"],
+                "rc": 1,
+                "stderr_contains": ["-l requires -d", "usage:"],
+            },
+            {
+                "name": "channel_requires_message",
+                "args": ["-c", "x", "-n", "alpha"],
+                "rc": 1,
+                "stderr_contains": ["-n requires -m or -b", "usage:"],
+            },
+            {
+                "name": "mime_requires_binary_message",
+                "args": ["-m", "hi", "-t", "image/png"],
+                "rc": 1,
+                "stderr_contains": ["-t requires -b", "usage:"],
+            },
+            {
+                "name": "checksum_requires_sync",
+                "args": ["-c", "x", "-k"],
+                "rc": 1,
+                "stderr_contains": ["-k requires sync", "usage:"],
+            },
+            {
+                "name": "json_requires_transfer",
+                "args": ["-m", "hi", "-J"],
+                "rc": 1,
+                "stderr_contains": ["-J requires -c, -g or sync", "usage:"],
+            },
+            {
+                "name": "rate_below_minimum",
+                "args": ["-c", "x", "-r", "1K"],
+                "rc": 1,
+                "stderr_contains": ["invalid rate", "usage:"],
+            },
+            {
+                "name": "global_rate_requires_transfer",
+                "args": ["-m", "hi", "-R", "1M"],
+                "rc": 1,
+                "stderr_contains": ["-R requires -d, -c, -g or sync", "usage:"],
+            },
+            {
+                "name": "stream_name_requires_stdin",
+                "args": ["-c", "x", "-N", "out.tar"],
+                "rc": 1,
+                "stderr_contains": ["-N requires -c -", "usage:"],
+            },
+            {
+                "name": "sync_requires_directory",
+                "args": ["sync", "-k"],
+                "rc": 1,
+                "stderr_contains": ["sync requires a directory", "usage:"],
+            },
+            {
+                "name": "control_with_s",
+                "args": ["stop", "-s"],
+                "rc": 1,
+                "stderr_contains": ["control mode does not accept -s", "usage:"],
+            },
             {
                 "name": "output_requires_get",
                 "args": ["-o", "out.txt"],
@@ -337,5 +407,146 @@ class TestCLI(unittest.TestCase):
             finally:
                 server.stop()
 
+    def test_message_log_restores_messages_after_restart(self) -> None:
+        def fetch(server: HFileServer, path: str) -> dict:
+            with urllib.request.urlopen(server.http_url + path, timeout=5.0) as resp:
+                return json.loads(resp.read().decode("utf-8"))
+
+        with make_temp_dir(prefix="hf_cli_message_log_") as tmp_dir:
+            out_dir = Path(tmp_dir) / "out"
+            log_path = Path(tmp_dir) / "messages.log"
+            server = HFileServer(
+                hf_path=self.hf_path,
+                out_dir=out_dir,
+                port=reserve_free_port(),
+                extra_args=["-l", str(log_path)],
+            )
+            server.start(startup_timeout=5.0)
+            try:
+                for text in ("first", "second", "third"):
+                    req = urllib.request.Request(
+                        server.http_url + "/api/messages",
+                        data=json.dumps({"message": text}).encode("utf-8"),
+                        method="POST",
+                        headers={"Content-Type": "application/json"},
+                    )
+                    with urllib.request.urlopen(req, timeout=5.0) as resp:
+                        self.assertEqual(201, resp.status)
+                req = urllib.request.Request(
+                    server.http_url + "/api/messages/shots",
+                    data=b"\x89PNG payload",
+                    method="POST",
+                    headers={"Content-Type": "image/png"},
+                )
+                with urllib.request.urlopen(req, timeout=5.0) as resp:
+                    self.assertEqual(201, resp.status)
+            finally:
+                server.stop()
+            self.assertTrue(log_path.is_file())
+
+            # A torn append from a crash is cut off on the next start.
+            with log_path.open("ab") as f:
+                f.write(b"\x10\x00\x00\x00partial")
+
+            server = HFileServer(
+                hf_path=self.hf_path,
+                out_dir=out_dir,
+                port=reserve_free_port(),
+                extra_args=["-l", str(log_path)],
+            )
+            server.start(startup_timeout=5.0)
+            try:
+                latest = fetch(server, "/api/messages/latest")
+                self.assertEqual("third", latest["message"])
+                self.assertEqual(3, latest["version"])
+                history = fetch(server, "/api/messages?since=0")
+                self.assertEqual(
+                    ["first", "second", "third"],
+                    [m["message"] for m in history["messages"]],
+                )
+                self.assertTrue(all("mime" not in m for m in history["messages"]))
+
+                # The binary payload is gone; only its type comes back.
+                shot = fetch(server, "/api/messages/shots/latest")
+                self.assertEqual(1, shot["version"])
+                self.assertEqual("image/png", shot["mime"])
+                self.assertTrue(shot["expired"])
+                with self.assertRaises(urllib.error.HTTPError) as ctx:
+                    urllib.request.urlopen(server.http_url + "/api/messages/shots/1", timeout=5.0)
+                self.assertEqual(410, ctx.exception.code)
+                ctx.exception.close()
+            finally:
+                server.stop()
+
+    def test_message_log_compaction_keeps_concurrent_publishes(self) -> None:
+        channels = ("alpha", "beta")
+        per_channel = 60
+        pad = "x" * 200_000
+
+        def post(server: HFileServer, channel: str, text: str) -> None:
+            req = urllib.request.Request(
+                f"{server.http_url}/api/messages/{channel}",
+                data=json.dumps({"message": text}).encode("utf-8"),
+                method="POST",
+                headers={"Content-Type": "application/json"},
+            )
+            with urllib.request.urlopen(req, timeout=10.0) as resp:
+                self.assertEqual(201, resp.status)
+
+        def fetch(server: HFileServer, path: str) -> dict:
+            with urllib.request.urlopen(server.http_url + path, timeout=5.0) as resp:
+                return json.loads(resp.read().decode("utf-8"))
+
+        with make_temp_dir(prefix="hf_cli_message_compact_") as tmp_dir:
+            out_dir = Path(tmp_dir) / "out"
+            log_path = Path(tmp_dir) / "messages.log"
+            server = HFileServer(
+                hf_path=self.hf_path,
+                out_dir=out_dir,
+                port=reserve_free_port(),
+                extra_args=["-l", str(log_path)],
+            )
+            server.start(startup_timeout=5.0)
+            errors: list[BaseException] = []
+
+            def publish(channel: str) -> None:
+                try:
+                    for i in range(1, per_channel + 1):
+                        post(server, channel, f"{channel}-{i}-{pad}")
+                except BaseException as e:
+                    errors.append(e)
+
+            try:
+                workers = [threading.Thread(target=publish, args=(c,)) for c in channels]
+                for t in workers:
+                    t.start()
+                for t in workers:
+                    t.join()
+                self.assertEqual([], errors)
+            finally:
+                server.stop()
+
+            # Both channels wrote about 24 MB in all; compaction must have
+            # dropped what fell out of their histories.
+            self.assertLess(log_path.stat().st_size, 20_000_000)
+
+            server = HFileServer(
+                hf_path=self.hf_path,
+                out_dir=out_dir,
+                port=reserve_free_port(),
+                extra_args=["-l", str(log_path)],
+            )
+            server.start(startup_timeout=5.0)
+            try:
+                for channel in channels:
+                    history = fetch(server, f"/api/messages/{channel}?since=0")
+                    versions = [m["version"] for m in history["messages"]]
+                    self.assertEqual(per_channel, history["latest_version"])
+                    self.assertEqual(list(range(versions[0], per_channel + 1)), versions)
+                    for m in history["messages"]:
+                        self.assertEqual(f"{channel}-{m['version']}-{pad}", m["message"])
+            finally:
+                server.stop()
+
 if __name__ == "__main__":
     unittest.main(verbosity=2)
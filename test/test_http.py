@@ -1,15 +1,25 @@
 from __future__ import annotations
 
+import base64
+import gzip
+import hashlib
 import http.client
+import io
 import json
 import os
+import select
 import signal
 import shutil
+import socket
+import struct
+import sys
+import tarfile
 import time
 import unittest
 import urllib.error
 import urllib.parse
 import urllib.request
+import zipfile
 from pathlib import Path
 
 from test.support.hf import (
@@ -160,6 +170,52 @@ class TestHTTP(unittest.TestCase):
         self.assertIn("Current Folder:", body.decode("utf-8", errors="replace"))
         self.assertIn("loadFiles(parentDir(currentDir))", body.decode("utf-8", errors="replace"))
 
+    def test_static_assets_negotiate_gzip_and_revalidate(self) -> None:
+        status, plain, headers = self._request("GET", "/app.js")
+        self.assertEqual(status, 200)
+        self.assertIsNone(headers.get("Content-Encoding"))
+        plain_etag = headers.get("ETag")
+        self.assertTrue(plain_etag)
+        self.assertEqual(headers.get("Cache-Control"), "no-cache")
+
+        status, packed, headers = self._request(
+            "GET", "/app.js", headers={"Accept-Encoding": "gzip, deflate"}
+        )
+        self.assertEqual(status, 200)
+        self.assertEqual(headers.get("Content-Encoding"), "gzip")
+        self.assertEqual(headers.get("Vary"), "Accept-Encoding")
+        self.assertLess(len(packed), len(plain))
+        self.assertEqual(gzip.decompress(packed), plain)
+        gzip_etag = headers.get("ETag")
+        self.assertNotEqual(gzip_etag, plain_etag)
+
+        status, body, headers = self._request(
+            "GET", "/app.js", headers={"Accept-Encoding": "gzip;q=0, *"}
+        )
+        self.assertEqual(status, 200)
+        self.assertIsNone(headers.get("Content-Encoding"))
+        self.assertEqual(body, plain)
+
+        status, body, headers = self._request(
+            "GET", "/app.js", headers={"If-None-Match": f"\"other\", W/{plain_etag}"}
+        )
+        self.assertEqual(status, 304)
+        self.assertEqual(body, b"")
+        self.assertEqual(headers.get("ETag"), plain_etag)
+
+        status, body, _ = self._request(
+            "GET",
+            "/app.js",
+            headers={"Accept-Encoding": "gzip", "If-None-Match": gzip_etag},
+        )
+        self.assertEqual(status, 304)
+
+        status, body, _ = self._request(
+            "GET", "/app.js", headers={"If-None-Match": gzip_etag}
+        )
+        self.assertEqual(status, 200)
+        self.assertEqual(body, plain)
+
     def test_upload_list_and_download(self) -> None:
         src = self.in_dir / "mobile.txt"
         src.write_bytes(b"hello from mobile web\n")
@@ -200,6 +256,85 @@ class TestHTTP(unittest.TestCase):
         self.assertEqual(status, 405, body.decode("utf-8", errors="replace"))
         self.assertTrue(dst.exists(), f"file should not be deleted: {dst}")
 
+    def test_multipart_upload_saves_every_file_part(self) -> None:
+        boundary = "----hfBoundary7MA4YWxkTrZu0gW"
+        target_dir = self.out_dir / "multipart"
+        self._reset_output_path(target_dir)
+        target_dir.mkdir(parents=True)
+
+        large = os.urandom(3 * 1024 * 1024 + 17)
+        # Near-miss delimiters inside the payload must stay part of the data.
+        tricky = b"head\r\n--" + boundary.encode("ascii")[:-1] + b"X\r\n--tail"
+        parts = [
+            (b'Content-Disposition: form-data; name="note"', b"not a file"),
+            (
+                b'Content-Disposition: form-data; name="files"; filename="big.bin"\r\n'
+                b"Content-Type: application/octet-stream",
+                large,
+            ),
+            (
+                b'Content-Disposition: form-data; name="files"; filename="C:\\tmp\\tricky.txt"',
+                tricky,
+            ),
+            (b'Content-Disposition: form-data; name="files"; filename="empty.txt"', b""),
+        ]
+        body = b"preamble\r\n"
+        for headers, content in parts:
+            body += b"--" + boundary.encode("ascii") + b"\r\n" + headers + b"\r\n\r\n"
+            body += content + b"\r\n"
+        body += b"--" + boundary.encode("ascii") + b"--\r\nepilogue"
+
+        status, resp, _ = self._request(
+            "POST",
+            "/api/files?path=multipart",
+            data=body,
+            headers={"Content-Type": f'multipart/form-data; boundary="{boundary}"'},
+        )
+        self.assertEqual(status, 201, resp.decode("utf-8", errors="replace"))
+        saved = json.loads(resp.decode("utf-8"))["files"]
+        self.assertEqual(
+            [item["path"] for item in saved],
+            ["multipart/big.bin", "multipart/tricky.txt", "multipart/empty.txt"],
+        )
+        self.assertEqual(saved[0]["size"], len(large))
+        self.assertEqual((target_dir / "big.bin").read_bytes(), large)
+        self.assertEqual((target_dir / "tricky.txt").read_bytes(), tricky)
+        self.assertEqual((target_dir / "empty.txt").read_bytes(), b"")
+
+        truncated = body[: len(body) // 2]
+        status, _, _ = self._request(
+            "POST",
+            "/api/files",
+            data=truncated[: truncated.rfind(b"\r\n--")] + b"--",
+            headers={"Content-Type": f"multipart/form-data; boundary={boundary}"},
+        )
+        self.assertEqual(status, 400)
+
+        # A part rejected early must still let the client finish sending and
+        # read the error, rather than see the connection reset.
+        rejected = (
+            b"--" + boundary.encode("ascii") + b"\r\n"
+            b'Content-Disposition: form-data; name="files"; filename=".."\r\n\r\n'
+            + os.urandom(8 * 1024 * 1024)
+            + b"\r\n--" + boundary.encode("ascii") + b"--\r\n"
+        )
+        status, resp, _ = self._request(
+            "POST",
+            "/api/files?path=multipart",
+            data=rejected,
+            headers={"Content-Type": f"multipart/form-data; boundary={boundary}"},
+        )
+        self.assertEqual(status, 400)
+        self.assertIn(b"invalid file name", resp)
+
+        status, _, _ = self._request(
+            "POST",
+            "/api/files",
+            data=b"{}",
+            headers={"Content-Type": "application/json"},
+        )
+        self.assertEqual(status, 415)
+
     def test_upload_rejects_transfer_encoding(self) -> None:
         status, body, _ = self._transfer_encoding_request(
             "PUT",
@@ -266,6 +401,377 @@ class TestHTTP(unittest.TestCase):
         self.assertEqual(status, 405, body.decode("utf-8", errors="replace"))
         self.assertTrue((self.out_dir / "docs").exists())
 
+    def test_download_reflects_overwrites_of_cached_file(self) -> None:
+        name = "hot-file.bin"
+        url = f"/api/files/{name}"
+        dst = self.out_dir / name
+        self._reset_output_path(dst)
+
+        for payload in (b"first version\n", b"other version\n"):
+            status, body, _ = self._request(
+                "PUT",
+                url,
+                data=payload,
+                headers={"Content-Type": "application/octet-stream"},
+            )
+            self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+            for _ in range(3):
+                status, body, _ = self._request("GET", url)
+                self.assertEqual(status, 200)
+                self.assertEqual(body, payload)
+
+        if not sys.platform.startswith("linux"):
+            return
+
+        external = b"edited in place\n"
+        dst.write_bytes(external)
+        deadline = time.time() + 5.0
+        body = b""
+        while time.time() < deadline:
+            status, body, _ = self._request("GET", url)
+            self.assertEqual(status, 200)
+            if body == external:
+                break
+            time.sleep(0.05)
+        self.assertEqual(body, external)
+
+        # A writer that keeps the file open never closes it to signal the change.
+        with dst.open("r+b") as f:
+            f.write(b"EDITED")
+            f.flush()
+            expected = b"EDITED" + external[6:]
+            deadline = time.time() + 5.0
+            while time.time() < deadline:
+                status, body, _ = self._request("GET", url)
+                self.assertEqual(status, 200)
+                if body == expected:
+                    break
+                time.sleep(0.05)
+            self.assertEqual(body, expected)
+
+        dst.unlink()
+        deadline = time.time() + 5.0
+        status = 200
+        while time.time() < deadline:
+            status, _, _ = self._request("GET", url)
+            if status == 404:
+                break
+            time.sleep(0.05)
+        self.assertEqual(status, 404)
+
+    def test_download_supports_head_and_conditional_get(self) -> None:
+        name = "validated.txt"
+        dst = self.out_dir / name
+        self._reset_output_path(dst)
+        dst.write_bytes(b"validator payload\n")
+        os.utime(dst, (1709211909, 1709211909))
+        url = f"/api/files/{name}"
+
+        status, body, headers = self._request("HEAD", url)
+        self.assertEqual(status, 200)
+        self.assertEqual(body, b"")
+        self.assertEqual(headers.get("Content-Length"), str(dst.stat().st_size))
+        self.assertEqual(headers.get("Last-Modified"), "Thu, 29 Feb 2024 13:05:09 GMT")
+        etag = headers.get("ETag")
+        self.assertTrue(etag and etag.startswith('"'))
+
+        status, body, headers = self._request("GET", url)
+        self.assertEqual(status, 200)
+        self.assertEqual(body, b"validator payload\n")
+        self.assertEqual(headers.get("ETag"), etag)
+
+        status, body, headers = self._request("GET", url, headers={"If-None-Match": etag})
+        self.assertEqual(status, 304)
+        self.assertEqual(body, b"")
+        self.assertEqual(headers.get("ETag"), etag)
+
+        status, _, _ = self._request(
+            "GET", url, headers={"If-Modified-Since": "Thu, 29 Feb 2024 13:05:09 GMT"}
+        )
+        self.assertEqual(status, 304)
+        status, _, _ = self._request(
+            "GET", url, headers={"If-Modified-Since": "Thu, 29 Feb 2024 13:05:08 GMT"}
+        )
+        self.assertEqual(status, 200)
+        status, _, _ = self._request(
+            "GET",
+            url,
+            headers={
+                "If-None-Match": '"stale"',
+                "If-Modified-Since": "Thu, 29 Feb 2024 13:05:09 GMT",
+            },
+        )
+        self.assertEqual(status, 200)
+
+        status, _, _ = self._request(
+            "PUT",
+            url,
+            data=b"changed payload\n",
+            headers={"Content-Type": "application/octet-stream"},
+        )
+        self.assertEqual(status, 201)
+        status, body, headers = self._request("GET", url, headers={"If-None-Match": etag})
+        self.assertEqual(status, 200)
+        self.assertEqual(body, b"changed payload\n")
+        self.assertNotEqual(headers.get("ETag"), etag)
+
+        status, body, _ = self._request("HEAD", "/api/files/missing-validated.txt")
+        self.assertEqual(status, 404)
+        self.assertEqual(body, b"")
+
+    def test_upload_session_accepts_chunks_out_of_order_and_resumes(self) -> None:
+        target_dir = self.out_dir / "sessions"
+        self._reset_output_path(target_dir)
+        target_dir.mkdir(parents=True)
+
+        chunk = 64 * 1024
+        data = os.urandom(3 * chunk + 123)
+        status, body, _ = self._request(
+            "POST", f"/api/uploads?path=sessions/video.bin&size={len(data)}&chunk_size={chunk}"
+        )
+        self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+        session = json.loads(body.decode("utf-8"))
+        self.assertEqual(len(session["id"]), 32)
+        self.assertEqual(session["size"], len(data))
+        self.assertEqual(session["received"], [])
+        url = f"/api/uploads/{session['id']}"
+
+        def put_chunk(index: int) -> int:
+            start = index * chunk
+            piece = data[start : start + chunk]
+            status, _, _ = self._request(
+                "PUT",
+                url,
+                data=piece,
+                headers={
+                    "Content-Range": f"bytes {start}-{start + len(piece) - 1}/{len(data)}"
+                },
+            )
+            return status
+
+        self.assertEqual(put_chunk(3), 204)
+        self.assertEqual(put_chunk(1), 204)
+        status, body, _ = self._request(
+            "PUT",
+            url,
+            data=data[10 : 10 + chunk],
+            headers={"Content-Range": f"bytes 10-{10 + chunk - 1}/{len(data)}"},
+        )
+        self.assertEqual(status, 416, body.decode("utf-8", errors="replace"))
+
+        status, body, _ = self._request("POST", url)
+        self.assertEqual(status, 409, body.decode("utf-8", errors="replace"))
+
+        # A client coming back after a drop asks what is still missing.
+        status, body, _ = self._request("GET", url)
+        self.assertEqual(status, 200)
+        received = json.loads(body.decode("utf-8"))["received"]
+        self.assertEqual(received, [[chunk, 2 * chunk], [3 * chunk, len(data)]])
+        self.assertFalse((target_dir / "video.bin").exists())
+
+        self.assertEqual(put_chunk(0), 204)
+        self.assertEqual(put_chunk(2), 204)
+        status, body, _ = self._request("POST", url)
+        self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+        saved = json.loads(body.decode("utf-8"))
+        self.assertEqual(saved["path"], "sessions/video.bin")
+        self.assertEqual(saved["size"], len(data))
+        self.assertEqual((target_dir / "video.bin").read_bytes(), data)
+        self.assertEqual(sorted(p.name for p in target_dir.iterdir()), ["video.bin"])
+
+        status, _, _ = self._request("GET", url)
+        self.assertEqual(status, 404)
+
+        # Declaring a huge upload must not claim disk space before any data.
+        status, body, _ = self._request(
+            "POST", f"/api/uploads?path=sessions/huge.bin&size={1 << 30}&chunk_size={chunk}"
+        )
+        self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+        huge_url = f"/api/uploads/{json.loads(body.decode('utf-8'))['id']}"
+        temps = [p for p in target_dir.iterdir() if p.name != "video.bin"]
+        self.assertEqual(len(temps), 1)
+        if hasattr(os, "statvfs"):
+            self.assertLess(temps[0].stat().st_blocks * 512, 1024 * 1024)
+        status, _, _ = self._request("DELETE", huge_url)
+        self.assertEqual(status, 204)
+        deadline = time.time() + 5.0
+        while time.time() < deadline and len(list(target_dir.iterdir())) > 1:
+            time.sleep(0.05)
+        self.assertEqual(sorted(p.name for p in target_dir.iterdir()), ["video.bin"])
+
+    def test_archive_streams_directory_as_zip_and_tar(self) -> None:
+        root = self.out_dir / "bundle"
+        self._reset_output_path(root)
+        (root / "nested" / "deep").mkdir(parents=True)
+        (root / "empty").mkdir()
+        chain = "bundle/chain" + "/d" * 40
+        (self.out_dir / chain).mkdir(parents=True)
+        contents = {
+            "bundle/big.bin": os.urandom(2 * 1024 * 1024 + 3),
+            "bundle/nested/note.txt": b"hello archive\n",
+            "bundle/nested/deep/" + "n" * 120 + ".txt": b"long name",
+            "bundle/nested/zero.txt": b"",
+            chain + "/leaf.txt": b"bottom of a deep tree\n",
+        }
+        for name, data in contents.items():
+            (self.out_dir / name).write_bytes(data)
+        expected_dirs = {"bundle", "bundle/empty", "bundle/nested", "bundle/nested/deep"}
+        expected_dirs.update("bundle/chain" + "/d" * i for i in range(41))
+
+        status, body, headers = self._request("GET", "/api/archive?path=bundle")
+        self.assertEqual(status, 200, body[:200])
+        self.assertEqual(headers.get("Content-Type"), "application/zip")
+        self.assertEqual(int(headers.get("Content-Length")), len(body))
+        self.assertIn('filename="bundle.zip"', headers.get("Content-Disposition"))
+        with zipfile.ZipFile(io.BytesIO(body)) as zf:
+            self.assertIsNone(zf.testzip())
+            names = zf.namelist()
+            self.assertEqual(
+                {n.rstrip("/") for n in names if n.endswith("/")}, expected_dirs
+            )
+            for name, data in contents.items():
+                self.assertEqual(zf.read(name), data)
+                info = zf.getinfo(name)
+                self.assertEqual(info.compress_type, zipfile.ZIP_STORED)
+
+        status, body, headers = self._request(
+            "GET", "/api/archive?path=bundle&format=tar"
+        )
+        self.assertEqual(status, 200, body[:200])
+        self.assertEqual(headers.get("Content-Type"), "application/x-tar")
+        self.assertEqual(int(headers.get("Content-Length")), len(body))
+        with tarfile.open(fileobj=io.BytesIO(body)) as tf:
+            dirs = {m.name for m in tf.getmembers() if m.isdir()}
+            self.assertEqual(dirs, expected_dirs)
+            for name, data in contents.items():
+                member = tf.extractfile(name)
+                self.assertIsNotNone(member)
+                self.assertEqual(member.read(), data)
+
+        status, _, _ = self._request("GET", "/api/archive?path=missing-dir")
+        self.assertEqual(status, 404)
+        status, _, _ = self._request("GET", "/api/archive?path=bundle&format=rar")
+        self.assertEqual(status, 400)
+
+    def test_stats_reports_buffer_pool_usage(self) -> None:
+        name = "pooled-upload.bin"
+        payload = os.urandom(3 * 1024 * 1024 + 5)
+        self._reset_output_path(self.out_dir / name)
+
+        status, body, _ = self._request("GET", "/api/stats")
+        self.assertEqual(status, 200)
+        before = json.loads(body.decode("utf-8"))["buffer_pool"]
+
+        for _ in range(3):
+            status, body, _ = self._request(
+                "PUT",
+                f"/api/files/{name}",
+                data=payload,
+                headers={"Content-Type": "application/octet-stream"},
+            )
+            self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+        self.assertEqual((self.out_dir / name).read_bytes(), payload)
+
+        status, body, _ = self._request("GET", "/api/stats")
+        self.assertEqual(status, 200)
+        pool = json.loads(body.decode("utf-8"))["buffer_pool"]
+        self.assertGreaterEqual(pool["acquired"], before["acquired"] + 3)
+        self.assertEqual(pool["in_use"], 0)
+        self.assertEqual(pool["heap_bytes"], 0)
+        self.assertGreater(pool["heap_cap_bytes"], 0)
+        self.assertEqual(pool["refused"], 0)
+        self.assertIn(pool["backing"], ("hugetlb", "thp", "default", "none"))
+        if pool["backing"] != "none":
+            self.assertEqual(pool["misses"], before["misses"])
+            self.assertLessEqual(pool["reserved_bytes"], pool["capacity_bytes"])
+
+    def test_slow_header_trickle_is_evicted(self) -> None:
+        status, body, _ = self._request("GET", "/api/stats")
+        self.assertEqual(status, 200)
+        before = json.loads(body.decode("utf-8"))["connections"]
+
+        started = time.monotonic()
+        with socket.create_connection(
+            (self.server.host, self.server.port), timeout=5.0
+        ) as sock:
+            sock.sendall(b"GET /api/stats HTTP/1.1\r\nHost: x\r\n")
+            closed = False
+            for byte in b"X-Slow: " + b"a" * 64:
+                try:
+                    sock.sendall(bytes([byte]))
+                    readable, _, _ = select.select([sock], [], [], 0.5)
+                    if readable and sock.recv(1) == b"":
+                        closed = True
+                        break
+                except OSError:
+                    closed = True
+                    break
+            self.assertTrue(closed, "server kept a trickling client past its header deadline")
+        self.assertLess(time.monotonic() - started, 20.0)
+
+        status, body, _ = self._request("GET", "/api/stats")
+        self.assertEqual(status, 200)
+        after = json.loads(body.decode("utf-8"))["connections"]
+        self.assertEqual(after["evicted_header"], before["evicted_header"] + 1)
+        self.assertGreaterEqual(after["active"], 1)
+
+    def _search_paths(self, query: str, **params: str) -> list[str]:
+        qs = urllib.parse.urlencode({"q": query, **params}, quote_via=urllib.parse.quote)
+        status, body, _ = self._request("GET", f"/api/search?{qs}")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        payload = json.loads(body.decode("utf-8"))
+        return [item["path"] for item in payload["results"]]
+
+    def _wait_for_search(self, query: str, expected: str, present: bool = True,
+                         **params: str) -> list[str]:
+        deadline = time.time() + 5.0
+        paths = self._search_paths(query, **params)
+        while (expected in paths) != present and time.time() < deadline:
+            time.sleep(0.05)
+            paths = self._search_paths(query, **params)
+        return paths
+
+    def test_search_finds_uploaded_and_external_files(self) -> None:
+        upload_name = "index/Alpha-Report.txt"
+        (self.out_dir / "index").mkdir(parents=True, exist_ok=True)
+        status, body, _ = self._request(
+            "PUT",
+            f"/api/files/{urllib.parse.quote(upload_name, safe='')}",
+            data=b"indexed upload\n",
+            headers={"Content-Type": "application/octet-stream"},
+        )
+        self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+        self.assertIn(upload_name, self._wait_for_search("report", upload_name))
+
+        status, body, _ = self._request("GET", "/api/search?q=alpha-rep&limit=5")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        payload = json.loads(body.decode("utf-8"))
+        item = next(item for item in payload["results"] if item["path"] == upload_name)
+        self.assertEqual(item["name"], "Alpha-Report.txt")
+        self.assertEqual(item["kind"], "file")
+        self.assertEqual(item["size"], len(b"indexed upload\n"))
+
+        status, body, _ = self._request("GET", "/api/search")
+        self.assertEqual(status, 400, body.decode("utf-8", errors="replace"))
+        status, body, _ = self._request("GET", "/api/search?q=x&mode=fuzzy")
+        self.assertEqual(status, 400, body.decode("utf-8", errors="replace"))
+
+        if not sys.platform.startswith("linux"):
+            return
+
+        external = self.out_dir / "index" / "deep" / "beta-notes.md"
+        external.parent.mkdir(parents=True, exist_ok=True)
+        external.write_bytes(b"written outside hf\n")
+        paths = self._wait_for_search("index/deep/", "index/deep/beta-notes.md",
+                                      mode="prefix")
+        self.assertIn("index/deep/beta-notes.md", paths)
+        self.assertNotIn(upload_name, paths)
+
+        external.unlink()
+        paths = self._wait_for_search("beta-notes", "index/deep/beta-notes.md",
+                                      present=False)
+        self.assertNotIn("index/deep/beta-notes.md", paths)
+
     def test_root_directory_listing_accepts_symlink_output_dir(self) -> None:
         if os.name == "nt":
             self.skipTest("symlinked output dir coverage is POSIX-only")
@@ -344,6 +850,31 @@ class TestHTTP(unittest.TestCase):
         self.assertEqual(payload["has_message"], True)
         self.assertEqual(payload["message"], "你好")
 
+    def test_message_post_round_trips_large_message_with_escapes(self) -> None:
+        message = ('plain text run 你好 "quoted" back\\slash\ttab\x01' * 3000).strip()
+        status, body, _ = self._request(
+            "POST",
+            "/api/messages",
+            data=json.dumps({"message": message}, ensure_ascii=False).encode("utf-8"),
+            headers={"Content-Type": "application/json"},
+        )
+        self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+
+        status, body, _ = self._request("GET", "/api/messages/latest")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        payload = json.loads(body.decode("utf-8"))
+        self.assertEqual(payload["message"], message)
+
+    def test_message_post_rejects_invalid_utf8(self) -> None:
+        for raw in (b"\xff", b"\xc0\xaf", b"\xed\xa0\x80", b"abc\xe4\xbd"):
+            status, body, _ = self._request(
+                "POST",
+                "/api/messages",
+                data=b'{"message":"' + raw + b'"}',
+                headers={"Content-Type": "application/json"},
+            )
+            self.assertEqual(status, 400, body.decode("utf-8", errors="replace"))
+
     def test_message_post_trims_trailing_whitespace_before_store(self) -> None:
         status, body, _ = self._request(
             "POST",
@@ -524,6 +1055,369 @@ class TestHTTP(unittest.TestCase):
             for conn in conns:
                 conn.close()
 
+    def _post_message(self, message: str, path: str = "/api/messages") -> None:
+        status, body, _ = self._request(
+            "POST",
+            path,
+            data=json.dumps({"message": message}).encode("utf-8"),
+            headers={"Content-Type": "application/json"},
+        )
+        self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+
+    def _latest_version(self) -> int:
+        status, body, _ = self._request("GET", "/api/messages/latest")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        return json.loads(body.decode("utf-8"))["version"]
+
+    def test_message_channels_keep_independent_versions(self) -> None:
+        default_version = self._latest_version()
+        self._post_message("alpha one", "/api/messages/alpha")
+        self._post_message("alpha two", "/api/messages/alpha")
+        self._post_message("beta one", "/api/messages/beta")
+
+        status, body, _ = self._request("GET", "/api/messages/alpha/latest")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        payload = json.loads(body.decode("utf-8"))
+        self.assertEqual(payload["message"], "alpha two")
+        self.assertEqual(payload["version"], 2)
+
+        status, body, _ = self._request("GET", "/api/messages/beta?since=0")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        page = json.loads(body.decode("utf-8"))
+        self.assertEqual([m["message"] for m in page["messages"]], ["beta one"])
+        self.assertEqual(self._latest_version(), default_version)
+
+        status, _, _ = self._request("GET", "/api/messages/bad%20name/latest")
+        self.assertEqual(status, 400)
+        status, _, _ = self._request("DELETE", "/api/messages/alpha")
+        self.assertEqual(status, 405)
+
+    def test_reading_unknown_channels_does_not_use_up_channels(self) -> None:
+        # More names than the store has channel slots; reading them must not
+        # create any, so a publish to yet another name still succeeds.
+        conn = http.client.HTTPConnection(
+            self.server.host, self.server.port, timeout=5.0
+        )
+        try:
+            for i in range(4200):
+                path = ("/api/messages/unread-{}", "/api/messages/unread-{}/latest",
+                        "/api/messages/unread-{}/1")[i % 3].format(i)
+                conn.request("GET", path)
+                resp = conn.getresponse()
+                body = resp.read()
+                if i % 3 == 0:
+                    self.assertEqual(resp.status, 200, path)
+                    self.assertEqual(json.loads(body.decode("utf-8"))["messages"], [])
+                elif i % 3 == 1:
+                    self.assertEqual(resp.status, 200, path)
+                    self.assertFalse(json.loads(body.decode("utf-8"))["has_message"])
+                else:
+                    self.assertEqual(resp.status, 404, path)
+        finally:
+            conn.close()
+
+        self._post_message("first on a fresh channel", "/api/messages/fresh-after-reads")
+        status, body, _ = self._request("GET", "/api/messages/fresh-after-reads/latest")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        self.assertEqual(json.loads(body.decode("utf-8"))["version"], 1)
+
+    def test_binary_message_is_served_from_spill_file(self) -> None:
+        payload = bytes(range(256)) * 1200
+        status, body, _ = self._request(
+            "POST",
+            "/api/messages/shots",
+            data=payload,
+            headers={"Content-Type": "image/png"},
+        )
+        self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+
+        status, body, _ = self._request("GET", "/api/messages/shots/latest")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        latest = json.loads(body.decode("utf-8"))
+        self.assertEqual(latest["mime"], "image/png")
+        self.assertEqual(latest["size"], len(payload))
+        self.assertEqual(latest["message"], "")
+        self.assertNotIn("expired", latest)
+
+        status, body, headers = self._request(
+            "GET", f"/api/messages/shots/{latest['version']}"
+        )
+        self.assertEqual(status, 200)
+        self.assertEqual(headers["Content-Type"], "image/png")
+        self.assertEqual(headers["Content-Security-Policy"], "sandbox")
+        self.assertEqual(body, payload)
+        self.assertEqual(
+            [p.name for p in self.out_dir.iterdir() if p.name.startswith(".hf-message")],
+            [],
+        )
+
+        status, _, _ = self._request("GET", "/api/messages/shots/999")
+        self.assertEqual(status, 404)
+
+        src = self.in_dir / "clip.bin"
+        src.write_bytes(payload[:4096])
+        r = run_hf(
+            self.hf_path,
+            [
+                "-b",
+                str(src),
+                "-t",
+                "application/x-clip",
+                "-n",
+                "shots",
+                "-i",
+                self.server.host,
+                "-p",
+                str(self.server.port),
+            ],
+            timeout=8.0,
+        )
+        self.assertEqual(
+            r.returncode,
+            0,
+            f"client failed argv={r.argv} stdout={r.stdout!r} stderr={r.stderr!r}",
+        )
+        status, body, _ = self._request("GET", "/api/messages/shots?since=0")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        page = json.loads(body.decode("utf-8"))
+        self.assertEqual(
+            [(m.get("mime"), m.get("size")) for m in page["messages"]],
+            [("image/png", len(payload)), ("application/x-clip", 4096)],
+        )
+        status, body, _ = self._request(
+            "GET", f"/api/messages/shots/{page['latest_version']}"
+        )
+        self.assertEqual(status, 200)
+        self.assertEqual(body, payload[:4096])
+
+    def test_message_channel_stream_receives_only_its_channel(self) -> None:
+        conn = http.client.HTTPConnection(
+            self.server.host, self.server.port, timeout=5.0
+        )
+        try:
+            conn.request("GET", "/api/messages/gamma/stream")
+            resp = conn.getresponse()
+            self.assertEqual(resp.status, 200)
+
+            self._post_message("not for gamma")
+            r = run_hf(
+                self.hf_path,
+                [
+                    "-m",
+                    "hello gamma",
+                    "-n",
+                    "gamma",
+                    "-i",
+                    self.server.host,
+                    "-p",
+                    str(self.server.port),
+                ],
+                timeout=8.0,
+            )
+            self.assertEqual(
+                r.returncode,
+                0,
+                f"client failed argv={r.argv} stdout={r.stdout!r} stderr={r.stderr!r}",
+            )
+
+            while True:
+                line = resp.fp.readline()
+                self.assertTrue(line, "sse stream closed before delivering a message")
+                if line.startswith(b"data: "):
+                    break
+            self.assertEqual(line.decode("utf-8").strip(), "data: hello gamma")
+        finally:
+            conn.close()
+
+    def test_message_history_fetches_since_cursor(self) -> None:
+        start = self._latest_version()
+        sent = [f"history message {i}" for i in range(5)]
+        for message in sent:
+            self._post_message(message)
+
+        status, body, _ = self._request("GET", f"/api/messages?since={start}&limit=3")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        page = json.loads(body.decode("utf-8"))
+        self.assertEqual(page["latest_version"], start + 5)
+        self.assertTrue(page["has_more"])
+        self.assertEqual([m["message"] for m in page["messages"]], sent[:3])
+        self.assertEqual(
+            [m["version"] for m in page["messages"]], [start + 1, start + 2, start + 3]
+        )
+
+        cursor = page["messages"][-1]["version"]
+        status, body, _ = self._request("GET", f"/api/messages?since={cursor}")
+        self.assertEqual(status, 200, body.decode("utf-8", errors="replace"))
+        page = json.loads(body.decode("utf-8"))
+        self.assertFalse(page["has_more"])
+        self.assertEqual([m["message"] for m in page["messages"]], sent[3:])
+
+        status, _, _ = self._request("GET", "/api/messages?since=abc")
+        self.assertEqual(status, 400)
+
+    def test_message_stream_catches_up_from_last_event_id(self) -> None:
+        self._post_message("before disconnect")
+        last_seen = self._latest_version()
+        self._post_message("missed one")
+        self._post_message("missed two")
+
+        conn = http.client.HTTPConnection(
+            self.server.host, self.server.port, timeout=5.0
+        )
+        try:
+            conn.request(
+                "GET", "/api/messages/stream", headers={"Last-Event-ID": str(last_seen)}
+            )
+            resp = conn.getresponse()
+            self.assertEqual(resp.status, 200)
+            self._read_sse_message(resp, "missed one")
+            self._read_sse_message(resp, "missed two")
+            self._post_message("live again")
+            self._read_sse_message(resp, "live again")
+        finally:
+            conn.close()
+
+    def test_message_stream_stalled_subscriber_does_not_block_others(self) -> None:
+        stalled = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        stalled.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        conn = http.client.HTTPConnection(
+            self.server.host, self.server.port, timeout=5.0
+        )
+        try:
+            stalled.settimeout(5.0)
+            stalled.connect((self.server.host, self.server.port))
+            stalled.sendall(
+                b"GET /api/messages/stream HTTP/1.1\r\nHost: hf\r\n\r\n"
+            )
+
+            conn.request("GET", "/api/messages/stream")
+            resp = conn.getresponse()
+            self.assertEqual(resp.status, 200)
+
+            # Far more than the stalled socket's buffers can absorb.
+            for i in range(24):
+                message = f"{i:02d}" + "x" * (200 * 1024)
+                status, body, _ = self._request(
+                    "POST",
+                    "/api/messages",
+                    data=json.dumps({"message": message}).encode("utf-8"),
+                    headers={"Content-Type": "application/json"},
+                )
+                self.assertEqual(status, 201, body.decode("utf-8", errors="replace"))
+
+            self._read_sse_message(resp, message)
+        finally:
+            conn.close()
+            stalled.close()
+
+    @staticmethod
+    def _ws_recv_exact(sock: socket.socket, n: int) -> bytes:
+        data = b""
+        while len(data) < n:
+            chunk = sock.recv(n - len(data))
+            if not chunk:
+                raise ConnectionError("websocket closed early")
+            data += chunk
+        return data
+
+    def _ws_recv_frame(self, sock: socket.socket) -> tuple[int, bytes]:
+        head = self._ws_recv_exact(sock, 2)
+        self.assertEqual(head[1] & 0x80, 0, "server frames must not be masked")
+        length = head[1] & 0x7F
+        if length == 126:
+            length = struct.unpack("!H", self._ws_recv_exact(sock, 2))[0]
+        elif length == 127:
+            length = struct.unpack("!Q", self._ws_recv_exact(sock, 8))[0]
+        return head[0] & 0x0F, self._ws_recv_exact(sock, length)
+
+    @staticmethod
+    def _ws_send_frame(sock: socket.socket, opcode: int, payload: bytes) -> None:
+        mask = os.urandom(4)
+        header = bytes([0x80 | opcode])
+        if len(payload) < 126:
+            header += bytes([0x80 | len(payload)])
+        else:
+            header += bytes([0x80 | 126]) + struct.pack("!H", len(payload))
+        masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+        sock.sendall(header + mask + masked)
+
+    def test_websocket_carries_messages_both_ways(self) -> None:
+        key = base64.b64encode(os.urandom(16)).decode("ascii")
+        expected_accept = base64.b64encode(
+            hashlib.sha1(
+                (key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11").encode("ascii")
+            ).digest()
+        ).decode("ascii")
+
+        with socket.create_connection(
+            (self.server.host, self.server.port), timeout=5.0
+        ) as sock:
+            sock.sendall(
+                (
+                    "GET /api/ws HTTP/1.1\r\n"
+                    f"Host: {self.server.host}:{self.server.port}\r\n"
+                    "Upgrade: websocket\r\n"
+                    "Connection: keep-alive, Upgrade\r\n"
+                    f"Sec-WebSocket-Key: {key}\r\n"
+                    "Sec-WebSocket-Version: 13\r\n"
+                    "\r\n"
+                ).encode("ascii")
+            )
+            response = b""
+            while b"\r\n\r\n" not in response:
+                response += self._ws_recv_exact(sock, 1)
+            head = response.decode("latin-1")
+            self.assertTrue(head.startswith("HTTP/1.1 101 "), head)
+            self.assertIn(f"Sec-WebSocket-Accept: {expected_accept}\r\n", head)
+
+            message = "hello over websocket"
+            self._ws_send_frame(
+                sock, 0x1, json.dumps({"message": message}).encode("utf-8")
+            )
+            seen_ack = False
+            seen_event = False
+            while not (seen_ack and seen_event):
+                opcode, payload = self._ws_recv_frame(sock)
+                self.assertEqual(opcode, 0x1)
+                event = json.loads(payload.decode("utf-8"))
+                if event["type"] == "ack":
+                    seen_ack = True
+                elif event["type"] == "message" and event["message"] == message:
+                    seen_event = True
+
+            status, body, _ = self._request("GET", "/api/messages/latest")
+            self.assertEqual(status, 200)
+            self.assertEqual(json.loads(body.decode("utf-8"))["message"], message)
+
+            self._ws_send_frame(sock, 0x9, b"probe")
+            self.assertEqual(self._ws_recv_frame(sock), (0xA, b"probe"))
+
+            self._ws_send_frame(sock, 0x8, struct.pack("!H", 1000))
+            opcode, payload = self._ws_recv_frame(sock)
+            self.assertEqual(opcode, 0x8)
+            self.assertEqual(struct.unpack("!H", payload[:2])[0], 1000)
+
+        conn = http.client.HTTPConnection(
+            self.server.host, self.server.port, timeout=5.0
+        )
+        try:
+            conn.request(
+                "GET",
+                "/api/ws",
+                headers={
+                    "Upgrade": "websocket",
+                    "Connection": "Upgrade",
+                    "Sec-WebSocket-Key": key,
+                    "Sec-WebSocket-Version": "8",
+                },
+            )
+            resp = conn.getresponse()
+            resp.read()
+            self.assertEqual(resp.status, 426)
+            self.assertEqual(resp.getheader("Sec-WebSocket-Version"), "13")
+        finally:
+            conn.close()
+
     def test_http_server_graceful_shutdown_on_signal(self) -> None:
         shared_server = self.__class__.server
         shared_server.stop()
@@ -1,13 +1,17 @@
 from __future__ import annotations
 
+import json
 import os
+import select
 import signal
 import shutil
 import socket
 import struct
+import subprocess
 import threading
 import time
 import unittest
+import urllib.request
 from pathlib import Path
 
 from test.support.hf import (
@@ -30,6 +34,7 @@ PROTOCOL_VERSION = protocol_define("HF_PROTOCOL_VERSION")
 MSG_TYPE_SEND_FILE = protocol_define("HF_MSG_TYPE_SEND_FILE")
 MSG_TYPE_TEXT_MESSAGE = protocol_define("HF_MSG_TYPE_TEXT_MESSAGE")
 MSG_FLAG_NONE = protocol_define("HF_MSG_FLAG_NONE")
+MSG_FLAG_STREAM = protocol_define("HF_MSG_FLAG_STREAM")
 MAX_TEXT_MESSAGE_SIZE = protocol_define("HF_PROTOCOL_MAX_TEXT_MESSAGE_SIZE")
 MSG_TYPE_GET_FILE = protocol_define("HF_MSG_TYPE_GET_FILE")
 FIXTURES_DIR = Path(__file__).resolve().parent / "fixtures" / "transfer"
@@ -398,6 +403,181 @@ class TestTransferCLI(TransferTestCase):
                     f"client failed argv={r.argv} stdout={r.stdout!r} stderr={r.stderr!r}",
                 )
 
+    def test_multi_file_upload_reports_failures(self) -> None:
+        sources = [
+            self._write_input_file(f"batch_{i}.bin", bytes([i]) * (i * 4096))
+            for i in range(1, 7)
+        ]
+        listed = self._write_input_file("batch_listed.txt", b"from stdin\n")
+        missing = self.in_dir / "batch_missing.bin"
+        for src in [*sources, listed]:
+            self._reset_output_path(self.out_dir / src.name)
+
+        r = run_hf(
+            self.hf_path,
+            [
+                "-c",
+                str(self.in_dir / "batch_*.bin"),
+                str(missing),
+                "-",
+                "-j",
+                "3",
+                "-i",
+                self.server.host,
+                "-p",
+                str(self.server.port),
+            ],
+            timeout=15.0,
+            input_text=f"{listed}\n",
+        )
+        self.assertEqual(r.returncode, 1, f"stdout={r.stdout!r} stderr={r.stderr!r}")
+        self.assertIn(f"failed: {missing}", r.stderr)
+        self.assertIn("sent 7 of 8 files", r.stdout)
+        for src in [*sources, listed]:
+            dst = self.out_dir / src.name
+            self.assertTrue(wait_for_file_stable(dst, timeout=5.0), f"missing {dst}")
+            assert_files_equal(self, src, dst)
+
+    def test_sync_sends_only_new_or_changed_files(self) -> None:
+        root = self.in_dir / "sync_src"
+        files = {
+            "top.txt": b"top\n",
+            "a/one.bin": b"1" * 5000,
+            "a/b/two.bin": b"2" * 300,
+            "a b/three.txt": b"three\n",
+            "a-c/four.txt": b"four\n",
+        }
+        for rel, data in files.items():
+            path = root / rel
+            path.parent.mkdir(parents=True, exist_ok=True)
+            path.write_bytes(data)
+            os.utime(path, (1_600_000_000, 1_600_000_000))
+        self._reset_output_path(self.out_dir / "sync_src")
+
+        def sync(*extra: str) -> str:
+            r = run_hf(
+                self.hf_path,
+                ["sync", str(root), *extra, "-i", self.server.host, "-p", str(self.server.port)],
+                timeout=15.0,
+            )
+            self.assertEqual(r.returncode, 0, f"stdout={r.stdout!r} stderr={r.stderr!r}")
+            return r.stdout
+
+        self.assertIn("5 of 5 files new or changed", sync("-j", "2"))
+        for rel in files:
+            dst = self.out_dir / "sync_src" / rel
+            assert_files_equal(self, root / rel, dst)
+            self.assertEqual(int(dst.stat().st_mtime), 1_600_000_000)
+        self.assertIn("0 of 5 files new or changed", sync())
+
+        (root / "a/one.bin").write_bytes(b"1" * 4999 + b"x")
+        os.utime(root / "a/one.bin", (1_600_000_000, 1_600_000_000))
+        (root / "a/new.txt").write_bytes(b"new\n")
+        os.utime(root / "top.txt", (1_700_000_000, 1_700_000_000))
+        self.assertIn("2 of 6 files new or changed", sync("-k"))
+        assert_files_equal(self, root / "a/one.bin", self.out_dir / "sync_src/a/one.bin")
+        self.assertIn("1 of 6 files new or changed", sync())
+        self.assertEqual(int((self.out_dir / "sync_src/top.txt").stat().st_mtime), 1_700_000_000)
+
+    def test_json_summary_reports_phases(self) -> None:
+        src = self._write_input_file("telemetry.bin", b"t" * 200_000)
+        self._reset_output_path(self.out_dir / src.name)
+        download_dst = self.download_dir / "telemetry-copy.bin"
+        self._reset_output_path(download_dst)
+        server_args = ["-i", self.server.host, "-p", str(self.server.port)]
+
+        def summary(*args: object) -> dict:
+            r = run_hf(self.hf_path, [*args, "-J", *server_args], timeout=10.0)
+            self.assertEqual(r.returncode, 0, f"stdout={r.stdout!r} stderr={r.stderr!r}")
+            return json.loads(r.stdout)
+
+        sent = summary("-c", src)
+        self.assertEqual(sent["op"], "send")
+        self.assertTrue(sent["ok"])
+        self.assertEqual(sent["bytes"], 200_000)
+        self.assertIn(sent["io_path"], ("sendfile", "buffered"))
+        for key in ("connect_ms", "ready_ms", "body_ms", "final_ms", "total_ms"):
+            self.assertGreaterEqual(sent[key], 0.0, key)
+        assert_files_equal(self, src, self.out_dir / src.name)
+
+        got = summary("-g", src.name, "-o", download_dst)
+        self.assertEqual(got["op"], "get")
+        self.assertEqual(got["bytes"], 200_000)
+        self.assertIn(got["io_path"], ("splice", "buffered"))
+        assert_files_equal(self, src, download_dst)
+
+        batch = summary("-c", src, src, "-j", "2")
+        self.assertEqual((batch["files"], batch["sent"], batch["bytes"]), (2, 2, 400_000))
+        self.assertEqual(len(batch["transfers"]), 2)
+        self.assertEqual(set(batch["phase_ms"]), {"connect", "ready", "body", "final"})
+
+    def test_stream_upload_from_pipe_and_file(self) -> None:
+        data = os.urandom(3 * 1024 * 1024 + 123)
+        src = self._write_input_file("stream_src.bin", data)
+        server_args = ["-i", self.server.host, "-p", str(self.server.port)]
+
+        for name, stdin in (("piped.bin", subprocess.PIPE), ("redirected.bin", None)):
+            with self.subTest(name=name):
+                self._reset_output_path(self.out_dir / name)
+                with open(src, "rb") as f:
+                    p = subprocess.run(
+                        [str(self.hf_path), "-c", "-", "-N", name, "-J", *server_args],
+                        input=data if stdin is not None else None,
+                        stdin=f if stdin is None else None,
+                        stdout=subprocess.PIPE,
+                        stderr=subprocess.PIPE,
+                        timeout=15.0,
+                    )
+                self.assertEqual(p.returncode, 0, f"stderr={p.stderr!r}")
+                summary = json.loads(p.stdout)
+                self.assertEqual(summary["bytes"], len(data))
+                assert_files_equal(self, src, self.out_dir / name)
+
+    @unittest.skipIf(os.name == "nt", "stdin cannot be polled for keepalives on Windows")
+    def test_stream_survives_producer_pause(self) -> None:
+        # The pause spans several shortened body windows; only the client's
+        # keepalive chunks keep the server from evicting the upload.
+        name = "paused.bin"
+        shared_server = self.__class__.server
+        shared_server.stop()
+        with make_temp_dir(prefix="hf_transfer_stream_pause_") as tmp_dir:
+            out_dir = Path(tmp_dir) / "outputs"
+            server = HFileServer(
+                hf_path=self.hf_path,
+                out_dir=out_dir,
+                log_path=Path(tmp_dir) / "hf_server_stream_pause.log",
+                env={"HF_CONN_DEADLINE_BODY_WINDOW_MS": "1000"},
+            )
+            server.start(startup_timeout=5.0)
+            try:
+                p = subprocess.Popen(
+                    [str(self.hf_path), "-c", "-", "-N", name,
+                     "-i", server.host, "-p", str(server.port)],
+                    stdin=subprocess.PIPE,
+                    stdout=subprocess.DEVNULL,
+                    stderr=subprocess.PIPE,
+                    env=os.environ | {"HF_STREAM_KEEPALIVE_MS": "250"},
+                )
+                try:
+                    p.stdin.write(b"before ")
+                    p.stdin.flush()
+                    time.sleep(3.5)
+                    p.stdin.write(b"after\n")
+                    p.stdin.close()
+                    p.wait(timeout=15.0)
+                    stderr = p.stderr.read()
+                finally:
+                    if p.poll() is None:
+                        p.kill()
+                        p.wait()
+                    p.stderr.close()
+            finally:
+                server.stop()
+                shared_server.start(startup_timeout=5.0)
+
+            self.assertEqual(p.returncode, 0, f"stderr={stderr!r}")
+            self.assertEqual(b"before after\n", (out_dir / name).read_bytes())
+
     def test_file_chunk_boundaries(self) -> None:
         sizes = [CHUNK_SIZE - 1, CHUNK_SIZE, CHUNK_SIZE + 1]
 
@@ -718,7 +898,7 @@ class TestTransferProtocol(TransferTestCase):
         header = self._make_header(
             msg_type=MSG_TYPE_TEXT_MESSAGE,
             payload_size=0,
-            flags=0x01,
+            flags=0x02,
         )
 
         log_offset = self._server_log_offset()
@@ -797,6 +977,26 @@ class TestTransferProtocol(TransferTestCase):
                     f"unexpected text-message response: {response!r}; server_log_tail={self._server_log_tail()!r}",
                 )
 
+    def test_text_message_rejects_invalid_utf8(self) -> None:
+        for name, payload in [
+            ("stray_byte", b"bad \xff byte"),
+            ("overlong", b"\xc0\xaf"),
+            ("surrogate", b"\xed\xa0\x80"),
+            ("truncated", b"cut \xe2\x82"),
+        ]:
+            with self.subTest(name=name):
+                header = self._make_header(
+                    msg_type=MSG_TYPE_TEXT_MESSAGE,
+                    payload_size=len(payload),
+                )
+
+                response = self._send_raw_parts([header, payload])
+                self.assertEqual(
+                    response,
+                    self._make_res_frame(1, 2, 5),
+                    f"unexpected invalid-utf8 response: {response!r}; server_log_tail={self._server_log_tail()!r}",
+                )
+
     def test_protocol_rejects_invalid_file_name_before_body(self) -> None:
         file_name = b"bad..name.bin"
         content_size = 1024
@@ -989,6 +1189,117 @@ class TestTransferProtocol(TransferTestCase):
         self.assertEqual(b"", dst.read_bytes(), f"raw empty content mismatch for {dst}")
         self._assert_no_temp_files(file_name.decode("ascii"))
 
+    def test_shared_rate_limit_does_not_evict_uploads(self) -> None:
+        # 24 uploads share -R 16K, about 680 B/s each: well under the body
+        # deadline's minimum rate. Waiting on the limit is the server's doing
+        # and must not count against them. The whole drain takes longer than
+        # one 30 s body window.
+        bodies = {f"shared_{i}.bin": os.urandom(24_000) for i in range(24)}
+
+        shared_server = self.__class__.server
+        shared_server.stop()
+        with make_temp_dir(prefix="hf_transfer_shared_rate_") as tmp_dir:
+            out_dir = Path(tmp_dir) / "outputs"
+            out_dir.mkdir(parents=True, exist_ok=True)
+            log_path = Path(tmp_dir) / "hf_server_shared_rate.log"
+            server = HFileServer(
+                hf_path=self.hf_path,
+                out_dir=out_dir,
+                log_path=log_path,
+                extra_args=("-R", "16K"),
+            )
+            acks: dict[str, bytes] = {}
+
+            def upload(name: str, body: bytes) -> None:
+                prefix = self._make_file_prefix(name.encode("ascii"), len(body))
+                header = self._make_header(
+                    msg_type=MSG_TYPE_SEND_FILE,
+                    payload_size=len(prefix) + len(body),
+                )
+                try:
+                    with socket.create_connection(
+                        (server.host, server.port), timeout=120.0
+                    ) as s:
+                        s.sendall(header + prefix)
+                        if s.recv(4) != self._make_res_frame(0, 0, 0):
+                            return
+                        s.sendall(body)
+                        acks[name] = s.recv(4)
+                except OSError:
+                    pass
+
+            server.start(startup_timeout=5.0)
+            try:
+                threads = [
+                    threading.Thread(target=upload, args=item) for item in bodies.items()
+                ]
+                for t in threads:
+                    t.start()
+                for t in threads:
+                    t.join()
+            finally:
+                server.stop()
+                shared_server.start(startup_timeout=5.0)
+
+            log_text = log_path.read_text(errors="replace")
+            self.assertNotIn("evicting slow connection", log_text)
+            for name, body in bodies.items():
+                self.assertEqual(self._make_res_frame(1, 0, 0), acks.get(name), name)
+                self.assertEqual(body, (out_dir / name).read_bytes())
+
+    def test_stream_keepalive_trickle_is_evicted(self) -> None:
+        # Every four 0xFF bytes make a keepalive. Without data behind them the
+        # server stops honouring them once the stream idle cap is used up.
+        name = b"trickle.bin"
+        prefix = self._make_file_prefix(name, 0)
+        header = self._make_header(
+            msg_type=MSG_TYPE_SEND_FILE,
+            payload_size=len(prefix),
+            flags=MSG_FLAG_STREAM,
+        )
+
+        shared_server = self.__class__.server
+        shared_server.stop()
+        with make_temp_dir(prefix="hf_transfer_stream_trickle_") as tmp_dir:
+            out_dir = Path(tmp_dir) / "outputs"
+            server = HFileServer(
+                hf_path=self.hf_path,
+                out_dir=out_dir,
+                log_path=Path(tmp_dir) / "hf_server_stream_trickle.log",
+                env={
+                    "HF_CONN_DEADLINE_BODY_WINDOW_MS": "1000",
+                    "HF_CONN_DEADLINE_STREAM_IDLE_MS": "2000",
+                },
+            )
+            server.start(startup_timeout=5.0)
+            try:
+                started = time.monotonic()
+                closed = False
+                with socket.create_connection((server.host, server.port), timeout=5.0) as s:
+                    s.sendall(header + prefix)
+                    self.assertEqual(self._make_res_frame(0, 0, 0), s.recv(4))
+                    for _ in range(120):
+                        try:
+                            s.sendall(b"\xff")
+                            readable, _, _ = select.select([s], [], [], 0.1)
+                            if readable:
+                                closed = True
+                                break
+                        except OSError:
+                            closed = True
+                            break
+                self.assertTrue(closed, "server kept a keepalive-only stream past its idle cap")
+                self.assertLess(time.monotonic() - started, 10.0)
+
+                with urllib.request.urlopen(server.http_url + "/api/stats", timeout=5.0) as resp:
+                    stats = json.loads(resp.read().decode("utf-8"))["connections"]
+                self.assertEqual(stats["evicted_body"], 1)
+            finally:
+                server.stop()
+                shared_server.start(startup_timeout=5.0)
+
+            self.assertFalse((out_dir / name.decode("ascii")).exists())
+
     def test_partial_raw_file_transfer_cleans_up_temp_file(self) -> None:
         file_name = b"partial.bin"
         content_size = 1024
@@ -1019,6 +1330,90 @@ class TestTransferProtocol(TransferTestCase):
         self.assertFalse((self.out_dir / final_name).exists())
         self._assert_no_temp_files(final_name)
 
+    def test_durable_mode_commits_concurrent_uploads(self) -> None:
+        shared_server = self.__class__.server
+        shared_server.stop()
+
+        with make_temp_dir(prefix="hf_transfer_durable_") as tmp_dir:
+            base_dir = Path(tmp_dir)
+            in_dir = base_dir / "inputs"
+            out_dir = base_dir / "outputs"
+            in_dir.mkdir(parents=True, exist_ok=True)
+            out_dir.mkdir(parents=True, exist_ok=True)
+
+            sources = []
+            for i, size in enumerate((0, 1, 4096, 9 * 1024 * 1024 + 17)):
+                src = in_dir / f"durable_{i}.bin"
+                src.write_bytes(os.urandom(size))
+                sources.append(src)
+
+            server = HFileServer(
+                hf_path=self.hf_path,
+                out_dir=out_dir,
+                log_path=base_dir / "hf_server_durable.log",
+                extra_args=("-s",),
+            )
+            server.start(startup_timeout=5.0)
+            try:
+                results = {}
+
+                def upload(src: Path) -> None:
+                    results[src.name] = run_hf(
+                        self.hf_path,
+                        ["-c", src, "-i", server.host, "-p", str(server.port)],
+                        timeout=15.0,
+                    )
+
+                threads = [threading.Thread(target=upload, args=(src,)) for src in sources]
+                for t in threads:
+                    t.start()
+                for t in threads:
+                    t.join()
+
+                for src in sources:
+                    r = results[src.name]
+                    self.assertEqual(
+                        r.returncode, 0, f"argv={r.argv} stderr={r.stderr!r}"
+                    )
+                    assert_files_equal(self, src, out_dir / src.name)
+            finally:
+                server.stop()
+                shared_server.start(startup_timeout=5.0)
+
+    def test_rate_limits_pace_client_and_server(self) -> None:
+        src = self._write_input_file("paced.bin", os.urandom(160_000))
+
+        started = time.monotonic()
+        dst = self._send_and_assert_ok(src, extra_args=("-r", "64K"), timeout=15.0)
+        self.assertGreaterEqual(time.monotonic() - started, 1.5)
+        assert_files_equal(self, src, dst)
+
+        shared_server = self.__class__.server
+        shared_server.stop()
+        with make_temp_dir(prefix="hf_transfer_paced_") as tmp_dir:
+            out_dir = Path(tmp_dir) / "outputs"
+            out_dir.mkdir(parents=True, exist_ok=True)
+            server = HFileServer(
+                hf_path=self.hf_path,
+                out_dir=out_dir,
+                log_path=Path(tmp_dir) / "hf_server_paced.log",
+                extra_args=("-R", "64K"),
+            )
+            server.start(startup_timeout=5.0)
+            try:
+                started = time.monotonic()
+                r = run_hf(
+                    self.hf_path,
+                    ["-c", src, "-i", server.host, "-p", str(server.port)],
+                    timeout=15.0,
+                )
+                self.assertEqual(r.returncode, 0, f"argv={r.argv} stderr={r.stderr!r}")
+                self.assertGreaterEqual(time.monotonic() - started, 1.5)
+                assert_files_equal(self, src, out_dir / src.name)
+            finally:
+                server.stop()
+                shared_server.start(startup_timeout=5.0)
+
     def test_server_graceful_shutdown_on_signal(self) -> None:
         shared_server = self.__class__.server
         shared_server.stop()